@@ -0,0 +1,452 @@
+/*
+ * qperf - GPU memory for test buffers.
+ * Measure socket and RDMA performance.
+ *
+ * Copyright (c) 2002-2009 Johann George.  All rights reserved.
+ * Copyright (c) 2006-2009 QLogic Corporation.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "qperf.h"
+
+
+/*
+ * Parameters.
+ */
+#define GPU_ALIGN       (64*1024)       /* Alignment of CUDA buffers */
+#define MAX_BUFS        8               /* Maximum GPU buffers at once */
+#define MAX_DEPTH       32              /* Maximum depth of sysfs paths */
+#define CU_DMA_BUF_FD   1               /* CUDA dma-buf handle type */
+
+
+/*
+ * GPU runtimes; the values are those reported in STAT.gpu_kind.
+ */
+typedef enum GPUKIND {
+    GPU_ANY,
+    GPU_CUDA,
+    GPU_ROCM
+} GPUKIND;
+
+
+/*
+ * How the GPU reaches the NIC, as reported in STAT.gpu_topo.  The names follow
+ * those of nvidia-smi topo: through at most one PCIe switch, through several,
+ * through the host bridge, between host bridges of one NUMA node or across
+ * the interconnect between NUMA nodes.
+ */
+typedef enum TOPO {
+    TOPO_UNKNOWN,
+    TOPO_PIX,
+    TOPO_PXB,
+    TOPO_PHB,
+    TOPO_NODE,
+    TOPO_SYS
+} TOPO;
+
+
+/*
+ * The entry points of the CUDA driver API that we use.  They are looked up at
+ * run time so that qperf neither needs CUDA to build nor to run.
+ */
+typedef struct CUDA {
+    int (*init)(unsigned int flags);
+    int (*device_get)(int *dev, int ordinal);
+    int (*ctx_retain)(void **ctx, int dev);
+    int (*ctx_set)(void *ctx);
+    int (*alloc)(unsigned long long *dptr, size_t n);
+    int (*free)(unsigned long long dptr);
+    int (*memset)(unsigned long long dptr, unsigned char c, size_t n);
+    int (*handle)(void *handle, unsigned long long dptr, size_t n, int type,
+                  unsigned long long flags);
+    int (*bus_id)(char *id, int len, int dev);
+} CUDA;
+
+
+/*
+ * The entry points of the HIP and HSA runtimes that we use.
+ */
+typedef struct ROCM {
+    int (*set_device)(int dev);
+    int (*alloc)(void **p, size_t n);
+    int (*free)(void *p);
+    int (*memset)(void *p, int c, size_t n);
+    int (*bus_id)(char *id, int len, int dev);
+    int (*dmabuf)(const void *p, size_t n, int *fd, uint64_t *off);
+} ROCM;
+
+
+/*
+ * A GPU buffer that we handed out.
+ */
+typedef struct GPUBUF {
+    void       *addr;                   /* Address given to the caller */
+    void       *base;                   /* Address that was allocated */
+    GPUKIND     kind;                   /* Runtime it came from */
+} GPUBUF;
+
+
+/*
+ * Function prototypes.
+ */
+static void     *cuda_alloc(int index, long n, int *fd, uint64_t *off,
+                            void **base, char *bus);
+static int       cuda_load(void);
+static void      gpu_parse(char *spec, GPUKIND *kind, int *index);
+static TOPO      gpu_topo(char *bus, char *nic);
+static void     *load_sym(void *lib, char *name);
+static int       path_split(char *path, char **comp);
+static int       read_node(char *dir);
+static void     *rocm_alloc(int index, long n, int *fd, uint64_t *off,
+                            char *bus);
+static int       rocm_load(void);
+
+
+/*
+ * Static variables.
+ */
+static CUDA     Cuda;
+static ROCM     Rocm;
+static GPUBUF   Bufs[MAX_BUFS];
+static int      BufN;
+
+
+/*
+ * Allocate a test buffer of n bytes in the memory of the GPU given by
+ * --mem_gpu and export it as a dma-buf so that the NIC can be given access to
+ * it.  The file descriptor of the dma-buf and the offset of the buffer within
+ * it are returned through fd and off.  nic is the sysfs device directory of
+ * the NIC and is used to note how far the GPU is from it.
+ */
+void *
+gpu_alloc(long n, char *nic, int *fd, uint64_t *off)
+{
+    int index;
+    GPUKIND kind;
+    void *p;
+    void *base = 0;
+    char bus[32];
+    long page = sysconf(_SC_PAGESIZE);
+
+    if (BufN >= MAX_BUFS)
+        error(BUG, "too many GPU buffers");
+    gpu_parse(Req.mem_gpu, &kind, &index);
+    n = (n + page - 1) & ~(page - 1);
+    if (kind != GPU_ROCM && cuda_load()) {
+        kind = GPU_CUDA;
+        p = cuda_alloc(index, n, fd, off, &base, bus);
+    } else if (kind != GPU_CUDA && rocm_load()) {
+        kind = GPU_ROCM;
+        p = base = rocm_alloc(index, n, fd, off, bus);
+    } else {
+        error(0, "cannot load the %s runtime for GPU memory",
+              kind == GPU_CUDA ? "CUDA" : kind == GPU_ROCM ? "ROCm" :
+                                                            "CUDA or ROCm");
+        return 0;
+    }
+
+    Bufs[BufN].addr = p;
+    Bufs[BufN].base = base;
+    Bufs[BufN].kind = kind;
+    ++BufN;
+    LStat.gpu_kind = kind;
+    LStat.gpu_index = index;
+    LStat.gpu_topo = gpu_topo(bus, nic);
+    debug("GPU buffer %p of %ld bytes on %s GPU %d at %s", p, n,
+          kind == GPU_CUDA ? "CUDA" : "ROCm", index, bus);
+    return p;
+}
+
+
+/*
+ * Free a buffer allocated by gpu_alloc.
+ */
+void
+gpu_free(void *p)
+{
+    int i;
+
+    for (i = 0; i < BufN; ++i)
+        if (Bufs[i].addr == p)
+            break;
+    if (i == BufN)
+        error(BUG, "gpu_free: unknown buffer %p", p);
+    if (Bufs[i].kind == GPU_CUDA)
+        Cuda.free((uintptr_t)Bufs[i].base);
+    else
+        Rocm.free(Bufs[i].base);
+    Bufs[i] = Bufs[--BufN];
+}
+
+
+/*
+ * Parse a --mem_gpu specification: an index optionally preceded by cuda: or
+ * rocm: to choose the runtime.
+ */
+static void
+gpu_parse(char *spec, GPUKIND *kind, int *index)
+{
+    *kind = GPU_ANY;
+    if (!strncmp(spec, "cuda:", 5)) {
+        *kind = GPU_CUDA;
+        spec += 5;
+    } else if (!strncmp(spec, "rocm:", 5)) {
+        *kind = GPU_ROCM;
+        spec += 5;
+    }
+    *index = atoi(spec);
+}
+
+
+/*
+ * Load the CUDA driver API.  Return 1 if it is available.
+ */
+static int
+cuda_load(void)
+{
+    void *lib;
+
+    if (Cuda.init)
+        return 1;
+    lib = dlopen("libcuda.so.1", RTLD_NOW);
+    if (!lib) {
+        debug("cannot load CUDA: %s", dlerror());
+        return 0;
+    }
+    Cuda.device_get = load_sym(lib, "cuDeviceGet");
+    Cuda.ctx_retain = load_sym(lib, "cuDevicePrimaryCtxRetain");
+    Cuda.ctx_set    = load_sym(lib, "cuCtxSetCurrent");
+    Cuda.alloc      = load_sym(lib, "cuMemAlloc_v2");
+    Cuda.free       = load_sym(lib, "cuMemFree_v2");
+    Cuda.memset     = load_sym(lib, "cuMemsetD8_v2");
+    Cuda.handle     = load_sym(lib, "cuMemGetHandleForAddressRange");
+    Cuda.bus_id     = load_sym(lib, "cuDeviceGetPCIBusId");
+    Cuda.init       = load_sym(lib, "cuInit");
+    if (Cuda.init(0) != 0)
+        error(0, "cuInit failed");
+    return 1;
+}
+
+
+/*
+ * Allocate a buffer from a CUDA GPU.  A dma-buf must start on a page boundary
+ * which cuMemAlloc does not promise so we allocate extra and align it.
+ */
+static void *
+cuda_alloc(int index, long n, int *fd, uint64_t *off, void **base, char *bus)
+{
+    int dev;
+    void *ctx;
+    unsigned long long dptr;
+    unsigned long long p;
+
+    if (Cuda.device_get(&dev, index) != 0)
+        error(0, "no CUDA GPU %d", index);
+    if (Cuda.ctx_retain(&ctx, dev) != 0 || Cuda.ctx_set(ctx) != 0)
+        error(0, "cannot set up a context on CUDA GPU %d", index);
+    if (Cuda.alloc(&dptr, n + GPU_ALIGN) != 0)
+        error(0, "cannot allocate %ld bytes on CUDA GPU %d", n, index);
+    p = (dptr + GPU_ALIGN - 1) & ~(unsigned long long)(GPU_ALIGN - 1);
+    if (Cuda.memset(p, 0, n) != 0)
+        error(0, "cannot clear buffer on CUDA GPU %d", index);
+    if (Cuda.handle(fd, p, n, CU_DMA_BUF_FD, 0) != 0)
+        error(0, "cannot export CUDA GPU %d memory as a dma-buf", index);
+    if (Cuda.bus_id(bus, 32, dev) != 0)
+        bus[0] = '\0';
+    *off = 0;
+    *base = (void *)(uintptr_t)dptr;
+    return (void *)(uintptr_t)p;
+}
+
+
+/*
+ * Load the HIP runtime.  The HSA call that exports a dma-buf comes from the
+ * HSA runtime that HIP depends on.  Return 1 if they are available.
+ */
+static int
+rocm_load(void)
+{
+    void *lib;
+
+    if (Rocm.alloc)
+        return 1;
+    lib = dlopen("libamdhip64.so", RTLD_NOW);
+    if (!lib) {
+        debug("cannot load ROCm: %s", dlerror());
+        return 0;
+    }
+    Rocm.set_device = load_sym(lib, "hipSetDevice");
+    Rocm.free       = load_sym(lib, "hipFree");
+    Rocm.memset     = load_sym(lib, "hipMemset");
+    Rocm.bus_id     = load_sym(lib, "hipDeviceGetPCIBusId");
+    Rocm.dmabuf     = load_sym(lib, "hsa_amd_portable_export_dmabuf");
+    Rocm.alloc      = load_sym(lib, "hipMalloc");
+    return 1;
+}
+
+
+/*
+ * Allocate a buffer from a ROCm GPU.
+ */
+static void *
+rocm_alloc(int index, long n, int *fd, uint64_t *off, char *bus)
+{
+    void *p;
+
+    if (Rocm.set_device(index) != 0)
+        error(0, "no ROCm GPU %d", index);
+    if (Rocm.alloc(&p, n) != 0)
+        error(0, "cannot allocate %ld bytes on ROCm GPU %d", n, index);
+    if (Rocm.memset(p, 0, n) != 0)
+        error(0, "cannot clear buffer on ROCm GPU %d", index);
+    if (Rocm.dmabuf(p, n, fd, off) != 0)
+        error(0, "cannot export ROCm GPU %d memory as a dma-buf", index);
+    if (Rocm.bus_id(bus, 32, index) != 0)
+        bus[0] = '\0';
+    return p;
+}
+
+
+/*
+ * Look up a symbol in a runtime library.
+ */
+static void *
+load_sym(void *lib, char *name)
+{
+    void *p = dlsym(lib, name);
+
+    if (!p)
+        error(0, "GPU runtime lacks %s; it may be too old", name);
+    return p;
+}
+
+
+/*
+ * Work out how the GPU with the given PCI bus id reaches the NIC whose sysfs
+ * device directory is nic.  Both are found under /sys/devices where each PCI
+ * device sits below the bridges that lead to it and those below the host
+ * bridge they all hang off, such as pci0000:00.
+ */
+static TOPO
+gpu_topo(char *bus, char *nic)
+{
+    int i;
+    int na;
+    int nb;
+    int common;
+    char *a;
+    char *b;
+    char *path;
+    char *ca[MAX_DEPTH];
+    char *cb[MAX_DEPTH];
+    TOPO topo = TOPO_UNKNOWN;
+
+    if (!bus[0] || !nic)
+        return TOPO_UNKNOWN;
+    for (i = 0; bus[i]; ++i)
+        if (bus[i] >= 'A' && bus[i] <= 'F')
+            bus[i] += 'a' - 'A';
+    path = qasprintf("/sys/bus/pci/devices/%s", bus);
+    a = realpath(path, 0);
+    b = realpath(nic, 0);
+    free(path);
+    if (!a || !b)
+        goto out;
+
+    if (read_node(a) >= 0 && read_node(a) == read_node(b))
+        topo = TOPO_NODE;
+    else
+        topo = TOPO_SYS;
+    na = path_split(a, ca);
+    nb = path_split(b, cb);
+    if (na < 4 || nb < 4 ||
+        strncmp(ca[2], "pci", 3) != 0 || strncmp(cb[2], "pci", 3) != 0)
+        topo = TOPO_UNKNOWN;
+    else if (streq(ca[2], cb[2])) {
+        for (common = 0; common + 4 < na && common + 4 < nb; ++common)
+            if (!streq(ca[common+3], cb[common+3]))
+                break;
+        if (!common)
+            topo = TOPO_PHB;
+        else if (na - 3 - common <= 2 && nb - 3 - common <= 2)
+            topo = TOPO_PIX;
+        else
+            topo = TOPO_PXB;
+    }
+out:
+    free(a);
+    free(b);
+    return topo;
+}
+
+
+/*
+ * Split a path into its components, returning how many there are.
+ */
+static int
+path_split(char *path, char **comp)
+{
+    int n = 0;
+    char *save;
+    char *s = strtok_r(path, "/", &save);
+
+    while (s && n < MAX_DEPTH) {
+        comp[n++] = s;
+        s = strtok_r(0, "/", &save);
+    }
+    return n;
+}
+
+
+/*
+ * Return the NUMA node of a device given its sysfs directory or -1 if it is
+ * not known.
+ */
+static int
+read_node(char *dir)
+{
+    int node = -1;
+    char *path = qasprintf("%s/numa_node", dir);
+    FILE *fp = fopen(path, "r");
+
+    if (fp) {
+        if (fscanf(fp, "%d", &node) != 1)
+            node = -1;
+        fclose(fp);
+    }
+    free(path);
+    return node;
+}
@@ -36,8 +36,11 @@
 #define _GNU_SOURCE
 #include <ctype.h>
 #include <errno.h>
+#include <limits.h>
+#include <math.h>
 #include <fcntl.h>
 #include <netdb.h>
+#include <pthread.h>
 #include <sched.h>
 #include <stdio.h>
 #include <signal.h>
@@ -48,9 +51,12 @@
 #include <sys/time.h>
 #include <sys/wait.h>
 #include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <sys/resource.h>
 #include <sys/times.h>
 #include <sys/select.h>
 #include <sys/utsname.h>
+#include <linux/perf_event.h>
 #include "qperf.h"
 
 
@@ -61,10 +67,12 @@
  * VER_MAJ is reserved for major changes.
  */
 #define VER_MAJ 0                       /* Major version */
-#define VER_MIN 4                       /* Minor version */
-#define VER_INC 11                       /* Incremental version */
-#define LISTENQ 5                       /* Size of listen queue */
+#define VER_MIN 28                      /* Minor version */
+#define VER_INC 0                       /* Incremental version */
+#define LISTENQ 128                     /* Size of listen queue */
 #define BUFSIZE 1024                    /* Size of buffers */
+#define CTL_ARGS 4096                   /* Size of options passed to relays */
+#define RELAY_INDEX 0xFFFF              /* Request index of a relay */
 
 
 /*
@@ -97,6 +105,7 @@ typedef struct LOOP {
     long          last;                 /* Last value */
     long          incr;                 /* Increment */
     int           mult;                 /* If set, multiply, otherwise add */
+    long          cur;                  /* Current value */
 } LOOP;
 
 
@@ -133,6 +142,30 @@ typedef struct DICT {
 } DICT;
 
 
+/*
+ * Performance counter.
+ */
+typedef struct PERF_EVENT {
+    char       *name;                   /* Name */
+    char       *per_msg;                /* Name shown per message */
+    char       *per_kb;                 /* Name shown per kilobyte */
+    uint32_t    type;                   /* Event type */
+    uint64_t    config;                 /* Event configuration */
+} PERF_EVENT;
+
+
+/*
+ * Network counter.  file is either a table in /proc/net, in which case key is
+ * the name of the row and column, or a file relative to the directory given
+ * to net_dir.
+ */
+typedef struct NET_COUNTER {
+    char       *name;                   /* Name */
+    char       *file;                   /* File holding the counter */
+    char       *key;                    /* Row and column in a table */
+} NET_COUNTER;
+
+
 /*
  * Test prototype.
  */
@@ -155,6 +188,75 @@ typedef struct SHOW {
 } SHOW;
 
 
+/*
+ * A field of a machine readable record.
+ */
+typedef struct FIELD {
+    char    *name;                      /* Name */
+    char    *data;                      /* Value as text */
+    int      str;                       /* Value is a string */
+} FIELD;
+
+
+/*
+ * Summary of one result over the trials of a test run with --repeat.
+ */
+typedef struct TRIAL {
+    int     n;                          /* Number of trials */
+    double  mean;                       /* Mean */
+    double  m2;                         /* Sum of squared deviations */
+    double  min;                        /* Smallest value */
+    double  max;                        /* Largest value */
+} TRIAL;
+
+
+/*
+ * Traffic patterns that a controller can run between the hosts it is given.
+ */
+typedef enum PATTERN {
+    PAT_PAIRWISE,                       /* First to second, third to fourth */
+    PAT_ALL_TO_ALL,                     /* Every host to every other host */
+    PAT_INCAST,                         /* Every other host to the first */
+    PAT_RING                            /* Each host to the next */
+} PATTERN;
+
+
+/*
+ * A flow that a controller runs from one host to another and its results.
+ */
+typedef struct FLOW {
+    int         src;                    /* Host that runs the client */
+    int         dst;                    /* Host that runs the server */
+    double      send_bw;                /* Send bandwidth */
+    double      recv_bw;                /* Receive bandwidth */
+    double      msg_rate;               /* Messaging rate */
+    double      latency;                /* Latency */
+} FLOW;
+
+
+/*
+ * Request from a controller to a host to run flows to other hosts.  It is
+ * followed by the names of the hosts, STRSIZE bytes each.
+ */
+typedef struct RELAY {
+    uint32_t    req_index;              /* Test to run */
+    uint32_t    no_flows;               /* Number of flows */
+    char        src[STRSIZE];           /* Name the host was given as */
+    char        args[CTL_ARGS];         /* Options, each null terminated */
+} RELAY;
+
+
+/*
+ * Results of a flow as a relay sends them back to the controller.
+ */
+typedef struct RELAY_RES {
+    uint32_t    measure;                /* What the test measures */
+    STAT        l;                      /* Client statistics */
+    STAT        r;                      /* Server statistics */
+    HIST        hist;                   /* Latency histogram */
+} RELAY_RES;
+
+
 /*
  * Configuration information.
  */
@@ -175,37 +277,88 @@ static long      arg_size(char ***argvp);
 static char     *arg_strn(char ***argvp);
 static long      arg_time(char ***argvp);
 static void      calc_node(RESN *resn, STAT *stat);
-static void      calc_results(void);
+static double    calc_cost(RESN *resn);
+static void      calc_results(MEASURE measure);
 static void      client(TEST *test);
+static void      client_init(TEST *test);
+static void      cpu_accnt_end(void);
+static void      cpu_accnt_start(void);
+static void      cpu_times(cpu_set_t *set, CLOCK timex[T_N]);
+static void      client_connect_server(void);
 static int       cmpsub(char *s2, char *s1);
 static char     *commify(char *data);
+static void      ctl_arg(OPTION *option, char **args, char **next);
+static void      ctl_flow_show(FLOW *flow, MEASURE measure);
+static void      ctl_flows(void);
+static void      ctl_hosts(char *list);
+static void      ctl_round(TEST *test);
+static void      ctl_show(MEASURE measure);
 static void      dec_req_data(REQ *host);
+static void      dec_hist(HIST *host);
 static void      dec_req_version(REQ *host);
 static void      dec_stat(STAT *host);
+static void      dec_tcpi(TCPI *host);
 static void      dec_ustat(USTAT *host);
 static void      do_args(char *args[]);
 static void      do_loop(LOOP *loop, TEST *test);
 static void      do_option(OPTION *option, char ***argvp);
+static void      enc_hist(HIST *host);
 static void      enc_req(REQ *host);
 static void      enc_stat(STAT *host);
+static void      enc_tcpi(TCPI *host);
 static void      enc_ustat(USTAT *host);
 static TEST     *find_test(char *name);
 static OPTION   *find_option(char *name);
+static void      flow_time(char *name, double value);
 static void      get_conf(CONF *conf);
 static void      get_cpu(CONF *conf);
 static void      get_times(CLOCK timex[T_N]);
 static void      initialize(void);
 static void      init_lstat(void);
+static void     *interval_main(void *arg);
+static void      interval_show(double t1, double t2, USTAT *s, USTAT *r,
+                               CLOCK *c1, CLOCK *c2, TCPI *k1, TCPI *k2);
+static void      interval_start(void);
+static void      interval_stop(void);
+static void      interval_sum(USTAT *s, USTAT *r);
+static void      interval_val(char *name, int band, double value);
+static double    load_rate(char *s, long msg_size);
 static char     *loop_arg(char **pp);
 static int       nice_1024(char *pref, char *name, long long value);
+static void      open_proc_stat(void);
 static PAR_INFO *par_info(PAR_INDEX index);
 static PAR_INFO *par_set(char *name, PAR_INDEX index);
 static int       par_isset(PAR_INDEX index);
+static int       parse_cpus(char *list, int *cpus);
+static void      net_read(void);
+static void      net_start(void);
+static uint64_t  net_value(NET_COUNTER *counter, int *found);
 static void      parse_loop(char ***argvp);
+static void      perf_disable(void);
+static void      perf_read(void);
+static void      perf_reset(void);
+static void      perf_start(void);
 static void      place_any(char *pref, char *name, char *unit, char *data,
                            char *altn);
+static void      place_clear(void);
 static void      place_show(void);
+static char     *rec_name(OPTION *option);
+static void      rec_num(char *pref, char *name, uint64_t value);
+static void      rec_print(void);
+static void      rec_put(char *pref, char *name, char *data, int str);
+static void      rec_resn(char *pref, RESN *resn);
+static void      rec_show(void);
+static void      rec_stat(char *pref, STAT *stat);
+static void      rec_str(char *pref, char *name, char *value);
+static void      rec_trial(char *pref, TRIAL *trial);
+static void      rec_ustat(char *pref, USTAT *ustat);
+static void      rec_val(char *pref, char *name, double value);
 static void      place_val(char *pref, char *name, char *unit, double value);
+static void      relay_args(char *args);
+static void      relay_flow(TEST *test, char *dst, int fd);
+static void      relay_recv(int fd, void *ptr, int len, char *src, char *dst);
+static void      relay_session(void);
+static void      relay_sync(void);
 static void      remotefd_close(void);
 static void      remotefd_setup(void);
 static void      run_client_conf(void);
@@ -215,37 +368,69 @@ static void      run_server_quit(void);
 static void      server(void);
 static void      server_listen(void);
 static int       server_recv_request(void);
+static void      server_session(void);
+static int       server_wait_request(void);
 static void      set_affinity(void);
+static void      set_alarm(int restart);
 static void      set_signals(void);
+static void      show_conn(char *pref, STAT *stat);
 static void      show_debug(void);
+static void      show_gpu(char *pref, STAT *stat);
+static void      show_hist(char *pref, HIST *hist);
 static void      show_info(MEASURE measure);
+static void      show_mcast(void);
+static void      show_mem(char *pref, STAT *stat);
+static void      show_net(char *pref, STAT *stat);
+static void      show_perf(char *pref, STAT *stat);
+static void      show_reg_mr(void);
 static void      show_rest(void);
+static void      show_tcp(char *pref, STAT *stat);
+static void      show_threads(MEASURE measure);
+static void      show_trial(char *pref, TRIAL *trial,
+                    void (*view)(int, char *, char *, double));
+static void      show_trials(void);
 static void      show_used(void);
+static void      show_verify(void);
+static void      show_xdp(char *pref, STAT *stat);
+static void      show_zcopy(void);
 static void      sig_alrm(int signo, siginfo_t *siginfo, void *ucontext);
+static void      sig_chld(int signo, siginfo_t *siginfo, void *ucontext);
 static void      sig_quit(int signo, siginfo_t *siginfo, void *ucontext);
 static void      sig_urg(int signo, siginfo_t *siginfo, void *ucontext);
 static char     *skip_colon(char *s);
-static void      start_test_timer(int seconds);
+static void      start_test_timer(int warmup, int seconds);
 static long      str_size(char *arg, char *str);
 static void      strncopy(char *d, char *s, int n);
+static void      sub_ustat(USTAT *l, USTAT *r);
 static char     *two_args(char ***argvp);
+static double    thread_bw(USTAT *l, USTAT *r);
+static void      trial_add(TRIAL *trial, double value);
+static int       trial_bw(void);
+static double    trial_ci95(TRIAL *trial);
+static int       trial_lat(void);
+static double    trial_stddev(TRIAL *trial);
 static int       verbose(int type, double value);
 static void      version_error(void);
 static void      view_band(int type, char *pref, char *name, double value);
 static void      view_cost(int type, char *pref, char *name, double value);
+static void      view_count(int type, char *pref, char *name, double value);
 static void      view_cpus(int type, char *pref, char *name, double value);
 static void      view_rate(int type, char *pref, char *name, double value);
 static void      view_long(int type, char *pref, char *name, long long value);
 static void      view_size(int type, char *pref, char *name, long long value);
 static void      view_strn(int type, char *pref, char *name, char *value);
 static void      view_time(int type, char *pref, char *name, double value);
+static void      warmup_apply(void);
+static void      warmup_end(void);
 
 
 /*
  * Configurable variables.
  */
+static int  Interval        = 0;
 static int  ListenPort      = DEF_LISTEN_PORT;
 static int  Precision       = DEF_PRECISION;
+static int  Repeat          = 1;
 static int  ServerWait      = DEF_TIMEOUT;
 static int  UseBitsPerSec   = 0;
 
@@ -255,9 +440,30 @@ static int  UseBitsPerSec   = 0;
  */
 static REQ      RReq;
 static STAT     IStat;
+static char    *RecHeader;
+static int      RecIndex;
+static FIELD    RecTable[1024];
+static int      Results;
+static int      IntervalN;
+static USTAT   *IntervalR[MAX_THREADS];
+static USTAT   *IntervalS[MAX_THREADS];
+static int      IntervalFD[MAX_THREADS];
+static int      IntervalFDN;
+static int      IntervalState;
+static pthread_cond_t  IntervalCond = PTHREAD_COND_INITIALIZER;
+static pthread_mutex_t IntervalLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t       IntervalThread;
 static int      ListenFD;
 static LOOP    *Loops;
 static int      ProcStatFD;
+static cpu_set_t PinCPUs;
+static cpu_set_t IrqCPUs;
+static CLOCK    PinTimes[T_N];
+static CLOCK    IrqTimes[T_N];
+static struct rusage SelfUsage;
+static char     NetDir[PATH_MAX];
+static uint64_t NetStart[NC_N];
+static int      PerfFD[PC_N];
 static STAT     RStat;
 static int      ShowIndex;
 static SHOW     ShowTable[256];
@@ -267,12 +473,40 @@ static int      VerboseConf;
 static int      VerboseStat;
 static int      VerboseTime;
 static int      VerboseUsed;
+static uint64_t PaceBase;
+static double   PaceGap;
+static double   PaceNext;
+static unsigned short PaceSeed[3];
+static volatile int Warming;
+static int      Warmed;
+static int      TestSecs;
+static volatile uint64_t WarmDeadline;
+static STAT     WarmStat;
+static HIST     WarmHist;
+static int      WarmN;
+static USTAT    WarmS[MAX_THREADS];
+static USTAT    WarmR[MAX_THREADS];
+static TRIAL    TrialBW;
+static TRIAL    TrialLat;
+static TRIAL    TrialRate;
+static MEASURE  TrialMeasure;
+static char     CtlArgs[CTL_ARGS];
+static int      CtlArgsLen;
+static char   **HostList;
+static int      HostN;
+static PATTERN  Pattern;
+static FLOW    *Flows;
+static int      FlowN;
+static HIST     FlowHist;
+static int      RelayFD;
+static int      RelaySynced;
 
 
 /*
  * Global variables.
  */
 RES          Res;
+HIST         LatHist;
 REQ          Req;
 STAT         LStat;
 char        *TestName;
@@ -281,7 +515,65 @@ SS           ServerAddr;
 int          ServerAddrLen;
 int          RemoteFD;
 int          Debug;
-volatile int Finished;
+volatile int FinishedFlag;
+volatile uint64_t Deadline;
+int          OutFormat;
+void        *SharedMem;
+
+
+/*
+ * Performance counters that may be requested with --perf_counters, indexed
+ * by PERF_INDEX.
+ */
+#define CACHE_MISS(c) ((c) | (PERF_COUNT_HW_CACHE_OP_READ << 8) |            \
+                       (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+PERF_EVENT PerfEvents[PC_N] ={
+    { "cycles", "cycles_per_msg", "cycles_per_kb",
+      PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES                       },
+    { "instructions", "instructions_per_msg", "instructions_per_kb",
+      PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS                     },
+    { "llc_misses", "llc_misses_per_msg", "llc_misses_per_kb",
+      PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_LL)             },
+    { "dtlb_misses", "dtlb_misses_per_msg", "dtlb_misses_per_kb",
+      PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB)           },
+    { "ctx_switches", "ctx_switches_per_msg", "ctx_switches_per_kb",
+      PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES                 },
+};
+
+
+/*
+ * Network counters that may be requested with --net_counters, indexed by
+ * NET_INDEX.
+ */
+NET_COUNTER NetCounters[NC_N] ={
+    { "tcp_retrans",        "/proc/net/snmp",    "Tcp:RetransSegs"          },
+    { "tcp_lost_retrans",   "/proc/net/netstat", "TcpExt:TCPLostRetransmit" },
+    { "tcp_in_errs",        "/proc/net/snmp",    "Tcp:InErrs"               },
+    { "tcp_out_rsts",       "/proc/net/snmp",    "Tcp:OutRsts"              },
+    { "udp_in_errs",        "/proc/net/snmp",    "Udp:InErrors"             },
+    { "udp_rcvbuf_errs",    "/proc/net/snmp",    "Udp:RcvbufErrors"         },
+    { "udp_sndbuf_errs",    "/proc/net/snmp",    "Udp:SndbufErrors"         },
+    { "ip_ce_pkts",         "/proc/net/netstat", "IpExt:InCEPkts"           },
+    { "nic_rx_dropped",     "statistics/rx_dropped"                         },
+    { "nic_tx_dropped",     "statistics/tx_dropped"                         },
+    { "nic_rx_errors",      "statistics/rx_errors"                          },
+    { "nic_tx_errors",      "statistics/tx_errors"                          },
+    { "nic_rx_missed",      "statistics/rx_missed_errors"                   },
+    { "port_rcv_errors",    "counters/port_rcv_errors"                      },
+    { "port_xmit_discards", "counters/port_xmit_discards"                   },
+    { "port_xmit_wait",     "counters/port_xmit_wait"                       },
+    { "symbol_errors",      "counters/symbol_error"                         },
+    { "link_downed",        "counters/link_downed"                          },
+    { "out_of_sequence",    "hw_counters/out_of_sequence"                   },
+    { "packet_seq_errs",    "hw_counters/packet_seq_err"                    },
+    { "rnr_nak_retry_errs", "hw_counters/rnr_nak_retry_err"                 },
+    { "local_ack_timeouts", "hw_counters/local_ack_timeout_err"             },
+    { "duplicate_requests", "hw_counters/duplicate_request"                 },
+    { "ecn_marked_pkts",    "hw_counters/np_ecn_marked_roce_packets"        },
+    { "cnp_sent",           "hw_counters/np_cnp_sent"                       },
+    { "cnp_handled",        "hw_counters/rp_cnp_handled"                    },
+};
 
 
 /*
@@ -292,20 +584,57 @@ PAR_NAME ParName[] ={
     { "access_recv",    L_ACCESS_RECV,    R_ACCESS_RECV   },
     { "affinity",       L_AFFINITY,       R_AFFINITY      },
     { "alt_port",       L_ALT_PORT,       R_ALT_PORT      },
+    { "atomic_shared",  L_ATOMIC_SHARED,  R_ATOMIC_SHARED },
+    { "atomic_spread",  L_ATOMIC_SPREAD,  R_ATOMIC_SPREAD },
+    { "batch_size",     L_BATCH_SIZE,     R_BATCH_SIZE    },
+    { "conn_depth",     L_CONN_DEPTH,     R_CONN_DEPTH    },
+    { "cpu_list",       L_CPU_LIST,       R_CPU_LIST      },
+    { "cq_spin",        L_CQ_SPIN,        R_CQ_SPIN       },
     { "flip",           L_FLIP,           R_FLIP          },
     { "id",             L_ID,             R_ID            },
+    { "io_engine",      L_IO_ENGINE,      R_IO_ENGINE     },
+    { "irq_cpus",       L_IRQ_CPUS,       R_IRQ_CPUS      },
+    { "mcast_group",    L_MCAST_GROUP,    R_MCAST_GROUP   },
+    { "mcast_receivers",L_MCAST_RECEIVERS,R_MCAST_RECEIVERS},
+    { "mem_gpu",        L_MEM_GPU,        R_MEM_GPU       },
+    { "mem_huge",       L_MEM_HUGE,       R_MEM_HUGE      },
+    { "mem_node",       L_MEM_NODE,       R_MEM_NODE      },
+    { "mr_odp",         L_MR_ODP,         R_MR_ODP        },
     { "msg_size",       L_MSG_SIZE,       R_MSG_SIZE      },
     { "mtu_size",       L_MTU_SIZE,       R_MTU_SIZE      },
+    { "net_counters",   L_NET_COUNTERS,   R_NET_COUNTERS  },
     { "no_msgs",        L_NO_MSGS,        R_NO_MSGS       },
+    { "num_qps",        L_NUM_QPS,        R_NUM_QPS       },
+    { "offered_load",   L_OFFERED_LOAD,   R_OFFERED_LOAD  },
+    { "perf_counters",  L_PERF_COUNTERS,  R_PERF_COUNTERS },
+    { "poisson",        L_POISSON,        R_POISSON       },
     { "poll_mode",      L_POLL_MODE,      R_POLL_MODE     },
     { "port",           L_PORT,           R_PORT          },
+    { "post_list",      L_POST_LIST,      R_POST_LIST     },
+    { "probe_size",     L_PROBE_SIZE,     R_PROBE_SIZE    },
+    { "probe_sl",       L_PROBE_SL,       R_PROBE_SL      },
+    { "queue_depth",    L_QUEUE_DEPTH,    R_QUEUE_DEPTH   },
     { "rd_atomic",      L_RD_ATOMIC,      R_RD_ATOMIC     },
     { "service_level",  L_SL,             R_SL            },
+    { "sig_every",      L_SIG_EVERY,      R_SIG_EVERY     },
     { "sock_buf_size",  L_SOCK_BUF_SIZE,  R_SOCK_BUF_SIZE },
+    { "sock_busy_poll", L_SOCK_BUSY_POLL, R_SOCK_BUSY_POLL},
     { "src_path_bits",  L_SRC_PATH_BITS,  R_SRC_PATH_BITS },
+    { "tcp_cc",         L_TCP_CC,         R_TCP_CC        },
+    { "tcp_cork",       L_TCP_CORK,       R_TCP_CORK      },
+    { "tcp_nodelay",    L_TCP_NODELAY,    R_TCP_NODELAY   },
+    { "threads",        L_THREADS,        R_THREADS       },
     { "time",           L_TIME,           R_TIME          },
     { "timeout",        L_TIMEOUT,        R_TIMEOUT       },
+    { "timer_poll",     L_TIMER_POLL,     R_TIMER_POLL    },
+    { "udp_gso",        L_UDP_GSO,        R_UDP_GSO       },
+    { "uring_depth",    L_URING_DEPTH,    R_URING_DEPTH   },
     { "use_cm",         L_USE_CM,         R_USE_CM        },
+    { "warmup",         L_WARMUP,         R_WARMUP        },
+    { "xdp_mode",       L_XDP_MODE,       R_XDP_MODE      },
+    { "xdp_queue",      L_XDP_QUEUE,      R_XDP_QUEUE     },
+    { "xdp_ring_size",  L_XDP_RING_SIZE,  R_XDP_RING_SIZE },
+    { "zcopy",          L_ZCOPY,          R_ZCOPY         },
 };
 
 
@@ -321,36 +650,110 @@ PAR_INFO ParInfo[P_N] ={
     { R_AFFINITY,       'l',  &RReq.affinity        },
     { L_ALT_PORT,       'l',  &Req.alt_port         },
     { R_ALT_PORT,       'l',  &RReq.alt_port        },
+    { L_ATOMIC_SHARED,  'l',  &Req.atomic_shared    },
+    { R_ATOMIC_SHARED,  'l',  &RReq.atomic_shared   },
+    { L_ATOMIC_SPREAD,  'l',  &Req.atomic_spread    },
+    { R_ATOMIC_SPREAD,  'l',  &RReq.atomic_spread   },
+    { L_BATCH_SIZE,     'l',  &Req.batch_size       },
+    { R_BATCH_SIZE,     'l',  &RReq.batch_size      },
+    { L_CONN_DEPTH,     'l',  &Req.conn_depth       },
+    { R_CONN_DEPTH,     'l',  &RReq.conn_depth      },
+    { L_CPU_LIST,       'p',  &Req.cpu_list         },
+    { R_CPU_LIST,       'p',  &RReq.cpu_list        },
+    { L_CQ_SPIN,        'l',  &Req.cq_spin          },
+    { R_CQ_SPIN,        'l',  &RReq.cq_spin         },
     { L_FLIP,           'l',  &Req.flip             },
     { R_FLIP,           'l',  &RReq.flip            },
     { L_ID,             'p',  &Req.id               },
     { R_ID,             'p',  &RReq.id              },
+    { L_IO_ENGINE,      'p',  &Req.io_engine        },
+    { R_IO_ENGINE,      'p',  &RReq.io_engine       },
+    { L_IRQ_CPUS,       'p',  &Req.irq_cpus         },
+    { R_IRQ_CPUS,       'p',  &RReq.irq_cpus        },
+    { L_MCAST_GROUP,    'p',  &Req.mcast_group      },
+    { R_MCAST_GROUP,    'p',  &RReq.mcast_group     },
+    { L_MCAST_RECEIVERS,'l',  &Req.mcast_receivers  },
+    { R_MCAST_RECEIVERS,'l',  &RReq.mcast_receivers },
+    { L_MEM_GPU,        'p',  &Req.mem_gpu          },
+    { R_MEM_GPU,        'p',  &RReq.mem_gpu         },
+    { L_MEM_HUGE,       's',  &Req.mem_huge         },
+    { R_MEM_HUGE,       's',  &RReq.mem_huge        },
+    { L_MEM_NODE,       'p',  &Req.mem_node         },
+    { R_MEM_NODE,       'p',  &RReq.mem_node        },
+    { L_MR_ODP,         'p',  &Req.mr_odp           },
+    { R_MR_ODP,         'p',  &RReq.mr_odp          },
     { L_MSG_SIZE,       's',  &Req.msg_size         },
     { R_MSG_SIZE,       's',  &RReq.msg_size        },
     { L_MTU_SIZE,       's',  &Req.mtu_size         },
     { R_MTU_SIZE,       's',  &RReq.mtu_size        },
+    { L_NET_COUNTERS,   'l',  &Req.net_counters     },
+    { R_NET_COUNTERS,   'l',  &RReq.net_counters    },
     { L_NO_MSGS,        'l',  &Req.no_msgs          },
     { R_NO_MSGS,        'l',  &RReq.no_msgs         },
+    { L_NUM_QPS,        'l',  &Req.num_qps          },
+    { R_NUM_QPS,        'l',  &RReq.num_qps         },
+    { L_OFFERED_LOAD,   'p',  &Req.offered_load     },
+    { R_OFFERED_LOAD,   'p',  &RReq.offered_load    },
+    { L_PERF_COUNTERS,  'l',  &Req.perf_counters    },
+    { R_PERF_COUNTERS,  'l',  &RReq.perf_counters   },
+    { L_POISSON,        'l',  &Req.poisson          },
+    { R_POISSON,        'l',  &RReq.poisson         },
     { L_POLL_MODE,      'l',  &Req.poll_mode        },
     { R_POLL_MODE,      'l',  &RReq.poll_mode       },
     { L_PORT,           'l',  &Req.port             },
     { R_PORT,           'l',  &RReq.port            },
+    { L_POST_LIST,      'l',  &Req.post_list        },
+    { R_POST_LIST,      'l',  &RReq.post_list       },
+    { L_PROBE_SIZE,     's',  &Req.probe_size       },
+    { R_PROBE_SIZE,     's',  &RReq.probe_size      },
+    { L_PROBE_SL,       'l',  &Req.probe_sl         },
+    { R_PROBE_SL,       'l',  &RReq.probe_sl        },
+    { L_QUEUE_DEPTH,    'l',  &Req.queue_depth      },
+    { R_QUEUE_DEPTH,    'l',  &RReq.queue_depth     },
     { L_RD_ATOMIC,      'l',  &Req.rd_atomic        },
     { R_RD_ATOMIC,      'l',  &RReq.rd_atomic       },
+    { L_SIG_EVERY,      'l',  &Req.sig_every        },
+    { R_SIG_EVERY,      'l',  &RReq.sig_every       },
     { L_SL,             'l',  &Req.sl               },
     { R_SL,             'l',  &RReq.sl              },
     { L_SOCK_BUF_SIZE,  's',  &Req.sock_buf_size    },
     { R_SOCK_BUF_SIZE,  's',  &RReq.sock_buf_size   },
+    { L_SOCK_BUSY_POLL, 'l',  &Req.sock_busy_poll   },
+    { R_SOCK_BUSY_POLL, 'l',  &RReq.sock_busy_poll  },
     { L_SRC_PATH_BITS,  's',  &Req.src_path_bits    },
     { R_SRC_PATH_BITS,  's',  &RReq.src_path_bits   },
     { L_STATIC_RATE,    'p',  &Req.static_rate      },
     { R_STATIC_RATE,    'p',  &RReq.static_rate     },
+    { L_TCP_CC,         'p',  &Req.tcp_cc           },
+    { R_TCP_CC,         'p',  &RReq.tcp_cc          },
+    { L_TCP_CORK,       'l',  &Req.tcp_cork         },
+    { R_TCP_CORK,       'l',  &RReq.tcp_cork        },
+    { L_TCP_NODELAY,    'l',  &Req.tcp_nodelay      },
+    { R_TCP_NODELAY,    'l',  &RReq.tcp_nodelay     },
+    { L_THREADS,        'l',  &Req.threads          },
+    { R_THREADS,        'l',  &RReq.threads         },
     { L_TIME,           't',  &Req.time             },
     { R_TIME,           't',  &RReq.time            },
     { L_TIMEOUT,        't',  &Req.timeout          },
     { R_TIMEOUT,        't',  &RReq.timeout         },
+    { L_TIMER_POLL,     'l',  &Req.timer_poll       },
+    { R_TIMER_POLL,     'l',  &RReq.timer_poll      },
+    { L_UDP_GSO,        'l',  &Req.udp_gso          },
+    { R_UDP_GSO,        'l',  &RReq.udp_gso         },
+    { L_URING_DEPTH,    'l',  &Req.uring_depth      },
+    { R_URING_DEPTH,    'l',  &RReq.uring_depth     },
     { L_USE_CM,         'l',  &Req.use_cm           },
     { R_USE_CM,         'l',  &RReq.use_cm          },
+    { L_WARMUP,         'l',  &Req.warmup           },
+    { R_WARMUP,         'l',  &RReq.warmup          },
+    { L_XDP_MODE,       'p',  &Req.xdp_mode         },
+    { R_XDP_MODE,       'p',  &RReq.xdp_mode        },
+    { L_XDP_QUEUE,      'l',  &Req.xdp_queue        },
+    { R_XDP_QUEUE,      'l',  &RReq.xdp_queue       },
+    { L_XDP_RING_SIZE,  'l',  &Req.xdp_ring_size    },
+    { R_XDP_RING_SIZE,  'l',  &RReq.xdp_ring_size   },
+    { L_ZCOPY,          'p',  &Req.zcopy            },
+    { R_ZCOPY,          'p',  &RReq.zcopy           },
 };
 
 
@@ -404,6 +807,7 @@ DICT Renamed[] = {
     {   "-vU",              "-vvu",                 },
     /* options that are on */
     {   "-aro",             "-ar1"                  },
+    {   "-asho",            "-ash1"                 },
     {   "-cmo",             "-cm1"                  },
     {   "-fo",              "-f1"                   },
     {   "-cpo",             "-cp1"                  },
@@ -422,8 +826,8 @@ DICT Renamed[] = {
  * obsolete and will eventually go away.
  */
 OPTION Options[] ={
-    { "--access_recv",        "int",   L_ACCESS_RECV,   R_ACCESS_RECV   },
-    {   "-ar",                "int",   L_ACCESS_RECV,   R_ACCESS_RECV   },
+    { "--access_recv",        "access", L_ACCESS_RECV,  R_ACCESS_RECV   },
+    {   "-ar",                "access", L_ACCESS_RECV,  R_ACCESS_RECV   },
     {   "-ar1",               "set1",  L_ACCESS_RECV,   R_ACCESS_RECV   },
     { "--alt_port",           "int",   L_ALT_PORT,      R_ALT_PORT      },
     {   "-ap",                "int",   L_ALT_PORT,      R_ALT_PORT      },
@@ -431,12 +835,31 @@ OPTION Options[] ={
     {   "-lap",               "int",   L_ALT_PORT,                      },
     {  "--rem_alt_port",      "int",   R_ALT_PORT                       },
     {   "-rap",               "int",   R_ALT_PORT                       },
+    { "--atomic_shared",      "int",   L_ATOMIC_SHARED, R_ATOMIC_SHARED },
+    {   "-ash",               "int",   L_ATOMIC_SHARED, R_ATOMIC_SHARED },
+    {   "-ash1",              "set1",  L_ATOMIC_SHARED, R_ATOMIC_SHARED },
+    { "--atomic_spread",      "int",   L_ATOMIC_SPREAD, R_ATOMIC_SPREAD },
+    {   "-as",                "int",   L_ATOMIC_SPREAD, R_ATOMIC_SPREAD },
+    { "--batch_size",         "int",   L_BATCH_SIZE,    R_BATCH_SIZE    },
+    {   "-bs",                "int",   L_BATCH_SIZE,    R_BATCH_SIZE    },
+    {  "--loc_batch_size",    "int",   L_BATCH_SIZE,                    },
+    {   "-lbs",               "int",   L_BATCH_SIZE,                    },
+    {  "--rem_batch_size",    "int",   R_BATCH_SIZE                     },
+    {   "-rbs",               "int",   R_BATCH_SIZE                     },
     { "--cpu_affinity",       "int",   L_AFFINITY,      R_AFFINITY      },
     {   "-ca",                "int",   L_AFFINITY,      R_AFFINITY      },
     {  "--loc_cpu_affinity",  "int",   L_AFFINITY,                      },
     {   "-lca",               "int",   L_AFFINITY,                      },
     {  "--rem_cpu_affinity",  "int",   R_AFFINITY                       },
     {   "-rca",               "int",   R_AFFINITY                       },
+    { "--conn_depth",         "int",   L_CONN_DEPTH,    R_CONN_DEPTH    },
+    {   "-cd",                "int",   L_CONN_DEPTH,    R_CONN_DEPTH    },
+    { "--cpu_list",           "cpus",  L_CPU_LIST,      R_CPU_LIST      },
+    {   "-cl",                "cpus",  L_CPU_LIST,      R_CPU_LIST      },
+    {  "--loc_cpu_list",      "cpus",  L_CPU_LIST,                      },
+    {   "-lcl",               "cpus",  L_CPU_LIST,                      },
+    {  "--rem_cpu_list",      "cpus",  R_CPU_LIST                       },
+    {   "-rcl",               "cpus",  R_CPU_LIST                       },
     { "--debug",              "Sdebug",                                 },
     {   "-D",                 "Sdebug",                                 },
     { "--flip",               "int",   L_FLIP,          R_FLIP          },
@@ -446,22 +869,90 @@ OPTION Options[] ={
     {   "-h",                 "help"                                    }, 
     { "--host",               "host",                                   },
     {   "-H",                 "host",                                   },
+    { "--hosts",              "hosts",                                  },
+    {   "-hs",                "hosts",                                  },
     { "--id",                 "str",   L_ID,            R_ID            },
     {   "-i",                 "str",   L_ID,            R_ID            },
     {  "--loc_id",            "str",   L_ID,                            },
     {   "-li",                "str",   L_ID,                            },
     {  "--rem_id",            "str",   R_ID                             },
     {   "-ri",                "str",   R_ID                             },
+    { "--io_engine",          "engine", L_IO_ENGINE,    R_IO_ENGINE     },
+    {   "-ie",                "engine", L_IO_ENGINE,    R_IO_ENGINE     },
+    {  "--loc_io_engine",     "engine", L_IO_ENGINE,                    },
+    {   "-lie",               "engine", L_IO_ENGINE,                    },
+    {  "--rem_io_engine",     "engine", R_IO_ENGINE                     },
+    {   "-rie",               "engine", R_IO_ENGINE                     },
+    { "--irq_cpus",           "cpus",  L_IRQ_CPUS,      R_IRQ_CPUS      },
+    {   "-ic",                "cpus",  L_IRQ_CPUS,      R_IRQ_CPUS      },
+    {  "--loc_irq_cpus",      "cpus",  L_IRQ_CPUS,                      },
+    {   "-lic",               "cpus",  L_IRQ_CPUS,                      },
+    {  "--rem_irq_cpus",      "cpus",  R_IRQ_CPUS                       },
+    {   "-ric",               "cpus",  R_IRQ_CPUS                       },
+    { "--interval",           "interval",                               },
+    {   "-iv",                "interval",                               },
     { "--listen_port",        "Slp",                                    },
     {   "-lp",                "Slp",                                    },
     { "--loop",               "loop",                                   },
     {   "-oo",                "loop",                                   },
+    { "--mcast_group",        "str",   L_MCAST_GROUP,   R_MCAST_GROUP   },
+    {   "-mg",                "str",   L_MCAST_GROUP,   R_MCAST_GROUP   },
+    { "--mcast_receivers",    "int",   L_MCAST_RECEIVERS, R_MCAST_RECEIVERS },
+    {   "-mr",                "int",   L_MCAST_RECEIVERS, R_MCAST_RECEIVERS },
+    { "--mem_gpu",            "gpu",   L_MEM_GPU,       R_MEM_GPU       },
+    {   "-mgp",               "gpu",   L_MEM_GPU,       R_MEM_GPU       },
+    {  "--loc_mem_gpu",       "gpu",   L_MEM_GPU,                       },
+    {   "-lmgp",              "gpu",   L_MEM_GPU,                       },
+    {  "--rem_mem_gpu",       "gpu",   R_MEM_GPU                        },
+    {   "-rmgp",              "gpu",   R_MEM_GPU                        },
+    { "--mem_huge",           "huge",  L_MEM_HUGE,      R_MEM_HUGE      },
+    {   "-mh",                "huge",  L_MEM_HUGE,      R_MEM_HUGE      },
+    {  "--loc_mem_huge",      "huge",  L_MEM_HUGE,                      },
+    {   "-lmh",               "huge",  L_MEM_HUGE,                      },
+    {  "--rem_mem_huge",      "huge",  R_MEM_HUGE                       },
+    {   "-rmh",               "huge",  R_MEM_HUGE                       },
+    { "--mem_node",           "node",  L_MEM_NODE,      R_MEM_NODE      },
+    {   "-mn",                "node",  L_MEM_NODE,      R_MEM_NODE      },
+    {  "--loc_mem_node",      "node",  L_MEM_NODE,                      },
+    {   "-lmn",               "node",  L_MEM_NODE,                      },
+    {  "--rem_mem_node",      "node",  R_MEM_NODE                       },
+    {   "-rmn",               "node",  R_MEM_NODE                       },
+    { "--mr_odp",             "odp",   L_MR_ODP,        R_MR_ODP        },
+    {   "-mo",                "odp",   L_MR_ODP,        R_MR_ODP        },
+    {  "--loc_mr_odp",        "odp",   L_MR_ODP,                        },
+    {   "-lmo",               "odp",   L_MR_ODP,                        },
+    {  "--rem_mr_odp",        "odp",   R_MR_ODP                         },
+    {   "-rmo",               "odp",   R_MR_ODP                         },
     { "--msg_size",           "size",  L_MSG_SIZE,      R_MSG_SIZE      },
     {   "-m",                 "size",  L_MSG_SIZE,      R_MSG_SIZE      },
     { "--mtu_size",           "size",  L_MTU_SIZE,      R_MTU_SIZE      },
     {   "-mt",                "size",  L_MTU_SIZE,      R_MTU_SIZE      },
+    { "--net_counters",       "int",   L_NET_COUNTERS,  R_NET_COUNTERS  },
+    {  "-nc",                 "int",   L_NET_COUNTERS,  R_NET_COUNTERS  },
+    {   "-nc1",               "set1",  L_NET_COUNTERS,  R_NET_COUNTERS  },
+    {  "--loc_net_counters",  "int",   L_NET_COUNTERS,                  },
+    {   "-lnc",               "int",   L_NET_COUNTERS,                  },
+    {   "-lnc1",              "set1",  L_NET_COUNTERS                   },
+    {  "--rem_net_counters",  "int",   R_NET_COUNTERS                   },
+    {   "-rnc",               "int",   R_NET_COUNTERS                   },
+    {   "-rnc1",              "set1",  R_NET_COUNTERS                   },
     { "--no_msgs",            "int",   L_NO_MSGS,       R_NO_MSGS       },
     {   "-n",                 "int",   L_NO_MSGS,       R_NO_MSGS       },
+    { "--num_qps",            "int",   L_NUM_QPS,       R_NUM_QPS       },
+    {   "-nq",                "int",   L_NUM_QPS,       R_NUM_QPS       },
+    { "--offered_load",       "load",  L_OFFERED_LOAD,  R_OFFERED_LOAD  },
+    {   "-ol",                "load",  L_OFFERED_LOAD,  R_OFFERED_LOAD  },
+    { "--output_format",      "format",                                 },
+    {   "-of",                "format",                                 },
+    { "--perf_counters",      "int",   L_PERF_COUNTERS, R_PERF_COUNTERS },
+    {  "-pc",                 "int",   L_PERF_COUNTERS, R_PERF_COUNTERS },
+    {   "-pc1",               "set1",  L_PERF_COUNTERS, R_PERF_COUNTERS },
+    {  "--loc_perf_counters", "int",   L_PERF_COUNTERS,                 },
+    {   "-lpc",               "int",   L_PERF_COUNTERS,                 },
+    {   "-lpc1",              "set1",  L_PERF_COUNTERS                  },
+    {  "--rem_perf_counters", "int",   R_PERF_COUNTERS                  },
+    {   "-rpc",               "int",   R_PERF_COUNTERS                  },
+    {   "-rpc1",              "set1",  R_PERF_COUNTERS                  },
     { "--cq_poll",            "int",   L_POLL_MODE,     R_POLL_MODE     },
     {  "-cp",                 "int",   L_POLL_MODE,     R_POLL_MODE     },
     {   "-cp1",               "set1",  L_POLL_MODE,     R_POLL_MODE     },
@@ -471,28 +962,69 @@ OPTION Options[] ={
     {  "--rem_cq_poll",       "int",   R_POLL_MODE                      },
     {   "-rcp",               "int",   R_POLL_MODE                      },
     {   "-rcp1",              "set1",  R_POLL_MODE                      },
+    { "--cq_spin",            "int",   L_CQ_SPIN,       R_CQ_SPIN       },
+    {   "-cs",                "int",   L_CQ_SPIN,       R_CQ_SPIN       },
+    {  "--loc_cq_spin",       "int",   L_CQ_SPIN,                       },
+    {   "-lcs",               "int",   L_CQ_SPIN,                       },
+    {  "--rem_cq_spin",       "int",   R_CQ_SPIN                        },
+    {   "-rcs",               "int",   R_CQ_SPIN                        },
     { "--ip_port",            "int",   L_PORT,          R_PORT          },
     {   "-ip",                "int",   L_PORT,          R_PORT          },
+    { "--pattern",            "pattern",                                },
+    {   "-pat",               "pattern",                                },
+    { "--poisson",            "int",   L_POISSON,       R_POISSON       },
+    {   "-po",                "int",   L_POISSON,       R_POISSON       },
+    {   "-po1",               "set1",  L_POISSON,       R_POISSON       },
+    { "--post_list",          "int",   L_POST_LIST,     R_POST_LIST     },
+    {   "-pl",                "int",   L_POST_LIST,     R_POST_LIST     },
+    {  "--loc_post_list",     "int",   L_POST_LIST,                     },
+    {   "-lpl",               "int",   L_POST_LIST,                     },
+    {  "--rem_post_list",     "int",   R_POST_LIST                      },
+    {   "-rpl",               "int",   R_POST_LIST                      },
+    { "--probe_size",         "size",  L_PROBE_SIZE,    R_PROBE_SIZE    },
+    {   "-ps",                "size",  L_PROBE_SIZE,    R_PROBE_SIZE    },
+    { "--probe_sl",           "sl",    L_PROBE_SL,      R_PROBE_SL      },
+    {   "-psl",               "sl",    L_PROBE_SL,      R_PROBE_SL      },
     { "--precision",          "precision",                              },
     {   "-e",                 "precision",                              },
+    { "--queue_depth",        "int",   L_QUEUE_DEPTH,   R_QUEUE_DEPTH   },
+    {   "-qd",                "int",   L_QUEUE_DEPTH,   R_QUEUE_DEPTH   },
+    {  "--loc_queue_depth",   "int",   L_QUEUE_DEPTH,                   },
+    {   "-lqd",               "int",   L_QUEUE_DEPTH,                   },
+    {  "--rem_queue_depth",   "int",   R_QUEUE_DEPTH                    },
+    {   "-rqd",               "int",   R_QUEUE_DEPTH                    },
     { "--rd_atomic",          "int",   L_RD_ATOMIC,     R_RD_ATOMIC     },
     {   "-nr",                "int",   L_RD_ATOMIC,     R_RD_ATOMIC     },
     {  "--loc_rd_atomic",     "int",   L_RD_ATOMIC,                     },
     {   "-lnr",               "int",   L_RD_ATOMIC,                     },
     {  "--rem_rd_atomic",     "int",   R_RD_ATOMIC                      },
     {   "-rnr",               "int",   R_RD_ATOMIC                      },
+    { "--repeat",             "repeat",                                 },
+    {   "-re",                "repeat",                                 },
     { "--service_level",      "sl",    L_SL,            R_SL            },
     {   "-sl",                "sl",    L_SL,            R_SL            },
     {  "--loc_service_level", "sl",    L_SL                             },
     {   "-lsl",               "sl",    L_SL                             },
     {  "--rem_service_level", "sl",    R_SL                             },
     {   "-rsl",               "sl",    R_SL                             },
+    { "--sig_every",          "int",   L_SIG_EVERY,     R_SIG_EVERY     },
+    {   "-se",                "int",   L_SIG_EVERY,     R_SIG_EVERY     },
+    {  "--loc_sig_every",     "int",   L_SIG_EVERY,                     },
+    {   "-lse",               "int",   L_SIG_EVERY,                     },
+    {  "--rem_sig_every",     "int",   R_SIG_EVERY                      },
+    {   "-rse",               "int",   R_SIG_EVERY                      },
     { "--sock_buf_size",      "size",  L_SOCK_BUF_SIZE, R_SOCK_BUF_SIZE },
     {   "-sb",                "size",  L_SOCK_BUF_SIZE, R_SOCK_BUF_SIZE },
     {  "--loc_sock_buf_size", "size",  L_SOCK_BUF_SIZE                  },
     {   "-lsb",               "size",  L_SOCK_BUF_SIZE                  },
     {  "--rem_sock_buf_size", "size",  R_SOCK_BUF_SIZE                  },
     {   "-rsb",               "size",  R_SOCK_BUF_SIZE                  },
+    { "--sock_busy_poll",     "int",   L_SOCK_BUSY_POLL,R_SOCK_BUSY_POLL},
+    {   "-sbp",               "int",   L_SOCK_BUSY_POLL,R_SOCK_BUSY_POLL},
+    {  "--loc_sock_busy_poll","int",   L_SOCK_BUSY_POLL                 },
+    {   "-lsbp",              "int",   L_SOCK_BUSY_POLL                 },
+    {  "--rem_sock_busy_poll","int",   R_SOCK_BUSY_POLL                 },
+    {   "-rsbp",              "int",   R_SOCK_BUSY_POLL                 },
     { "--src_path_bits",      "size",  L_SRC_PATH_BITS, R_SRC_PATH_BITS },
     {   "-sp",                "size",  L_SRC_PATH_BITS, R_SRC_PATH_BITS },
     {  "--loc_src_path_bits", "size",  L_SRC_PATH_BITS                  },
@@ -505,6 +1037,20 @@ OPTION Options[] ={
     {   "-lsr",               "str",   L_STATIC_RATE                    },
     {  "--rem_static_rate",   "str",   R_STATIC_RATE                    },
     {   "-rsr",               "str",   R_STATIC_RATE                    },
+    { "--tcp_cc",             "str",   L_TCP_CC,        R_TCP_CC        },
+    {   "-tcc",               "str",   L_TCP_CC,        R_TCP_CC        },
+    {  "--loc_tcp_cc",        "str",   L_TCP_CC,                        },
+    {   "-ltcc",              "str",   L_TCP_CC,                        },
+    {  "--rem_tcp_cc",        "str",   R_TCP_CC                         },
+    {   "-rtcc",              "str",   R_TCP_CC                         },
+    { "--tcp_cork",           "int",   L_TCP_CORK,      R_TCP_CORK      },
+    {   "-tck",               "int",   L_TCP_CORK,      R_TCP_CORK      },
+    {   "-tck1",              "set1",  L_TCP_CORK,      R_TCP_CORK      },
+    { "--tcp_nodelay",        "int",   L_TCP_NODELAY,   R_TCP_NODELAY   },
+    {   "-tnd",               "int",   L_TCP_NODELAY,   R_TCP_NODELAY   },
+    {   "-tnd1",              "set1",  L_TCP_NODELAY,   R_TCP_NODELAY   },
+    { "--threads",            "int",   L_THREADS,       R_THREADS       },
+    {   "-th",                "int",   L_THREADS,       R_THREADS       },
     { "--time",               "time",  L_TIME,          R_TIME          },
     {   "-t",                 "time",  L_TIME,          R_TIME          },
     { "--timeout",            "time",  L_TIMEOUT,       R_TIMEOUT       },
@@ -513,10 +1059,34 @@ OPTION Options[] ={
     {   "-lto",               "Stime", L_TIMEOUT                        },
     {  "--rem_timeout",       "time",  R_TIMEOUT                        },
     {   "-rto",               "time",  R_TIMEOUT                        },
+    { "--timer_poll",         "int",   L_TIMER_POLL,    R_TIMER_POLL    },
+    {  "-tp",                 "int",   L_TIMER_POLL,    R_TIMER_POLL    },
+    {   "-tp1",               "set1",  L_TIMER_POLL,    R_TIMER_POLL    },
+    {  "--loc_timer_poll",    "int",   L_TIMER_POLL,                    },
+    {   "-ltp",               "int",   L_TIMER_POLL,                    },
+    {   "-ltp1",              "set1",  L_TIMER_POLL                     },
+    {  "--rem_timer_poll",    "int",   R_TIMER_POLL                     },
+    {   "-rtp",               "int",   R_TIMER_POLL                     },
+    {   "-rtp1",              "set1",  R_TIMER_POLL                     },
+    { "--udp_gso",            "int",   L_UDP_GSO,       R_UDP_GSO       },
+    {   "-ug",                "int",   L_UDP_GSO,       R_UDP_GSO       },
+    {   "-ug1",               "set1",  L_UDP_GSO,       R_UDP_GSO       },
+    {  "--loc_udp_gso",       "int",   L_UDP_GSO,                       },
+    {   "-lug",               "int",   L_UDP_GSO,                       },
+    {   "-lug1",              "set1",  L_UDP_GSO                        },
+    {  "--rem_udp_gso",       "int",   R_UDP_GSO                        },
+    {   "-rug",               "int",   R_UDP_GSO                        },
+    {   "-rug1",              "set1",  R_UDP_GSO                        },
     { "--unify_nodes",        "un",                                     },
     {   "-un",                "un",                                     },
     { "--unify_units",        "uu",                                     },
     {   "-uu",                "uu",                                     },
+    { "--uring_depth",        "int",   L_URING_DEPTH,   R_URING_DEPTH   },
+    {   "-ud",                "int",   L_URING_DEPTH,   R_URING_DEPTH   },
+    {  "--loc_uring_depth",   "int",   L_URING_DEPTH,                   },
+    {   "-lud",               "int",   L_URING_DEPTH,                   },
+    {  "--rem_uring_depth",   "int",   R_URING_DEPTH                    },
+    {   "-rud",               "int",   R_URING_DEPTH                    },
     { "--use_bits_per_sec",   "ub",                                     },
     {   "-ub",                "ub",                                     },
     { "--use_cm",             "int",   L_USE_CM,        R_USE_CM        },
@@ -546,6 +1116,28 @@ OPTION Options[] ={
     {   "-V",                 "version",                                },
     { "--wait_server",        "wait",                                   },
     {   "-ws",                "wait",                                   },
+    { "--warmup",             "time",  L_WARMUP,        R_WARMUP        },
+    {   "-wu",                "time",  L_WARMUP,        R_WARMUP        },
+    { "--xdp_mode",           "xdp",   L_XDP_MODE,      R_XDP_MODE      },
+    {   "-xm",                "xdp",   L_XDP_MODE,      R_XDP_MODE      },
+    {  "--loc_xdp_mode",      "xdp",   L_XDP_MODE,                      },
+    {   "-lxm",               "xdp",   L_XDP_MODE,                      },
+    {  "--rem_xdp_mode",      "xdp",   R_XDP_MODE                       },
+    {   "-rxm",               "xdp",   R_XDP_MODE                       },
+    { "--xdp_queue",          "int",   L_XDP_QUEUE,     R_XDP_QUEUE     },
+    {   "-xq",                "int",   L_XDP_QUEUE,     R_XDP_QUEUE     },
+    {  "--loc_xdp_queue",     "int",   L_XDP_QUEUE,                     },
+    {   "-lxq",               "int",   L_XDP_QUEUE,                     },
+    {  "--rem_xdp_queue",     "int",   R_XDP_QUEUE                      },
+    {   "-rxq",               "int",   R_XDP_QUEUE                      },
+    { "--xdp_ring_size",      "int",   L_XDP_RING_SIZE, R_XDP_RING_SIZE },
+    {   "-xr",                "int",   L_XDP_RING_SIZE, R_XDP_RING_SIZE },
+    {  "--loc_xdp_ring_size", "int",   L_XDP_RING_SIZE,                 },
+    {   "-lxr",               "int",   L_XDP_RING_SIZE,                 },
+    {  "--rem_xdp_ring_size", "int",   R_XDP_RING_SIZE                  },
+    {   "-rxr",               "int",   R_XDP_RING_SIZE                  },
+    { "--zcopy",              "zcopy", L_ZCOPY,         R_ZCOPY         },
+    {   "-zc",                "zcopy", L_ZCOPY,         R_ZCOPY         },
 };
 
 
@@ -562,21 +1154,35 @@ TEST Tests[] ={
     test(sctp_lat),
     test(sdp_bw),
     test(sdp_lat),
+    test(shm_bw),
+    test(shm_lat),
     test(tcp_bw),
+    test(tcp_bw_lat),
+    test(tcp_conn_rate),
     test(tcp_lat),
     test(udp_bw),
     test(udp_lat),
+    test(unix_dgram_bw),
+    test(unix_dgram_lat),
+    test(unix_stream_bw),
+    test(unix_stream_lat),
+    test(xdp_bw),
+    test(xdp_lat),
 #ifdef RDMA
     test(rc_bi_bw),
     test(rc_bw),
+    test(rc_cm_conn_rate),
     test(rc_compare_swap_mr),
     test(rc_fetch_add_mr),
     test(rc_lat),
+    test(rc_odp_fault_lat),
     test(rc_rdma_read_bw),
     test(rc_rdma_read_lat),
     test(rc_rdma_write_bw),
+    test(rc_rdma_write_bw_lat),
     test(rc_rdma_write_lat),
     test(rc_rdma_write_poll_lat),
+    test(reg_mr_lat),
     test(uc_bi_bw),
     test(uc_bw),
     test(uc_lat),
@@ -586,6 +1192,8 @@ TEST Tests[] ={
     test(ud_bi_bw),
     test(ud_bw),
     test(ud_lat),
+    test(ud_mcast_bw),
+    test(ud_mcast_lat),
     test(ver_rc_compare_swap),
     test(ver_rc_fetch_add),
 #ifdef HAS_XRC
@@ -616,14 +1224,26 @@ initialize(void)
     int i;
 
     RemoteFD = -1;
+    RelayFD = -1;
     for (i = 0; i < P_N; ++i)
         if (ParInfo[i].index != i)
             error(BUG, "initialize: ParInfo: out of order: %d", i);
+    open_proc_stat();
+    IStat.no_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    IStat.no_ticks = sysconf(_SC_CLK_TCK);
+}
+
+
+/*
+ * Open /proc/stat.  Each process that reads it needs its own file descriptor
+ * since the file offset would otherwise be shared.
+ */
+static void
+open_proc_stat(void)
+{
     ProcStatFD = open("/proc/stat", 0);
     if (ProcStatFD < 0)
         error(SYS, "cannot open /proc/stat");
-    IStat.no_cpus = sysconf(_SC_NPROCESSORS_ONLN);
-    IStat.no_ticks = sysconf(_SC_CLK_TCK);
 }
 
 
@@ -687,19 +1307,63 @@ set_signals(void)
 
     act.sa_sigaction = sig_urg;
     sigaction(SIGURG, &act, 0);
+
+    act.sa_flags |= SA_RESTART | SA_NOCLDSTOP;
+    act.sa_sigaction = sig_chld;
+    sigaction(SIGCHLD, &act, 0);
+}
+
+
+/*
+ * Set up the SIGALRM handler.  While warming up, system calls that the alarm
+ * interrupts are restarted since the alarm that ends the warm up does not end
+ * the test and a test blocked in a read should not see it as an error.
+ */
+static void
+set_alarm(int restart)
+{
+    struct sigaction act ={
+        .sa_flags = SA_SIGINFO
+    };
+
+    if (restart)
+        act.sa_flags |= SA_RESTART;
+    act.sa_sigaction = sig_alrm;
+    sigaction(SIGALRM, &act, 0);
 }
 
 
 /*
- * Note that time is up.
+ * Note that time is up.  If we were only warming up, we just set the deadlines
+ * so that the next test of Finished calls past_deadline which ends the warm up
+ * outside of the signal handler.
  */
 static void
 sig_alrm(int signo, siginfo_t *siginfo, void *ucontext)
 {
+    if (Warming && !Req.timer_poll) {
+        WarmDeadline = 0;
+        Deadline = ~0ULL;
+        return;
+    }
     set_finished();
 }
 
 
+/*
+ * Reap any children that have finished running a test.
+ */
+static void
+sig_chld(int signo, siginfo_t *siginfo, void *ucontext)
+{
+    int save = errno;
+
+    while (waitpid(-1, 0, WNOHANG) > 0)
+        ;
+    errno = save;
+}
+
+
 /*
  * Our child sends us a quit when it wishes us to exit.
  */
@@ -732,15 +1396,18 @@ do_args(char *args[])
     while (*args) {
         char *arg = *args;
         if (arg[0] == '-') {
+            char **next = args;
             OPTION *option = find_option(arg);
             if (!option)
                 error(0, "%s: bad option; try: qperf --help options", arg);
             if (option->type[0] != 'S')
                 isClient = 1;
-            do_option(option, &args);
+            do_option(option, &next);
+            ctl_arg(option, args, next);
+            args = next;
         } else {
             isClient = 1;
-            if (!ServerName)
+            if (!ServerName && !HostN)
                 ServerName = arg;
             else {
                 TEST *test = find_test(arg);
@@ -754,10 +1421,12 @@ do_args(char *args[])
         }
     }
 
+    if (RemoteFD >= 0)
+        remotefd_close();
     if (!isClient)
         server();
     else if (!testSpecified) {
-        if (!ServerName)
+        if (!ServerName && !HostN)
             error(0, "you used a client-only option but did not specify the "
                       "server name.\nDo you want to be a client or server?");
         if (find_test(ServerName))
@@ -785,6 +1454,7 @@ do_loop(LOOP *loop, TEST *test)
 
             snprintf(buf, sizeof(buf), "%ld", l);
             do_option(loop->option, &argv);
+            loop->cur = l;
             do_loop(loop->next, test);
             if (loop->mult)
                 l *= loop->incr;
@@ -855,6 +1525,45 @@ do_option(OPTION *option, char ***argvp)
     if (streq(t, "debug")) {
         Debug = 1;
         *argvp += 1;
+    } else if (streq(t, "access")) {
+        int i;
+        char *s = arg_strn(argvp);
+        static char *modes[] ={ "none", "read", "copy", "verify" };
+
+        for (i = 0; i < (int)cardof(modes); ++i)
+            if (streq(s, modes[i]) || (s[0] == '0' + i && !s[1]))
+                break;
+        if (i == (int)cardof(modes))
+            error(0, "access mode must be one of none, read, copy or "
+                     "verify: %s given", s);
+        setp_u32(option->name, option->arg1, i);
+        setp_u32(option->name, option->arg2, i);
+    } else if (streq(t, "cpus")) {
+        int cpus[CPU_SETSIZE];
+        char *s = arg_strn(argvp);
+
+        parse_cpus(s, cpus);
+        setp_str(option->name, option->arg1, s);
+        setp_str(option->name, option->arg2, s);
+    } else if (streq(t, "engine")) {
+        char *s = arg_strn(argvp);
+        if (!streq(s, "sync") && !streq(s, "io_uring") &&
+            !streq(s, "io_uring_sqpoll"))
+            error(0, "I/O engine must be one of sync, io_uring or "
+                     "io_uring_sqpoll: %s given", s);
+        setp_str(option->name, option->arg1, s);
+        setp_str(option->name, option->arg2, s);
+    } else if (streq(t, "format")) {
+        char *s = arg_strn(argvp);
+        if (streq(s, "text"))
+            OutFormat = OUT_TEXT;
+        else if (streq(s, "json"))
+            OutFormat = OUT_JSON;
+        else if (streq(s, "csv"))
+            OutFormat = OUT_CSV;
+        else
+            error(0, "output format must be one of text, json or csv: "
+                     "%s given", s);
     } else if (streq(t, "help")) {
         /* Help */
         char **usage;
@@ -874,16 +1583,76 @@ do_option(OPTION *option, char ***argvp)
         exit(0);
     } else if (streq(t, "host")) {
         ServerName = arg_strn(argvp);
+    } else if (streq(t, "hosts")) {
+        ctl_hosts(arg_strn(argvp));
+    } else if (streq(t, "huge")) {
+        long v = arg_size(argvp);
+        if (v != 0 && v != 2*1024*1024 && v != 1024*1024*1024)
+            error(0, "huge page size must be one of 0, 2M or 1G: %ld given", v);
+        setp_u32(option->name, option->arg1, v);
+        setp_u32(option->name, option->arg2, v);
     } else if (streq(t, "int")) {
         long v = arg_long(argvp);
         setp_u32(option->name, option->arg1, v);
         setp_u32(option->name, option->arg2, v);
+    } else if (streq(t, "interval")) {
+        Interval = arg_long(argvp);
     } else if (streq(t, "loop")) {
         parse_loop(argvp);
     } else if (streq(t, "lp")) {
         ListenPort = arg_long(argvp);
+    } else if (streq(t, "load")) {
+        char *s = arg_strn(argvp);
+        if (load_rate(s, 1) <= 0)
+            error(0, "offered load must be a positive number of messages or "
+                     "bits per second: %s given", s);
+        setp_str(option->name, option->arg1, s);
+        setp_str(option->name, option->arg2, s);
+    } else if (streq(t, "gpu")) {
+        char *s = arg_strn(argvp);
+        char *n = s;
+        char *e = s;
+        if (!strncmp(s, "cuda:", 5) || !strncmp(s, "rocm:", 5))
+            n = s + 5;
+        if (!streq(s, "none") && (strtol(n, &e, 10) < 0 || e == n || *e))
+            error(0, "GPU must be none, an index, cuda:Index or rocm:Index: "
+                     "%s given", s);
+        setp_str(option->name, option->arg1, s);
+        setp_str(option->name, option->arg2, s);
+    } else if (streq(t, "node")) {
+        char *s = arg_strn(argvp);
+        char *e = s;
+        if (!streq(s, "nic") && (strtol(s, &e, 10) < 0 || e == s || *e))
+            error(0, "memory node must be nic or a node number: %s given", s);
+        setp_str(option->name, option->arg1, s);
+        setp_str(option->name, option->arg2, s);
+    } else if (streq(t, "odp")) {
+        char *s = arg_strn(argvp);
+        if (!streq(s, "none") && !streq(s, "explicit") &&
+            !streq(s, "implicit"))
+            error(0, "On-Demand Paging mode must be one of none, explicit "
+                     "or implicit: %s given", s);
+        setp_str(option->name, option->arg1, s);
+        setp_str(option->name, option->arg2, s);
+    } else if (streq(t, "pattern")) {
+        char *s = arg_strn(argvp);
+        if (streq(s, "pairwise"))
+            Pattern = PAT_PAIRWISE;
+        else if (streq(s, "all_to_all"))
+            Pattern = PAT_ALL_TO_ALL;
+        else if (streq(s, "incast"))
+            Pattern = PAT_INCAST;
+        else if (streq(s, "ring"))
+            Pattern = PAT_RING;
+        else
+            error(0, "pattern must be one of pairwise, all_to_all, incast or "
+                     "ring: %s given", s);
     } else if (streq(t, "precision")) {
         Precision = arg_long(argvp);
+    } else if (streq(t, "repeat")) {
+        Repeat = arg_long(argvp);
+        if (Repeat < 1)
+            error(0, "repeat count must be at least 1: %d given", Repeat);
     } else if (streq(t, "set1")) {
         setp_u32(option->name, option->arg1, 1);
         setp_u32(option->name, option->arg2, 1);
@@ -960,6 +1729,21 @@ do_option(OPTION *option, char ***argvp)
         *argvp += 1;
     } else if (streq(t, "wait")) {
         ServerWait = arg_time(argvp);
+    } else if (streq(t, "xdp")) {
+        char *s = arg_strn(argvp);
+        if (!streq(s, "auto") && !streq(s, "copy") && !streq(s, "zerocopy"))
+            error(0, "XDP mode must be one of auto, copy or zerocopy: "
+                     "%s given", s);
+        setp_str(option->name, option->arg1, s);
+        setp_str(option->name, option->arg2, s);
+    } else if (streq(t, "zcopy")) {
+        char *s = arg_strn(argvp);
+        if (!streq(s, "none") && !streq(s, "msg_zerocopy") &&
+            !streq(s, "sendfile") && !streq(s, "splice"))
+            error(0, "zero copy mode must be one of none, msg_zerocopy, "
+                     "sendfile or splice: %s given", s);
+        setp_str(option->name, option->arg1, s);
+        setp_str(option->name, option->arg2, s);
     } else
         error(BUG, "do_option: unknown type: %s", t);
 }
@@ -1206,6 +1990,18 @@ arg_time(char ***argvp)
 }
 
 
+/*
+ * Get a value stored in a 32 bit value.  This lets a test see the remote
+ * value of a parameter.
+ */
+uint32_t
+getv_u32(PAR_INDEX index)
+{
+    PAR_INFO *p = par_info(index);
+    return *((uint32_t *)p->ptr);
+}
+
+
 /*
  * Set a value stored in a 32 bit value without letting anyone know we set it.
  */
@@ -1331,17 +2127,16 @@ opt_check(void)
 
 
 /*
- * Server.
+ * Server.  Each client connection is handled by a child process so that we
+ * can serve many clients at the same time; children are reaped by sig_chld.
  */
 static void
 server(void)
 {
     server_listen();
+    mem_share();
     for (;;) {
-        REQ req;
         pid_t pid;
-        TEST *test;
-        int s = offset(REQ, req_index);
 
         debug("ready for requests");
         if (!server_recv_request())
@@ -1353,10 +2148,36 @@ server(void)
         }
         if (pid > 0) {
             remotefd_close();
-            waitpid(pid, 0, 0);
             continue;
         }
+        close(ListenFD);
+        close(ProcStatFD);
+        open_proc_stat();
         remotefd_setup();
+        server_session();
+        exit(0);
+    }
+    close(ListenFD);
+}
+
+
+/*
+ * Run the requests that a client sends over its control connection until it
+ * closes it.  A client running several tests or a --loop sends them all over
+ * the one connection so they are handled here, one after the other.  Each
+ * request starts with the processor affinity we had when the client arrived.
+ */
+static void
+server_session(void)
+{
+    cpu_set_t cpus;
+
+    if (sched_getaffinity(0, sizeof(cpus), &cpus) < 0)
+        error(SYS, "cannot get processor affinity");
+    while (server_wait_request()) {
+        REQ req;
+        TEST *test;
+        int s = offset(REQ, req_index);
 
         recv_mesg(&req, s, "request version");
         dec_init(&req);
@@ -1365,6 +2186,11 @@ server(void)
             version_error();
         recv_mesg(&req.req_index, sizeof(req)-s, "request data");
         dec_req_data(&Req);
+        if (Req.req_index == RELAY_INDEX) {
+            relay_session();
+            sched_setaffinity(0, sizeof(cpus), &cpus);
+            continue;
+        }
         if (Req.req_index >= cardof(Tests))
             error(0, "bad request index: %d", Req.req_index);
 
@@ -1372,11 +2198,42 @@ server(void)
         TestName = test->name;
         debug("received request: %s", TestName);
         init_lstat();
+        sched_setaffinity(0, sizeof(cpus), &cpus);
         set_affinity();
         (test->server)();
-        exit(0);
     }
-    close(ListenFD);
+}
+
+
+/*
+ * Wait for the next request on the control connection.  Return false if the
+ * client closed it or sent nothing for the timeout period.
+ */
+static int
+server_wait_request(void)
+{
+    char c;
+    fd_set fdset;
+    struct timeval timeval ={
+        .tv_sec = Req.timeout
+    };
+
+    for (;;) {
+        int n;
+
+        FD_ZERO(&fdset);
+        FD_SET(RemoteFD, &fdset);
+        n = select(RemoteFD+1, &fdset, 0, 0, &timeval);
+        if (n > 0)
+            break;
+        if (n == 0) {
+            debug("no further requests");
+            return 0;
+        }
+        if (errno != EINTR)
+            error(SYS, "select failed");
+    }
+    return recv(RemoteFD, &c, 1, MSG_PEEK) == 1;
 }
 
 
@@ -1454,8 +2311,11 @@ server_recv_request(void)
 
     clientLen = sizeof(clientAddr);
     RemoteFD = accept(ListenFD, (struct sockaddr *)&clientAddr, &clientLen);
-    if (RemoteFD < 0)
+    if (RemoteFD < 0) {
+        if (errno == EINTR)
+            return 0;
         return error(SYS|RET, "accept failed");
+    }
     return 1;
 }
 
@@ -1468,6 +2328,44 @@ client(TEST *test)
 {
     int i;
 
+    client_init(test);
+    if (!OutFormat)
+        printf("%s:\n", TestName);
+    memset(&TrialBW, 0, sizeof(TrialBW));
+    memset(&TrialLat, 0, sizeof(TrialLat));
+    memset(&TrialRate, 0, sizeof(TrialRate));
+    for (i = 0; i < Repeat; ++i) {
+        if (i)
+            place_clear();
+        init_lstat();
+        Results = 0;
+        if (HostN)
+            ctl_round(test);
+        else
+            (*test->client)();
+        if (Results) {
+            trial_add(&TrialBW, Res.recv_bw);
+            trial_add(&TrialLat, Res.latency);
+            trial_add(&TrialRate, Res.msg_rate);
+        }
+    }
+    if (Repeat > 1 && Results && !OutFormat)
+        show_trials();
+    if (OutFormat)
+        rec_show();
+    else
+        place_show();
+}
+
+
+/*
+ * Set the parameters that every test uses and prepare the request.
+ */
+static void
+client_init(TEST *test)
+{
+    int i;
+
     for (i = 0; i < P_N; ++i)
         ParInfo[i].inuse = 0;
     if (!par_isset(L_NO_MSGS))
@@ -1480,6 +2378,16 @@ client(TEST *test)
     par_use(R_AFFINITY);
     par_use(L_TIME);
     par_use(R_TIME);
+    par_use(L_TIMER_POLL);
+    par_use(R_TIMER_POLL);
+    par_use(L_WARMUP);
+    par_use(R_WARMUP);
+    par_use(L_IRQ_CPUS);
+    par_use(R_IRQ_CPUS);
+    par_use(L_NET_COUNTERS);
+    par_use(R_NET_COUNTERS);
+    par_use(L_PERF_COUNTERS);
+    par_use(R_PERF_COUNTERS);
 
     set_affinity();
     RReq.ver_maj = VER_MAJ;
@@ -1488,101 +2396,680 @@ client(TEST *test)
     RReq.req_index = test - Tests;
     TestName = test->name;
     debug("sending request: %s", TestName);
-    init_lstat();
-    printf("%s:\n", TestName);
-    (*test->client)();
-    remotefd_close();
-    place_show();
 }
 
 
 /*
- * Send a request to the server.
+ * Add the result of one trial.  The mean and the sum of squared deviations
+ * are kept with Welford's method.
  */
-void
-client_send_request(void)
+static void
+trial_add(TRIAL *trial, double value)
 {
-    REQ req;
-    AI *a;
-    AI hints ={
-        .ai_family   = AF_UNSPEC,
-        .ai_socktype = SOCK_STREAM
-    };
-    AI *ailist = getaddrinfo_port(ServerName, ListenPort, &hints);
+    double d = value - trial->mean;
+
+    if (trial->n == 0 || value < trial->min)
+        trial->min = value;
+    if (trial->n == 0 || value > trial->max)
+        trial->max = value;
+    trial->n++;
+    trial->mean += d / trial->n;
+    trial->m2 += d * (value - trial->mean);
+}
 
-    RemoteFD = -1;
-    if (ServerWait)
-        start_test_timer(ServerWait);
-    for (;;) {
-        for (a = ailist; a; a = a->ai_next) {
-            if (Finished)
-                break;
-            RemoteFD = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
-            if (RemoteFD < 0)
-                continue;
-            if (connect(RemoteFD, a->ai_addr, a->ai_addrlen) != SUCCESS0) {
-                remotefd_close();
-                continue;
-            }
-            ServerAddrLen = a->ai_addrlen;
-            memcpy(&ServerAddr, a->ai_addr, ServerAddrLen);
-            break;
-        }
-        if (RemoteFD >= 0 || !ServerWait || Finished)
-            break;
-        sleep(1);
-    }
 
-    if (ServerWait)
-        stop_test_timer();
-    freeaddrinfo(ailist);
+/*
+ * Return the half width of the 95% confidence interval of the mean of a
+ * set of trials using Student's t distribution.  Past 30 degrees of freedom,
+ * the normal distribution is close enough.
+ */
+static double
+trial_ci95(TRIAL *trial)
+{
+    static double t95[] ={
+        12.706, 4.303, 3.182, 2.776, 2.571, 2.447, 2.365, 2.306, 2.262, 2.228,
+         2.201, 2.179, 2.160, 2.145, 2.131, 2.120, 2.110, 2.101, 2.093, 2.086,
+         2.080, 2.074, 2.069, 2.064, 2.060, 2.056, 2.052, 2.048, 2.045, 2.042
+    };
+    int df = trial->n - 1;
+    double t;
 
-    if (RemoteFD < 0)
-        error(0, "%s: failed to connect", ServerName);
-    remotefd_setup();
-    enc_init(&req);
-    enc_req(&RReq);
-    send_mesg(&req, sizeof(req), "request data");
+    if (df < 1)
+        return 0;
+    t = df <= (int)cardof(t95) ? t95[df-1] : 1.960;
+    return t * trial_stddev(trial) / sqrt(trial->n);
 }
 
 
 /*
- * Configure the remote file descriptor.
+ * Return the sample standard deviation of a set of trials.
  */
-static void
-remotefd_setup(void)
+static double
+trial_stddev(TRIAL *trial)
 {
-    int one = 1;
-
-    if (ioctl(RemoteFD, FIONBIO, &one) < 0)
-        error(SYS, "ioctl FIONBIO failed");
-    if (fcntl(RemoteFD, F_SETOWN, getpid()) < 0)
-        error(SYS, "fcntl F_SETOWN failed");
+    if (trial->n < 2)
+        return 0;
+    return sqrt(trial->m2 / (trial->n - 1));
 }
 
 
 /*
- * Close the remote file descriptor.
- * Set a file descriptor to non-blocking.
+ * Remember the options we were given so that, as a controller, we can pass
+ * them on to the hosts that run the flows.  Those that only concern the
+ * controller are kept back.
  */
 static void
-remotefd_close(void)
+ctl_arg(OPTION *option, char **args, char **next)
 {
-    close(RemoteFD);
-    RemoteFD = -1;
+    char *t = option->type;
+
+    if (streq(t, "host") || streq(t, "hosts") || streq(t, "pattern"))
+        return;
+    for (; args < next; ++args) {
+        int n = strlen(*args) + 1;
+
+        if (CtlArgsLen < 0 || CtlArgsLen + n >= CTL_ARGS) {
+            CtlArgsLen = -1;
+            return;
+        }
+        memcpy(&CtlArgs[CtlArgsLen], *args, n);
+        CtlArgsLen += n;
+    }
 }
 
 
 /*
- * Exchange results.  We sync up only to ensure that the client is out of its
- * loop so we can close our socket or whatever communication medium we are
- * using.
+ * Set the hosts that we run flows between as a controller.  They are given
+ * as a comma separated list or, if the list starts with @, in a file with
+ * any number per line.  In a file, # starts a comment.
  */
-void
-exchange_results(void)
+static void
+ctl_hosts(char *list)
 {
-    STAT stat;
+    char *p;
+    char *save;
+    char *data;
 
+    if (list[0] != '@')
+        data = qasprintf("%s", list);
+    else {
+        char line[BUFSIZE];
+        FILE *fp = fopen(&list[1], "r");
+
+        if (!fp)
+            error(SYS, "cannot open %s", &list[1]);
+        data = qasprintf("%s", "");
+        while (fgets(line, sizeof(line), fp)) {
+            char *d;
+
+            if ((p = strchr(line, '#')) != 0)
+                *p = '\0';
+            d = qasprintf("%s %s", data, line);
+            free(data);
+            data = d;
+        }
+        fclose(fp);
+    }
+
+    HostN = 0;
+    for (p = strtok_r(data, ", \t\n", &save); p;
+         p = strtok_r(0, ", \t\n", &save)) {
+        char **l = realloc(HostList, (HostN+1) * sizeof(*HostList));
+
+        if (!l)
+            error(0, "out of space");
+        if (strlen(p) >= STRSIZE)
+            error(0, "%s: host name too long", p);
+        HostList = l;
+        HostList[HostN] = qmalloc(STRSIZE);
+        memset(HostList[HostN], 0, STRSIZE);
+        strncopy(HostList[HostN], p, STRSIZE);
+        ++HostN;
+    }
+    free(data);
+    if (HostN < 2)
+        error(0, "at least two hosts must be given to --hosts");
+}
+
+
+/*
+ * Work out the flows of the pattern we were asked for.  They are kept in
+ * order of the host they run from.
+ */
+static void
+ctl_flows(void)
+{
+    int i;
+    int j;
+
+    if (Pattern == PAT_PAIRWISE && HostN % 2)
+        error(0, "pairwise pattern needs an even number of hosts: %d given",
+                                                                    HostN);
+    free(Flows);
+    Flows = qmalloc(HostN * (HostN-1) * sizeof(*Flows));
+    FlowN = 0;
+    for (i = 0; i < HostN; ++i) {
+        for (j = 0; j < HostN; ++j) {
+            if (i == j)
+                continue;
+            if (Pattern == PAT_PAIRWISE && (i % 2 || j != i+1))
+                continue;
+            if (Pattern == PAT_INCAST && j != 0)
+                continue;
+            if (Pattern == PAT_RING && j != (i+1) % HostN)
+                continue;
+            memset(&Flows[FlowN], 0, sizeof(Flows[FlowN]));
+            Flows[FlowN].src = i;
+            Flows[FlowN].dst = j;
+            ++FlowN;
+        }
+    }
+}
+
+
+/*
+ * Run one round of a test as a controller.  Each host that a flow runs from
+ * is sent the test, our options and the hosts it is to run flows to; it runs
+ * the client side of each flow, the servers at the other end being ordinary
+ * qperf servers.  Once every flow is set up and waiting in sync_test, they
+ * are all told to start.  Their results are then gathered and added up.
+ */
+static void
+ctl_round(TEST *test)
+{
+    int i;
+    int j;
+    int *fds;
+    int timeout;
+    uint32_t measure = 0;
+    static RELAY relay;
+    static RELAY_RES res;
+
+    if (Loops)
+        error(0, "--loop cannot be used with --hosts");
+    if (test->client == run_client_conf || test->client == run_client_quit)
+        error(0, "%s cannot be run with --hosts", test->name);
+    if (CtlArgsLen < 0)
+        error(0, "too many options to pass on with --hosts");
+    ctl_flows();
+
+    fds = qmalloc(HostN * sizeof(*fds));
+    for (i = 0; i < HostN; ++i) {
+        int n = 0;
+
+        fds[i] = -1;
+        for (j = 0; j < FlowN; ++j)
+            if (Flows[j].src == i)
+                ++n;
+        if (!n)
+            continue;
+        ServerName = HostList[i];
+        RemoteFD = -1;
+        RReq.req_index = RELAY_INDEX;
+        client_send_request();
+        enc_init(&relay);
+        enc_int(test - Tests, sizeof(relay.req_index));
+        enc_int(n, sizeof(relay.no_flows));
+        enc_str(HostList[i], sizeof(relay.src));
+        enc_str(CtlArgs, sizeof(relay.args));
+        send_mesg(&relay, sizeof(relay), "relay request");
+        for (j = 0; j < FlowN; ++j)
+            if (Flows[j].src == i)
+                send_mesg(HostList[Flows[j].dst], STRSIZE, "relay host");
+        fds[i] = RemoteFD;
+    }
+
+    for (i = 0; i < HostN; ++i) {
+        if (fds[i] < 0)
+            continue;
+        RemoteFD = fds[i];
+        recv_sync("flows ready");
+    }
+    for (i = 0; i < HostN; ++i) {
+        if (fds[i] < 0)
+            continue;
+        RemoteFD = fds[i];
+        send_sync("flows start");
+    }
+
+    timeout = Req.timeout;
+    Req.timeout += Req.warmup + Req.time;
+    memset(&FlowHist, 0, sizeof(FlowHist));
+    for (j = 0; j < FlowN; ++j) {
+        FLOW *flow = &Flows[j];
+
+        RemoteFD = fds[flow->src];
+        recv_mesg(&res, sizeof(res), "flow results");
+        dec_init(&res);
+        measure = dec_int(sizeof(res.measure));
+        dec_stat(&LStat);
+        dec_stat(&RStat);
+        dec_hist(&LatHist);
+        calc_results(measure);
+        flow->send_bw  = Res.send_bw;
+        flow->recv_bw  = Res.recv_bw;
+        flow->msg_rate = Res.msg_rate;
+        flow->latency  = Res.latency;
+        hist_merge(&FlowHist, &LatHist);
+    }
+    Req.timeout = timeout;
+    for (i = 0; i < HostN; ++i)
+        if (fds[i] >= 0)
+            close(fds[i]);
+    free(fds);
+    RemoteFD = -1;
+
+    memset(&Res, 0, sizeof(Res));
+    for (j = 0; j < FlowN; ++j) {
+        Res.send_bw  += Flows[j].send_bw;
+        Res.recv_bw  += Flows[j].recv_bw;
+        Res.msg_rate += Flows[j].msg_rate;
+        Res.latency  += Flows[j].latency / FlowN;
+    }
+    LatHist = FlowHist;
+    Results = 1;
+    TrialMeasure = measure;
+    ctl_show(measure);
+}
+
+
+/*
+ * Show the results of a round run as a controller.  Bandwidths and rates are
+ * the sum over the flows and the latency is their mean; the histogram is that
+ * of all the samples the flows took.  The slowest and fastest flow show how
+ * fairly the fabric shared itself out.
+ */
+static void
+ctl_show(MEASURE measure)
+{
+    int i;
+    FLOW *lo = &Flows[0];
+    FLOW *hi = &Flows[0];
+
+    for (i = 0; i < FlowN; ++i) {
+        ctl_flow_show(&Flows[i], measure);
+        if (Flows[i].recv_bw < lo->recv_bw)
+            lo = &Flows[i];
+        if (Flows[i].recv_bw > hi->recv_bw)
+            hi = &Flows[i];
+    }
+
+    view_long('a', "", "flows", FlowN);
+    if (measure == BANDWIDTH_SR) {
+        view_band('a', "", "send_bw", Res.send_bw);
+        view_band('a', "", "recv_bw", Res.recv_bw);
+    } else if (trial_bw())
+        view_band('a', "", "bw", Res.recv_bw);
+    if (trial_bw()) {
+        view_band('a', "", "flow_bw_min", lo->recv_bw);
+        view_band('a', "", "flow_bw_max", hi->recv_bw);
+    }
+    if (measure == CONN_RATE)
+        view_rate('a', "", "conn_rate", Res.msg_rate);
+    else
+        view_rate(measure == MSG_RATE ? 'a' : 's', "", "msg_rate",
+                                                    Res.msg_rate);
+    if (trial_lat()) {
+        view_time('a', "", "latency", Res.latency);
+        show_hist("latency_", &LatHist);
+    }
+}
+
+
+/*
+ * Show the results of one flow.  As text, this is a line for each flow with
+ * --verbose_stat; otherwise, it is a record of its own.
+ */
+static void
+ctl_flow_show(FLOW *flow, MEASURE measure)
+{
+    char *src = HostList[flow->src];
+    char *dst = HostList[flow->dst];
+
+    if (OutFormat) {
+        rec_str("", "test", TestName);
+        rec_str("", "flow_src", src);
+        rec_str("", "flow_dst", dst);
+        rec_val("", "send_bw",  flow->send_bw);
+        rec_val("", "recv_bw",  flow->recv_bw);
+        rec_val("", "msg_rate", flow->msg_rate);
+        rec_val("", "latency",  flow->latency);
+        rec_print();
+        return;
+    }
+    if (!VerboseStat)
+        return;
+    printf("    [%s -> %s]", src, dst);
+    if (measure == BANDWIDTH_SR)
+        interval_val("send_bw", 1, flow->send_bw);
+    if (trial_bw())
+        interval_val(measure == BANDWIDTH_SR ? "recv_bw" : "bw", 1,
+                                                        flow->recv_bw);
+    interval_val("msg_rate", 0, flow->msg_rate);
+    if (trial_lat())
+        flow_time("latency", flow->latency);
+    printf("\n");
+}
+
+
+/*
+ * Show a time in seconds on the line of a flow.
+ */
+static void
+flow_time(char *name, double value)
+{
+    int n = 0;
+    int d = Precision;
+    double v;
+    static char *units[] ={ "ns", "us", "ms", "sec" };
+
+    value *= 1E9;
+    while (value >= 1000 && n < (int)cardof(units)-1) {
+        value /= 1000;
+        ++n;
+    }
+    for (v = value; v >= 1 && d > 0; v /= 10)
+        --d;
+    printf("  %s = %.*f %s", name, d, value, units[n]);
+}
+
+
+/*
+ * Run flows to other hosts for a controller.  A child is forked for each
+ * flow which runs the client side of the test as if it had been started from
+ * the command line with the controller's options.  We stand between the
+ * controller and the children: we tell it when they are all ready, tell them
+ * when to start and pass their results back.
+ */
+static void
+relay_session(void)
+{
+    int i;
+    int n;
+    int *fds;
+    int ctlFD = RemoteFD;
+    int timeout;
+    TEST *test;
+    char (*dsts)[STRSIZE];
+    static RELAY relay;
+    static RELAY_RES res;
+
+    recv_mesg(&relay, sizeof(relay), "relay request");
+    dec_init(&relay);
+    relay.req_index = dec_int(sizeof(relay.req_index));
+    relay.no_flows  = dec_int(sizeof(relay.no_flows));
+    dec_str(relay.src,  sizeof(relay.src));
+    dec_str(relay.args, sizeof(relay.args));
+    relay.src[sizeof(relay.src)-1] = '\0';
+    relay.args[sizeof(relay.args)-1] = '\0';
+    if (relay.req_index >= cardof(Tests))
+        error(0, "bad relay request index: %d", relay.req_index);
+    n = relay.no_flows;
+    if (n < 1 || n > FD_SETSIZE/4)
+        error(0, "bad number of relay flows: %d", n);
+    dsts = qmalloc(n * sizeof(*dsts));
+    for (i = 0; i < n; ++i) {
+        recv_mesg(dsts[i], sizeof(dsts[i]), "relay host");
+        dsts[i][STRSIZE-1] = '\0';
+    }
+
+    test = &Tests[relay.req_index];
+    debug("relaying %d %s flows", n, test->name);
+    memset(&Req, 0, sizeof(Req));
+    memset(&RReq, 0, sizeof(RReq));
+    relay_args(relay.args);
+    client_init(test);
+    Interval = 0;
+
+    fds = qmalloc(n * sizeof(*fds));
+    for (i = 0; i < n; ++i) {
+        int sv[2];
+        pid_t pid;
+
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) < 0)
+            error(SYS, "socketpair failed");
+        pid = fork();
+        if (pid < 0)
+            error(SYS, "fork failed");
+        if (pid == 0) {
+            int j;
+
+            for (j = 0; j < i; ++j)
+                close(fds[j]);
+            close(sv[0]);
+            close(ctlFD);
+            close(ProcStatFD);
+            open_proc_stat();
+            relay_flow(test, dsts[i], sv[1]);
+        }
+        close(sv[1]);
+        fds[i] = sv[0];
+    }
+
+    for (i = 0; i < n; ++i) {
+        char data[sizeof("flow ready")-1];
+
+        relay_recv(fds[i], data, sizeof(data), relay.src, dsts[i]);
+    }
+    RemoteFD = ctlFD;
+    send_sync("flows ready");
+    recv_sync("flows start");
+    for (i = 0; i < n; ++i) {
+        RemoteFD = fds[i];
+        send_sync("flow start");
+    }
+    RemoteFD = ctlFD;
+
+    timeout = Req.timeout;
+    Req.timeout += Req.warmup + Req.time;
+    for (i = 0; i < n; ++i) {
+        relay_recv(fds[i], &res, sizeof(res), relay.src, dsts[i]);
+        RemoteFD = ctlFD;
+        send_mesg(&res, sizeof(res), "flow results");
+    }
+    Req.timeout = timeout;
+    for (i = 0; i < n; ++i)
+        close(fds[i]);
+    free(fds);
+    free(dsts);
+    RemoteFD = ctlFD;
+}
+
+
+/*
+ * Parse the options that a controller passed on to us.
+ */
+static void
+relay_args(char *args)
+{
+    int n = 0;
+    char *p;
+    char **argp;
+    static char *argv[CTL_ARGS/2+1];
+
+    for (p = args; *p; p += strlen(p) + 1)
+        argv[n++] = p;
+    argv[n] = 0;
+    argp = argv;
+    while (*argp) {
+        OPTION *option = find_option(*argp);
+
+        if (!option)
+            error(0, "%s: bad option from controller", *argp);
+        do_option(option, &argp);
+    }
+}
+
+
+/*
+ * Run one flow as the child of a relay.  We are a client of the server at
+ * dst; the relay is reached through fd.
+ */
+static void
+relay_flow(TEST *test, char *dst, int fd)
+{
+    static RELAY_RES res;
+
+    RelayFD = fd;
+    RemoteFD = -1;
+    ServerName = dst;
+    init_lstat();
+    Results = 0;
+    (*test->client)();
+    if (RemoteFD >= 0)
+        remotefd_close();
+    RemoteFD = RelayFD;
+    if (!Results)
+        error(0, "%s: no results", test->name);
+    enc_init(&res);
+    enc_int(TrialMeasure, sizeof(res.measure));
+    enc_stat(&LStat);
+    enc_stat(&RStat);
+    enc_hist(&LatHist);
+    send_mesg(&res, sizeof(res), "flow results");
+    exit(0);
+}
+
+
+/*
+ * Called from sync_test in the child of a relay.  Tell the relay that the
+ * flow is set up and wait for the word to start.
+ */
+static void
+relay_sync(void)
+{
+    int fd = RemoteFD;
+
+    if (RelaySynced)
+        return;
+    RelaySynced = 1;
+    RemoteFD = RelayFD;
+    send_sync("flow ready");
+    recv_sync("flow start");
+    RemoteFD = fd;
+}
+
+
+/*
+ * Receive a message from the child of a relay running a flow.  If it failed,
+ * it has already reported why to the server of the flow, so we just tell the
+ * controller which flow it was.
+ */
+static void
+relay_recv(int fd, void *ptr, int len, char *src, char *dst)
+{
+    int ctlFD = RemoteFD;
+
+    RemoteFD = fd;
+    if (recv_mesg(ptr, len, 0) != len) {
+        RemoteFD = ctlFD;
+        error(0, "flow from %s to %s failed", src, dst);
+    }
+    RemoteFD = ctlFD;
+}
+
+
+/*
+ * Send a request to the server.  The control connection is made for the first
+ * request and kept open for the rest of the tests we run.
+ */
+void
+client_send_request(void)
+{
+    REQ req;
+
+    if (RemoteFD < 0)
+        client_connect_server();
+    enc_init(&req);
+    enc_req(&RReq);
+    send_mesg(&req, sizeof(req), "request data");
+}
+
+
+/*
+ * Make the control connection to the server.
+ */
+static void
+client_connect_server(void)
+{
+    AI *a;
+    AI hints ={
+        .ai_family   = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM
+    };
+    AI *ailist = getaddrinfo_port(ServerName, ListenPort, &hints);
+
+    RemoteFD = -1;
+    if (ServerWait)
+        start_test_timer(0, ServerWait);
+    for (;;) {
+        for (a = ailist; a; a = a->ai_next) {
+            if (Finished)
+                break;
+            RemoteFD = socket(a->ai_family, a->ai_socktype, a->ai_protocol);
+            if (RemoteFD < 0)
+                continue;
+            if (connect(RemoteFD, a->ai_addr, a->ai_addrlen) != SUCCESS0) {
+                remotefd_close();
+                continue;
+            }
+            ServerAddrLen = a->ai_addrlen;
+            memcpy(&ServerAddr, a->ai_addr, ServerAddrLen);
+            break;
+        }
+        if (RemoteFD >= 0 || !ServerWait || Finished)
+            break;
+        sleep(1);
+    }
+
+    if (ServerWait)
+        stop_test_timer();
+    freeaddrinfo(ailist);
+
+    if (RemoteFD < 0)
+        error(0, "%s: failed to connect", ServerName);
+    remotefd_setup();
+}
+
+
+/*
+ * Configure the remote file descriptor.
+ */
+static void
+remotefd_setup(void)
+{
+    int one = 1;
+
+    if (ioctl(RemoteFD, FIONBIO, &one) < 0)
+        error(SYS, "ioctl FIONBIO failed");
+    if (fcntl(RemoteFD, F_SETOWN, getpid()) < 0)
+        error(SYS, "fcntl F_SETOWN failed");
+}
+
+
+/*
+ * Close the remote file descriptor.
+ * Set a file descriptor to non-blocking.
+ */
+static void
+remotefd_close(void)
+{
+    close(RemoteFD);
+    RemoteFD = -1;
+}
+
+
+/*
+ * Exchange results.  We sync up only to ensure that the client is out of its
+ * loop so we can close our socket or whatever communication medium we are
+ * using.
+ */
+void
+exchange_results(void)
+{
+    STAT stat;
+
+    warmup_apply();
     if (is_client()) {
         recv_mesg(&stat, sizeof(stat), "results");
         dec_init(&stat);
@@ -1604,6 +3091,8 @@ static void
 init_lstat(void)
 {
     memcpy(&LStat, &IStat, sizeof(LStat));
+    memset(&LatHist, 0, sizeof(LatHist));
+    NetDir[0] = '\0';
 }
 
 
@@ -1793,38 +3282,283 @@ run_server_quit(void)
 void
 sync_test(void)
 {
+    if (RelayFD >= 0)
+        relay_sync();
     synchronize("synchronization before test");
-    start_test_timer(Req.time);
+    start_test_timer(Req.warmup, Req.time);
+    if (Interval && is_client() && !OutFormat)
+        interval_start();
 }
 
 
 /*
- * Start test timer.
+ * Have the interval reporter also watch a pair of counters that a worker
+ * thread keeps to itself until the test is over.
  */
-static void
-start_test_timer(int seconds)
+void
+interval_watch(USTAT *s, USTAT *r)
 {
-    struct itimerval itimerval = {{0}};
-
-    Finished = 0;
-    get_times(LStat.time_s);
-    setitimer(ITIMER_REAL, &itimerval, 0);
-    if (!seconds)
+    if (IntervalN >= MAX_THREADS)
         return;
-
-    debug("starting timer for %d seconds", seconds);
-    itimerval.it_value.tv_sec = seconds;
-    /*
-     * SLES11 has high precision timers; too low an interval will cause timer
-     * to fire extremely rapidly after first occurrence.  We set it to 10 ms.
-     */
-    itimerval.it_interval.tv_usec = 10000;
-    setitimer(ITIMER_REAL, &itimerval, 0);
+    IntervalS[IntervalN] = s;
+    IntervalR[IntervalN] = r;
+    IntervalN++;
 }
 
 
 /*
- * Stop timing.  Note that the end time is obtained by the first call to
+ * Have the interval reporter also show the state of a TCP connection.
+ */
+void
+interval_tcp(int fd)
+{
+    if (IntervalFDN >= MAX_THREADS)
+        return;
+    IntervalFD[IntervalFDN++] = fd;
+}
+
+
+/*
+ * Start a thread that reports on progress every Interval milliseconds.  It
+ * only reads the counters so the test loop itself is not disturbed.  All
+ * signals are blocked in it so that SIGALRM still reaches the test.
+ */
+static void
+interval_start(void)
+{
+    sigset_t set;
+    sigset_t old;
+
+    IntervalState = 1;
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+    if (pthread_create(&IntervalThread, 0, interval_main, 0))
+        error(SYS, "failed to create interval thread");
+    pthread_sigmask(SIG_SETMASK, &old, 0);
+}
+
+
+/*
+ * Stop the interval reporter if it is running.
+ */
+static void
+interval_stop(void)
+{
+    if (IntervalState) {
+        pthread_mutex_lock(&IntervalLock);
+        IntervalState = 0;
+        pthread_cond_signal(&IntervalCond);
+        pthread_mutex_unlock(&IntervalLock);
+        pthread_join(IntervalThread, 0);
+    }
+    IntervalN = 0;
+    IntervalFDN = 0;
+}
+
+
+/*
+ * Main routine of the interval reporter.  When the test ends, whatever time
+ * is left over since the last report is shown as a final short interval.
+ */
+static void *
+interval_main(void *arg)
+{
+    USTAT s1, r1;
+    CLOCK c1[T_N];
+    TCPI k1 ={0};
+    struct timespec ts;
+    uint64_t base = get_nsecs();
+    double t1 = 0;
+
+    interval_sum(&s1, &r1);
+    get_times(c1);
+    if (IntervalFDN)
+        tcp_sample(IntervalFD, IntervalFDN, &k1);
+    clock_gettime(CLOCK_REALTIME, &ts);
+    pthread_mutex_lock(&IntervalLock);
+    for (;;) {
+        USTAT s2, r2, ds, dr;
+        CLOCK c2[T_N];
+        TCPI k2 ={0};
+        double t2;
+
+        ts.tv_sec  += Interval / 1000;
+        ts.tv_nsec += (Interval % 1000) * 1000000L;
+        if (ts.tv_nsec >= 1000000000) {
+            ts.tv_nsec -= 1000000000;
+            ts.tv_sec++;
+        }
+        while (IntervalState) {
+            if (pthread_cond_timedwait(&IntervalCond, &IntervalLock, &ts)
+                                                                == ETIMEDOUT)
+                break;
+        }
+
+        interval_sum(&s2, &r2);
+        get_times(c2);
+        if (IntervalFDN)
+            tcp_sample(IntervalFD, IntervalFDN, &k2);
+        t2 = (get_nsecs() - base) / 1E9;
+        ds.no_bytes = s2.no_bytes - s1.no_bytes;
+        ds.no_msgs  = s2.no_msgs  - s1.no_msgs;
+        dr.no_bytes = r2.no_bytes - r1.no_bytes;
+        dr.no_msgs  = r2.no_msgs  - r1.no_msgs;
+        interval_show(t1, t2, &ds, &dr, c1, c2, &k1, &k2);
+        if (!IntervalState)
+            break;
+        s1 = s2;
+        r1 = r2;
+        k1 = k2;
+        memcpy(c1, c2, sizeof(c1));
+        t1 = t2;
+    }
+    pthread_mutex_unlock(&IntervalLock);
+    return 0;
+}
+
+
+/*
+ * Add up the counters that the interval reporter watches.
+ */
+static void
+interval_sum(USTAT *s, USTAT *r)
+{
+    int i;
+
+    *s = LStat.s;
+    *r = LStat.r;
+    for (i = 0; i < IntervalN; ++i) {
+        s->no_bytes += IntervalS[i]->no_bytes;
+        s->no_msgs  += IntervalS[i]->no_msgs;
+        r->no_bytes += IntervalR[i]->no_bytes;
+        r->no_msgs  += IntervalR[i]->no_msgs;
+    }
+}
+
+
+/*
+ * Show what happened between times t1 and t2.  s and r are the amounts sent
+ * and received in that time, c1 and c2 the CPU times at either end and k1
+ * and k2 the state of any TCP connections being watched.
+ */
+static void
+interval_show(double t1, double t2, USTAT *s, USTAT *r, CLOCK *c1, CLOCK *c2,
+              TCPI *k1, TCPI *k2)
+{
+    int i;
+    double d = t2 - t1;
+    double real = c2[T_REAL] - c1[T_REAL];
+    CLOCK cpu = 0;
+
+    if (d <= 0)
+        return;
+    printf("    [%7.2f -%7.2f sec]", t1, t2);
+    if (s->no_bytes)
+        interval_val("send_bw", 1, s->no_bytes / d);
+    if (r->no_bytes)
+        interval_val("recv_bw", 1, r->no_bytes / d);
+    interval_val("msg_rate", 0, (s->no_msgs ? s->no_msgs : r->no_msgs) / d);
+    if (real > 0) {
+        for (i = 0; i < T_N; ++i)
+            if (i != T_REAL && i != T_IDLE)
+                cpu += c2[i] - c1[i];
+        printf("  cpus_used = %.0f %%", cpu * 100 / real);
+    }
+    if (k2->conns) {
+        printf("  rtt = %u us  cwnd = %u  retrans = %u", k2->rtt, k2->cwnd,
+                                                k2->retrans - k1->retrans);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+
+/*
+ * Show a bandwidth or messaging rate on an interval line.
+ */
+static void
+interval_val(char *name, int band, double value)
+{
+    int n = 0;
+    int d = Precision;
+    double v;
+    char **tab;
+    static char *bytes[] ={ "bytes/sec", "KB/sec", "MB/sec", "GB/sec", "TB/sec" };
+    static char *bits[]  ={ "bits/sec", "Kb/sec", "Mb/sec", "Gb/sec", "Tb/sec" };
+    static char *msgs[]  ={ "/sec", "K/sec", "M/sec", "G/sec", "T/sec" };
+
+    tab = msgs;
+    if (band) {
+        tab = bytes;
+        if (UseBitsPerSec) {
+            tab = bits;
+            value *= 8;
+        }
+    }
+    if (!UnifyUnits) {
+        while (value >= 1000 && n < (int)cardof(msgs)-1) {
+            value /= 1000;
+            ++n;
+        }
+    }
+    for (v = value; v >= 1 && d > 0; v /= 10)
+        --d;
+    printf("  %s = %.*f %s", name, d, value, tab[n]);
+}
+
+
+/*
+ * Start test timer.  With timer_poll, the test ends when a loop testing
+ * Finished sees that the deadline has passed.  The alarm is still set, a
+ * second after the deadline, so that a test blocked in a system call is not
+ * stuck forever.  If warmup is set, the test first runs for that many
+ * seconds before warmup_end starts the measurement proper.
+ */
+static void
+start_test_timer(int warmup, int seconds)
+{
+    struct itimerval itimerval = {{0}};
+
+    FinishedFlag = 0;
+    Deadline = 0;
+    Warmed = 0;
+    Warming = 0;
+    if (!seconds)
+        warmup = 0;
+    TestSecs = seconds;
+    net_start();
+    get_times(LStat.time_s);
+    cpu_accnt_start();
+    perf_start();
+    LStat.nsecs_s = get_nsecs();
+    setitimer(ITIMER_REAL, &itimerval, 0);
+    if (!seconds)
+        return;
+
+    debug("starting timer for %d seconds", seconds);
+    if (warmup) {
+        debug("warming up for %d seconds", warmup);
+        Warming = 1;
+        if (!Req.timer_poll)
+            set_alarm(1);
+    }
+    itimerval.it_value.tv_sec = warmup ? warmup : seconds;
+    if (Req.timer_poll) {
+        WarmDeadline = LStat.nsecs_s + warmup * 1000000000ULL;
+        Deadline = WarmDeadline + seconds * 1000000000ULL;
+        itimerval.it_value.tv_sec = warmup + seconds + 1;
+    }
+    /*
+     * SLES11 has high precision timers; too low an interval will cause timer
+     * to fire extremely rapidly after first occurrence.  We set it to 10 ms.
+     */
+    itimerval.it_interval.tv_usec = 10000;
+    setitimer(ITIMER_REAL, &itimerval, 0);
+}
+
+
+/*
+ * Stop timing.  Note that the end time is obtained by the first call to
  * set_finished.  In the tests, when SIGALRM goes off, it may be executing a
  * system call which gets interrupted.  If SIGALRM goes off after Finished is
  * checked but before the system call is initiated, the system call will be
@@ -1840,20 +3574,134 @@ stop_test_timer(void)
     struct itimerval itimerval = {{0}};
 
     set_finished();
+    perf_read();
+    net_read();
+    interval_stop();
     setitimer(ITIMER_REAL, &itimerval, 0);
-    Finished = 0;
+    if (Warming && !Req.timer_poll)
+        set_alarm(0);
+    FinishedFlag = 0;
+    Deadline = 0;
+    Warming = 0;
     debug("stopping timer");
 }
 
 
 /*
- * Establish the current test as finished.
+ * End the warm up period.  What the test has done so far is remembered so
+ * that warmup_apply can take it out of the results and the clocks and
+ * counters that the measurement is based on are started again.  This is
+ * called from past_deadline where several worker threads may get here at
+ * once.  Without timer_poll, sig_alrm set the deadline to bring us here and
+ * we set the timer again for the length of the test.  Warming stays set until
+ * then so that an alarm still to come does not end the test.
+ */
+static void
+warmup_end(void)
+{
+    int i;
+
+    if (!__sync_bool_compare_and_swap(&Warming, 1, 2))
+        return;
+    WarmStat = LStat;
+    WarmHist = LatHist;
+    LatHist.min = ~0ULL;
+    LatHist.max = 0;
+    WarmN = IntervalN;
+    for (i = 0; i < WarmN; ++i) {
+        WarmS[i] = *IntervalS[i];
+        WarmR[i] = *IntervalR[i];
+    }
+    net_start();
+    get_times(LStat.time_s);
+    cpu_accnt_start();
+    perf_reset();
+    LStat.nsecs_s = get_nsecs();
+    Warmed = 1;
+    if (!Req.timer_poll) {
+        struct itimerval itimerval = {{0}};
+
+        set_alarm(0);
+        itimerval.it_value.tv_sec = TestSecs;
+        itimerval.it_interval.tv_usec = 10000;
+        setitimer(ITIMER_REAL, &itimerval, 0);
+        Deadline = 0;
+    }
+    Warming = 0;
+}
+
+
+/*
+ * Take what was done during the warm up period out of the statistics.  By
+ * now, any worker counters that were watched have been folded into LStat.
+ */
+static void
+warmup_apply(void)
+{
+    int i;
+
+    if (!Warmed)
+        return;
+    Warmed = 0;
+    sub_ustat(&LStat.s, &WarmStat.s);
+    sub_ustat(&LStat.r, &WarmStat.r);
+    sub_ustat(&LStat.rem_s, &WarmStat.rem_s);
+    sub_ustat(&LStat.rem_r, &WarmStat.rem_r);
+    for (i = 0; i < MAX_THREADS; ++i) {
+        sub_ustat(&LStat.ts[i], &WarmStat.ts[i]);
+        sub_ustat(&LStat.tr[i], &WarmStat.tr[i]);
+    }
+    for (i = 0; i < WarmN; ++i) {
+        sub_ustat(&LStat.ts[i], &WarmS[i]);
+        sub_ustat(&LStat.tr[i], &WarmR[i]);
+        sub_ustat(&LStat.s, &WarmS[i]);
+        sub_ustat(&LStat.r, &WarmR[i]);
+    }
+    LStat.zc_done   -= WarmStat.zc_done;
+    LStat.zc_copied -= WarmStat.zc_copied;
+    LStat.data_errs -= WarmStat.data_errs;
+
+    LatHist.count -= WarmHist.count;
+    LatHist.sum   -= WarmHist.sum;
+    for (i = 0; i < HIST_BINS; ++i)
+        LatHist.bins[i] -= WarmHist.bins[i];
+    if (!LatHist.count)
+        memset(&LatHist, 0, sizeof(LatHist));
+}
+
+
+/*
+ * Establish the current test as finished.  With timer_poll, every worker
+ * thread may get here at about the same time.
  */
 void
 set_finished(void)
 {
-    if (Finished++ == 0)
+    if (__sync_fetch_and_add(&FinishedFlag, 1) == 0) {
+        LStat.nsecs_e = get_nsecs();
         get_times(LStat.time_e);
+        cpu_accnt_end();
+        perf_disable();
+    }
+}
+
+
+/*
+ * Called when testing Finished with a deadline set.  Return true and mark the
+ * test finished if the deadline has passed.  Ending a warm up without
+ * timer_poll clears the deadline.
+ */
+int
+past_deadline(void)
+{
+    uint64_t now = get_nsecs();
+
+    if (Warming && now >= WarmDeadline)
+        warmup_end();
+    if (!Deadline || now < Deadline)
+        return 0;
+    set_finished();
+    return 1;
 }
 
 
@@ -1863,8 +3711,15 @@ set_finished(void)
 void
 show_results(MEASURE measure)
 {
-    calc_results();
+    if (RelayFD >= 0) {
+        Results = 1;
+        TrialMeasure = measure;
+        return;
+    }
+    calc_results(measure);
     show_info(measure);
+    Results = 1;
+    TrialMeasure = measure;
 }
 
 
@@ -1872,7 +3727,7 @@ show_results(MEASURE measure)
  * Calculate results.
  */
 static void
-calc_results(void)
+calc_results(MEASURE measure)
 {
     double no_msgs;
     double locTime;
@@ -1889,7 +3744,10 @@ calc_results(void)
     calc_node(&Res.l, &LStat);
     calc_node(&Res.r, &RStat);
     no_msgs = LStat.r.no_msgs + RStat.r.no_msgs;
-    if (no_msgs)
+    if ((Req.offered_load[0] || measure == BANDWIDTH_LAT ||
+         measure == CONN_RATE) && LatHist.count)
+        Res.latency = (double)LatHist.sum / LatHist.count / 1E9;
+    else if (no_msgs)
         Res.latency = Res.l.time_real / no_msgs;
 
     locTime = Res.l.time_real;
@@ -1899,8 +3757,13 @@ calc_results(void)
     if (locTime == 0 || remTime == 0)
         return;
 
-    /* Calculate messaging rate */
-    if (!RStat.r.no_msgs)
+    /*
+     * Calculate messaging rate; under an offered load, that of round trips
+     * and when setting up connections, that of those the client made.
+     */
+    if (Req.offered_load[0] || measure == CONN_RATE)
+        Res.msg_rate = LStat.r.no_msgs / locTime;
+    else if (!RStat.r.no_msgs)
         Res.msg_rate = LStat.r.no_msgs / remTime;
     else if (!LStat.r.no_msgs)
         Res.msg_rate = RStat.r.no_msgs / locTime;
@@ -1924,14 +3787,20 @@ calc_results(void)
         Res.recv_bw = (LStat.r.no_bytes + RStat.r.no_bytes) / midTime;
 
     /* Calculate costs */
-    if (LStat.s.no_bytes && !LStat.r.no_bytes && !RStat.s.no_bytes)
-        Res.send_cost = Res.l.time_cpu*gB / LStat.s.no_bytes;
-    else if (RStat.s.no_bytes && !RStat.r.no_bytes && !LStat.s.no_bytes)
-        Res.send_cost = Res.r.time_cpu*gB / RStat.s.no_bytes;
-    if (RStat.r.no_bytes && !RStat.s.no_bytes && !LStat.r.no_bytes)
-        Res.recv_cost = Res.r.time_cpu*gB / RStat.r.no_bytes;
-    else if (LStat.r.no_bytes && !LStat.s.no_bytes && !RStat.r.no_bytes)
-        Res.recv_cost = Res.l.time_cpu*gB / LStat.r.no_bytes;
+    if (LStat.s.no_bytes && !LStat.r.no_bytes && !RStat.s.no_bytes) {
+        Res.send_cost = calc_cost(&Res.l)*gB / LStat.s.no_bytes;
+        Res.send_msg_cost = calc_cost(&Res.l) / LStat.s.no_msgs;
+    } else if (RStat.s.no_bytes && !RStat.r.no_bytes && !LStat.s.no_bytes) {
+        Res.send_cost = calc_cost(&Res.r)*gB / RStat.s.no_bytes;
+        Res.send_msg_cost = calc_cost(&Res.r) / RStat.s.no_msgs;
+    }
+    if (RStat.r.no_bytes && !RStat.s.no_bytes && !LStat.r.no_bytes) {
+        Res.recv_cost = calc_cost(&Res.r)*gB / RStat.r.no_bytes;
+        Res.recv_msg_cost = calc_cost(&Res.r) / RStat.r.no_msgs;
+    } else if (LStat.r.no_bytes && !LStat.s.no_bytes && !RStat.r.no_bytes) {
+        Res.recv_cost = calc_cost(&Res.l)*gB / LStat.r.no_bytes;
+        Res.recv_msg_cost = calc_cost(&Res.l) / LStat.r.no_msgs;
+    }
 }
 
 
@@ -1955,85 +3824,565 @@ left_to_send(long *sentp, int room)
 
 
 /*
- * Combine statistics that the remote node kept track of with those that the
- * local node kept.
+ * Start open-loop sending at the --offered_load rate.  Messages are scheduled
+ * at fixed intervals or, with --poisson, at exponentially distributed ones
+ * whether or not earlier ones have been answered.
+ */
+void
+pace_init(void)
+{
+    double rate = load_rate(Req.offered_load, Req.msg_size);
+
+    if (rate <= 0)
+        error(BUG, "bad offered load: %s", Req.offered_load);
+    PaceGap = 1E9 / rate;
+    PaceNext = 0;
+    PaceSeed[0] = getpid();
+    PaceSeed[1] = time(0);
+    PaceSeed[2] = 0x330e;
+    PaceBase = get_nsecs();
+}
+
+
+/*
+ * Return the time that the next message is scheduled to be sent or, if it is
+ * not yet due, 0.  A latency measured from the scheduled time rather than the
+ * time the message actually went out includes any time it spent waiting
+ * behind others so a slow system cannot hide it by sending less.
+ */
+uint64_t
+pace_take(void)
+{
+    uint64_t t = PaceBase + (uint64_t)PaceNext;
+
+    if (get_nsecs() < t)
+        return 0;
+    if (Req.poisson)
+        PaceNext -= PaceGap * log(1.0 - erand48(PaceSeed));
+    else
+        PaceNext += PaceGap;
+    return t;
+}
+
+
+/*
+ * Convert an offered load to messages per second.  It is either a number of
+ * messages, optionally followed by k or m for thousands or millions, or a
+ * number of bits followed by bps, kbps, mbps or gbps.  Return 0 if it is
+ * malformed.
+ */
+static double
+load_rate(char *s, long msg_size)
+{
+    char *e;
+    double v = strtod(s, &e);
+
+    if (e == s || v <= 0)
+        return 0;
+    if (*e == '\0')
+        return v;
+    if (strcasecmp(e, "k") == 0)
+        return v * 1E3;
+    if (strcasecmp(e, "m") == 0)
+        return v * 1E6;
+    if (msg_size <= 0)
+        return 0;
+    if (strcasecmp(e, "bps") == 0)
+        return v / (8 * msg_size);
+    if (strcasecmp(e, "kbps") == 0)
+        return v * 1E3 / (8 * msg_size);
+    if (strcasecmp(e, "mbps") == 0)
+        return v * 1E6 / (8 * msg_size);
+    if (strcasecmp(e, "gbps") == 0)
+        return v * 1E9 / (8 * msg_size);
+    return 0;
+}
+
+
+/*
+ * Combine statistics that the remote node kept track of with those that the
+ * local node kept.
+ */
+static void
+add_ustat(USTAT *l, USTAT *r)
+{
+    l->no_bytes += r->no_bytes;
+    l->no_msgs  += r->no_msgs;
+    l->no_errs  += r->no_errs;
+}
+
+
+/*
+ * Subtract one set of statistics from another.
+ */
+static void
+sub_ustat(USTAT *l, USTAT *r)
+{
+    l->no_bytes -= r->no_bytes;
+    l->no_msgs  -= r->no_msgs;
+    l->no_errs  -= r->no_errs;
+}
+
+
+/*
+ * Calculate time values for a node.  The processor times are only kept in
+ * ticks but the real time they are divided by is measured in nanoseconds.
+ */
+static void
+calc_node(RESN *resn, STAT *stat)
+{
+    int i;
+    CLOCK cpu;
+    double s = stat->time_e[T_REAL] - stat->time_s[T_REAL];
+
+    memset(resn, 0, sizeof(*resn));
+    if (stat->no_ticks == 0)
+        return;
+
+    /* Real time comes from the nanosecond clock; s is then in ticks */
+    if (stat->nsecs_e > stat->nsecs_s) {
+        resn->time_real = (stat->nsecs_e - stat->nsecs_s) / 1E9;
+        s = resn->time_real * stat->no_ticks;
+    } else
+        resn->time_real = s / stat->no_ticks;
+    if (s == 0)
+        return;
+
+    cpu = 0;
+    for (i = 0; i < T_N; ++i)
+        if (i != T_REAL && i != T_IDLE)
+            cpu += stat->time_e[i] - stat->time_s[i];
+    resn->time_cpu = (float) cpu / stat->no_ticks;
+
+    resn->cpu_user = (stat->time_e[T_USER] - stat->time_s[T_USER]
+                   + stat->time_e[T_NICE] - stat->time_s[T_NICE]) / s;
+
+    resn->cpu_intr = (stat->time_e[T_IRQ] - stat->time_s[T_IRQ]
+                   +  stat->time_e[T_SOFTIRQ] - stat->time_s[T_SOFTIRQ]) / s;
+
+    resn->cpu_idle = (stat->time_e[T_IDLE] - stat->time_s[T_IDLE]) / s;
+
+    resn->cpu_kernel = (stat->time_e[T_KERNEL] - stat->time_s[T_KERNEL]
+                     +  stat->time_e[T_STEAL] - stat->time_s[T_STEAL]) / s;
+
+    resn->cpu_io_wait = (stat->time_e[T_IOWAIT] - stat->time_s[T_IOWAIT]) / s;
+
+    resn->cpu_total = resn->cpu_user + resn->cpu_intr
+                    + resn->cpu_kernel + resn->cpu_io_wait;
+
+    resn->time_self = (stat->self_user + stat->self_kernel) / 1E6;
+    resn->cpu_self = resn->time_self / resn->time_real;
+    if (stat->no_pin_cpus) {
+        cpu = 0;
+        for (i = 0; i < T_N; ++i)
+            if (i != T_REAL && i != T_IDLE)
+                cpu += stat->pin_times[i];
+        resn->cpu_pinned = cpu / s;
+    }
+    if (stat->no_irq_cpus) {
+        cpu = stat->irq_times[T_IRQ] + stat->irq_times[T_SOFTIRQ];
+        resn->time_irq = (double) cpu / stat->no_ticks;
+        resn->cpu_irq = cpu / s;
+    }
+}
+
+
+/*
+ * Return the cpu time to charge a node with when computing costs: that used
+ * by qperf itself and the interrupt time on the NIC processors.
+ */
+static double
+calc_cost(RESN *resn)
+{
+    return resn->time_self + resn->time_irq;
+}
+
+
+/*
+ * Show relevant values.
+ */
+static void
+show_info(MEASURE measure)
+{
+    if (measure == LATENCY) {
+        view_time('a', "", "latency", Res.latency);
+        show_hist("latency_", &LatHist);
+        view_rate(Req.offered_load[0] ? 'a' : 's', "", "msg_rate",
+                                                            Res.msg_rate);
+    } else if (measure == MSG_RATE) {
+        view_rate('a', "", "msg_rate", Res.msg_rate);
+        show_hist("latency_", &LatHist);
+    } else if (measure == BANDWIDTH) {
+        view_band('a', "", "bw", Res.recv_bw);
+        view_rate('s', "", "msg_rate", Res.msg_rate);
+    } else if (measure == BANDWIDTH_SR) {
+        view_band('a', "", "send_bw", Res.send_bw);
+        view_band('a', "", "recv_bw", Res.recv_bw);
+        view_rate('s', "", "msg_rate", Res.msg_rate);
+    } else if (measure == BANDWIDTH_LAT) {
+        view_band('a', "", "bw", Res.recv_bw);
+        view_rate('s', "", "msg_rate", Res.msg_rate);
+        view_time('a', "", "latency", Res.latency);
+        show_hist("latency_", &LatHist);
+    } else if (measure == CONN_RATE) {
+        view_rate('a', "", "conn_rate", Res.msg_rate);
+        view_time('a', "", "latency", Res.latency);
+        show_hist("latency_", &LatHist);
+        show_conn("loc_", &LStat);
+        show_conn("rem_", &RStat);
+    } else if (measure == MULTICAST) {
+        view_band('a', "", "bw", Res.recv_bw);
+        view_rate('a', "", "send_msg_rate",
+                  Res.l.time_real ? LStat.s.no_msgs / Res.l.time_real : 0);
+        view_rate('a', "", "recv_msg_rate", Res.msg_rate);
+        show_mcast();
+    }
+    show_threads(measure);
+    show_zcopy();
+    show_verify();
+    show_tcp("loc_", &LStat);
+    show_tcp("rem_", &RStat);
+    show_mem("loc_", &LStat);
+    show_mem("rem_", &RStat);
+    show_gpu("loc_", &LStat);
+    show_gpu("rem_", &RStat);
+    show_xdp("loc_", &LStat);
+    show_xdp("rem_", &RStat);
+    show_perf("loc_", &LStat);
+    show_perf("rem_", &RStat);
+    show_net("loc_", &LStat);
+    show_net("rem_", &RStat);
+    show_reg_mr();
+    show_used();
+    view_cost('t', "", "send_cost", Res.send_cost);
+    view_cost('t', "", "recv_cost", Res.recv_cost);
+    view_time('T', "", "send_msg_cost", Res.send_msg_cost);
+    view_time('T', "", "recv_msg_cost", Res.recv_msg_cost);
+    show_rest();
+    if (Debug)
+        show_debug();
+}
+
+
+/*
+ * Summarize the trials of a test run with --repeat.  Only the results that
+ * the test reports are summarized.
+ */
+static void
+show_trials(void)
+{
+    view_long('a', "", "trials", TrialBW.n);
+    if (trial_bw())
+        show_trial("trial_bw_", &TrialBW, view_band);
+    show_trial("trial_msg_rate_", &TrialRate, view_rate);
+    if (trial_lat())
+        show_trial("trial_latency_", &TrialLat, view_time);
+}
+
+
+/*
+ * Return true if the test last run reports a bandwidth.
+ */
+static int
+trial_bw(void)
+{
+    return TrialMeasure != LATENCY && TrialMeasure != MSG_RATE &&
+           TrialMeasure != CONN_RATE;
+}
+
+
+/*
+ * Return true if the test last run reports a latency.
+ */
+static int
+trial_lat(void)
+{
+    return TrialMeasure == LATENCY || TrialMeasure == BANDWIDTH_LAT ||
+           TrialMeasure == CONN_RATE;
+}
+
+
+/*
+ * Show the mean, standard deviation, extremes and 95% confidence interval of
+ * one result over a set of trials.  The confidence interval is shown as the
+ * distance either side of the mean.
+ */
+static void
+show_trial(char *pref, TRIAL *trial,
+           void (*view)(int, char *, char *, double))
+{
+    (*view)('a', pref, "mean",   trial->mean);
+    (*view)('a', pref, "stddev", trial_stddev(trial));
+    (*view)('a', pref, "min",    trial->min);
+    (*view)('a', pref, "max",    trial->max);
+    (*view)('a', pref, "ci95",   trial_ci95(trial));
+}
+
+
+/*
+ * Show the distribution of latencies that were sampled.  The samples are in
+ * nanoseconds.
+ */
+static void
+show_hist(char *pref, HIST *hist)
+{
+    if (!hist->count)
+        return;
+    view_time('s', pref, "min",   hist->min / 1E9);
+    view_time('s', pref, "p50",   hist_pct(hist, 50.0) / 1E9);
+    view_time('s', pref, "p90",   hist_pct(hist, 90.0) / 1E9);
+    view_time('s', pref, "p99",   hist_pct(hist, 99.0) / 1E9);
+    view_time('s', pref, "p99.9", hist_pct(hist, 99.9) / 1E9);
+    view_time('s', pref, "max",   hist->max / 1E9);
+}
+
+
+/*
+ * If worker threads were used, show how the traffic was split between them.
+ * The bandwidth of each thread is computed from whichever node sent or
+ * received its data.
+ */
+static void
+show_threads(MEASURE measure)
+{
+    int i;
+    int n = LStat.no_threads;
+    static char pref[MAX_THREADS][STRSIZE];
+
+    if (RStat.no_threads > n)
+        n = RStat.no_threads;
+    if (n < 2 || measure == MULTICAST)
+        return;
+    for (i = 0; i < n; ++i) {
+        snprintf(pref[i], sizeof(pref[i]), "thread%d_", i);
+        if (measure == BANDWIDTH_SR) {
+            view_band('s', pref[i], "send_bw",
+                      thread_bw(&LStat.ts[i], &RStat.ts[i]));
+            view_band('s', pref[i], "recv_bw",
+                      thread_bw(&LStat.tr[i], &RStat.tr[i]));
+        } else
+            view_band('s', pref[i], "bw",
+                      thread_bw(&LStat.tr[i], &RStat.tr[i]));
+    }
+}
+
+
+/*
+ * Calculate the bandwidth of a thread given the local and remote statistics.
+ */
+static double
+thread_bw(USTAT *l, USTAT *r)
+{
+    double bw = 0;
+
+    if (l->no_bytes && Res.l.time_real)
+        bw += l->no_bytes / Res.l.time_real;
+    if (r->no_bytes && Res.r.time_real)
+        bw += r->no_bytes / Res.r.time_real;
+    return bw;
+}
+
+
+/*
+ * Show the message rate each multicast receiver got and how many of the
+ * messages that were sent it lost.
+ */
+static void
+show_mcast(void)
+{
+    int i;
+    uint64_t sent = LStat.s.no_msgs;
+    static char pref[MAX_THREADS][STRSIZE];
+
+    for (i = 0; i < (int)RStat.no_threads && i < MAX_THREADS; ++i) {
+        USTAT *r = &RStat.tr[i];
+        double rate = Res.r.time_real ? r->no_msgs / Res.r.time_real : 0;
+
+        snprintf(pref[i], sizeof(pref[i]), "recv%d_", i);
+        view_rate('a', pref[i], "msg_rate", rate);
+        view_long('a', pref[i], "lost",
+                  sent > r->no_msgs ? sent - r->no_msgs : 0);
+    }
+}
+
+
+/*
+ * If MSG_ZEROCOPY was used, show how many of the sends completed without
+ * copying and how many the kernel fell back to copying.
+ */
+static void
+show_zcopy(void)
+{
+    uint64_t done = LStat.zc_done + RStat.zc_done;
+    uint64_t copied = LStat.zc_copied + RStat.zc_copied;
+
+    view_long('s', "", "zc_zerocopy", done - copied);
+    view_long('s', "", "zc_copied", copied);
+}
+
+
+/*
+ * If received data was verified, show how many messages did not match what
+ * was sent.
+ */
+static void
+show_verify(void)
+{
+    if (Req.access_recv != ACCESS_VERIFY || !par_info(L_ACCESS_RECV)->inuse)
+        return;
+    view_long('a', "", "data_errs", LStat.data_errs + RStat.data_errs);
+}
+
+
+/*
+ * Show the state of the TCP connections at the end of the test.  The times
+ * spent limited by the receive window and by the send buffer are shown
+ * along with the time spent sending so that they can be compared.
+ */
+static void
+show_tcp(char *pref, STAT *stat)
+{
+    TCPI *t = &stat->tcp;
+
+    if (!t->conns)
+        return;
+    view_strn('s', pref, "tcp_cc", t->cc);
+    view_time('s', pref, "tcp_rtt", t->rtt / 1E6);
+    view_time('s', pref, "tcp_rttvar", t->rttvar / 1E6);
+    view_long('s', pref, "tcp_cwnd", t->cwnd);
+    view_long('s', pref, "tcp_retrans", t->retrans);
+    view_band('s', pref, "tcp_delivery_rate", t->delivery_rate);
+    view_time('s', pref, "tcp_busy", t->busy / 1E6);
+    view_time('s', pref, "tcp_rwnd_limited", t->rwnd_limited / 1E6);
+    view_time('s', pref, "tcp_sndbuf_limited", t->sndbuf_limited / 1E6);
+}
+
+
+/*
+ * If a buffer placement was requested, show the NUMA node and page size the
+ * test buffers actually ended up with.
+ */
+static void
+show_mem(char *pref, STAT *stat)
+{
+    if (!stat->mem_page)
+        return;
+    if (stat->mem_node < 0)
+        view_strn('a', pref, "mem_node", "unknown");
+    else
+        view_long('a', pref, "mem_node", stat->mem_node);
+    view_size('a', pref, "mem_page", stat->mem_page);
+}
+
+
+/*
+ * If the buffers were in GPU memory, show which GPU and how far it is from
+ * the NIC over PCIe.
+ */
+static void
+show_gpu(char *pref, STAT *stat)
+{
+    static char *kinds[] ={ "", "cuda", "rocm" };
+    static char *topos[] ={ "unknown", "PIX", "PXB", "PHB", "NODE", "SYS" };
+    static char gpu[2][STRSIZE];
+    char *p = gpu[pref[0] == 'r'];
+
+    if (!stat->gpu_kind || stat->gpu_kind >= cardof(kinds))
+        return;
+    snprintf(p, STRSIZE, "%s:%d", kinds[stat->gpu_kind], stat->gpu_index);
+    view_strn('a', pref, "mem_gpu", p);
+    view_strn('a', pref, "gpu_nic_path",
+              stat->gpu_topo < cardof(topos) ? topos[stat->gpu_topo] : "?");
+}
+
+
+/*
+ * If AF_XDP was used, show whether its buffers were shared with the NIC or
+ * copied.
+ */
+static void
+show_xdp(char *pref, STAT *stat)
+{
+    if (!stat->xdp_zcopy)
+        return;
+    view_strn('a', pref, "xdp_mode", stat->xdp_zcopy > 1 ? "zerocopy" : "copy");
+}
+
+
+/*
+ * If connections were set up as part of the test, show the average time each
+ * one spent in the phases that the node timed.
+ */
+static void
+show_conn(char *pref, STAT *stat)
+{
+    uint64_t n = stat->r.no_msgs;
+
+    if (!n)
+        return;
+    if (stat->addr_nsecs)
+        view_time('a', pref, "addr_resolve_lat", stat->addr_nsecs / 1E9 / n);
+    if (stat->route_nsecs)
+        view_time('a', pref, "route_resolve_lat", stat->route_nsecs / 1E9 / n);
+    if (stat->create_nsecs)
+        view_time('a', pref, "create_lat", stat->create_nsecs / 1E9 / n);
+    if (stat->connect_nsecs)
+        view_time('a', pref, "connect_lat", stat->connect_nsecs / 1E9 / n);
+}
+
+
+/*
+ * If memory regions were registered as part of the test, show the average time
+ * taken to register and to deregister one.
  */
 static void
-add_ustat(USTAT *l, USTAT *r)
+show_reg_mr(void)
 {
-    l->no_bytes += r->no_bytes;
-    l->no_msgs  += r->no_msgs;
-    l->no_errs  += r->no_errs;
+    uint64_t n = LStat.r.no_msgs;
+
+    if (!n || !LStat.reg_mr_nsecs)
+        return;
+    view_time('a', "", "reg_mr_lat",   LStat.reg_mr_nsecs / 1E9 / n);
+    view_time('a', "", "dereg_mr_lat", LStat.dereg_mr_nsecs / 1E9 / n);
 }
 
 
 /*
- * Calculate time values for a node.
+ * If performance counters were requested, show what each of them counted per
+ * message and per kilobyte that the node sent and received.
  */
 static void
-calc_node(RESN *resn, STAT *stat)
+show_perf(char *pref, STAT *stat)
 {
     int i;
-    CLOCK cpu;
-    double s = stat->time_e[T_REAL] - stat->time_s[T_REAL];
-
-    memset(resn, 0, sizeof(*resn));
-    if (s == 0)
-        return;
-    if (stat->no_ticks == 0)
-        return;
-
-    resn->time_real = s / stat->no_ticks;
-
-    cpu = 0;
-    for (i = 0; i < T_N; ++i)
-        if (i != T_REAL && i != T_IDLE)
-            cpu += stat->time_e[i] - stat->time_s[i];
-    resn->time_cpu = (float) cpu / stat->no_ticks;
-
-    resn->cpu_user = (stat->time_e[T_USER] - stat->time_s[T_USER]
-                   + stat->time_e[T_NICE] - stat->time_s[T_NICE]) / s;
-
-    resn->cpu_intr = (stat->time_e[T_IRQ] - stat->time_s[T_IRQ]
-                   +  stat->time_e[T_SOFTIRQ] - stat->time_s[T_SOFTIRQ]) / s;
-
-    resn->cpu_idle = (stat->time_e[T_IDLE] - stat->time_s[T_IDLE]) / s;
+    uint64_t msgs = stat->s.no_msgs + stat->r.no_msgs;
+    uint64_t bytes = stat->s.no_bytes + stat->r.no_bytes;
 
-    resn->cpu_kernel = (stat->time_e[T_KERNEL] - stat->time_s[T_KERNEL]
-                     +  stat->time_e[T_STEAL] - stat->time_s[T_STEAL]) / s;
-
-    resn->cpu_io_wait = (stat->time_e[T_IOWAIT] - stat->time_s[T_IOWAIT]) / s;
-
-    resn->cpu_total = resn->cpu_user + resn->cpu_intr
-                    + resn->cpu_kernel + resn->cpu_io_wait;
+    for (i = 0; i < PC_N; ++i) {
+        if (!(stat->perf_valid & (1 << i)))
+            continue;
+        if (msgs)
+            view_count('a', pref, PerfEvents[i].per_msg,
+                       (double)stat->perf[i] / msgs);
+        if (bytes)
+            view_count('a', pref, PerfEvents[i].per_kb,
+                       stat->perf[i] * 1000.0 / bytes);
+    }
 }
 
 
 /*
- * Show relevant values.
+ * If network counters were requested, show those that changed during the
+ * test.
  */
 static void
-show_info(MEASURE measure)
+show_net(char *pref, STAT *stat)
 {
-    if (measure == LATENCY) {
-        view_time('a', "", "latency", Res.latency);
-        view_rate('s', "", "msg_rate", Res.msg_rate);
-    } else if (measure == MSG_RATE) {
-        view_rate('a', "", "msg_rate", Res.msg_rate);
-    } else if (measure == BANDWIDTH) {
-        view_band('a', "", "bw", Res.recv_bw);
-        view_rate('s', "", "msg_rate", Res.msg_rate);
-    } else if (measure == BANDWIDTH_SR) {
-        view_band('a', "", "send_bw", Res.send_bw);
-        view_band('a', "", "recv_bw", Res.recv_bw);
-        view_rate('s', "", "msg_rate", Res.msg_rate);
-    }
-    show_used();
-    view_cost('t', "", "send_cost", Res.send_cost);
-    view_cost('t', "", "recv_cost", Res.recv_cost);
-    show_rest();
-    if (Debug)
-        show_debug();
+    int i;
+
+    for (i = 0; i < NC_N; ++i)
+        if ((stat->net_valid & (1 << i)) && stat->net[i])
+            view_long('a', pref, NetCounters[i].name, stat->net[i]);
 }
 
 
@@ -2134,6 +4483,9 @@ show_rest(void)
         view_cpus('T', "", "send_cpus_intr",   resnS->cpu_intr);
         view_cpus('T', "", "send_cpus_kernel", resnS->cpu_kernel);
         view_cpus('T', "", "send_cpus_iowait", resnS->cpu_io_wait);
+        view_cpus('T', "", "send_cpus_self",   resnS->cpu_self);
+        view_cpus('T', "", "send_cpus_pinned", resnS->cpu_pinned);
+        view_cpus('T', "", "send_cpus_nic_irq", resnS->cpu_irq);
         view_time('T', "", "send_real_time",   resnS->time_real);
         view_time('T', "", "send_cpu_time",    resnS->time_cpu);
         view_long('S', "", "send_errors",      statS->s.no_errs);
@@ -2146,6 +4498,9 @@ show_rest(void)
         view_cpus('T', "", "recv_cpus_intr",   resnR->cpu_intr);
         view_cpus('T', "", "recv_cpus_kernel", resnR->cpu_kernel);
         view_cpus('T', "", "recv_cpus_iowait", resnR->cpu_io_wait);
+        view_cpus('T', "", "recv_cpus_self",   resnR->cpu_self);
+        view_cpus('T', "", "recv_cpus_pinned", resnR->cpu_pinned);
+        view_cpus('T', "", "recv_cpus_nic_irq", resnR->cpu_irq);
         view_time('T', "", "recv_real_time",   resnR->time_real);
         view_time('T', "", "recv_cpu_time",    resnR->time_cpu);
         view_long('S', "", "recv_errors",      statR->r.no_errs);
@@ -2158,6 +4513,9 @@ show_rest(void)
         view_cpus('T', "", "loc_cpus_intr",    Res.l.cpu_intr);
         view_cpus('T', "", "loc_cpus_kernel",  Res.l.cpu_kernel);
         view_cpus('T', "", "loc_cpus_iowait",  Res.l.cpu_io_wait);
+        view_cpus('T', "", "loc_cpus_self",    Res.l.cpu_self);
+        view_cpus('T', "", "loc_cpus_pinned",  Res.l.cpu_pinned);
+        view_cpus('T', "", "loc_cpus_nic_irq", Res.l.cpu_irq);
         view_time('T', "", "loc_real_time",    Res.l.time_real);
         view_time('T', "", "loc_cpu_time",     Res.l.time_cpu);
         view_long('S', "", "loc_send_errors",  LStat.s.no_errs);
@@ -2173,6 +4531,9 @@ show_rest(void)
         view_cpus('T', "", "rem_cpus_intr",    Res.r.cpu_intr);
         view_cpus('T', "", "rem_cpus_kernel",  Res.r.cpu_kernel);
         view_cpus('T', "", "rem_cpus_iowait",  Res.r.cpu_io_wait);
+        view_cpus('T', "", "rem_cpus_self",    Res.r.cpu_self);
+        view_cpus('T', "", "rem_cpus_pinned",  Res.r.cpu_pinned);
+        view_cpus('T', "", "rem_cpus_nic_irq", Res.r.cpu_irq);
         view_time('T', "", "rem_real_time",    Res.r.time_real);
         view_time('T', "", "rem_cpu_time",     Res.r.time_cpu);
         view_long('S', "", "rem_send_errors",  RStat.s.no_errs);
@@ -2201,7 +4562,7 @@ show_debug(void)
         double t = LStat.no_ticks;
         CLOCK *s = LStat.time_s;
         CLOCK *e = LStat.time_e;
-        double real    = (e[T_REAL]    - s[T_REAL])    / t;
+        double real    = (LStat.nsecs_e - LStat.nsecs_s) / 1E9;
         double user    = (e[T_USER]    - s[T_USER])    / t;
         double nice    = (e[T_NICE]    - s[T_NICE])    / t;
         double system  = (e[T_KERNEL]  - s[T_KERNEL])  / t;
@@ -2248,7 +4609,7 @@ show_debug(void)
         CLOCK *s = RStat.time_s;
         CLOCK *e = RStat.time_e;
 
-        double real    = (e[T_REAL]    - s[T_REAL])    / t;
+        double real    = (RStat.nsecs_e - RStat.nsecs_s) / 1E9;
         double user    = (e[T_USER]    - s[T_USER])    / t;
         double nice    = (e[T_NICE]    - s[T_NICE])    / t;
         double system  = (e[T_KERNEL]  - s[T_KERNEL])  / t;
@@ -2343,6 +4704,27 @@ view_rate(int type, char *pref, char *name, double value)
 }
 
 
+/*
+ * Show a count that need not be a whole number.
+ */
+static void
+view_count(int type, char *pref, char *name, double value)
+{
+    int n = 0;
+    char *tab[] ={ "", "thousand", "million", "billion", "trillion" };
+
+    if (!verbose(type, value))
+        return;
+    if (!UnifyUnits && value >= 1000*1000) {
+        while (value >= 1000 && n < (int)cardof(tab)-1) {
+            value /= 1000;
+            ++n;
+        }
+    }
+    place_val(pref, name, tab[n], value);
+}
+
+
 /*
  * Show a number.
  */
@@ -2557,56 +4939,425 @@ place_any(char *pref, char *name, char *unit, char *data, char *altn)
 
 
 /*
- * Show all saved values.
+ * Discard all saved values.
+ */
+static void
+place_clear(void)
+{
+    int i;
+
+    for (i = 0; i < ShowIndex; ++i) {
+        free(ShowTable[i].data);
+        free(ShowTable[i].altn);
+    }
+    ShowIndex = 0;
+}
+
+
+/*
+ * Show all saved values.
+ */
+static void
+place_show(void)
+{
+    int i;
+    int nameLen = 0;
+    int dataLen = 0;
+    int unitLen = 0;
+
+    /* First compute formating sizes */
+    for (i = 0; i < ShowIndex; ++i) {
+        int n;
+        SHOW *show = &ShowTable[i];
+        n = (show->pref ? strlen(show->pref) : 0) + strlen(show->name);
+        if (n > nameLen)
+            nameLen = n;
+        n = strlen(show->data);
+        if (show->unit) {
+            if (n > dataLen)
+                dataLen = n;
+            n = strlen(show->unit);
+            if (n > unitLen)
+                unitLen = n;
+        }
+    }
+
+    /* Then display results */
+    for (i = 0; i < ShowIndex; ++i) {
+        int n = 0;
+        SHOW *show = &ShowTable[i];
+
+        printf("    ");
+        if (show->pref) {
+            n = strlen(show->pref);
+            printf("%s", show->pref);
+        }
+        printf("%-*s", nameLen-n, show->name);
+        if (show->unit) {
+            printf("  =  %*s", dataLen, show->data);
+            printf(" %s", show->unit);
+        } else
+            printf("  =  %s", show->data);
+        if (show->altn)
+            printf(" (%s)", show->altn);
+        printf("\n");
+        free(show->data);
+        free(show->altn);
+    }
+    ShowIndex = 0;
+}
+
+
+/*
+ * Show the results of a test as a single machine readable record rather than
+ * as text.  Values are unscaled: times are in seconds, bandwidths in bytes
+ * per second, rates in messages per second and CPU usage is a fraction of a
+ * processor.  Loop variables and all parameters in use are included so that
+ * each record stands on its own.  Tests that do not measure anything, such
+ * as conf, have what they would have shown recorded instead.
+ */
+static void
+rec_show(void)
+{
+    int i;
+    LOOP *loop;
+    PAR_NAME *p;
+
+    rec_str("", "test", TestName);
+    for (loop = Loops; loop; loop = loop->next)
+        rec_num("loop_", rec_name(loop->option), loop->cur);
+
+    for (p = ParName; p < endof(ParName); ++p) {
+        PAR_INFO *l = par_info(p->loc_i);
+        PAR_INFO *r = par_info(p->rem_i);
+
+        if (!l->inuse && !r->inuse)
+            continue;
+        if (l->type == 'p') {
+            rec_str("loc_", p->name, l->ptr);
+            rec_str("rem_", p->name, r->ptr);
+        } else {
+            rec_num("loc_", p->name, *(uint32_t *)l->ptr);
+            rec_num("rem_", p->name, *(uint32_t *)r->ptr);
+        }
+    }
+
+    if (Results) {
+        rec_val("", "send_bw",   Res.send_bw);
+        rec_val("", "recv_bw",   Res.recv_bw);
+        rec_val("", "msg_rate",  Res.msg_rate);
+        rec_val("", "send_cost", Res.send_cost);
+        rec_val("", "recv_cost", Res.recv_cost);
+        rec_val("", "send_msg_cost", Res.send_msg_cost);
+        rec_val("", "recv_msg_cost", Res.recv_msg_cost);
+        rec_val("", "latency",   Res.latency);
+        if (LatHist.count) {
+            rec_num("", "latency_samples", LatHist.count);
+            rec_val("", "latency_min",   LatHist.min / 1E9);
+            rec_val("", "latency_p50",   hist_pct(&LatHist, 50.0) / 1E9);
+            rec_val("", "latency_p90",   hist_pct(&LatHist, 90.0) / 1E9);
+            rec_val("", "latency_p99",   hist_pct(&LatHist, 99.0) / 1E9);
+            rec_val("", "latency_p99.9", hist_pct(&LatHist, 99.9) / 1E9);
+            rec_val("", "latency_max",   LatHist.max / 1E9);
+        }
+        if (Repeat > 1) {
+            rec_num("", "trials", TrialBW.n);
+            if (trial_bw())
+                rec_trial("trial_bw_", &TrialBW);
+            rec_trial("trial_msg_rate_", &TrialRate);
+            if (trial_lat())
+                rec_trial("trial_latency_", &TrialLat);
+        }
+        if (HostN)
+            rec_num("", "flows", FlowN);
+        else {
+            rec_resn("loc_", &Res.l);
+            rec_resn("rem_", &Res.r);
+            rec_stat("loc_", &LStat);
+            rec_stat("rem_", &RStat);
+        }
+    } else {
+        for (i = 0; i < ShowIndex; ++i) {
+            SHOW *show = &ShowTable[i];
+            rec_str(show->pref, show->name, show->data);
+        }
+    }
+
+    place_clear();
+    rec_print();
+}
+
+
+/*
+ * Print the current record and start a new one.
+ */
+static void
+rec_print(void)
+{
+    int i;
+    char *header;
+
+    if (OutFormat == OUT_JSON) {
+        printf("{");
+        for (i = 0; i < RecIndex; ++i) {
+            FIELD *f = &RecTable[i];
+            printf("%s\"%s\":", i ? "," : "", f->name);
+            if (f->str) {
+                char *s;
+
+                printf("\"");
+                for (s = f->data; *s; ++s) {
+                    if (*s == '"' || *s == '\\')
+                        printf("\\%c", *s);
+                    else if ((unsigned char)*s < ' ')
+                        printf("\\u%04x", *s);
+                    else
+                        putchar(*s);
+                }
+                printf("\"");
+            } else
+                printf("%s", f->data);
+        }
+        printf("}\n");
+    } else {
+        header = qasprintf("%s", "");
+        for (i = 0; i < RecIndex; ++i) {
+            char *h = qasprintf("%s%s%s", header, i ? "," : "",
+                                                        RecTable[i].name);
+            free(header);
+            header = h;
+        }
+        if (!RecHeader || !streq(header, RecHeader)) {
+            printf("%s\n", header);
+            free(RecHeader);
+            RecHeader = header;
+        } else
+            free(header);
+        for (i = 0; i < RecIndex; ++i) {
+            FIELD *f = &RecTable[i];
+
+            if (i)
+                putchar(',');
+            if (f->str && strpbrk(f->data, ",\"\n")) {
+                char *s;
+
+                putchar('"');
+                for (s = f->data; *s; ++s) {
+                    if (*s == '"')
+                        putchar('"');
+                    putchar(*s);
+                }
+                putchar('"');
+            } else
+                printf("%s", f->data);
+        }
+        printf("\n");
+    }
+    fflush(stdout);
+
+    for (i = 0; i < RecIndex; ++i) {
+        free(RecTable[i].name);
+        free(RecTable[i].data);
+    }
+    RecIndex = 0;
+}
+
+
+/*
+ * Return the name to record a loop variable under.  We use the name of the
+ * parameter it sets where there is one.
+ */
+static char *
+rec_name(OPTION *option)
+{
+    PAR_NAME *p;
+    char *name = option->name;
+    static char buf[STRSIZE];
+
+    for (p = ParName; p < endof(ParName); ++p) {
+        if (option->arg1 == p->rem_i) {
+            snprintf(buf, sizeof(buf), "rem_%s", p->name);
+            return buf;
+        }
+        if (option->arg1 != p->loc_i)
+            continue;
+        if (option->arg2 == p->rem_i)
+            return p->name;
+        snprintf(buf, sizeof(buf), "loc_%s", p->name);
+        return buf;
+    }
+    while (*name == '-')
+        ++name;
+    return name;
+}
+
+
+/*
+ * Record the statistics a node kept.
+ */
+static void
+rec_stat(char *pref, STAT *stat)
+{
+    int i;
+
+    rec_num(pref, "no_cpus",    stat->no_cpus);
+    rec_num(pref, "no_ticks",   stat->no_ticks);
+    rec_num(pref, "max_cqes",   stat->max_cqes);
+    rec_num(pref, "no_threads", stat->no_threads);
+    rec_num(pref, "zc_done",    stat->zc_done);
+    rec_num(pref, "zc_copied",  stat->zc_copied);
+    rec_num(pref, "data_errs",  stat->data_errs);
+    if (stat->tcp.conns) {
+        TCPI *t = &stat->tcp;
+
+        rec_str(pref, "tcp_cc", t->cc);
+        rec_val(pref, "tcp_rtt", t->rtt / 1E6);
+        rec_val(pref, "tcp_rttvar", t->rttvar / 1E6);
+        rec_num(pref, "tcp_cwnd", t->cwnd);
+        rec_num(pref, "tcp_retrans", t->retrans);
+        rec_val(pref, "tcp_delivery_rate", t->delivery_rate);
+        rec_val(pref, "tcp_busy", t->busy / 1E6);
+        rec_val(pref, "tcp_rwnd_limited", t->rwnd_limited / 1E6);
+        rec_val(pref, "tcp_sndbuf_limited", t->sndbuf_limited / 1E6);
+    }
+    if (stat->mem_page) {
+        rec_val(pref, "mem_node", stat->mem_node < 0 ? NAN : stat->mem_node);
+        rec_num(pref, "mem_page", stat->mem_page);
+    }
+    if (stat->xdp_zcopy)
+        rec_num(pref, "xdp_zcopy", stat->xdp_zcopy - 1);
+    if (stat->gpu_kind) {
+        rec_num(pref, "gpu_index", stat->gpu_index);
+        rec_num(pref, "gpu_topo",  stat->gpu_topo);
+    }
+    for (i = 0; i < PC_N; ++i)
+        if (stat->perf_valid & (1 << i))
+            rec_num(pref, PerfEvents[i].name, stat->perf[i]);
+    for (i = 0; i < NC_N; ++i)
+        if (stat->net_valid & (1 << i))
+            rec_num(pref, NetCounters[i].name, stat->net[i]);
+    if (stat->reg_mr_nsecs) {
+        rec_num(pref, "reg_mr_nsecs",   stat->reg_mr_nsecs);
+        rec_num(pref, "dereg_mr_nsecs", stat->dereg_mr_nsecs);
+    }
+    if (stat->connect_nsecs) {
+        rec_num(pref, "addr_nsecs",    stat->addr_nsecs);
+        rec_num(pref, "route_nsecs",   stat->route_nsecs);
+        rec_num(pref, "create_nsecs",  stat->create_nsecs);
+        rec_num(pref, "connect_nsecs", stat->connect_nsecs);
+    }
+    rec_ustat(qasprintf("%ss_", pref),     &stat->s);
+    rec_ustat(qasprintf("%sr_", pref),     &stat->r);
+    rec_ustat(qasprintf("%srem_s_", pref), &stat->rem_s);
+    rec_ustat(qasprintf("%srem_r_", pref), &stat->rem_r);
+    if (stat->no_threads < 2)
+        return;
+    for (i = 0; i < (int)stat->no_threads && i < MAX_THREADS; ++i) {
+        rec_ustat(qasprintf("%sthread%d_s_", pref, i), &stat->ts[i]);
+        rec_ustat(qasprintf("%sthread%d_r_", pref, i), &stat->tr[i]);
+    }
+}
+
+
+/*
+ * Record a USTAT structure.  The prefix was allocated by the caller and is
+ * freed here.
+ */
+static void
+rec_ustat(char *pref, USTAT *ustat)
+{
+    rec_num(pref, "no_bytes", ustat->no_bytes);
+    rec_num(pref, "no_msgs",  ustat->no_msgs);
+    rec_num(pref, "no_errs",  ustat->no_errs);
+    free(pref);
+}
+
+
+/*
+ * Record the times computed for a node.
+ */
+static void
+rec_resn(char *pref, RESN *resn)
+{
+    rec_val(pref, "time_real",   resn->time_real);
+    rec_val(pref, "time_cpu",    resn->time_cpu);
+    rec_val(pref, "cpu_total",   resn->cpu_total);
+    rec_val(pref, "cpu_user",    resn->cpu_user);
+    rec_val(pref, "cpu_intr",    resn->cpu_intr);
+    rec_val(pref, "cpu_idle",    resn->cpu_idle);
+    rec_val(pref, "cpu_kernel",  resn->cpu_kernel);
+    rec_val(pref, "cpu_io_wait", resn->cpu_io_wait);
+    rec_val(pref, "time_self",   resn->time_self);
+    rec_val(pref, "cpu_self",    resn->cpu_self);
+    rec_val(pref, "cpu_pinned",  resn->cpu_pinned);
+    rec_val(pref, "cpu_irq",     resn->cpu_irq);
+}
+
+
+/*
+ * Record a floating point value.  JSON has no way to express infinities or
+ * NaNs so those are recorded as null.
+ */
+static void
+rec_val(char *pref, char *name, double value)
+{
+    char *null = OutFormat == OUT_JSON ? "null" : "";
+
+    if (isfinite(value))
+        rec_put(pref, name, qasprintf("%.15g", value), 0);
+    else
+        rec_put(pref, name, qasprintf("%s", null), 0);
+}
+
+
+/*
+ * Record an integer value.
+ */
+static void
+rec_num(char *pref, char *name, uint64_t value)
+{
+    rec_put(pref, name, qasprintf("%llu", (unsigned long long)value), 0);
+}
+
+
+/*
+ * Record a string value.
+ */
+static void
+rec_str(char *pref, char *name, char *value)
+{
+    rec_put(pref, name, qasprintf("%s", value), 1);
+}
+
+
+/*
+ * Record the summary of a result over the trials of a test run with
+ * --repeat.
  */
 static void
-place_show(void)
+rec_trial(char *pref, TRIAL *trial)
 {
-    int i;
-    int nameLen = 0;
-    int dataLen = 0;
-    int unitLen = 0;
+    rec_val(pref, "mean",   trial->mean);
+    rec_val(pref, "stddev", trial_stddev(trial));
+    rec_val(pref, "min",    trial->min);
+    rec_val(pref, "max",    trial->max);
+    rec_val(pref, "ci95",   trial_ci95(trial));
+}
 
-    /* First compute formating sizes */
-    for (i = 0; i < ShowIndex; ++i) {
-        int n;
-        SHOW *show = &ShowTable[i];
-        n = (show->pref ? strlen(show->pref) : 0) + strlen(show->name);
-        if (n > nameLen)
-            nameLen = n;
-        n = strlen(show->data);
-        if (show->unit) {
-            if (n > dataLen)
-                dataLen = n;
-            n = strlen(show->unit);
-            if (n > unitLen)
-                unitLen = n;
-        }
-    }
 
-    /* Then display results */
-    for (i = 0; i < ShowIndex; ++i) {
-        int n = 0;
-        SHOW *show = &ShowTable[i];
+/*
+ * Add a field to the current record.  The data has been allocated.
+ */
+static void
+rec_put(char *pref, char *name, char *data, int str)
+{
+    FIELD *field = &RecTable[RecIndex++];
 
-        printf("    ");
-        if (show->pref) {
-            n = strlen(show->pref);
-            printf("%s", show->pref);
-        }
-        printf("%-*s", nameLen-n, show->name);
-        if (show->unit) {
-            printf("  =  %*s", dataLen, show->data);
-            printf(" %s", show->unit);
-        } else
-            printf("  =  %s", show->data);
-        if (show->altn)
-            printf(" (%s)", show->altn);
-        printf("\n");
-        free(show->data);
-        free(show->altn);
-    }
-    ShowIndex = 0;
+    if (RecIndex > cardof(RecTable))
+        error(BUG, "need to increase size of RecTable");
+    field->name = qasprintf("%s%s", pref ? pref : "", name);
+    field->data = data;
+    field->str  = str;
 }
 
 
@@ -2628,6 +5379,62 @@ set_affinity(void)
 }
 
 
+/*
+ * Return the CPU that worker thread i should be bound to or -1 if no CPU list
+ * was given.  CPUs are taken from the list in order, wrapping around if there
+ * are more threads than CPUs.  The list is of the form 0,2,4-7.
+ */
+int
+thread_cpu(int i)
+{
+    int cpus[CPU_SETSIZE];
+
+    if (!Req.cpu_list[0])
+        return -1;
+    return cpus[i % parse_cpus(Req.cpu_list, cpus)];
+}
+
+
+/*
+ * Parse a list of CPUs of the form 0,2,4-7 into cpus, which must have room
+ * for CPU_SETSIZE entries, and return how many there are.
+ */
+static int
+parse_cpus(char *list, int *cpus)
+{
+    int n = 0;
+    char *p = list;
+
+    while (*p) {
+        char *q;
+        long lo = strtol(p, &q, 10);
+        long hi = lo;
+
+        if (q == p)
+            break;
+        if (*q == '-') {
+            char *r = q + 1;
+
+            hi = strtol(r, &q, 10);
+            if (q == r)
+                break;
+        }
+        if (lo < 0 || hi < lo || hi >= CPU_SETSIZE)
+            break;
+        while (lo <= hi && n < CPU_SETSIZE)
+            cpus[n++] = lo++;
+        if (*q == ',')
+            ++q;
+        else if (*q)
+            break;
+        p = q;
+    }
+    if (*p || !n)
+        error(0, "%s: bad cpu list", list);
+    return n;
+}
+
+
 /*
  * Encode a REQ structure into a data stream.
  */
@@ -2641,21 +5448,58 @@ enc_req(REQ *host)
     enc_int(host->access_recv,   sizeof(host->access_recv));
     enc_int(host->affinity,      sizeof(host->affinity));
     enc_int(host->alt_port,      sizeof(host->alt_port));
+    enc_int(host->atomic_shared, sizeof(host->atomic_shared));
+    enc_int(host->atomic_spread, sizeof(host->atomic_spread));
+    enc_int(host->batch_size,    sizeof(host->batch_size));
+    enc_int(host->conn_depth,    sizeof(host->conn_depth));
+    enc_int(host->cq_spin,       sizeof(host->cq_spin));
     enc_int(host->flip,          sizeof(host->flip));
+    enc_int(host->mcast_receivers, sizeof(host->mcast_receivers));
+    enc_int(host->mem_huge,      sizeof(host->mem_huge));
     enc_int(host->msg_size,      sizeof(host->msg_size));
     enc_int(host->mtu_size,      sizeof(host->mtu_size));
+    enc_int(host->net_counters,  sizeof(host->net_counters));
     enc_int(host->no_msgs,       sizeof(host->no_msgs));
+    enc_int(host->num_qps,       sizeof(host->num_qps));
+    enc_int(host->perf_counters, sizeof(host->perf_counters));
+    enc_int(host->poisson,       sizeof(host->poisson));
     enc_int(host->poll_mode,     sizeof(host->poll_mode));
     enc_int(host->port,          sizeof(host->port));
+    enc_int(host->post_list,     sizeof(host->post_list));
+    enc_int(host->probe_size,    sizeof(host->probe_size));
+    enc_int(host->probe_sl,      sizeof(host->probe_sl));
+    enc_int(host->queue_depth,   sizeof(host->queue_depth));
     enc_int(host->rd_atomic,     sizeof(host->rd_atomic));
+    enc_int(host->sig_every,     sizeof(host->sig_every));
     enc_int(host->sl,            sizeof(host->sl));
     enc_int(host->sock_buf_size, sizeof(host->sock_buf_size));
+    enc_int(host->sock_busy_poll, sizeof(host->sock_busy_poll));
     enc_int(host->src_path_bits, sizeof(host->src_path_bits));
+    enc_int(host->tcp_cork,      sizeof(host->tcp_cork));
+    enc_int(host->tcp_nodelay,   sizeof(host->tcp_nodelay));
+    enc_int(host->threads,       sizeof(host->threads));
     enc_int(host->time,          sizeof(host->time));
     enc_int(host->timeout,       sizeof(host->timeout));
+    enc_int(host->timer_poll,    sizeof(host->timer_poll));
+    enc_int(host->udp_gso,       sizeof(host->udp_gso));
+    enc_int(host->uring_depth,   sizeof(host->uring_depth));
     enc_int(host->use_cm,        sizeof(host->use_cm));
+    enc_int(host->warmup,        sizeof(host->warmup));
+    enc_int(host->xdp_queue,     sizeof(host->xdp_queue));
+    enc_int(host->xdp_ring_size, sizeof(host->xdp_ring_size));
+    enc_str(host->cpu_list,      sizeof(host->cpu_list));
     enc_str(host->id,            sizeof(host->id));
+    enc_str(host->io_engine,     sizeof(host->io_engine));
+    enc_str(host->irq_cpus,      sizeof(host->irq_cpus));
+    enc_str(host->mcast_group,   sizeof(host->mcast_group));
+    enc_str(host->mem_gpu,       sizeof(host->mem_gpu));
+    enc_str(host->mem_node,      sizeof(host->mem_node));
+    enc_str(host->mr_odp,        sizeof(host->mr_odp));
+    enc_str(host->offered_load,  sizeof(host->offered_load));
     enc_str(host->static_rate,   sizeof(host->static_rate));
+    enc_str(host->tcp_cc,        sizeof(host->tcp_cc));
+    enc_str(host->xdp_mode,      sizeof(host->xdp_mode));
+    enc_str(host->zcopy,         sizeof(host->zcopy));
 }
 
 
@@ -2683,21 +5527,58 @@ dec_req_data(REQ *host)
     host->access_recv   = dec_int(sizeof(host->access_recv));
     host->affinity      = dec_int(sizeof(host->affinity));
     host->alt_port      = dec_int(sizeof(host->alt_port));
+    host->atomic_shared = dec_int(sizeof(host->atomic_shared));
+    host->atomic_spread = dec_int(sizeof(host->atomic_spread));
+    host->batch_size    = dec_int(sizeof(host->batch_size));
+    host->conn_depth    = dec_int(sizeof(host->conn_depth));
+    host->cq_spin       = dec_int(sizeof(host->cq_spin));
     host->flip          = dec_int(sizeof(host->flip));
+    host->mcast_receivers = dec_int(sizeof(host->mcast_receivers));
+    host->mem_huge      = dec_int(sizeof(host->mem_huge));
     host->msg_size      = dec_int(sizeof(host->msg_size));
     host->mtu_size      = dec_int(sizeof(host->mtu_size));
+    host->net_counters  = dec_int(sizeof(host->net_counters));
     host->no_msgs       = dec_int(sizeof(host->no_msgs));
+    host->num_qps       = dec_int(sizeof(host->num_qps));
+    host->perf_counters = dec_int(sizeof(host->perf_counters));
+    host->poisson       = dec_int(sizeof(host->poisson));
     host->poll_mode     = dec_int(sizeof(host->poll_mode));
     host->port          = dec_int(sizeof(host->port));
+    host->post_list     = dec_int(sizeof(host->post_list));
+    host->probe_size    = dec_int(sizeof(host->probe_size));
+    host->probe_sl      = dec_int(sizeof(host->probe_sl));
+    host->queue_depth   = dec_int(sizeof(host->queue_depth));
     host->rd_atomic     = dec_int(sizeof(host->rd_atomic));
+    host->sig_every     = dec_int(sizeof(host->sig_every));
     host->sl            = dec_int(sizeof(host->sl));
     host->sock_buf_size = dec_int(sizeof(host->sock_buf_size));
+    host->sock_busy_poll = dec_int(sizeof(host->sock_busy_poll));
     host->src_path_bits = dec_int(sizeof(host->src_path_bits));
+    host->tcp_cork      = dec_int(sizeof(host->tcp_cork));
+    host->tcp_nodelay   = dec_int(sizeof(host->tcp_nodelay));
+    host->threads       = dec_int(sizeof(host->threads));
     host->time          = dec_int(sizeof(host->time));
     host->timeout       = dec_int(sizeof(host->timeout));
+    host->timer_poll    = dec_int(sizeof(host->timer_poll));
+    host->udp_gso       = dec_int(sizeof(host->udp_gso));
+    host->uring_depth   = dec_int(sizeof(host->uring_depth));
     host->use_cm        = dec_int(sizeof(host->use_cm));
+    host->warmup        = dec_int(sizeof(host->warmup));
+    host->xdp_queue     = dec_int(sizeof(host->xdp_queue));
+    host->xdp_ring_size = dec_int(sizeof(host->xdp_ring_size));
+                          dec_str(host->cpu_list, sizeof(host->cpu_list));
                           dec_str(host->id, sizeof(host->id));
+                          dec_str(host->io_engine, sizeof(host->io_engine));
+                          dec_str(host->irq_cpus, sizeof(host->irq_cpus));
+                          dec_str(host->mcast_group, sizeof(host->mcast_group));
+                          dec_str(host->mem_gpu, sizeof(host->mem_gpu));
+                          dec_str(host->mem_node, sizeof(host->mem_node));
+                          dec_str(host->mr_odp, sizeof(host->mr_odp));
+                          dec_str(host->offered_load, sizeof(host->offered_load));
                           dec_str(host->static_rate,sizeof(host->static_rate));
+                          dec_str(host->tcp_cc, sizeof(host->tcp_cc));
+                          dec_str(host->xdp_mode, sizeof(host->xdp_mode));
+                          dec_str(host->zcopy, sizeof(host->zcopy));
 }
 
 
@@ -2712,14 +5593,51 @@ enc_stat(STAT *host)
     enc_int(host->no_cpus,  sizeof(host->no_cpus));
     enc_int(host->no_ticks, sizeof(host->no_ticks));
     enc_int(host->max_cqes, sizeof(host->max_cqes));
+    enc_int(host->no_threads, sizeof(host->no_threads));
+    enc_int(host->no_pin_cpus, sizeof(host->no_pin_cpus));
+    enc_int(host->no_irq_cpus, sizeof(host->no_irq_cpus));
+    enc_int(host->perf_valid, sizeof(host->perf_valid));
+    enc_int(host->net_valid, sizeof(host->net_valid));
     for (i = 0; i < T_N; ++i)
         enc_int(host->time_s[i], sizeof(host->time_s[i]));
     for (i = 0; i < T_N; ++i)
         enc_int(host->time_e[i], sizeof(host->time_e[i]));
+    enc_int(host->nsecs_s, sizeof(host->nsecs_s));
+    enc_int(host->nsecs_e, sizeof(host->nsecs_e));
+    enc_int(host->self_user, sizeof(host->self_user));
+    enc_int(host->self_kernel, sizeof(host->self_kernel));
+    for (i = 0; i < T_N; ++i)
+        enc_int(host->pin_times[i], sizeof(host->pin_times[i]));
+    for (i = 0; i < T_N; ++i)
+        enc_int(host->irq_times[i], sizeof(host->irq_times[i]));
+    for (i = 0; i < PC_N; ++i)
+        enc_int(host->perf[i], sizeof(host->perf[i]));
+    for (i = 0; i < NC_N; ++i)
+        enc_int(host->net[i], sizeof(host->net[i]));
     enc_ustat(&host->s);
     enc_ustat(&host->r);
     enc_ustat(&host->rem_s);
     enc_ustat(&host->rem_r);
+    enc_int(host->zc_done,   sizeof(host->zc_done));
+    enc_int(host->zc_copied, sizeof(host->zc_copied));
+    enc_int(host->data_errs, sizeof(host->data_errs));
+    enc_tcpi(&host->tcp);
+    enc_int(host->mem_node,  sizeof(host->mem_node));
+    enc_int(host->mem_page,  sizeof(host->mem_page));
+    enc_int(host->xdp_zcopy, sizeof(host->xdp_zcopy));
+    enc_int(host->gpu_kind,  sizeof(host->gpu_kind));
+    enc_int(host->gpu_index, sizeof(host->gpu_index));
+    enc_int(host->gpu_topo,  sizeof(host->gpu_topo));
+    enc_int(host->reg_mr_nsecs, sizeof(host->reg_mr_nsecs));
+    enc_int(host->dereg_mr_nsecs, sizeof(host->dereg_mr_nsecs));
+    enc_int(host->addr_nsecs, sizeof(host->addr_nsecs));
+    enc_int(host->route_nsecs, sizeof(host->route_nsecs));
+    enc_int(host->create_nsecs, sizeof(host->create_nsecs));
+    enc_int(host->connect_nsecs, sizeof(host->connect_nsecs));
+    for (i = 0; i < host->no_threads; ++i) {
+        enc_ustat(&host->ts[i]);
+        enc_ustat(&host->tr[i]);
+    }
 }
 
 
@@ -2734,14 +5652,53 @@ dec_stat(STAT *host)
     host->no_cpus  = dec_int(sizeof(host->no_cpus));
     host->no_ticks = dec_int(sizeof(host->no_ticks));
     host->max_cqes = dec_int(sizeof(host->max_cqes));
+    host->no_threads = dec_int(sizeof(host->no_threads));
+    if (host->no_threads > MAX_THREADS)
+        error(0, "bad thread count in results: %d", host->no_threads);
+    host->no_pin_cpus = dec_int(sizeof(host->no_pin_cpus));
+    host->no_irq_cpus = dec_int(sizeof(host->no_irq_cpus));
+    host->perf_valid = dec_int(sizeof(host->perf_valid));
+    host->net_valid = dec_int(sizeof(host->net_valid));
     for (i = 0; i < T_N; ++i)
         host->time_s[i] = dec_int(sizeof(host->time_s[i]));
     for (i = 0; i < T_N; ++i)
         host->time_e[i] = dec_int(sizeof(host->time_e[i]));
+    host->nsecs_s = dec_int(sizeof(host->nsecs_s));
+    host->nsecs_e = dec_int(sizeof(host->nsecs_e));
+    host->self_user = dec_int(sizeof(host->self_user));
+    host->self_kernel = dec_int(sizeof(host->self_kernel));
+    for (i = 0; i < T_N; ++i)
+        host->pin_times[i] = dec_int(sizeof(host->pin_times[i]));
+    for (i = 0; i < T_N; ++i)
+        host->irq_times[i] = dec_int(sizeof(host->irq_times[i]));
+    for (i = 0; i < PC_N; ++i)
+        host->perf[i] = dec_int(sizeof(host->perf[i]));
+    for (i = 0; i < NC_N; ++i)
+        host->net[i] = dec_int(sizeof(host->net[i]));
     dec_ustat(&host->s);
     dec_ustat(&host->r);
     dec_ustat(&host->rem_s);
     dec_ustat(&host->rem_r);
+    host->zc_done   = dec_int(sizeof(host->zc_done));
+    host->zc_copied = dec_int(sizeof(host->zc_copied));
+    host->data_errs = dec_int(sizeof(host->data_errs));
+    dec_tcpi(&host->tcp);
+    host->mem_node  = dec_int(sizeof(host->mem_node));
+    host->mem_page  = dec_int(sizeof(host->mem_page));
+    host->xdp_zcopy = dec_int(sizeof(host->xdp_zcopy));
+    host->gpu_kind  = dec_int(sizeof(host->gpu_kind));
+    host->gpu_index = dec_int(sizeof(host->gpu_index));
+    host->gpu_topo  = dec_int(sizeof(host->gpu_topo));
+    host->reg_mr_nsecs = dec_int(sizeof(host->reg_mr_nsecs));
+    host->dereg_mr_nsecs = dec_int(sizeof(host->dereg_mr_nsecs));
+    host->addr_nsecs = dec_int(sizeof(host->addr_nsecs));
+    host->route_nsecs = dec_int(sizeof(host->route_nsecs));
+    host->create_nsecs = dec_int(sizeof(host->create_nsecs));
+    host->connect_nsecs = dec_int(sizeof(host->connect_nsecs));
+    for (i = 0; i < host->no_threads; ++i) {
+        dec_ustat(&host->ts[i]);
+        dec_ustat(&host->tr[i]);
+    }
 }
 
 
@@ -2769,6 +5726,78 @@ dec_ustat(USTAT *host)
 }
 
 
+/*
+ * Encode a HIST structure into a data stream.
+ */
+static void
+enc_hist(HIST *host)
+{
+    int i;
+
+    enc_int(host->count, sizeof(host->count));
+    enc_int(host->min,   sizeof(host->min));
+    enc_int(host->max,   sizeof(host->max));
+    enc_int(host->sum,   sizeof(host->sum));
+    for (i = 0; i < HIST_BINS; ++i)
+        enc_int(host->bins[i], sizeof(host->bins[i]));
+}
+
+
+/*
+ * Decode a HIST structure from a data stream.
+ */
+static void
+dec_hist(HIST *host)
+{
+    int i;
+
+    host->count = dec_int(sizeof(host->count));
+    host->min   = dec_int(sizeof(host->min));
+    host->max   = dec_int(sizeof(host->max));
+    host->sum   = dec_int(sizeof(host->sum));
+    for (i = 0; i < HIST_BINS; ++i)
+        host->bins[i] = dec_int(sizeof(host->bins[i]));
+}
+
+
+/*
+ * Encode a TCPI structure into a data stream.
+ */
+static void
+enc_tcpi(TCPI *host)
+{
+    enc_int(host->conns,          sizeof(host->conns));
+    enc_int(host->rtt,            sizeof(host->rtt));
+    enc_int(host->rttvar,         sizeof(host->rttvar));
+    enc_int(host->cwnd,           sizeof(host->cwnd));
+    enc_int(host->retrans,        sizeof(host->retrans));
+    enc_int(host->delivery_rate,  sizeof(host->delivery_rate));
+    enc_int(host->busy,           sizeof(host->busy));
+    enc_int(host->rwnd_limited,   sizeof(host->rwnd_limited));
+    enc_int(host->sndbuf_limited, sizeof(host->sndbuf_limited));
+    enc_str(host->cc,             sizeof(host->cc));
+}
+
+
+/*
+ * Decode a TCPI structure from a data stream.
+ */
+static void
+dec_tcpi(TCPI *host)
+{
+    host->conns          = dec_int(sizeof(host->conns));
+    host->rtt            = dec_int(sizeof(host->rtt));
+    host->rttvar         = dec_int(sizeof(host->rttvar));
+    host->cwnd           = dec_int(sizeof(host->cwnd));
+    host->retrans        = dec_int(sizeof(host->retrans));
+    host->delivery_rate  = dec_int(sizeof(host->delivery_rate));
+    host->busy           = dec_int(sizeof(host->busy));
+    host->rwnd_limited   = dec_int(sizeof(host->rwnd_limited));
+    host->sndbuf_limited = dec_int(sizeof(host->sndbuf_limited));
+                           dec_str(host->cc, sizeof(host->cc));
+}
+
+
 /*
  * Get various temporal parameters.
  */
@@ -2781,9 +5810,7 @@ get_times(CLOCK timex[T_N])
     struct tms tms;
 
     timex[0] = times(&tms);
-    if (lseek(ProcStatFD, 0, 0) < 0)
-        error(SYS, "failed to seek /proc/stat");
-    n = read(ProcStatFD, buf, sizeof(buf)-1);
+    n = pread(ProcStatFD, buf, sizeof(buf)-1, 0);
     if (n < 0)
         error(SYS, "failed to read /proc/stat");
     buf[n] = '\0';
@@ -2807,6 +5834,340 @@ get_times(CLOCK timex[T_N])
 }
 
 
+/*
+ * Note where a test starts using cpu time that can be pinned on it: the time
+ * qperf itself uses, the time used on the processors it was bound to with
+ * --cpu_affinity or --cpu_list and the interrupt time on the processors that
+ * --irq_cpus says take the NIC interrupts.  The system-wide times of get_times
+ * include everything else running on the node.
+ */
+static void
+cpu_accnt_start(void)
+{
+    int i;
+    int n;
+    int cpus[CPU_SETSIZE];
+
+    CPU_ZERO(&PinCPUs);
+    if (Req.affinity)
+        CPU_SET(Req.affinity-1, &PinCPUs);
+    if (Req.cpu_list[0]) {
+        n = parse_cpus(Req.cpu_list, cpus);
+        for (i = 0; i < n; ++i)
+            CPU_SET(cpus[i], &PinCPUs);
+    }
+    CPU_ZERO(&IrqCPUs);
+    if (Req.irq_cpus[0]) {
+        n = parse_cpus(Req.irq_cpus, cpus);
+        for (i = 0; i < n; ++i)
+            CPU_SET(cpus[i], &IrqCPUs);
+    }
+    LStat.no_pin_cpus = CPU_COUNT(&PinCPUs);
+    LStat.no_irq_cpus = CPU_COUNT(&IrqCPUs);
+    if (LStat.no_pin_cpus)
+        cpu_times(&PinCPUs, PinTimes);
+    if (LStat.no_irq_cpus)
+        cpu_times(&IrqCPUs, IrqTimes);
+    getrusage(RUSAGE_SELF, &SelfUsage);
+}
+
+
+/*
+ * Note the cpu time used since cpu_accnt_start.  Called from set_finished.
+ */
+static void
+cpu_accnt_end(void)
+{
+    int i;
+    CLOCK timex[T_N];
+    struct rusage usage;
+
+    getrusage(RUSAGE_SELF, &usage);
+    LStat.self_user =
+        (usage.ru_utime.tv_sec - SelfUsage.ru_utime.tv_sec) * 1000000LL
+        + usage.ru_utime.tv_usec - SelfUsage.ru_utime.tv_usec;
+    LStat.self_kernel =
+        (usage.ru_stime.tv_sec - SelfUsage.ru_stime.tv_sec) * 1000000LL
+        + usage.ru_stime.tv_usec - SelfUsage.ru_stime.tv_usec;
+    if (LStat.no_pin_cpus) {
+        cpu_times(&PinCPUs, timex);
+        for (i = 0; i < T_N; ++i)
+            LStat.pin_times[i] = timex[i] - PinTimes[i];
+    }
+    if (LStat.no_irq_cpus) {
+        cpu_times(&IrqCPUs, timex);
+        for (i = 0; i < T_N; ++i)
+            LStat.irq_times[i] = timex[i] - IrqTimes[i];
+    }
+}
+
+
+/*
+ * Sum the times of the processors in set from their cpuN lines in /proc/stat.
+ * The real time is not kept.
+ */
+static void
+cpu_times(cpu_set_t *set, CLOCK timex[T_N])
+{
+    int n;
+    char *p;
+    static char buf[64*1024];
+
+    for (n = 0; n < T_N; ++n)
+        timex[n] = 0;
+    n = pread(ProcStatFD, buf, sizeof(buf)-1, 0);
+    if (n < 0)
+        error(SYS, "failed to read /proc/stat");
+    buf[n] = '\0';
+    p = buf;
+    while ((p = strchr(p, '\n')) && strncmp(++p, "cpu", 3) == 0) {
+        int cpu;
+
+        p += 3;
+        if (!isdigit(*p))
+            continue;
+        cpu = strtol(p, &p, 10);
+        if (cpu >= CPU_SETSIZE || !CPU_ISSET(cpu, set))
+            continue;
+        for (n = 1; n < T_N; ++n) {
+            while (*p == ' ')
+                ++p;
+            if (!isdigit(*p))
+                break;
+            timex[n] += strtoll(p, &p, 10);
+        }
+    }
+}
+
+
+/*
+ * Open the performance counters for this process and its threads and start
+ * them.  Counters that cannot be opened, either because the hardware lacks
+ * them or because perf_event_paranoid forbids it, are quietly left out.
+ */
+static void
+perf_start(void)
+{
+    int i;
+
+    for (i = 0; i < PC_N; ++i)
+        PerfFD[i] = -1;
+    LStat.perf_valid = 0;
+    if (!Req.perf_counters)
+        return;
+    for (i = 0; i < PC_N; ++i) {
+        int fd;
+        struct perf_event_attr attr;
+
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = PerfEvents[i].type;
+        attr.config = PerfEvents[i].config;
+        attr.disabled = 1;
+        attr.inherit = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+                           PERF_FORMAT_TOTAL_TIME_RUNNING;
+        fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        if (fd < 0 && (errno == EACCES || errno == EPERM)) {
+            attr.exclude_kernel = 1;
+            fd = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+        }
+        if (fd < 0) {
+            debug("cannot count %s: %s", PerfEvents[i].name, strerror(errno));
+            continue;
+        }
+        PerfFD[i] = fd;
+    }
+    for (i = 0; i < PC_N; ++i) {
+        if (PerfFD[i] < 0)
+            continue;
+        ioctl(PerfFD[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(PerfFD[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+
+/*
+ * Stop the performance counters.  Called from set_finished.
+ */
+static void
+perf_disable(void)
+{
+    int i;
+
+    for (i = 0; i < PC_N; ++i)
+        if (PerfFD[i] >= 0)
+            ioctl(PerfFD[i], PERF_EVENT_IOC_DISABLE, 0);
+}
+
+
+/*
+ * Zero the performance counters, leaving them running.
+ */
+static void
+perf_reset(void)
+{
+    int i;
+
+    for (i = 0; i < PC_N; ++i)
+        if (PerfFD[i] >= 0)
+            ioctl(PerfFD[i], PERF_EVENT_IOC_RESET, 0);
+}
+
+
+/*
+ * Read and close the performance counters.  This is done once the test
+ * threads have exited so that their counts have been folded into ours.  If
+ * the counters were multiplexed, the values are scaled up to cover the whole
+ * time they were enabled.
+ */
+static void
+perf_read(void)
+{
+    int i;
+
+    for (i = 0; i < PC_N; ++i) {
+        uint64_t val[3];
+
+        if (PerfFD[i] < 0)
+            continue;
+        if (read(PerfFD[i], val, sizeof(val)) == sizeof(val) && val[2]) {
+            if (val[2] < val[1])
+                val[0] = (double)val[0] * val[1] / val[2];
+            LStat.perf[i] = val[0];
+            LStat.perf_valid |= 1 << i;
+        }
+        close(PerfFD[i]);
+        PerfFD[i] = -1;
+    }
+}
+
+
+/*
+ * Note the sysfs directory of the network interface or RDMA port used by the
+ * test so that its counters can be read.
+ */
+void
+net_dir(char *dir)
+{
+    if (strlen(dir) >= sizeof(NetDir))
+        return;
+    strcpy(NetDir, dir);
+    debug("network counters from %s", dir);
+}
+
+
+/*
+ * If network counters were requested, take the starting value of each that
+ * can be found.
+ */
+static void
+net_start(void)
+{
+    int i;
+
+    LStat.net_valid = 0;
+    if (!Req.net_counters)
+        return;
+    for (i = 0; i < NC_N; ++i) {
+        int found;
+
+        NetStart[i] = net_value(&NetCounters[i], &found);
+        if (found)
+            LStat.net_valid |= 1 << i;
+    }
+}
+
+
+/*
+ * Note how much each network counter found by net_start changed.
+ */
+static void
+net_read(void)
+{
+    int i;
+
+    for (i = 0; i < NC_N; ++i) {
+        int found;
+        uint64_t value;
+
+        if (!(LStat.net_valid & (1 << i)))
+            continue;
+        value = net_value(&NetCounters[i], &found);
+        if (found && value >= NetStart[i])
+            LStat.net[i] = value - NetStart[i];
+        else
+            LStat.net_valid &= ~(1 << i);
+    }
+}
+
+
+/*
+ * Read a network counter.  A table in /proc/net has lines in pairs, the first
+ * naming the columns and the second holding their values, both starting with
+ * the name of the row.
+ */
+static uint64_t
+net_value(NET_COUNTER *counter, int *found)
+{
+    FILE *fp;
+    char *path;
+    char *col;
+    int n;
+    uint64_t value = 0;
+    static char names[16*1024];
+    static char values[16*1024];
+
+    *found = 0;
+    if (counter->file[0] != '/') {
+        if (!NetDir[0])
+            return 0;
+        path = qasprintf("%s/%s", NetDir, counter->file);
+        fp = fopen(path, "r");
+        free(path);
+        if (!fp)
+            return 0;
+        if (fgets(values, sizeof(values), fp) && isdigit(values[0])) {
+            value = strtoull(values, 0, 10);
+            *found = 1;
+        }
+        fclose(fp);
+        return value;
+    }
+
+    fp = fopen(counter->file, "r");
+    if (!fp)
+        return 0;
+    col = strchr(counter->key, ':') + 1;
+    n = col - counter->key;
+    while (fgets(names, sizeof(names), fp) &&
+           fgets(values, sizeof(values), fp)) {
+        char *p;
+        char *v;
+        char *np;
+        char *vp;
+
+        if (strncmp(names, counter->key, n) != 0)
+            continue;
+        p = strtok_r(names + n, " \n", &np);
+        v = strtok_r(values + n, " \n", &vp);
+        while (p && v) {
+            if (streq(p, col)) {
+                value = strtoull(v, 0, 10);
+                *found = 1;
+                break;
+            }
+            p = strtok_r(0, " \n", &np);
+            v = strtok_r(0, " \n", &vp);
+        }
+        break;
+    }
+    fclose(fp);
+    return value;
+}
+
+
 /*
  * Insert commas within a number for readability.
  */
@@ -40,6 +40,28 @@
  * Parameters.
  */
 #define STRSIZE 64
+#define MAX_THREADS 64                  /* Maximum number of worker threads */
+#define MAX_BATCH 1024                  /* Maximum datagrams per system call */
+#define HIST_SUB_BITS 5                 /* Histogram sub-buckets (log2) */
+#define CACHE_LINE 64                   /* Cache line size */
+#define MAX_SPREAD 4096                 /* Most cache lines atomics target */
+
+
+/*
+ * Output formats.
+ */
+#define OUT_TEXT 0                      /* Show results as text */
+#define OUT_JSON 1                      /* One JSON object per test */
+#define OUT_CSV  2                      /* One CSV row per test */
+
+
+/*
+ * Ways of accessing received data, set with --access_recv.
+ */
+#define ACCESS_NONE   0                 /* Ignore it */
+#define ACCESS_READ   1                 /* Read it */
+#define ACCESS_COPY   2                 /* Copy it to another buffer */
+#define ACCESS_VERIFY 3                 /* Check its CRC32C */
 
 
 /*
@@ -88,6 +110,54 @@ typedef enum {
 } TIME_INDEX;
 
 
+/*
+ * Performance counter indices.
+ */
+typedef enum {
+    PC_CYCLES,
+    PC_INSTRS,
+    PC_LLC_MISSES,
+    PC_DTLB_MISSES,
+    PC_CTX_SWITCHES,
+    PC_N
+} PERF_INDEX;
+
+
+/*
+ * Network counter indices.  The first are kept by the kernel's IP stack, the
+ * next by an Ethernet interface and the last by an RDMA port.
+ */
+typedef enum {
+    NC_TCP_RETRANS,
+    NC_TCP_LOST_RETRANS,
+    NC_TCP_IN_ERRS,
+    NC_TCP_OUT_RSTS,
+    NC_UDP_IN_ERRS,
+    NC_UDP_RCVBUF_ERRS,
+    NC_UDP_SNDBUF_ERRS,
+    NC_IP_CE_PKTS,
+    NC_RX_DROPPED,
+    NC_TX_DROPPED,
+    NC_RX_ERRORS,
+    NC_TX_ERRORS,
+    NC_RX_MISSED,
+    NC_PORT_RCV_ERRORS,
+    NC_PORT_XMIT_DISCARDS,
+    NC_PORT_XMIT_WAIT,
+    NC_SYMBOL_ERROR,
+    NC_LINK_DOWNED,
+    NC_OUT_OF_SEQUENCE,
+    NC_PACKET_SEQ_ERR,
+    NC_RNR_NAK_RETRY_ERR,
+    NC_LOCAL_ACK_TIMEOUT,
+    NC_DUPLICATE_REQUEST,
+    NC_ECN_MARKED,
+    NC_CNP_SENT,
+    NC_CNP_HANDLED,
+    NC_N
+} NET_INDEX;
+
+
 /*
  * Parameter indices.  P_NULL must be 0.
  */
@@ -99,36 +169,110 @@ typedef enum {
     R_AFFINITY,
     L_ALT_PORT,
     R_ALT_PORT,
+    L_ATOMIC_SHARED,
+    R_ATOMIC_SHARED,
+    L_ATOMIC_SPREAD,
+    R_ATOMIC_SPREAD,
+    L_BATCH_SIZE,
+    R_BATCH_SIZE,
+    L_CONN_DEPTH,
+    R_CONN_DEPTH,
+    L_CPU_LIST,
+    R_CPU_LIST,
+    L_CQ_SPIN,
+    R_CQ_SPIN,
     L_FLIP,
     R_FLIP,
     L_ID,
     R_ID,
+    L_IO_ENGINE,
+    R_IO_ENGINE,
+    L_IRQ_CPUS,
+    R_IRQ_CPUS,
+    L_MCAST_GROUP,
+    R_MCAST_GROUP,
+    L_MCAST_RECEIVERS,
+    R_MCAST_RECEIVERS,
+    L_MEM_GPU,
+    R_MEM_GPU,
+    L_MEM_HUGE,
+    R_MEM_HUGE,
+    L_MEM_NODE,
+    R_MEM_NODE,
+    L_MR_ODP,
+    R_MR_ODP,
     L_MSG_SIZE,
     R_MSG_SIZE,
     L_MTU_SIZE,
     R_MTU_SIZE,
+    L_NET_COUNTERS,
+    R_NET_COUNTERS,
     L_NO_MSGS,
     R_NO_MSGS,
+    L_NUM_QPS,
+    R_NUM_QPS,
+    L_OFFERED_LOAD,
+    R_OFFERED_LOAD,
+    L_PERF_COUNTERS,
+    R_PERF_COUNTERS,
+    L_POISSON,
+    R_POISSON,
     L_POLL_MODE,
     R_POLL_MODE,
     L_PORT,
     R_PORT,
+    L_POST_LIST,
+    R_POST_LIST,
+    L_PROBE_SIZE,
+    R_PROBE_SIZE,
+    L_PROBE_SL,
+    R_PROBE_SL,
+    L_QUEUE_DEPTH,
+    R_QUEUE_DEPTH,
     L_RD_ATOMIC,
     R_RD_ATOMIC,
+    L_SIG_EVERY,
+    R_SIG_EVERY,
     L_SL,
     R_SL,
     L_SOCK_BUF_SIZE,
     R_SOCK_BUF_SIZE,
+    L_SOCK_BUSY_POLL,
+    R_SOCK_BUSY_POLL,
     L_SRC_PATH_BITS,
     R_SRC_PATH_BITS,
     L_STATIC_RATE,
     R_STATIC_RATE,
+    L_TCP_CC,
+    R_TCP_CC,
+    L_TCP_CORK,
+    R_TCP_CORK,
+    L_TCP_NODELAY,
+    R_TCP_NODELAY,
+    L_THREADS,
+    R_THREADS,
     L_TIME,
     R_TIME,
     L_TIMEOUT,
     R_TIMEOUT,
+    L_TIMER_POLL,
+    R_TIMER_POLL,
+    L_UDP_GSO,
+    R_UDP_GSO,
+    L_URING_DEPTH,
+    R_URING_DEPTH,
     L_USE_CM,
     R_USE_CM,
+    L_WARMUP,
+    R_WARMUP,
+    L_XDP_MODE,
+    R_XDP_MODE,
+    L_XDP_QUEUE,
+    R_XDP_QUEUE,
+    L_XDP_RING_SIZE,
+    R_XDP_RING_SIZE,
+    L_ZCOPY,
+    R_ZCOPY,
     P_N
 } PAR_INDEX;
 
@@ -140,7 +284,10 @@ typedef enum {
     LATENCY,
     MSG_RATE,
     BANDWIDTH,
-    BANDWIDTH_SR
+    BANDWIDTH_SR,
+    BANDWIDTH_LAT,
+    CONN_RATE,
+    MULTICAST
 } MEASURE;
 
 
@@ -158,21 +305,58 @@ typedef struct REQ {
     uint32_t    access_recv;            /* Access data after receiving */
     uint32_t    affinity;               /* Processor affinity */
     uint32_t    alt_port;               /* Alternate path port number */
+    uint32_t    atomic_shared;          /* Clients share the atomic words */
+    uint32_t    atomic_spread;          /* Cache lines atomics target */
+    uint32_t    batch_size;             /* Datagrams per system call */
+    uint32_t    conn_depth;             /* Connections set up at once */
+    uint32_t    cq_spin;                /* Microseconds to spin on CQ */
     uint32_t    flip;                   /* Flip sender/receiver */
+    uint32_t    mcast_receivers;        /* Multicast receiving QPs */
+    uint32_t    mem_huge;               /* Huge page size for buffers */
     uint32_t    msg_size;               /* Message Size */
     uint32_t    mtu_size;               /* MTU Size */
+    uint32_t    net_counters;           /* Report network counters */
     uint32_t    no_msgs;                /* Number of messages */
+    uint32_t    num_qps;                /* Number of queue pairs */
+    uint32_t    perf_counters;          /* Use hardware counters */
+    uint32_t    poisson;                /* Poisson message arrivals */
     uint32_t    poll_mode;              /* Poll mode */
     uint32_t    port;                   /* Port number requested */
+    uint32_t    post_list;              /* Work requests per post */
+    uint32_t    probe_size;             /* Latency probe message size */
+    uint32_t    probe_sl;               /* Latency probe service level */
+    uint32_t    queue_depth;            /* Work requests outstanding */
     uint32_t    rd_atomic;              /* Number of pending RDMA or atomics */
+    uint32_t    sig_every;              /* Signal every Nth work request */
     uint32_t    sl;                     /* Service level */
     uint32_t    sock_buf_size;          /* Socket buffer size */
+    uint32_t    sock_busy_poll;         /* Socket busy poll microseconds */
     uint32_t    src_path_bits;          /* Source path bits */
+    uint32_t    tcp_cork;               /* Set TCP_CORK */
+    uint32_t    tcp_nodelay;            /* Set TCP_NODELAY */
+    uint32_t    threads;                /* Number of worker threads */
     uint32_t    time;                   /* Duration in seconds */
     uint32_t    timeout;                /* Timeout for messages */
+    uint32_t    timer_poll;             /* End tests by reading the clock */
+    uint32_t    udp_gso;                /* Use UDP segmentation offload */
+    uint32_t    uring_depth;            /* io_uring operations in flight */
     uint32_t    use_cm;                 /* Use Connection Manager */
+    uint32_t    warmup;                 /* Seconds run before measuring */
+    uint32_t    xdp_queue;              /* NIC queue for AF_XDP */
+    uint32_t    xdp_ring_size;          /* AF_XDP ring entries */
+    char        cpu_list[STRSIZE];      /* CPUs for worker threads */
     char        id[STRSIZE];            /* Identifier */
+    char        io_engine[STRSIZE];     /* Socket I/O engine */
+    char        irq_cpus[STRSIZE];      /* CPUs taking NIC interrupts */
+    char        mcast_group[STRSIZE];   /* Multicast group address */
+    char        mem_gpu[STRSIZE];       /* GPU for buffers */
+    char        mem_node[STRSIZE];      /* NUMA node for buffers */
+    char        mr_odp[STRSIZE];        /* On-Demand Paging mode */
+    char        offered_load[STRSIZE];  /* Open-loop sending rate */
     char        static_rate[STRSIZE];   /* Static rate */
+    char        tcp_cc[STRSIZE];        /* TCP congestion control */
+    char        xdp_mode[STRSIZE];      /* AF_XDP copy mode */
+    char        zcopy[STRSIZE];         /* Zero copy send mode */
 } REQ;
 
 
@@ -186,6 +370,24 @@ typedef struct USTAT {
 } USTAT;
 
 
+/*
+ * TCP connection state from TCP_INFO at the end of a test.  With several
+ * connections, times and windows are averaged and counts and rates summed.
+ */
+typedef struct TCPI {
+    uint32_t    conns;                  /* Connections sampled */
+    uint32_t    rtt;                    /* Smoothed round trip time in us */
+    uint32_t    rttvar;                 /* Round trip time variation in us */
+    uint32_t    cwnd;                   /* Send congestion window in MSS */
+    uint32_t    retrans;                /* Segments retransmitted */
+    uint64_t    delivery_rate;          /* Delivery rate in bytes/sec */
+    uint64_t    busy;                   /* Time spent sending in us */
+    uint64_t    rwnd_limited;           /* Time limited by receive window */
+    uint64_t    sndbuf_limited;         /* Time limited by send buffer */
+    char        cc[STRSIZE];            /* Congestion control in use */
+} TCPI;
+
+
 /*
  * Statistics.
  */
@@ -193,15 +395,77 @@ typedef struct STAT {
     uint32_t    no_cpus;                /* Number of processors */
     uint32_t    no_ticks;               /* Ticks per second */
     uint32_t    max_cqes;               /* Maximum CQ entries */
+    uint32_t    no_threads;             /* Number of worker threads */
+    uint32_t    no_pin_cpus;            /* Number of processors pinned to */
+    uint32_t    no_irq_cpus;            /* Number of NIC interrupt processors */
+    uint32_t    perf_valid;             /* Mask of counters that worked */
+    uint32_t    net_valid;              /* Mask of network counters found */
     CLOCK       time_s[T_N];            /* Start times */
     CLOCK       time_e[T_N];            /* End times */
+    uint64_t    nsecs_s;                /* Start time in nanoseconds */
+    uint64_t    nsecs_e;                /* End time in nanoseconds */
+    uint64_t    self_user;              /* Our user time in microseconds */
+    uint64_t    self_kernel;            /* Our kernel time in microseconds */
+    CLOCK       pin_times[T_N];         /* Times used on pinned processors */
+    CLOCK       irq_times[T_N];         /* Times used on interrupt processors */
+    uint64_t    perf[PC_N];             /* Performance counter values */
+    uint64_t    net[NC_N];              /* Network counter changes */
     USTAT       s;                      /* Send statistics */
     USTAT       r;                      /* Receive statistics */
     USTAT       rem_s;                  /* Remote send statistics */
     USTAT       rem_r;                  /* Remote receive statistics */
+    uint64_t    zc_done;                /* Zero copy sends completed */
+    uint64_t    zc_copied;              /* Zero copy sends that copied */
+    uint64_t    data_errs;              /* Messages that failed verification */
+    TCPI        tcp;                    /* TCP connection state */
+    int32_t     mem_node;               /* NUMA node of buffers */
+    uint32_t    mem_page;               /* Page size of buffers */
+    uint32_t    xdp_zcopy;              /* AF_XDP mode: 0 none, 1 copy, 2 zc */
+    uint32_t    gpu_kind;               /* GPU of buffers: 0 none, 1 CUDA, 2 ROCm */
+    uint32_t    gpu_index;              /* Index of that GPU */
+    uint32_t    gpu_topo;               /* PCIe path from GPU to NIC */
+    uint64_t    reg_mr_nsecs;           /* Time spent registering MRs */
+    uint64_t    dereg_mr_nsecs;         /* Time spent deregistering MRs */
+    uint64_t    addr_nsecs;             /* Time spent resolving addresses */
+    uint64_t    route_nsecs;            /* Time spent resolving routes */
+    uint64_t    create_nsecs;           /* Time spent creating sockets/QPs */
+    uint64_t    connect_nsecs;          /* Time spent connecting */
+    USTAT       ts[MAX_THREADS];        /* Send statistics per thread */
+    USTAT       tr[MAX_THREADS];        /* Receive statistics per thread */
 } STAT;
 
 
+/*
+ * Latency histogram.  Values below 2^HIST_SUB_BITS are counted exactly; above
+ * that, each power of two is split into 2^HIST_SUB_BITS linear buckets which
+ * bounds the relative error of any reported percentile to about 3%.
+ */
+#define HIST_SUB    (1 << HIST_SUB_BITS)
+#define HIST_BINS   ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct HIST {
+    uint64_t    count;                  /* Number of samples */
+    uint64_t    min;                    /* Smallest sample */
+    uint64_t    max;                    /* Largest sample */
+    uint64_t    sum;                    /* Sum of the samples */
+    uint64_t    bins[HIST_BINS];        /* Sample counts */
+} HIST;
+
+
+/*
+ * State for sending or receiving a batch of datagrams with one call to
+ * sendmmsg or recvmmsg.
+ */
+typedef struct MMSG {
+    int             n;                  /* Number of messages */
+    int             ctl_size;           /* Size of each control buffer */
+    char           *buf;                /* Message buffers */
+    char           *ctl;                /* Control buffers */
+    struct iovec   *iov;                /* I/O vectors */
+    struct mmsghdr *hdr;                /* Message headers */
+} MMSG;
+
+
 /*
  * Results per node.
  */
@@ -214,6 +478,11 @@ typedef struct RESN {
     double      cpu_idle;               /* Idle time (fraction of cpu) */
     double      cpu_kernel;             /* Kernel time (fraction of cpu) */
     double      cpu_io_wait;            /* IO wait time (fraction of cpu) */
+    double      time_self;              /* Cpu time used by qperf in seconds */
+    double      time_irq;               /* Interrupt time on NIC cpus */
+    double      cpu_self;               /* Cpu used by qperf (fraction) */
+    double      cpu_pinned;             /* Busy time of pinned cpus */
+    double      cpu_irq;                /* Interrupt time of NIC cpus */
 } RESN;
 
 
@@ -228,6 +497,8 @@ typedef struct RES {
     double      msg_rate;               /* Messaging rate */
     double      send_cost;              /* Send cost */
     double      recv_cost;              /* Receive cost */
+    double      send_msg_cost;          /* Send cost per message */
+    double      recv_msg_cost;          /* Receive cost per message */
     double      latency;                /* Latency */
 } RES;
 
@@ -237,9 +508,16 @@ typedef struct RES {
  */
 void        client_send_request(void);
 void        exchange_results(void);
+uint32_t    getv_u32(PAR_INDEX index);
+void        interval_tcp(int fd);
+void        interval_watch(USTAT *s, USTAT *r);
+void        net_dir(char *dir);
 int         left_to_send(long *sentp, int room);
 void        opt_check(void);
 void        par_use(PAR_INDEX index);
+int         past_deadline(void);
+void        pace_init(void);
+uint64_t    pace_take(void);
 int         recv_mesg(void *ptr, int len, char *item);
 int         send_mesg(void *ptr, int len, char *item);
 void        set_finished(void);
@@ -249,12 +527,14 @@ void        setv_u32(PAR_INDEX index, uint32_t l);
 void        show_results(MEASURE measure);
 void        stop_test_timer(void);
 void        sync_test(void);
+int         thread_cpu(int i);
 
 
 /*
  * Functions prototypes in support.c.
  */
 void        check_remote_error(void);
+void        data_fill(void *p, long n);
 void        debug(char *fmt, ...);
 void        dec_init(void *p);
 int64_t     dec_int(int n);
@@ -267,6 +547,19 @@ void        enc_str(char *s, int n);
 void        encode_uint32(uint32_t *p, uint32_t v);
 int         error(int actions, char *fmt, ...);
 AI         *getaddrinfo_port(char *node, int port, AI *hints);
+uint64_t    get_nsecs(void);
+void        hist_add(HIST *hist, uint64_t value);
+void        hist_merge(HIST *hist, HIST *add);
+uint64_t    hist_pct(HIST *hist, double pct);
+void       *mem_alloc(long n);
+void        mem_free(void *p);
+void        mem_nic(char *dev);
+void        mem_share(void);
+void        mmsg_free(MMSG *mmsg);
+int         mmsg_recv(MMSG *mmsg, int fd);
+void        mmsg_recv_init(MMSG *mmsg, int n, int size, int ctl_size);
+int         mmsg_send(MMSG *mmsg, int fd);
+void        mmsg_send_init(MMSG *mmsg, int n, int size, SA *addr, socklen_t len);
 char       *qasprintf(char *fmt, ...);
 void       *qmalloc(long n);
 void        recv_sync(char *msg);
@@ -277,9 +570,42 @@ void        touch_data(void *p, int n);
 void        urgent(void);
 
 
+/*
+ * io_uring socket I/O engine in uring.c.
+ */
+typedef struct URING URING;
+
+void    uring_client_lat(URING *u);
+void    uring_close(URING *u);
+URING  *uring_open(int fd, int depth, int stream);
+void    uring_recv_bw(URING *u, USTAT *r);
+void    uring_send_bw(URING *u, USTAT *s);
+void    uring_server_lat(URING *u);
+
+
+/*
+ * Shared memory tests in shm.c.
+ */
+void    run_client_shm_bw(void);
+void    run_server_shm_bw(void);
+void    run_client_shm_lat(void);
+void    run_server_shm_lat(void);
+
+
+/*
+ * GPU memory in gpu.c.
+ */
+void   *gpu_alloc(long n, char *nic, int *fd, uint64_t *off);
+void    gpu_free(void *p);
+
+
 /*
  * Socket tests in socket.c.
  */
+void    set_nic(char *name);
+void    socket_addr(int fd, SS *sa);
+char   *socket_nic(int fd);
+void    tcp_sample(int *fds, int n, TCPI *tcpi);
 void    run_client_rds_bw(void);
 void    run_server_rds_bw(void);
 void    run_client_rds_lat(void);
@@ -294,12 +620,33 @@ void    run_client_sdp_lat(void);
 void    run_server_sdp_lat(void);
 void    run_client_tcp_bw(void);
 void    run_server_tcp_bw(void);
+void    run_client_tcp_bw_lat(void);
+void    run_server_tcp_bw_lat(void);
+void    run_client_tcp_conn_rate(void);
+void    run_server_tcp_conn_rate(void);
 void    run_client_tcp_lat(void);
 void    run_server_tcp_lat(void);
 void    run_client_udp_bw(void);
 void    run_server_udp_bw(void);
 void    run_client_udp_lat(void);
 void    run_server_udp_lat(void);
+void    run_client_unix_dgram_bw(void);
+void    run_server_unix_dgram_bw(void);
+void    run_client_unix_dgram_lat(void);
+void    run_server_unix_dgram_lat(void);
+void    run_client_unix_stream_bw(void);
+void    run_server_unix_stream_bw(void);
+void    run_client_unix_stream_lat(void);
+void    run_server_unix_stream_lat(void);
+
+
+/*
+ * AF_XDP tests in xdp.c.
+ */
+void    run_client_xdp_bw(void);
+void    run_server_xdp_bw(void);
+void    run_client_xdp_lat(void);
+void    run_server_xdp_lat(void);
 
 
 /*
@@ -311,22 +658,30 @@ void    run_client_rc_bi_bw(void);
 void    run_server_rc_bi_bw(void);
 void    run_client_rc_bw(void);
 void    run_server_rc_bw(void);
+void    run_client_rc_cm_conn_rate(void);
+void    run_server_rc_cm_conn_rate(void);
 void    run_client_rc_compare_swap_mr(void);
 void    run_server_rc_compare_swap_mr(void);
 void    run_client_rc_fetch_add_mr(void);
 void    run_server_rc_fetch_add_mr(void);
 void    run_client_rc_lat(void);
 void    run_server_rc_lat(void);
+void    run_client_rc_odp_fault_lat(void);
+void    run_server_rc_odp_fault_lat(void);
 void    run_client_rc_rdma_read_bw(void);
 void    run_server_rc_rdma_read_bw(void);
 void    run_client_rc_rdma_read_lat(void);
 void    run_server_rc_rdma_read_lat(void);
 void    run_client_rc_rdma_write_bw(void);
 void    run_server_rc_rdma_write_bw(void);
+void    run_client_rc_rdma_write_bw_lat(void);
+void    run_server_rc_rdma_write_bw_lat(void);
 void    run_client_rc_rdma_write_lat(void);
 void    run_server_rc_rdma_write_lat(void);
 void    run_client_rc_rdma_write_poll_lat(void);
 void    run_server_rc_rdma_write_poll_lat(void);
+void    run_client_reg_mr_lat(void);
+void    run_server_reg_mr_lat(void);
 void    run_client_uc_bi_bw(void);
 void    run_server_uc_bi_bw(void);
 void    run_client_uc_bw(void);
@@ -345,6 +700,10 @@ void    run_client_ud_bw(void);
 void    run_server_ud_bw(void);
 void    run_client_ud_lat(void);
 void    run_server_ud_lat(void);
+void    run_client_ud_mcast_bw(void);
+void    run_server_ud_mcast_bw(void);
+void    run_client_ud_mcast_lat(void);
+void    run_server_ud_mcast_lat(void);
 void    run_client_ver_rc_compare_swap(void);
 void    run_server_ver_rc_compare_swap(void);
 void    run_client_ver_rc_fetch_add(void);
@@ -361,6 +720,7 @@ void    run_server_xrc_lat(void);
  * Variables.
  */
 extern RES          Res;
+extern HIST         LatHist;
 extern REQ          Req;
 extern STAT         LStat;
 extern char        *Usage[];
@@ -370,4 +730,15 @@ extern SS           ServerAddr;
 extern int          ServerAddrLen;
 extern int          RemoteFD;
 extern int          Debug;
-extern volatile int Finished;
+extern int          OutFormat;
+extern volatile int FinishedFlag;
+extern volatile uint64_t Deadline;
+extern void        *SharedMem;
+
+
+/*
+ * A test is over once Finished is true.  SIGALRM normally sets FinishedFlag
+ * but with --timer_poll, no signal is sent and testing Finished reads the
+ * clock instead.
+ */
+#define Finished (FinishedFlag || (Deadline && past_deadline()))
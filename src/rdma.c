@@ -35,10 +35,12 @@
 #define _GNU_SOURCE
 #include <fcntl.h>
 #include <errno.h>
+#include <poll.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
 #include <netinet/in.h>
 #include <rdma/rdma_cma.h>
 #include <infiniband/verbs.h>
@@ -50,12 +52,15 @@
  */
 #define QKEY                0x11111111  /* Q_Key */
 #define NCQE                1024        /* Number of CQ entries */
+#define MAX_POST_LIST       64          /* Maximum work requests per post */
 #define GRH_SIZE            40          /* InfiniBand GRH size */
 #define MTU_SIZE            2048        /* Default MTU Size */
 #define RETRY_CNT           7           /* RC retry count */
 #define RNR_RETRY_CNT       7           /* RC RNR retry count */
 #define MIN_RNR_TIMER       12          /* RC Minimum RNR timer */
 #define LOCAL_ACK_TIMEOUT   14          /* RC local ACK timeout */
+#define MC_GROUP4           "239.255.0.81"  /* Default IPv4 multicast group */
+#define MC_GROUP6           "ff15::81"      /* Default IPv6 multicast group */
 
 
 /*
@@ -66,6 +71,20 @@
 #define WRID_RDMA   3                   /* RDMA */
 
 
+/*
+ * When only some work requests are signaled, the signaled one carries the
+ * number of work requests it completes above the low bits of its ID.  When
+ * several queue pairs are in use, the index of the one the request was posted
+ * on is kept in the upper 32 bits.
+ */
+#define WRID_SHIFT          8
+#define WRID_QP_SHIFT       32
+#define WRID_TYPE(id)       ((id) & ((1 << WRID_SHIFT) - 1))
+#define WRID_N(id)          (((id) & 0xFFFFFFFF) >> WRID_SHIFT)
+#define WRID_COUNT(id)      (WRID_N(id) ? WRID_N(id) : 1)
+#define WRID_QP(id)         ((uint64_t)(id) >> WRID_QP_SHIFT)
+
+
 /*
  * Constants.
  */
@@ -136,6 +155,31 @@ typedef struct CMINFO {
 } CMINFO;
 
 
+/*
+ * A connection being set up or torn down by rc_cm_conn_rate.
+ */
+typedef struct CMCONN {
+    struct rdma_cm_id *id;              /* RDMA id */
+    uint64_t           start;           /* Time set up began */
+    uint64_t           mark;            /* Time the current phase began */
+    struct CMCONN     *next;            /* Next on server */
+} CMCONN;
+
+
+/*
+ * A queue pair when more than one is in use.
+ */
+typedef struct QP {
+    struct ibv_qp   *qp;                /* Queue pair */
+    uint32_t         psn;               /* Local packet sequence number */
+    uint32_t         rqpn;              /* Remote queue pair number */
+    uint32_t         rpsn;              /* Remote packet sequence number */
+    int              send_room;         /* Send work requests we may post */
+    int              recv_room;         /* Receive work requests we may post */
+    int              unsignaled;        /* Unsignaled work requests posted */
+} QP;
+
+
 /*
  * RDMA device descriptor.
  */
@@ -151,15 +195,30 @@ typedef struct DEVICE {
     int              max_send_wr;       /* Maximum send work requests */
     int              max_recv_wr;       /* Maximum receive work requests */
     int              max_inline;        /* Maximum amount of inline data */
+    int              post_list;         /* Work requests per post */
+    int              sig_every;         /* Signal every Nth work request */
+    int              unsignaled;        /* Unsignaled work requests posted */
+    int              sig_flush;         /* Signal the last request posted */
+    int              armed;             /* CQ notification requested */
+    int              num_qps;           /* Number of queue pairs */
+    int              qp_next;           /* Next queue pair to post on */
+    int              sl;                /* Service level */
     char            *buffer;            /* Buffer */
     ibv_cc          *channel;           /* Channel */
     struct ibv_pd   *pd;                /* Protection domain */
     struct ibv_mr   *mr;                /* Memory region */
     struct ibv_cq   *cq;                /* Completion queue */
     struct ibv_qp   *qp;                /* Queue Pair */
+    QP              *qps;               /* All queue pairs if more than one */
     struct ibv_ah   *ah;                /* Address handle */
     struct ibv_srq  *srq;               /* Shared receive queue */
     ibv_xrc         *xrc;               /* XRC domain */
+    SS               mc_addr;           /* Multicast group address */
+    union ibv_gid    mc_gid;            /* Multicast group GID */
+    uint16_t         mc_lid;            /* Multicast group LID */
+    int              mc_attached;       /* Queue pairs attached to group */
+    int              gpu;               /* Buffer is in GPU memory */
+    int              shared;            /* Buffer is SharedMem */
 } DEVICE;
 
 
@@ -206,34 +265,75 @@ static void     ib_close2(DEVICE *dev);
 static void     ib_migrate(DEVICE *dev);
 static void     ib_open(DEVICE *dev);
 static void     ib_post_atomic(DEVICE *dev, ATOMIC atomic, int wrid,
-                            int offset, uint64_t compare_add, uint64_t swap);
+                int offset, int roffset, uint64_t compare_add, uint64_t swap);
 static void     ib_prep(DEVICE *dev);
+static void     ib_prep_qp(DEVICE *dev, struct ibv_qp *qp,
+                    struct ibv_qp_attr *rtr_attr, struct ibv_qp_attr *rts_attr);
+static void     mc_close(DEVICE *dev);
+static void     mc_open(DEVICE *dev, int max_send_wr, int max_recv_wr,
+                                                                int num_qps);
+static void     mc_params(long msg_size);
 static void     rd_bi_bw(int transport);
 static void     rd_client_bw(int transport);
+static void     rd_cm_conn_rate(void);
+static void     rd_cm_conn_qp(struct rdma_cm_id *id, struct ibv_pd **pd,
+                              struct ibv_cq **cq);
 static void     rd_client_rdma_bw(int transport, ibv_op opcode);
-static void     rd_client_rdma_read_lat(int transport);
+static void     rd_client_rdma_read_lat(int transport, int fault);
 static void     rd_close(DEVICE *dev);
+static void     rd_credit(DEVICE *dev, struct ibv_wc *wc, int n);
+static int      rd_depth(void);
+static void     rd_drop_pages(DEVICE *dev);
 static void     rd_mralloc(DEVICE *dev, int size);
+static void     rd_mralloc_gpu(DEVICE *dev, int size, char *nic, int flags);
 static void     rd_mrfree(DEVICE *dev);
+static void     rd_net_dir(struct ibv_context *context, int port);
+static void     rd_load_lat(DEVICE *dev);
+static int      rd_odp(DEVICE *dev);
 static void     rd_open(DEVICE *dev, int trans, int max_send_wr, int max_recv_wr);
+static void     rd_open_qps(DEVICE *dev, int trans, int max_send_wr,
+                            int max_recv_wr, int num_qps);
 static void     rd_params(int transport, long msg_size, int poll, int atomic);
 static int      rd_poll(DEVICE *dev, struct ibv_wc *wc, int nwc);
+static int      rd_poll_cq(DEVICE *dev, struct ibv_wc *wc, int nwc);
+static void     rd_post_params(DEVICE *dev, int depth);
 static void     rd_post_rdma_std(DEVICE *dev, ibv_op opcode, int n);
 static void     rd_post_recv_std(DEVICE *dev, int n);
 static void     rd_post_send(DEVICE *dev, int off, int len,
                                                 int inc, int rep, int stat);
+static int      rd_post_send_imm(DEVICE *dev, uint32_t imm);
 static void     rd_post_send_std(DEVICE *dev, int n);
+static int      rd_post_wrs(DEVICE *dev, struct ibv_send_wr *tmpl,
+                                                        int inc, int n);
 static void     rd_pp_lat(int transport, IOMODE iomode);
 static void     rd_pp_lat_loop(DEVICE *dev, IOMODE iomode);
 static void     rd_prep(DEVICE *dev, int size);
+static struct ibv_qp *rd_qp(DEVICE *dev, int i);
+static void     rd_rdma_bw_lat(int transport, ibv_op opcode);
 static void     rd_rdma_write_poll_lat(int transport);
+static void     rd_send_bw(DEVICE *dev, int depth);
+static int      rd_recv_total(DEVICE *dev);
+static void     rd_reg_mr_lat(void);
+static void     rd_server_atomic(void);
 static void     rd_server_def(int transport);
 static void     rd_server_nop(int transport, int size);
+static int      rd_spread(void);
 static int      maybe(int val, char *msg);
 static char    *opcode_name(int opcode);
 static void     show_node_info(DEVICE *dev);
 
 
+/*
+ * The device context and protection domain are kept open from one test to
+ * the next so that a session running many tests does not reopen the device
+ * for each of them.
+ */
+static char                KeptName[STRSIZE];
+static struct ibv_device **KeptDevList;
+static struct ibv_context *KeptContext;
+static struct ibv_pd      *KeptPD;
+
+
 /*
  * List of errors we can get from a CQE.
  */
@@ -367,10 +467,18 @@ run_server_rc_bi_bw(void)
 void
 run_client_rc_bw(void)
 {
+    par_use(L_MEM_GPU);
+    par_use(R_MEM_GPU);
     par_use(L_ACCESS_RECV);
     par_use(R_ACCESS_RECV);
     par_use(L_NO_MSGS);
     par_use(R_NO_MSGS);
+    par_use(L_POST_LIST);
+    par_use(R_POST_LIST);
+    par_use(L_QUEUE_DEPTH);
+    par_use(R_QUEUE_DEPTH);
+    par_use(L_SIG_EVERY);
+    par_use(R_SIG_EVERY);
     rd_params(IBV_QPT_RC, K64, 1, 0);
     rd_client_bw(IBV_QPT_RC);
     show_results(BANDWIDTH);
@@ -387,12 +495,44 @@ run_server_rc_bw(void)
 }
 
 
+/*
+ * Measure the RC connection rate using the Connection Manager (client side).
+ */
+void
+run_client_rc_cm_conn_rate(void)
+{
+    par_use(L_CONN_DEPTH);
+    par_use(R_CONN_DEPTH);
+    setv_u32(L_USE_CM, 1);
+    setv_u32(R_USE_CM, 1);
+    rd_params(IBV_QPT_RC, 0, 0, 0);
+    rd_cm_conn_rate();
+    show_results(CONN_RATE);
+}
+
+
+/*
+ * Measure the RC connection rate using the Connection Manager (server side).
+ */
+void
+run_server_rc_cm_conn_rate(void)
+{
+    rd_cm_conn_rate();
+}
+
+
 /*
  * Measure RC compare and swap messaging rate (client side).
  */
 void
 run_client_rc_compare_swap_mr(void)
 {
+    par_use(L_ATOMIC_SHARED);
+    par_use(R_ATOMIC_SHARED);
+    par_use(L_ATOMIC_SPREAD);
+    par_use(R_ATOMIC_SPREAD);
+    par_use(L_QUEUE_DEPTH);
+    par_use(R_QUEUE_DEPTH);
     ib_client_atomic(COMPARE_SWAP);
 }
 
@@ -403,7 +543,7 @@ run_client_rc_compare_swap_mr(void)
 void
 run_server_rc_compare_swap_mr(void)
 {
-    rd_server_nop(IBV_QPT_RC, sizeof(uint64_t));
+    rd_server_atomic();
 }
 
 
@@ -413,6 +553,12 @@ run_server_rc_compare_swap_mr(void)
 void
 run_client_rc_fetch_add_mr(void)
 {
+    par_use(L_ATOMIC_SHARED);
+    par_use(R_ATOMIC_SHARED);
+    par_use(L_ATOMIC_SPREAD);
+    par_use(R_ATOMIC_SPREAD);
+    par_use(L_QUEUE_DEPTH);
+    par_use(R_QUEUE_DEPTH);
     ib_client_atomic(FETCH_ADD);
 }
 
@@ -423,7 +569,7 @@ run_client_rc_fetch_add_mr(void)
 void
 run_server_rc_fetch_add_mr(void)
 {
-    rd_server_nop(IBV_QPT_RC, sizeof(uint64_t));
+    rd_server_atomic();
 }
 
 
@@ -433,6 +579,16 @@ run_server_rc_fetch_add_mr(void)
 void
 run_client_rc_lat(void)
 {
+    par_use(L_MEM_GPU);
+    par_use(R_MEM_GPU);
+    par_use(L_OFFERED_LOAD);
+    par_use(R_OFFERED_LOAD);
+    par_use(L_POISSON);
+    par_use(R_POISSON);
+    if (Req.offered_load[0]) {
+        par_use(L_QUEUE_DEPTH);
+        par_use(R_QUEUE_DEPTH);
+    }
     rd_params(IBV_QPT_RC, 1, 1, 0);
     rd_pp_lat(IBV_QPT_RC, IO_SR);
 }
@@ -448,16 +604,50 @@ run_server_rc_lat(void)
 }
 
 
+/*
+ * Measure RC RDMA read latency into On-Demand Paging memory whose pages were
+ * dropped so each read faults them back in (client side).
+ */
+void
+run_client_rc_odp_fault_lat(void)
+{
+    setp_str(0, L_MR_ODP, "explicit");
+    setp_str(0, R_MR_ODP, "explicit");
+    rd_params(IBV_QPT_RC, K64, 1, 0);
+    if (streq(Req.mr_odp, "none"))
+        error(0, "rc_odp_fault_lat needs --mr_odp explicit or implicit");
+    rd_client_rdma_read_lat(IBV_QPT_RC, 1);
+}
+
+
+/*
+ * Measure RC RDMA read latency into On-Demand Paging memory (server side).
+ */
+void
+run_server_rc_odp_fault_lat(void)
+{
+    rd_server_nop(IBV_QPT_RC, 0);
+}
+
+
 /*
  * Measure RC RDMA read bandwidth (client side).
  */
 void
 run_client_rc_rdma_read_bw(void)
 {
+    par_use(L_MEM_GPU);
+    par_use(R_MEM_GPU);
     par_use(L_ACCESS_RECV);
     par_use(R_ACCESS_RECV);
+    par_use(L_POST_LIST);
+    par_use(R_POST_LIST);
+    par_use(L_QUEUE_DEPTH);
+    par_use(R_QUEUE_DEPTH);
     par_use(L_RD_ATOMIC);
     par_use(R_RD_ATOMIC);
+    par_use(L_SIG_EVERY);
+    par_use(R_SIG_EVERY);
     rd_params(IBV_QPT_RC, K64, 1, 0);
     rd_client_rdma_bw(IBV_QPT_RC, IBV_WR_RDMA_READ);
     show_results(BANDWIDTH);
@@ -480,8 +670,10 @@ run_server_rc_rdma_read_bw(void)
 void
 run_client_rc_rdma_read_lat(void)
 {
+    par_use(L_MEM_GPU);
+    par_use(R_MEM_GPU);
     rd_params(IBV_QPT_RC, 1, 1, 0);
-    rd_client_rdma_read_lat(IBV_QPT_RC);
+    rd_client_rdma_read_lat(IBV_QPT_RC, 0);
 }
 
 
@@ -501,6 +693,14 @@ run_server_rc_rdma_read_lat(void)
 void
 run_client_rc_rdma_write_bw(void)
 {
+    par_use(L_MEM_GPU);
+    par_use(R_MEM_GPU);
+    par_use(L_POST_LIST);
+    par_use(R_POST_LIST);
+    par_use(L_QUEUE_DEPTH);
+    par_use(R_QUEUE_DEPTH);
+    par_use(L_SIG_EVERY);
+    par_use(R_SIG_EVERY);
     rd_params(IBV_QPT_RC, K64, 1, 0);
     rd_client_rdma_bw(IBV_QPT_RC, IBV_WR_RDMA_WRITE_WITH_IMM);
     show_results(BANDWIDTH);
@@ -517,12 +717,54 @@ run_server_rc_rdma_write_bw(void)
 }
 
 
+/*
+ * Measure RC latency while RDMA write bandwidth is measured alongside (client
+ * side).
+ */
+void
+run_client_rc_rdma_write_bw_lat(void)
+{
+    par_use(L_POST_LIST);
+    par_use(R_POST_LIST);
+    par_use(L_PROBE_SIZE);
+    par_use(R_PROBE_SIZE);
+    par_use(L_PROBE_SL);
+    par_use(R_PROBE_SL);
+    par_use(L_QUEUE_DEPTH);
+    par_use(R_QUEUE_DEPTH);
+    par_use(L_SIG_EVERY);
+    par_use(R_SIG_EVERY);
+    setp_u32(0, L_PROBE_SIZE, 1);
+    setp_u32(0, R_PROBE_SIZE, 1);
+    setp_u32(0, L_PROBE_SL, Req.sl);
+    setp_u32(0, R_PROBE_SL, getv_u32(R_SL));
+    rd_params(IBV_QPT_RC, K64, 0, 0);
+    if (Req.use_cm)
+        error(0, "rc_rdma_write_bw_lat cannot be used with --use_cm");
+    rd_rdma_bw_lat(IBV_QPT_RC, IBV_WR_RDMA_WRITE_WITH_IMM);
+    show_results(BANDWIDTH_LAT);
+}
+
+
+/*
+ * Measure RC latency while RDMA write bandwidth is measured alongside (server
+ * side).
+ */
+void
+run_server_rc_rdma_write_bw_lat(void)
+{
+    rd_rdma_bw_lat(IBV_QPT_RC, IBV_WR_RDMA_WRITE_WITH_IMM);
+}
+
+
 /*
  * Measure RC RDMA write latency (client side).
  */
 void
 run_client_rc_rdma_write_lat(void)
 {
+    par_use(L_MEM_GPU);
+    par_use(R_MEM_GPU);
     rd_params(IBV_QPT_RC, 1, 1, 0);
     rd_pp_lat(IBV_QPT_RC, IO_RDMA);
 }
@@ -560,6 +802,30 @@ run_server_rc_rdma_write_poll_lat(void)
 }
 
 
+/*
+ * Measure memory region registration and deregistration latency (client
+ * side).
+ */
+void
+run_client_reg_mr_lat(void)
+{
+    rd_params(IBV_QPT_RC, K64, 0, 0);
+    rd_reg_mr_lat();
+    show_results(LATENCY);
+}
+
+
+/*
+ * Measure memory region registration and deregistration latency (server
+ * side).
+ */
+void
+run_server_reg_mr_lat(void)
+{
+    rd_server_nop(IBV_QPT_RC, 0);
+}
+
+
 /*
  * Measure UC bi-directional bandwidth (client side).
  */
@@ -594,6 +860,12 @@ run_client_uc_bw(void)
     par_use(R_ACCESS_RECV);
     par_use(L_NO_MSGS);
     par_use(R_NO_MSGS);
+    par_use(L_POST_LIST);
+    par_use(R_POST_LIST);
+    par_use(L_QUEUE_DEPTH);
+    par_use(R_QUEUE_DEPTH);
+    par_use(L_SIG_EVERY);
+    par_use(R_SIG_EVERY);
     rd_params(IBV_QPT_UC, K64, 1, 0);
     rd_client_bw(IBV_QPT_UC);
     show_results(BANDWIDTH_SR);
@@ -616,6 +888,8 @@ run_server_uc_bw(void)
 void
 run_client_uc_lat(void)
 {
+    par_use(L_MEM_GPU);
+    par_use(R_MEM_GPU);
     rd_params(IBV_QPT_UC, 1, 1, 0);
     rd_pp_lat(IBV_QPT_UC, IO_SR);
 }
@@ -637,6 +911,12 @@ run_server_uc_lat(void)
 void
 run_client_uc_rdma_write_bw(void)
 {
+    par_use(L_POST_LIST);
+    par_use(R_POST_LIST);
+    par_use(L_QUEUE_DEPTH);
+    par_use(R_QUEUE_DEPTH);
+    par_use(L_SIG_EVERY);
+    par_use(R_SIG_EVERY);
     rd_params(IBV_QPT_UC, K64, 1, 0);
     rd_client_rdma_bw(IBV_QPT_UC, IBV_WR_RDMA_WRITE_WITH_IMM);
     show_results(BANDWIDTH_SR);
@@ -659,6 +939,8 @@ run_server_uc_rdma_write_bw(void)
 void
 run_client_uc_rdma_write_lat(void)
 {
+    par_use(L_MEM_GPU);
+    par_use(R_MEM_GPU);
     rd_params(IBV_QPT_UC, 1, 1, 0);
     rd_pp_lat(IBV_QPT_UC, IO_RDMA);
 }
@@ -730,6 +1012,12 @@ run_client_ud_bw(void)
     par_use(R_ACCESS_RECV);
     par_use(L_NO_MSGS);
     par_use(R_NO_MSGS);
+    par_use(L_POST_LIST);
+    par_use(R_POST_LIST);
+    par_use(L_QUEUE_DEPTH);
+    par_use(R_QUEUE_DEPTH);
+    par_use(L_SIG_EVERY);
+    par_use(R_SIG_EVERY);
     rd_params(IBV_QPT_UD, K2, 1, 0);
     rd_client_bw(IBV_QPT_UD);
     show_results(BANDWIDTH_SR);
@@ -752,6 +1040,16 @@ run_server_ud_bw(void)
 void
 run_client_ud_lat(void)
 {
+    par_use(L_MEM_GPU);
+    par_use(R_MEM_GPU);
+    par_use(L_OFFERED_LOAD);
+    par_use(R_OFFERED_LOAD);
+    par_use(L_POISSON);
+    par_use(R_POISSON);
+    if (Req.offered_load[0]) {
+        par_use(L_QUEUE_DEPTH);
+        par_use(R_QUEUE_DEPTH);
+    }
     rd_params(IBV_QPT_UD, 1, 1, 0);
     rd_pp_lat(IBV_QPT_UD, IO_SR);
 }
@@ -767,6 +1065,167 @@ run_server_ud_lat(void)
 }
 
 
+/*
+ * Measure UD multicast bandwidth (client side).
+ */
+void
+run_client_ud_mcast_bw(void)
+{
+    DEVICE dev;
+    int depth;
+
+    par_use(L_NO_MSGS);
+    par_use(R_NO_MSGS);
+    par_use(L_POST_LIST);
+    par_use(R_POST_LIST);
+    par_use(L_QUEUE_DEPTH);
+    par_use(R_QUEUE_DEPTH);
+    par_use(L_SIG_EVERY);
+    par_use(R_SIG_EVERY);
+    par_use(L_ACCESS_RECV);
+    par_use(R_ACCESS_RECV);
+    mc_params(K2);
+    depth = rd_depth();
+    client_send_request();
+    mc_open(&dev, depth, 0, 1);
+    rd_post_params(&dev, depth);
+    rd_send_bw(&dev, depth);
+    stop_test_timer();
+    exchange_results();
+    mc_close(&dev);
+    show_results(MULTICAST);
+}
+
+
+/*
+ * Measure UD multicast bandwidth (server side).  Each of the receivers is a
+ * queue pair attached to the group and counts what it gets separately.
+ */
+void
+run_server_ud_mcast_bw(void)
+{
+    DEVICE dev;
+    int depth = rd_depth();
+
+    mc_open(&dev, 0, depth, Req.mcast_receivers);
+    rd_post_params(&dev, depth);
+    rd_post_recv_std(&dev, rd_recv_total(&dev));
+    LStat.no_threads = dev.num_qps;
+    sync_test();
+    while (!Finished) {
+        int i;
+        struct ibv_wc wc[NCQE];
+        int n = rd_poll(&dev, wc, cardof(wc));
+
+        if (Finished)
+            break;
+        if (n > LStat.max_cqes)
+            LStat.max_cqes = n;
+        for (i = 0; i < n; ++i) {
+            USTAT *tr = &LStat.tr[WRID_QP(wc[i].wr_id)];
+
+            if (wc[i].status == IBV_WC_SUCCESS) {
+                tr->no_bytes += dev.msg_size;
+                tr->no_msgs++;
+                LStat.r.no_bytes += dev.msg_size;
+                LStat.r.no_msgs++;
+                if (Req.access_recv)
+                    touch_data(dev.buffer + GRH_SIZE, dev.msg_size);
+            } else {
+                do_error(wc[i].status, &tr->no_errs);
+                do_error(wc[i].status, &LStat.r.no_errs);
+            }
+        }
+        rd_post_recv_std(&dev, n);
+    }
+    stop_test_timer();
+    exchange_results();
+    mc_close(&dev);
+}
+
+
+/*
+ * Measure UD multicast latency (client side).
+ */
+void
+run_client_ud_mcast_lat(void)
+{
+    DEVICE dev;
+
+    mc_params(1);
+    client_send_request();
+    mc_open(&dev, 1, 1, 1);
+    rd_pp_lat_loop(&dev, IO_SR);
+    stop_test_timer();
+    exchange_results();
+    mc_close(&dev);
+    show_results(LATENCY);
+}
+
+
+/*
+ * Measure UD multicast latency (server side).  Every receiver gets each
+ * message but only the first answers it, by unicast to whoever sent it, and
+ * only its messages count towards the latency.
+ */
+void
+run_server_ud_mcast_lat(void)
+{
+    DEVICE dev;
+
+    mc_open(&dev, 1, 1, Req.mcast_receivers);
+    rd_post_recv_std(&dev, rd_recv_total(&dev));
+    LStat.no_threads = dev.num_qps;
+    sync_test();
+    while (!Finished) {
+        int i;
+        struct ibv_wc wc[NCQE];
+        int n = rd_poll(&dev, wc, cardof(wc));
+        int reply = 0;
+        int recv = 0;
+
+        if (Finished)
+            break;
+        for (i = 0; i < n; ++i) {
+            int q = WRID_QP(wc[i].wr_id);
+            int status = wc[i].status;
+
+            if (WRID_TYPE(wc[i].wr_id) == WRID_SEND) {
+                if (status != IBV_WC_SUCCESS)
+                    do_error(status, &LStat.s.no_errs);
+                continue;
+            }
+            ++recv;
+            if (status != IBV_WC_SUCCESS) {
+                do_error(status, &LStat.tr[q].no_errs);
+                continue;
+            }
+            LStat.tr[q].no_bytes += dev.msg_size;
+            LStat.tr[q].no_msgs++;
+            if (q != 0)
+                continue;
+            LStat.r.no_bytes += dev.msg_size;
+            LStat.r.no_msgs++;
+            if (!dev.ah) {
+                dev.ah = ibv_create_ah_from_wc(dev.pd, &wc[i],
+                                (struct ibv_grh *)dev.buffer, dev.ib.port);
+                if (!dev.ah)
+                    error(SYS, "failed to create address handle");
+                dev.rnode.qpn = wc[i].src_qp;
+            }
+            ++reply;
+        }
+        if (recv)
+            rd_post_recv_std(&dev, recv);
+        if (reply)
+            rd_post_send_std(&dev, reply);
+    }
+    stop_test_timer();
+    exchange_results();
+    mc_close(&dev);
+}
+
+
 #ifdef HAS_XRC
 /*
  * Measure XRC bi-directional bandwidth (client side).
@@ -802,6 +1261,12 @@ run_client_xrc_bw(void)
     par_use(R_ACCESS_RECV);
     par_use(L_NO_MSGS);
     par_use(R_NO_MSGS);
+    par_use(L_POST_LIST);
+    par_use(R_POST_LIST);
+    par_use(L_QUEUE_DEPTH);
+    par_use(R_QUEUE_DEPTH);
+    par_use(L_SIG_EVERY);
+    par_use(R_SIG_EVERY);
     rd_params(IBV_QPT_XRC, K64, 1, 0);
     rd_client_bw(IBV_QPT_XRC);
     show_results(BANDWIDTH);
@@ -855,7 +1320,7 @@ run_client_ver_rc_compare_swap(void)
 void
 run_server_ver_rc_compare_swap(void)
 {
-    rd_server_nop(IBV_QPT_RC, sizeof(uint64_t));
+    rd_server_atomic();
 }
 
 
@@ -875,7 +1340,7 @@ run_client_ver_rc_fetch_add(void)
 void
 run_server_ver_rc_fetch_add(void)
 {
-    rd_server_nop(IBV_QPT_RC, sizeof(uint64_t));
+    rd_server_atomic();
 }
 
 
@@ -886,42 +1351,63 @@ static void
 rd_client_bw(int transport)
 {
     DEVICE dev;
-    long sent = 0;
+    int depth = rd_depth();
 
-    rd_open(&dev, transport, NCQE, 0);
+    rd_open(&dev, transport, depth, 0);
+    rd_post_params(&dev, depth);
     rd_prep(&dev, 0);
+    rd_send_bw(&dev, depth);
+    stop_test_timer();
+    exchange_results();
+    rd_close(&dev);
+}
+
+
+/*
+ * Keep depth sends outstanding until the test is finished.
+ */
+static void
+rd_send_bw(DEVICE *dev, int depth)
+{
+    long sent = 0;
+    int n;
+
     sync_test();
-    rd_post_send_std(&dev, left_to_send(&sent, NCQE));
-    sent = NCQE;
+    n = left_to_send(&sent, depth);
+    if (Req.no_msgs && n >= Req.no_msgs)
+        dev->sig_flush = 1;
+    rd_post_send_std(dev, n);
+    sent = depth;
     while (!Finished) {
         int i;
         struct ibv_wc wc[NCQE];
-        int n = rd_poll(&dev, wc, cardof(wc));
+        int c = rd_poll(dev, wc, cardof(wc));
 
-        if (n > LStat.max_cqes)
-            LStat.max_cqes = n;
+        if (c > LStat.max_cqes)
+            LStat.max_cqes = c;
         if (Finished)
             break;
-        for (i = 0; i < n; ++i) {
+        n = 0;
+        for (i = 0; i < c; ++i) {
             int id = wc[i].wr_id;
             int status = wc[i].status;
 
-            if (id != WRID_SEND)
+            if (WRID_TYPE(id) != WRID_SEND)
                 debug("bad WR ID %d", id);
             else if (status != IBV_WC_SUCCESS)
                 do_error(status, &LStat.s.no_errs);
+            n += WRID_COUNT(id);
         }
         if (Req.no_msgs) {
             if (LStat.s.no_msgs + LStat.s.no_errs >= Req.no_msgs)
                 break;
             n = left_to_send(&sent, n);
+            if (sent + n >= Req.no_msgs)
+                dev->sig_flush = 1;
         }
-        rd_post_send_std(&dev, n);
+        rd_post_send_std(dev, n);
         sent += n;
     }
-    stop_test_timer();
-    exchange_results();
-    rd_close(&dev);
 }
 
 
@@ -933,10 +1419,12 @@ static void
 rd_server_def(int transport)
 {
     DEVICE dev;
+    int depth = rd_depth();
 
-    rd_open(&dev, transport, 0, NCQE);
+    rd_open(&dev, transport, 0, depth);
+    rd_post_params(&dev, depth);
     rd_prep(&dev, 0);
-    rd_post_recv_std(&dev, NCQE);
+    rd_post_recv_std(&dev, rd_recv_total(&dev));
     sync_test();
     while (!Finished) {
         int i;
@@ -979,7 +1467,7 @@ rd_bi_bw(int transport)
 
     rd_open(&dev, transport, NCQE, NCQE);
     rd_prep(&dev, 0);
-    rd_post_recv_std(&dev, NCQE);
+    rd_post_recv_std(&dev, rd_recv_total(&dev));
     sync_test();
     rd_post_send_std(&dev, NCQE);
     while (!Finished) {
@@ -997,7 +1485,7 @@ rd_bi_bw(int transport)
             int id = wc[i].wr_id;
             int status = wc[i].status;
 
-            switch (id) {
+            switch (WRID_TYPE(id)) {
             case WRID_SEND:
                 if (status != IBV_WC_SUCCESS)
                     do_error(status, &LStat.s.no_errs);
@@ -1036,9 +1524,17 @@ rd_pp_lat(int transport, IOMODE iomode)
 {
     DEVICE dev;
 
-    rd_open(&dev, transport, 1, 1);
-    rd_prep(&dev, 0);
-    rd_pp_lat_loop(&dev, iomode);
+    if (Req.offered_load[0]) {
+        int depth = rd_depth();
+
+        rd_open(&dev, transport, depth, depth);
+        rd_prep(&dev, 0);
+        rd_load_lat(&dev);
+    } else {
+        rd_open(&dev, transport, 1, 1);
+        rd_prep(&dev, 0);
+        rd_pp_lat_loop(&dev, iomode);
+    }
     stop_test_timer();
     exchange_results();
     rd_close(&dev);
@@ -1054,10 +1550,12 @@ static void
 rd_pp_lat_loop(DEVICE *dev, IOMODE iomode)
 {
     int done = 1;
+    uint64_t t = 0;
 
-    rd_post_recv_std(dev, 1);
+    rd_post_recv_std(dev, rd_recv_total(dev));
     sync_test();
     if (is_client()) {
+        t = get_nsecs();
         if (iomode == IO_SR)
             rd_post_send_std(dev, 1);
         else
@@ -1076,7 +1574,7 @@ rd_pp_lat_loop(DEVICE *dev, IOMODE iomode)
             int id = wc[i].wr_id;
             int status = wc[i].status;
 
-            switch (id) {
+            switch (WRID_TYPE(id)) {
             case WRID_SEND:
             case WRID_RDMA:
                 if (status != IBV_WC_SUCCESS)
@@ -1099,6 +1597,11 @@ rd_pp_lat_loop(DEVICE *dev, IOMODE iomode)
             break;
         }
         if (done == 3) {
+            if (is_client()) {
+                uint64_t now = get_nsecs();
+                hist_add(&LatHist, (now - t) / 2);
+                t = now;
+            }
             if (iomode == IO_SR)
                 rd_post_send_std(dev, 1);
             else
@@ -1109,6 +1612,109 @@ rd_pp_lat_loop(DEVICE *dev, IOMODE iomode)
 }
 
 
+/*
+ * Measure latency under an offered load.  The client sends on the schedule
+ * set by --offered_load for as long as it has send queue room, whether or not
+ * earlier messages have been answered, and the server echoes each one.  Since
+ * all receives land in the same buffer, a message carries a sequence number in
+ * its immediate data rather than a timestamp in its payload and the client
+ * remembers when each sequence number was due.  The completion queue is
+ * always polled so that sends are not held up waiting for an event.  On the
+ * client, ring holds the time each outstanding sequence number was due; on the
+ * server it holds the sequence numbers waiting for send queue room.
+ */
+static void
+rd_load_lat(DEVICE *dev)
+{
+    int i;
+    int n;
+    uint32_t seq = 0;
+    int room = dev->num_qps * dev->max_send_wr;
+    int slots = 4 * room;
+    uint64_t *ring = qmalloc(slots * sizeof(*ring));
+    int head = 0;
+    int tail = 0;
+
+    memset(ring, 0, slots * sizeof(*ring));
+    rd_post_recv_std(dev, rd_recv_total(dev));
+    sync_test();
+    if (is_client())
+        pace_init();
+
+    while (!Finished) {
+        struct ibv_wc wc[NCQE];
+
+        if (is_client()) {
+            while (room > 0) {
+                uint64_t t = pace_take();
+
+                if (!t)
+                    break;
+                ring[seq % slots] = t;
+                if (!rd_post_send_imm(dev, seq++))
+                    break;
+                room--;
+            }
+        } else {
+            while (room > 0 && head != tail) {
+                if (!rd_post_send_imm(dev, ring[head]))
+                    break;
+                head = (head + 1) % slots;
+                room--;
+            }
+        }
+
+        n = ibv_poll_cq(dev->cq, cardof(wc), wc);
+        if (n < 0) {
+            maybe(0, "CQ poll failed");
+            break;
+        }
+        rd_credit(dev, wc, n);
+        for (i = 0; i < n; ++i) {
+            uint64_t id = wc[i].wr_id;
+            int status = wc[i].status;
+
+            if (WRID_TYPE(id) == WRID_SEND) {
+                if (status != IBV_WC_SUCCESS)
+                    do_error(status, &LStat.s.no_errs);
+                room++;
+                continue;
+            }
+            if (WRID_TYPE(id) != WRID_RECV) {
+                debug("bad WR ID %d", (int)id);
+                continue;
+            }
+            if (status != IBV_WC_SUCCESS) {
+                do_error(status, &LStat.r.no_errs);
+                continue;
+            }
+            LStat.r.no_bytes += dev->msg_size;
+            LStat.r.no_msgs++;
+            rd_post_recv_std(dev, 1);
+            if (is_client()) {
+                uint64_t *t = &ring[ntohl(wc[i].imm_data) % slots];
+
+                if (*t) {
+                    hist_add(&LatHist, (get_nsecs() - *t) / 2);
+                    *t = 0;
+                } else
+                    LStat.r.no_errs++;
+            } else {
+                int next = (tail + 1) % slots;
+
+                if (next == head)
+                    LStat.s.no_errs++;
+                else {
+                    ring[tail] = ntohl(wc[i].imm_data);
+                    tail = next;
+                }
+            }
+        }
+    }
+    free(ring);
+}
+
+
 /*
  * Loop sending packets back and forth using RDMA Write and polling to measure
  * latency.  This is the strategy used by some of the MPIs.  Note that it does
@@ -1137,6 +1743,8 @@ rd_rdma_write_poll_lat(int transport)
     *q = locid;
     sync_test();
     while (!Finished) {
+        uint64_t t = get_nsecs();
+
         if (send) {
             int i;
             int n;
@@ -1148,11 +1756,12 @@ rd_rdma_write_poll_lat(int transport)
             n = ibv_poll_cq(dev.cq, cardof(wc), wc);
             if (n < 0)
                 error(SYS, "CQ poll failed");
+            rd_credit(&dev, wc, n);
             for (i = 0; i < n; ++i) {
                 int id = wc[i].wr_id;
                 int status = wc[i].status;
 
-                if (id != WRID_RDMA)
+                if (WRID_TYPE(id) != WRID_RDMA)
                     debug("bad WR ID %d", id);
                 else if (status != IBV_WC_SUCCESS)
                     do_error(status, &LStat.s.no_errs);
@@ -1163,6 +1772,8 @@ rd_rdma_write_poll_lat(int transport)
                 break;
         LStat.r.no_bytes += dev.msg_size;
         LStat.r.no_msgs++;
+        if (is_client() && !Finished)
+            hist_add(&LatHist, (get_nsecs() - t) / 2);
         *p = locid;
         *q = locid;
         send = 1;
@@ -1174,16 +1785,22 @@ rd_rdma_write_poll_lat(int transport)
 
 
 /*
- * Measure RDMA Read latency (client side).
+ * Measure RDMA Read latency (client side).  If fault is set, the buffer is
+ * On-Demand Paging memory and its pages are dropped before each read so that
+ * the adapter must fault them back in.
  */
 static void
-rd_client_rdma_read_lat(int transport)
+rd_client_rdma_read_lat(int transport, int fault)
 {
     DEVICE dev;
+    uint64_t t;
 
     rd_open(&dev, transport, 1, 0);
     rd_prep(&dev, 0);
     sync_test();
+    if (fault)
+        rd_drop_pages(&dev);
+    t = get_nsecs();
     rd_post_rdma_std(&dev, IBV_WR_RDMA_READ, 1);
     while (!Finished) {
         struct ibv_wc wc;
@@ -1193,7 +1810,7 @@ rd_client_rdma_read_lat(int transport)
             continue;
         if (Finished)
             break;
-        if (wc.wr_id != WRID_RDMA) {
+        if (WRID_TYPE(wc.wr_id) != WRID_RDMA) {
             debug("bad WR ID %d", (int)wc.wr_id);
             continue;
         }
@@ -1202,8 +1819,12 @@ rd_client_rdma_read_lat(int transport)
             LStat.r.no_msgs++;
             LStat.rem_s.no_bytes += dev.msg_size;
             LStat.rem_s.no_msgs++;
+            hist_add(&LatHist, get_nsecs() - t);
         } else
             do_error(wc.status, &LStat.s.no_errs);
+        if (fault)
+            rd_drop_pages(&dev);
+        t = get_nsecs();
         rd_post_rdma_std(&dev, IBV_WR_RDMA_READ, 1);
     }
     stop_test_timer();
@@ -1220,34 +1841,39 @@ static void
 rd_client_rdma_bw(int transport, ibv_op opcode)
 {
     DEVICE dev;
+    int depth = rd_depth();
 
-    rd_open(&dev, transport, NCQE, 0);
+    rd_open(&dev, transport, depth, 0);
+    rd_post_params(&dev, depth);
     rd_prep(&dev, 0);
     sync_test();
-    rd_post_rdma_std(&dev, opcode, NCQE);
+    rd_post_rdma_std(&dev, opcode, depth);
     while (!Finished) {
         int i;
         struct ibv_wc wc[NCQE];
-        int n = rd_poll(&dev, wc, cardof(wc));
+        int c = rd_poll(&dev, wc, cardof(wc));
+        int n = 0;
 
         if (Finished)
             break;
-        if (n > LStat.max_cqes)
-            LStat.max_cqes = n;
-        for (i = 0; i < n; ++i) {
+        if (c > LStat.max_cqes)
+            LStat.max_cqes = c;
+        for (i = 0; i < c; ++i) {
+            int k = WRID_COUNT(wc[i].wr_id);
             int status = wc[i].status;
 
             if (status == IBV_WC_SUCCESS) {
                 if (opcode == IBV_WR_RDMA_READ) {
-                    LStat.r.no_bytes += dev.msg_size;
-                    LStat.r.no_msgs++;
-                    LStat.rem_s.no_bytes += dev.msg_size;
-                    LStat.rem_s.no_msgs++;
+                    LStat.r.no_bytes += k * dev.msg_size;
+                    LStat.r.no_msgs += k;
+                    LStat.rem_s.no_bytes += k * dev.msg_size;
+                    LStat.rem_s.no_msgs += k;
                     if (Req.access_recv)
                         touch_data(dev.buffer, dev.msg_size);
                 }
             } else
                 do_error(status, &LStat.s.no_errs);
+            n += k;
         }
         rd_post_rdma_std(&dev, opcode, n);
     }
@@ -1258,10 +1884,393 @@ rd_client_rdma_bw(int transport, ibv_op opcode)
 
 
 /*
- * Server just waits and lets driver take care of any requests.
+ * Measure latency with a Send/Receive ping-pong on a queue pair of its own
+ * while RDMA requests flood another, as rd_client_rdma_bw and rd_server_def
+ * do.  The probe may use a different service level and message size.  A
+ * single thread on each side polls both completion queues without waiting so
+ * that neither traffic stream starves the other.  Probe traffic is left out
+ * of the statistics.
  */
 static void
-rd_server_nop(int transport, int size)
+rd_rdma_bw_lat(int transport, ibv_op opcode)
+{
+    DEVICE dev;
+    DEVICE probe;
+    int depth = rd_depth();
+    int done = 1;
+    uint64_t t = 0;
+
+    if (is_client())
+        rd_open(&dev, transport, depth, 0);
+    else
+        rd_open(&dev, transport, 0, depth);
+    rd_post_params(&dev, depth);
+    rd_prep(&dev, 0);
+    rd_open_qps(&probe, transport, 1, 1, 1);
+    probe.msg_size = Req.probe_size;
+    probe.sl = Req.probe_sl;
+    rd_prep(&probe, Req.probe_size);
+
+    if (!is_client())
+        rd_post_recv_std(&dev, rd_recv_total(&dev));
+    rd_post_recv_std(&probe, 1);
+    sync_test();
+    if (is_client()) {
+        rd_post_rdma_std(&dev, opcode, depth);
+        t = get_nsecs();
+        rd_post_send(&probe, 0, probe.msg_size, 0, 1, 0);
+        done = 0;
+    }
+
+    while (!Finished) {
+        int i;
+        int k = 0;
+        struct ibv_wc wc[NCQE];
+        int n = ibv_poll_cq(dev.cq, cardof(wc), wc);
+
+        if (n < 0)
+            n = maybe(0, "CQ poll failed");
+        if (n > LStat.max_cqes)
+            LStat.max_cqes = n;
+        rd_credit(&dev, wc, n);
+        for (i = 0; i < n; ++i) {
+            int status = wc[i].status;
+
+            if (is_client()) {
+                if (status != IBV_WC_SUCCESS)
+                    do_error(status, &LStat.s.no_errs);
+                k += WRID_COUNT(wc[i].wr_id);
+            } else if (status == IBV_WC_SUCCESS) {
+                LStat.r.no_bytes += dev.msg_size;
+                LStat.r.no_msgs++;
+                if (Req.access_recv)
+                    touch_data(dev.buffer, dev.msg_size);
+            } else
+                do_error(status, &LStat.r.no_errs);
+        }
+        if (is_client())
+            rd_post_rdma_std(&dev, opcode, k);
+        else
+            rd_post_recv_std(&dev, n);
+
+        n = ibv_poll_cq(probe.cq, 2, wc);
+        if (n < 0)
+            n = maybe(0, "CQ poll failed");
+        for (i = 0; i < n; ++i) {
+            int status = wc[i].status;
+
+            if (WRID_TYPE(wc[i].wr_id) == WRID_RECV) {
+                if (status != IBV_WC_SUCCESS)
+                    do_error(status, &LStat.r.no_errs);
+                rd_post_recv_std(&probe, 1);
+                done |= 2;
+            } else {
+                if (status != IBV_WC_SUCCESS)
+                    do_error(status, &LStat.s.no_errs);
+                done |= 1;
+            }
+        }
+        if (done == 3) {
+            if (is_client()) {
+                uint64_t now = get_nsecs();
+
+                hist_add(&LatHist, (now - t) / 2);
+                t = now;
+            }
+            rd_post_send(&probe, 0, probe.msg_size, 0, 1, 0);
+            done = 0;
+        }
+    }
+    stop_test_timer();
+    exchange_results();
+    rd_close(&probe);
+    rd_close(&dev);
+}
+
+
+/*
+ * Repeatedly register and deregister a memory region of the message size
+ * noting how long each takes.
+ */
+static void
+rd_reg_mr_lat(void)
+{
+    DEVICE dev;
+    char *buf;
+    int flags;
+    int implicit;
+
+    rd_open(&dev, IBV_QPT_RC, 1, 0);
+    rd_prep(&dev, 0);
+    buf = mem_alloc(Req.msg_size);
+    memset(buf, 0, Req.msg_size);
+    flags = IBV_ACCESS_LOCAL_WRITE  |
+            IBV_ACCESS_REMOTE_READ  |
+            IBV_ACCESS_REMOTE_WRITE |
+            rd_odp(&dev);
+    implicit = streq(Req.mr_odp, "implicit");
+    sync_test();
+    while (!Finished) {
+        struct ibv_mr *mr;
+        uint64_t t0 = get_nsecs();
+        uint64_t t1;
+        uint64_t t2;
+
+        if (implicit)
+            mr = ibv_reg_mr(dev.pd, 0, SIZE_MAX, flags);
+        else
+            mr = ibv_reg_mr(dev.pd, buf, Req.msg_size, flags);
+        if (!mr)
+            error(SYS, "failed to register memory region");
+        t1 = get_nsecs();
+        if (ibv_dereg_mr(mr) != 0)
+            error(SYS, "failed to deregister memory region");
+        t2 = get_nsecs();
+        LStat.r.no_bytes += Req.msg_size;
+        LStat.r.no_msgs++;
+        LStat.reg_mr_nsecs += t1 - t0;
+        LStat.dereg_mr_nsecs += t2 - t1;
+        hist_add(&LatHist, t2 - t0);
+    }
+    stop_test_timer();
+    exchange_results();
+    mem_free(buf);
+    rd_close(&dev);
+}
+
+
+/*
+ * Repeatedly set up and tear down RC connections using the Connection
+ * Manager.  The client keeps up to --conn_depth connections in progress at
+ * once, each with an id of its own, and times the address resolution, route
+ * resolution, queue pair creation and connection phases of each.  The server
+ * times queue pair creation and how long it takes from accepting to being
+ * established.  A connection is disconnected as soon as it is up.  All
+ * queue pairs share one protection domain and completion queue; no data is
+ * sent over them.
+ */
+static void
+rd_cm_conn_rate(void)
+{
+    int i;
+    int n = 0;
+    uint32_t port;
+    AI *aip = 0;
+    CMCONN *conns = 0;
+    CMCONN *serving = 0;
+    struct ibv_pd *pd = 0;
+    struct ibv_cq *cq = 0;
+    struct rdma_cm_id *listenID = 0;
+    struct rdma_event_channel *channel;
+    int timeout = Req.timeout * 1000;
+    struct rdma_conn_param param ={
+        .responder_resources = 1,
+        .initiator_depth     = 1,
+        .rnr_retry_count     = RNR_RETRY_CNT,
+        .retry_count         = RETRY_CNT
+    };
+
+    channel = rdma_create_event_channel();
+    if (!channel)
+        error(0, "rdma_create_event_channel failed");
+    if (fcntl(channel->fd, F_SETFL, O_NONBLOCK) < 0)
+        error(SYS, "failed to make RDMA CM channel non-blocking");
+
+    if (is_client()) {
+        struct addrinfo hints ={
+            .ai_family   = AF_INET,
+            .ai_socktype = SOCK_STREAM
+        };
+
+        client_send_request();
+        recv_mesg(&port, sizeof(port), "RDMA CM TCP IPv4 server port");
+        port = decode_uint32(&port);
+        aip = getaddrinfo_port(ServerName, port, &hints);
+        n = Req.conn_depth ? Req.conn_depth : 1;
+        conns = qmalloc(n * sizeof(*conns));
+        memset(conns, 0, n * sizeof(*conns));
+    } else {
+        struct sockaddr_in saddr ={
+            .sin_family      = AF_INET,
+            .sin_addr.s_addr = htonl(INADDR_ANY),
+            .sin_port        = htons(0)
+        };
+
+        if (rdma_create_id(channel, &listenID, 0, RDMA_PS_TCP) != 0)
+            error(0, "rdma_create_id failed");
+        if (rdma_bind_addr(listenID, (SA *)&saddr) != 0)
+            error(0, "rdma_bind_addr failed");
+        if (rdma_listen(listenID, SOMAXCONN) != 0)
+            error(0, "rdma_listen failed");
+        port = ntohs(rdma_get_src_port(listenID));
+        encode_uint32(&port, port);
+        send_mesg(&port, sizeof(port), "RDMA CM TCP IPv4 server port");
+    }
+
+    sync_test();
+    while (!Finished) {
+        struct pollfd pfd ={ .fd = channel->fd, .events = POLLIN };
+        struct rdma_cm_event *event;
+
+        for (i = 0; i < n; ++i) {
+            CMCONN *c = &conns[i];
+
+            if (c->id)
+                continue;
+            c->start = c->mark = get_nsecs();
+            if (rdma_create_id(channel, &c->id, c, RDMA_PS_TCP) != 0)
+                error(0, "rdma_create_id failed");
+            if (rdma_resolve_addr(c->id, 0, aip->ai_addr, timeout) != 0)
+                error(0, "rdma_resolve_addr failed");
+        }
+        if (poll(&pfd, 1, 100) <= 0)
+            continue;
+
+        while (rdma_get_cm_event(channel, &event) == 0) {
+            struct rdma_cm_id *id = event->id;
+            CMCONN *c = id->context;
+            uint64_t t = get_nsecs();
+            int done = 0;
+
+            switch (event->event) {
+            case RDMA_CM_EVENT_ADDR_RESOLVED:
+                LStat.addr_nsecs += t - c->mark;
+                c->mark = t;
+                if (rdma_resolve_route(id, timeout) != 0)
+                    error(0, "rdma_resolve_route failed");
+                break;
+            case RDMA_CM_EVENT_ROUTE_RESOLVED:
+                LStat.route_nsecs += t - c->mark;
+                rd_cm_conn_qp(id, &pd, &cq);
+                c->mark = get_nsecs();
+                LStat.create_nsecs += c->mark - t;
+                if (rdma_connect(id, &param) != 0)
+                    error(0, "rdma_connect failed");
+                break;
+            case RDMA_CM_EVENT_CONNECT_REQUEST:
+                c = qmalloc(sizeof(*c));
+                c->id = id;
+                c->start = t;
+                c->next = serving;
+                serving = c;
+                id->context = c;
+                rd_cm_conn_qp(id, &pd, &cq);
+                c->mark = get_nsecs();
+                LStat.create_nsecs += c->mark - t;
+                if (rdma_accept(id, &param) != 0)
+                    error(0, "rdma_accept failed");
+                break;
+            case RDMA_CM_EVENT_ESTABLISHED:
+                LStat.connect_nsecs += t - c->mark;
+                LStat.r.no_msgs++;
+                if (is_client()) {
+                    hist_add(&LatHist, t - c->start);
+                    if (rdma_disconnect(id) != 0)
+                        error(0, "rdma_disconnect failed");
+                }
+                break;
+            case RDMA_CM_EVENT_DISCONNECTED:
+                done = 1;
+                break;
+            case RDMA_CM_EVENT_ADDR_ERROR:
+            case RDMA_CM_EVENT_ROUTE_ERROR:
+            case RDMA_CM_EVENT_CONNECT_ERROR:
+            case RDMA_CM_EVENT_UNREACHABLE:
+            case RDMA_CM_EVENT_REJECTED:
+                LStat.r.no_errs++;
+                done = 1;
+                break;
+            default:
+                break;
+            }
+            rdma_ack_cm_event(event);
+            if (!done)
+                continue;
+            if (id->qp)
+                rdma_destroy_qp(id);
+            rdma_destroy_id(id);
+            if (is_client())
+                c->id = 0;
+            else {
+                CMCONN **p = &serving;
+
+                while (*p != c)
+                    p = &(*p)->next;
+                *p = c->next;
+                free(c);
+            }
+        }
+    }
+    stop_test_timer();
+
+    for (i = 0; i < n; ++i) {
+        if (!conns[i].id)
+            continue;
+        if (conns[i].id->qp)
+            rdma_destroy_qp(conns[i].id);
+        rdma_destroy_id(conns[i].id);
+    }
+    while (serving) {
+        CMCONN *c = serving;
+
+        serving = c->next;
+        if (c->id->qp)
+            rdma_destroy_qp(c->id);
+        rdma_destroy_id(c->id);
+        free(c);
+    }
+    if (listenID)
+        rdma_destroy_id(listenID);
+    if (cq)
+        ibv_destroy_cq(cq);
+    if (pd)
+        ibv_dealloc_pd(pd);
+    rdma_destroy_event_channel(channel);
+    if (aip)
+        freeaddrinfo(aip);
+    free(conns);
+    exchange_results();
+}
+
+
+/*
+ * Create the queue pair of a connection being set up by rd_cm_conn_rate.  The
+ * protection domain and completion queue are made along with the first.
+ */
+static void
+rd_cm_conn_qp(struct rdma_cm_id *id, struct ibv_pd **pd, struct ibv_cq **cq)
+{
+    struct ibv_qp_init_attr qp_attr ={
+        .cap     ={
+            .max_send_wr     = 1,
+            .max_recv_wr     = 1,
+            .max_send_sge    = 1,
+            .max_recv_sge    = 1,
+        },
+        .qp_type = IBV_QPT_RC
+    };
+
+    if (!*pd) {
+        *pd = ibv_alloc_pd(id->verbs);
+        if (!*pd)
+            error(SYS, "failed to allocate protection domain");
+        *cq = ibv_create_cq(id->verbs, 1, 0, 0, 0);
+        if (!*cq)
+            error(SYS, "failed to create completion queue");
+    } else if ((*pd)->context != id->verbs)
+        error(0, "connections were made through more than one device");
+    qp_attr.send_cq = *cq;
+    qp_attr.recv_cq = *cq;
+    if (rdma_create_qp(id, *pd, &qp_attr) != 0)
+        error(SYS, "failed to create QP");
+}
+
+
+/*
+ * Server just waits and lets driver take care of any requests.
+ */
+static void
+rd_server_nop(int transport, int size)
 {
     DEVICE dev;
 
@@ -1278,54 +2287,102 @@ rd_server_nop(int transport, int size)
 
 
 /*
- * Measure messaging rate for an atomic operation.
+ * Server side of the atomic tests.  The client aims its atomics at words a
+ * cache line apart; there is one for each of the atomic_spread lines or for
+ * each of its queue pairs, whichever is more.  If atomic_shared is set, the
+ * words are in SharedMem so all the clients of this server contend for them.
+ */
+static void
+rd_server_atomic(void)
+{
+    DEVICE dev;
+    int n = rd_spread();
+
+    if (n < Req.num_qps)
+        n = Req.num_qps;
+    rd_open(&dev, IBV_QPT_RC, 0, 1);
+    dev.shared = Req.atomic_shared;
+    rd_prep(&dev, n * CACHE_LINE);
+    sync_test();
+    while (!Finished)
+        pause();
+    stop_test_timer();
+    exchange_results();
+    rd_close(&dev);
+}
+
+
+/*
+ * Measure messaging rate for an atomic operation.  We keep queue_depth atomics
+ * outstanding, spread round robin over the queue pairs, and aim each at the
+ * next of the atomic_spread words on the server.  The time each atomic takes
+ * to complete is noted in LatHist.
  */
 static void
 ib_client_atomic(ATOMIC atomic)
 {
     int i;
+    int depth;
+    int spread;
     DEVICE dev;
+    uint64_t *posted;
+    int next = 0;
 
     rd_params(IBV_QPT_RC, 0, 1, 1);
-    rd_open(&dev, IBV_QPT_RC, NCQE, 0);
+    depth = rd_depth();
+    spread = rd_spread();
+    rd_open(&dev, IBV_QPT_RC, depth, 0);
     rd_prep(&dev, sizeof(uint64_t));
+    posted = qmalloc(depth * sizeof(*posted));
     sync_test();
 
-    for (i = 0; i < NCQE; ++i) {
+    for (i = 0; i < depth; ++i) {
         if (Finished)
             break;
-        ib_post_atomic(&dev, atomic, 0, 0, 0, 0);
+        posted[i] = get_nsecs();
+        ib_post_atomic(&dev, atomic, i, 0, next * CACHE_LINE, 0, 0);
+        next = (next + 1) % spread;
     }
 
     while (!Finished) {
         struct ibv_wc wc[NCQE];
-        int n = rd_poll(&dev, wc, cardof(wc));
+        int n = rd_poll_cq(&dev, wc, cardof(wc));
+        uint64_t now;
 
         if (Finished)
             break;
         if (n > LStat.max_cqes)
             LStat.max_cqes = n;
+        now = get_nsecs();
         for (i = 0; i < n; ++i) {
+            int x = wc[i].wr_id;
             int status = wc[i].status;
 
             if (status == IBV_WC_SUCCESS) {
                 LStat.rem_r.no_bytes += sizeof(uint64_t);
                 LStat.rem_r.no_msgs++;
+                hist_add(&LatHist, now - posted[x]);
             } else
                 do_error(status, &LStat.s.no_errs);
-            ib_post_atomic(&dev, atomic, 0, 0, 0, 0);
+            posted[x] = now;
+            ib_post_atomic(&dev, atomic, x, 0, next * CACHE_LINE, 0, 0);
+            next = (next + 1) % spread;
         }
     }
 
     stop_test_timer();
     exchange_results();
+    free(posted);
     rd_close(&dev);
     show_results(MSG_RATE);
 }
 
 
 /*
- * Verify RC compare and swap (client side).
+ * Verify an atomic operation (client side).  Slot i is posted on queue pair
+ * i % num_qps and each queue pair aims at a word of its own.  Completions on
+ * a queue pair arrive in the order its atomics were posted so the value each
+ * returns can be checked against the sequence expected on that word.
  */
 static void
 ib_client_verify_atomic(ATOMIC atomic)
@@ -1333,10 +2390,14 @@ ib_client_verify_atomic(ATOMIC atomic)
     int i;
     int slots;
     DEVICE dev;
-    int head = 0;
-    int tail = 0;
+    int *head;
+    int *tail;
+    uint64_t *posted;
     uint64_t args[2] = {0};
 
+    /* Atomics from other clients would upset the sequence we check */
+    setv_u32(L_ATOMIC_SHARED, 0);
+    setv_u32(R_ATOMIC_SHARED, 0);
     rd_params(IBV_QPT_RC, K64, 1, 1);
     rd_open(&dev, IBV_QPT_RC, NCQE, 0);
     slots = Req.msg_size / sizeof(uint64_t);
@@ -1345,48 +2406,66 @@ ib_client_verify_atomic(ATOMIC atomic)
     if (slots > NCQE)
         slots = NCQE;
     rd_prep(&dev, 0);
+    head = qmalloc(dev.num_qps * sizeof(*head));
+    tail = qmalloc(dev.num_qps * sizeof(*tail));
+    memset(head, 0, dev.num_qps * sizeof(*head));
+    memset(tail, 0, dev.num_qps * sizeof(*tail));
+    posted = qmalloc(slots * sizeof(*posted));
     sync_test();
 
     for (i = 0; i < slots; ++i) {
+        int q = i % dev.num_qps;
+
         if (Finished)
             break;
-        atomic_seq(atomic, head++, 0, args);
-        ib_post_atomic(&dev, atomic, i, i*sizeof(uint64_t), args[0], args[1]);
+        atomic_seq(atomic, head[q]++, 0, args);
+        posted[i] = get_nsecs();
+        ib_post_atomic(&dev, atomic, i, i*sizeof(uint64_t), q*CACHE_LINE,
+                                                            args[0], args[1]);
     }
 
     while (!Finished) {
         struct ibv_wc wc[NCQE];
-        int n = rd_poll(&dev, wc, cardof(wc));
+        int n = rd_poll_cq(&dev, wc, cardof(wc));
+        uint64_t now;
 
         if (Finished)
             break;
         if (n > LStat.max_cqes)
             LStat.max_cqes = n;
+        now = get_nsecs();
         for (i = 0; i < n; ++i) {
             uint64_t seen;
             uint64_t want = 0;
             int x = wc[i].wr_id;
+            int q = x % dev.num_qps;
             int status = wc[i].status;
 
             if (status == IBV_WC_SUCCESS) {
                 LStat.rem_r.no_bytes += sizeof(uint64_t);
                 LStat.rem_r.no_msgs++;
+                hist_add(&LatHist, now - posted[x]);
             } else
                 do_error(status, &LStat.s.no_errs);
 
-            atomic_seq(atomic, tail++, &want, 0);
+            atomic_seq(atomic, tail[q]++, &want, 0);
             seen = ((uint64_t *)dev.buffer)[x];
             if (seen != want) {
-                error(0, "mismatch, sequence %d, expected %llx, got %llx",
-                                    tail, (long long)want, (long long)seen);
+                error(0, "mismatch, queue pair %d, sequence %d, "
+                         "expected %llx, got %llx",
+                         q, tail[q], (long long)want, (long long)seen);
             }
-            atomic_seq(atomic, head++, 0, args);
-            ib_post_atomic(&dev, atomic, x, x*sizeof(uint64_t),
+            atomic_seq(atomic, head[q]++, 0, args);
+            posted[x] = now;
+            ib_post_atomic(&dev, atomic, x, x*sizeof(uint64_t), q*CACHE_LINE,
                                                             args[0], args[1]);
         }
     }
     stop_test_timer();
     exchange_results();
+    free(posted);
+    free(tail);
+    free(head);
     rd_close(&dev);
     show_results(MSG_RATE);
 }
@@ -1446,6 +2525,20 @@ rd_params(int transport, long msg_size, int poll, int atomic)
         par_use(L_SRC_PATH_BITS);
         par_use(R_SRC_PATH_BITS);
     }
+    par_use(L_MEM_HUGE);
+    par_use(R_MEM_HUGE);
+    par_use(L_MEM_NODE);
+    par_use(R_MEM_NODE);
+    par_use(L_MR_ODP);
+    par_use(R_MR_ODP);
+
+    if (transport != IBV_QPT_UD && !Req.use_cm) {
+        par_use(L_NUM_QPS);
+        par_use(R_NUM_QPS);
+    } else {
+        setv_u32(L_NUM_QPS, 0);
+        setv_u32(R_NUM_QPS, 0);
+    }
 
     if (msg_size) {
         setp_u32(0, L_MSG_SIZE, msg_size);
@@ -1455,6 +2548,8 @@ rd_params(int transport, long msg_size, int poll, int atomic)
     if (poll) {
         par_use(L_POLL_MODE);
         par_use(R_POLL_MODE);
+        par_use(L_CQ_SPIN);
+        par_use(R_CQ_SPIN);
     }
 
     if (atomic) {
@@ -1465,6 +2560,50 @@ rd_params(int transport, long msg_size, int poll, int atomic)
 }
 
 
+/*
+ * Return the number of work requests to keep outstanding.
+ */
+static int
+rd_depth(void)
+{
+    return Req.queue_depth ? Req.queue_depth : NCQE;
+}
+
+
+/*
+ * Return the number of cache lines that atomics are spread over.
+ */
+static int
+rd_spread(void)
+{
+    int n = Req.atomic_spread ? Req.atomic_spread : 1;
+
+    if (n > MAX_SPREAD)
+        error(0, "atomic spread %d too large; maximum is %d", n, MAX_SPREAD);
+    return n;
+}
+
+
+/*
+ * Set how work requests are posted and signaled.  Called after rd_open.
+ */
+static void
+rd_post_params(DEVICE *dev, int depth)
+{
+    if (Req.post_list > MAX_POST_LIST)
+        error(0, "post list %d too large; maximum is %d",
+                                                Req.post_list, MAX_POST_LIST);
+    if (Req.sig_every > depth)
+        error(0, "sig_every %d exceeds the queue depth of %d",
+                                                Req.sig_every, depth);
+    if (dev->num_qps > 1 && Req.sig_every > dev->max_send_wr)
+        error(0, "sig_every %d exceeds the queue depth of %d per QP",
+                                        Req.sig_every, dev->max_send_wr);
+    dev->post_list = Req.post_list;
+    dev->sig_every = Req.sig_every;
+}
+
+
 /*
  * Open a RDMA device.
  */
@@ -1475,6 +2614,18 @@ rd_open(DEVICE *dev, int trans, int max_send_wr, int max_recv_wr)
     if (is_client())
         client_send_request();
 
+    rd_open_qps(dev, trans, max_send_wr, max_recv_wr, Req.num_qps);
+}
+
+
+/*
+ * Open a RDMA device with num_qps queue pairs.  Unlike rd_open, this does not
+ * send the request so a test may use it to open a second device.
+ */
+static void
+rd_open_qps(DEVICE *dev, int trans, int max_send_wr, int max_recv_wr,
+                                                                int num_qps)
+{
     /* Clear structure */
     memset(dev, 0, sizeof(*dev));
 
@@ -1482,6 +2633,23 @@ rd_open(DEVICE *dev, int trans, int max_send_wr, int max_recv_wr)
     dev->trans = trans;
     dev->max_send_wr = max_send_wr;
     dev->max_recv_wr = max_recv_wr;
+    dev->sl = Req.sl;
+
+    /* Split the work requests among the queue pairs */
+    dev->num_qps = 1;
+    if (num_qps > 1 && trans != IBV_QPT_UD) {
+        int n = num_qps;
+
+        dev->num_qps = n;
+        if (max_send_wr)
+            dev->max_send_wr = (max_send_wr + n - 1) / n;
+#ifdef HAS_XRC
+        if (max_recv_wr && trans != IBV_QPT_XRC)
+#else
+        if (max_recv_wr)
+#endif
+            dev->max_recv_wr = (max_recv_wr + n - 1) / n;
+    }
 
     /* Open device */
     if (Req.use_cm)
@@ -1530,6 +2698,34 @@ rd_prep(DEVICE *dev, int size)
         dec_node(&dev->rnode);
     }
 
+    /* Exchange the numbers of the other queue pairs */
+    if (dev->qps) {
+        int i;
+        int n = (dev->num_qps - 1) * 2 * sizeof(uint32_t);
+        char *buf = qmalloc(n);
+
+        enc_init(buf);
+        for (i = 1; i < dev->num_qps; ++i) {
+            enc_int(dev->qps[i].qp->qp_num, sizeof(uint32_t));
+            enc_int(dev->qps[i].psn,        sizeof(uint32_t));
+        }
+        if (is_client()) {
+            send_mesg(buf, n, "queue pair information");
+            recv_mesg(buf, n, "queue pair information");
+        } else {
+            recv_mesg(buf, n, "queue pair information");
+            send_mesg(buf, n, "queue pair information");
+        }
+        dec_init(buf);
+        for (i = 1; i < dev->num_qps; ++i) {
+            dev->qps[i].rqpn = dec_int(sizeof(uint32_t));
+            dev->qps[i].rpsn = dec_int(sizeof(uint32_t));
+        }
+        dev->qps[0].rqpn = dev->rnode.qpn;
+        dev->qps[0].rpsn = dev->rnode.psn;
+        free(buf);
+    }
+
     /* Second phase of open for devices */
     if (Req.use_cm) 
         cm_prep(dev);
@@ -1540,6 +2736,7 @@ rd_prep(DEVICE *dev, int size)
     if (!Req.poll_mode) {
         if (ibv_req_notify_cq(dev->cq, 0) != 0)
             error(SYS, "failed to request CQ notification");
+        dev->armed = 1;
     }
 
     /* Show node information if debugging */
@@ -1607,7 +2804,7 @@ rd_close(DEVICE *dev)
         ibv_destroy_ah(dev->ah);
     if (dev->cq)
         ibv_destroy_cq(dev->cq);
-    if (dev->pd)
+    if (dev->pd && dev->pd != KeptPD)
         ibv_dealloc_pd(dev->pd);
     if (dev->channel)
         ibv_destroy_comp_channel(dev->channel);
@@ -1620,12 +2817,32 @@ rd_close(DEVICE *dev)
 }
 
 
+/*
+ * If network counters were requested, note where those of the port are.
+ */
+static void
+rd_net_dir(struct ibv_context *context, int port)
+{
+    char *dir;
+
+    if (!Req.net_counters)
+        return;
+    dir = qasprintf("/sys/class/infiniband/%s/ports/%d",
+                    ibv_get_device_name(context->device), port);
+    net_dir(dir);
+    free(dir);
+}
+
+
 /*
  * Create a queue pair.
  */
 static void
 rd_create_qp(DEVICE *dev, struct ibv_context *context, struct rdma_cm_id *id)
 {
+    if (id)
+        rd_net_dir(context, id->port_num);
+
     /* Set up and verify rd_atomic parameters */
     {
         struct ibv_device_attr dev_attr;
@@ -1639,6 +2856,9 @@ rd_create_qp(DEVICE *dev, struct ibv_context *context, struct rdma_cm_id *id)
         else
             error(0, "device only supports %d (< %d) RDMA reads or atomics",
                                     dev_attr.max_qp_rd_atom, Req.rd_atomic);
+        if (dev->num_qps > dev_attr.max_qp)
+            error(0, "device only supports %d (< %d) queue pairs",
+                                            dev_attr.max_qp, dev->num_qps);
     }
 
     /* Allocate completion channel */
@@ -1647,13 +2867,20 @@ rd_create_qp(DEVICE *dev, struct ibv_context *context, struct rdma_cm_id *id)
         error(SYS, "failed to create completion channel");
 
     /* Allocate protection domain */
-    dev->pd = ibv_alloc_pd(context);
-    if (!dev->pd)
-        error(SYS, "failed to allocate protection domain");
+    if (!id && KeptPD)
+        dev->pd = KeptPD;
+    else {
+        dev->pd = ibv_alloc_pd(context);
+        if (!dev->pd)
+            error(SYS, "failed to allocate protection domain");
+        if (!id)
+            KeptPD = dev->pd;
+    }
 
     /* Create completion queue */
     dev->cq = ibv_create_cq(context,
-                        dev->max_send_wr+dev->max_recv_wr, 0, dev->channel, 0);
+                        dev->num_qps*dev->max_send_wr + rd_recv_total(dev),
+                                                        0, dev->channel, 0);
     if (!dev->cq)
         error(SYS, "failed to create completion queue");
 
@@ -1703,11 +2930,53 @@ rd_create_qp(DEVICE *dev, struct ibv_context *context, struct rdma_cm_id *id)
             dev->qp = ibv_create_qp(dev->pd, &qp_attr);
             if (!dev->qp)
                 error(SYS, "failed to create QP");
+
+            /* Create the remaining queue pairs */
+            if (dev->num_qps > 1) {
+                int i;
+
+                dev->qps = qmalloc(dev->num_qps * sizeof(*dev->qps));
+                memset(dev->qps, 0, dev->num_qps * sizeof(*dev->qps));
+                for (i = 0; i < dev->num_qps; ++i) {
+                    QP *q = &dev->qps[i];
+
+                    q->qp = i ? ibv_create_qp(dev->pd, &qp_attr) : dev->qp;
+                    if (!q->qp)
+                        error(SYS, "failed to create QP %d", i);
+                    q->send_room = dev->max_send_wr;
+                    q->recv_room = dev->max_recv_wr;
+                }
+            }
         }
     }
 }
 
 
+/*
+ * Return queue pair i.
+ */
+static struct ibv_qp *
+rd_qp(DEVICE *dev, int i)
+{
+    return dev->qps ? dev->qps[i].qp : dev->qp;
+}
+
+
+/*
+ * Return the total number of receives that may be outstanding.  With XRC,
+ * they are all posted to the one shared receive queue.
+ */
+static int
+rd_recv_total(DEVICE *dev)
+{
+#ifdef HAS_XRC
+    if (dev->trans == IBV_QPT_XRC)
+        return dev->max_recv_wr;
+#endif
+    return dev->max_recv_wr * dev->num_qps;
+}
+
+
 /*
  * Allocate a memory region and register it.  I thought this routine should
  * never be called with a size of 0 as prior code checks for that and sets it
@@ -1718,23 +2987,41 @@ static void
 rd_mralloc(DEVICE *dev, int size)
 {
     int flags;
-    int pagesize;
+    char *nic;
 
     if (dev->buffer)
         error(BUG, "rd_mralloc: memory region already allocated");
     if (size == 0)
         size = 1;
 
-    pagesize = sysconf(_SC_PAGESIZE);
-    if (posix_memalign((void **)&dev->buffer, pagesize, size) != 0)
-        error(SYS, "failed to allocate memory");
-    memset(dev->buffer, 0, size);
-    dev->buf_size = size;
+    nic = qasprintf("%s/device", dev->pd->context->device->ibdev_path);
+    mem_nic(nic);
     flags = IBV_ACCESS_LOCAL_WRITE  |
             IBV_ACCESS_REMOTE_READ  |
             IBV_ACCESS_REMOTE_WRITE |
             IBV_ACCESS_REMOTE_ATOMIC;
-    dev->mr = ibv_reg_mr(dev->pd, dev->buffer, size, flags);
+    if (Req.mem_gpu[0] && !streq(Req.mem_gpu, "none")) {
+        rd_mralloc_gpu(dev, size, nic, flags);
+        free(nic);
+        return;
+    }
+    free(nic);
+    if (dev->shared) {
+        if (size > MAX_SPREAD * CACHE_LINE)
+            error(0, "shared atomic words cover more than %d cache lines",
+                                                                MAX_SPREAD);
+        dev->buffer = SharedMem;
+    } else {
+        dev->buffer = mem_alloc(size);
+        if (Req.access_recv != ACCESS_VERIFY)
+            memset(dev->buffer, 0, size);
+    }
+    dev->buf_size = size;
+    flags |= rd_odp(dev);
+    if (streq(Req.mr_odp, "implicit"))
+        dev->mr = ibv_reg_mr(dev->pd, 0, SIZE_MAX, flags);
+    else
+        dev->mr = ibv_reg_mr(dev->pd, dev->buffer, size, flags);
     if (!dev->mr)
         error(SYS, "failed to allocate memory region");
     dev->lnode.rkey = dev->mr->rkey;
@@ -1742,6 +3029,82 @@ rd_mralloc(DEVICE *dev, int size)
 }
 
 
+/*
+ * Allocate the memory region from GPU memory and register the dma-buf that
+ * the GPU runtime exports for it.  The processor cannot touch the buffer so
+ * data is never sent inline from it.
+ */
+static void
+rd_mralloc_gpu(DEVICE *dev, int size, char *nic, int flags)
+{
+#ifdef HAS_DMABUF
+    int fd;
+    uint64_t off;
+
+    if (Req.mr_odp[0] && !streq(Req.mr_odp, "none"))
+        error(0, "On-Demand Paging cannot be used with GPU memory");
+    if (Req.access_recv)
+        error(0, "received data cannot be accessed in GPU memory");
+    dev->buffer = gpu_alloc(size, nic, &fd, &off);
+    dev->buf_size = size;
+    dev->gpu = 1;
+    dev->max_inline = 0;
+    dev->mr = ibv_reg_dmabuf_mr(dev->pd, off, size, (uintptr_t)dev->buffer,
+                                                                fd, flags);
+    close(fd);
+    if (!dev->mr)
+        error(SYS, "failed to register GPU memory region");
+    dev->lnode.rkey = dev->mr->rkey;
+    dev->lnode.vaddr = (uintptr_t)dev->buffer;
+#else
+    error(0, "GPU memory not supported by this build of qperf");
+#endif
+}
+
+
+/*
+ * If On-Demand Paging was requested, make sure the device supports it and
+ * return the access flag needed to register memory that way.  With implicit
+ * On-Demand Paging, a single region covers the entire address space.
+ */
+static int
+rd_odp(DEVICE *dev)
+{
+    if (!Req.mr_odp[0] || streq(Req.mr_odp, "none"))
+        return 0;
+#ifdef HAS_ODP
+    {
+        struct ibv_device_attr_ex attr;
+        uint32_t need = IBV_ODP_SUPPORT;
+
+        if (streq(Req.mr_odp, "implicit"))
+            need |= IBV_ODP_SUPPORT_IMPLICIT;
+        if (ibv_query_device_ex(dev->pd->context, 0, &attr) != 0)
+            error(SYS, "query device failed");
+        if ((attr.odp_caps.general_caps & need) != need)
+            error(0, "device does not support %s On-Demand Paging",
+                                                                Req.mr_odp);
+        return IBV_ACCESS_ON_DEMAND;
+    }
+#else
+    error(0, "On-Demand Paging not supported by this build of qperf");
+    return 0;
+#endif
+}
+
+
+/*
+ * Drop the pages backing an On-Demand Paging buffer so that the next access
+ * by the adapter must fault them in again.
+ */
+static void
+rd_drop_pages(DEVICE *dev)
+{
+    if (madvise(dev->buffer, dev->buf_size, MADV_DONTNEED) != 0)
+        error(SYS, "failed to drop buffer pages");
+}
+
+
 /*
  * Free the memory region.
  */
@@ -1752,8 +3115,12 @@ rd_mrfree(DEVICE *dev)
         ibv_dereg_mr(dev->mr);
     dev->mr = NULL;
 
-    if (dev->buffer)
-        free(dev->buffer);
+    if (dev->gpu)
+        gpu_free(dev->buffer);
+    else if (!dev->shared)
+        mem_free(dev->buffer);
+    dev->gpu = 0;
+    dev->shared = 0;
     dev->buffer = NULL;
     dev->buf_size = 0;
 
@@ -1995,12 +3362,200 @@ cm_ack_event(DEVICE *dev)
 }
 
 
+/*
+ * Set default parameters for the multicast tests.  The device, port and path
+ * come from the Connection Manager so the options that set them for the other
+ * UD tests do not apply.
+ */
+static void
+mc_params(long msg_size)
+{
+    setv_u32(L_USE_CM, 0);
+    setv_u32(R_USE_CM, 0);
+    setv_u32(L_NUM_QPS, 0);
+    setv_u32(R_NUM_QPS, 0);
+    setp_u32(0, L_MCAST_RECEIVERS, 1);
+    setp_u32(0, R_MCAST_RECEIVERS, 1);
+    setp_u32(0, L_MSG_SIZE, msg_size);
+    setp_u32(0, R_MSG_SIZE, msg_size);
+    par_use(L_MCAST_GROUP);
+    par_use(R_MCAST_GROUP);
+    par_use(L_MCAST_RECEIVERS);
+    par_use(R_MCAST_RECEIVERS);
+    par_use(L_MEM_HUGE);
+    par_use(R_MEM_HUGE);
+    par_use(L_MEM_NODE);
+    par_use(R_MEM_NODE);
+    par_use(L_MR_ODP);
+    par_use(R_MR_ODP);
+    par_use(L_POLL_MODE);
+    par_use(R_POLL_MODE);
+    par_use(L_CQ_SPIN);
+    par_use(R_CQ_SPIN);
+    opt_check();
+}
+
+
+/*
+ * Open a device for multicast.  The Connection Manager resolves the group
+ * on the device that carries our connection to the other side and joins it;
+ * it gives us the address handle, Q Key and MGID to use.  Since the id never
+ * has a queue pair of its own, the num_qps UD queue pairs we create are
+ * attached to the group ourselves, which lets several of them receive within
+ * the one process.  The request must already have been sent.
+ */
+static void
+mc_open(DEVICE *dev, int max_send_wr, int max_recv_wr, int num_qps)
+{
+    int i;
+    AI *aip;
+    SS local;
+    char *group = Req.mcast_group;
+    struct addrinfo hints ={
+        .ai_flags    = AI_NUMERICHOST,
+        .ai_socktype = SOCK_DGRAM
+    };
+    struct ibv_ah_attr ah_attr;
+    uint32_t qpn;
+    CMINFO *cm = &dev->cm;
+
+    if (num_qps > MAX_THREADS)
+        error(0, "mcast_receivers %d too large; maximum is %d",
+                                                    num_qps, MAX_THREADS);
+    memset(dev, 0, sizeof(*dev));
+    dev->trans = IBV_QPT_UD;
+    dev->max_send_wr = max_send_wr;
+    dev->max_recv_wr = max_recv_wr;
+    dev->num_qps = num_qps > 1 ? num_qps : 1;
+
+    /* Find the group and our address on the connection to the other side */
+    socket_addr(RemoteFD, &local);
+    if (local.ss_family == AF_INET6)
+        ((struct sockaddr_in6 *)&local)->sin6_port = 0;
+    else
+        ((struct sockaddr_in *)&local)->sin_port = 0;
+    if (!group[0])
+        group = local.ss_family == AF_INET6 ? MC_GROUP6 : MC_GROUP4;
+    hints.ai_family = local.ss_family;
+    aip = getaddrinfo_port(group, 0, &hints);
+    memcpy(&dev->mc_addr, aip->ai_addr, aip->ai_addrlen);
+    freeaddrinfo(aip);
+
+    /* Join the group */
+    cm->channel = rdma_create_event_channel();
+    if (!cm->channel)
+        error(0, "rdma_create_event_channel failed");
+    if (rdma_create_id(cm->channel, &cm->id, 0, RDMA_PS_UDP) != 0)
+        error(0, "rdma_create_id failed");
+    if (rdma_resolve_addr(cm->id, (SA *)&local, (SA *)&dev->mc_addr,
+                                                    Req.timeout * 1000) != 0)
+        error(SYS, "rdma_resolve_addr failed for %s", group);
+    cm_expect_event(dev, RDMA_CM_EVENT_ADDR_RESOLVED);
+    cm_ack_event(dev);
+    if (rdma_join_multicast(cm->id, (SA *)&dev->mc_addr, 0) != 0)
+        error(SYS, "rdma_join_multicast failed for %s", group);
+    cm_expect_event(dev, RDMA_CM_EVENT_MULTICAST_JOIN);
+    ah_attr = cm->event->param.ud.ah_attr;
+    qpn = cm->event->param.ud.qp_num;
+    dev->qkey = cm->event->param.ud.qkey;
+    cm_ack_event(dev);
+    dev->mc_gid = ah_attr.grh.dgid;
+    dev->mc_lid = ah_attr.dlid;
+    dev->ib.port = cm->id->port_num;
+
+    /* Create the queue pairs and bring them up */
+    rd_create_qp(dev, cm->id->verbs, cm->id);
+    {
+        struct ibv_qp_attr attr ={
+            .qp_state   = IBV_QPS_INIT,
+            .pkey_index = 0,
+            .port_num   = dev->ib.port,
+            .qkey       = dev->qkey
+        };
+        int flags = IBV_QP_STATE | IBV_QP_PKEY_INDEX | IBV_QP_PORT |
+                    IBV_QP_QKEY;
+
+        for (i = 0; i < dev->num_qps; ++i) {
+            struct ibv_qp *qp = rd_qp(dev, i);
+
+            attr.qp_state = IBV_QPS_INIT;
+            if (ibv_modify_qp(qp, &attr, flags) != 0)
+                error(SYS, "failed to modify QP to INIT state");
+            attr.qp_state = IBV_QPS_RTR;
+            if (ibv_modify_qp(qp, &attr, IBV_QP_STATE) != 0)
+                error(SYS, "failed to modify QP to RTR");
+            attr.qp_state = IBV_QPS_RTS;
+            if (ibv_modify_qp(qp, &attr, IBV_QP_STATE | IBV_QP_SQ_PSN) != 0)
+                error(SYS, "failed to modify QP to RTS");
+        }
+    }
+    dev->lnode.qpn = dev->qp->qp_num;
+    {
+        struct ibv_qp_attr qp_attr;
+        struct ibv_qp_init_attr qp_init_attr;
+
+        if (ibv_query_qp(dev->qp, &qp_attr, IBV_QP_CAP, &qp_init_attr) != 0)
+            error(SYS, "query QP failed");
+        dev->max_inline = qp_attr.cap.max_inline_data;
+    }
+
+    /* Senders send to the group */
+    if (max_send_wr && is_client()) {
+        dev->ah = ibv_create_ah(dev->pd, &ah_attr);
+        if (!dev->ah)
+            error(SYS, "failed to create address handle");
+        dev->rnode.qpn = qpn;
+    }
+
+    /* Receive buffers leave room for the GRH that comes with each message */
+    dev->msg_size = Req.msg_size;
+    rd_mralloc(dev, dev->msg_size + GRH_SIZE);
+    if (max_recv_wr && !is_client()) {
+        for (i = 0; i < dev->num_qps; ++i)
+            if (ibv_attach_mcast(rd_qp(dev, i), &dev->mc_gid, dev->mc_lid))
+                error(SYS, "failed to attach QP %d to %s", i, group);
+        dev->mc_attached = 1;
+    }
+
+    if (!Req.poll_mode) {
+        if (ibv_req_notify_cq(dev->cq, 0) != 0)
+            error(SYS, "failed to request CQ notification");
+        dev->armed = 1;
+    }
+}
+
+
+/*
+ * Close a multicast device.  The queue pairs are detached from the group and
+ * destroyed before we leave it and give up the id whose device they are on.
+ */
+static void
+mc_close(DEVICE *dev)
+{
+    int i;
+    CMINFO cm = dev->cm;
+    SS addr = dev->mc_addr;
+
+    if (dev->mc_attached)
+        for (i = 0; i < dev->num_qps; ++i)
+            ibv_detach_mcast(rd_qp(dev, i), &dev->mc_gid, dev->mc_lid);
+    rd_close(dev);
+    if (rdma_leave_multicast(cm.id, (SA *)&addr) != 0)
+        error(SYS, "rdma_leave_multicast failed");
+    rdma_destroy_id(cm.id);
+    rdma_destroy_event_channel(cm.channel);
+}
+
+
 /*
  * Open an InfiniBand device.
  */
 static void
 ib_open(DEVICE *dev)
 {
+    int i;
+    char id[STRSIZE];
+
     /* Determine MTU */
     {
         int mtu = Req.mtu_size;
@@ -2022,7 +3577,10 @@ ib_open(DEVICE *dev)
     /* Determine port */
     {
         int port = 1;
-        char *p = index(Req.id, ':');
+        char *p;
+
+        strcpy(id, Req.id);
+        p = index(id, ':');
 
         if (p) {
             *p++ = '\0';
@@ -2051,10 +3609,26 @@ ib_open(DEVICE *dev)
     /* Set up Q Key */
     dev->qkey = QKEY;
 
+    /* Reuse the device from the last test or close it if it differs */
+    if (KeptContext) {
+        if (streq(KeptName, id)) {
+            dev->ib.devlist = KeptDevList;
+            dev->ib.context = KeptContext;
+        } else {
+            if (KeptPD)
+                ibv_dealloc_pd(KeptPD);
+            ibv_close_device(KeptContext);
+            free(KeptDevList);
+            KeptPD = 0;
+            KeptContext = 0;
+            KeptDevList = 0;
+        }
+    }
+
     /* Open device */
-    {
+    if (!dev->ib.context) {
         struct ibv_device *device;
-        char *name = Req.id[0] ? Req.id : 0;
+        char *name = id[0] ? id : 0;
 
         dev->ib.devlist = ibv_get_device_list(0);
         if (!dev->ib.devlist)
@@ -2074,8 +3648,13 @@ ib_open(DEVICE *dev)
             const char *s = ibv_get_device_name(device);
             error(SYS, "failed to open device %s", s);
         }
+        strcpy(KeptName, id);
+        KeptDevList = dev->ib.devlist;
+        KeptContext = dev->ib.context;
     }
 
+    rd_net_dir(dev->ib.context, dev->ib.port);
+
     /* Set up local node LID */
     {
         struct ibv_port_attr port_attr;
@@ -2118,13 +3697,19 @@ ib_open(DEVICE *dev)
             flags |= IBV_QP_ACCESS_FLAGS;
             attr.qp_access_flags = IBV_ACCESS_REMOTE_WRITE;
         }
-        if (ibv_modify_qp(dev->qp, &attr, flags) != SUCCESS0)
-            error(SYS, "failed to modify QP to INIT state");
+        for (i = 0; i < dev->num_qps; ++i)
+            if (ibv_modify_qp(rd_qp(dev, i), &attr, flags) != SUCCESS0)
+                error(SYS, "failed to modify QP to INIT state");
     }
 
     /* Set up local node QP number, PSN and SRQ number */
     dev->lnode.qpn = dev->qp->qp_num;
     dev->lnode.psn = lrand48() & 0xffffff;
+    if (dev->qps) {
+        dev->qps[0].psn = dev->lnode.psn;
+        for (i = 1; i < dev->num_qps; ++i)
+            dev->qps[i].psn = lrand48() & 0xffffff;
+    }
 #ifdef HAS_XRC
     if (dev->trans == IBV_QPT_XRC)
         dev->lnode.srqn = dev->srq->xrc_srq_num;
@@ -2165,7 +3750,7 @@ ib_prep(DEVICE *dev)
             .port_num       = dev->ib.port,
             .static_rate    = dev->ib.rate,
 	    .src_path_bits  = Req.src_path_bits,
-            .sl             = Req.sl
+            .sl             = dev->sl
         }
     };
     struct ibv_qp_attr rts_attr ={
@@ -2182,7 +3767,7 @@ ib_prep(DEVICE *dev)
             .port_num      = Req.alt_port,
             .static_rate   = dev->ib.rate,
 	    .src_path_bits = Req.src_path_bits,
-            .sl            = Req.sl
+            .sl            = dev->sl
         }
     };
     struct ibv_ah_attr ah_attr ={
@@ -2190,7 +3775,7 @@ ib_prep(DEVICE *dev)
         .port_num      = dev->ib.port,
         .static_rate   = dev->ib.rate,
 	.src_path_bits = Req.src_path_bits,
-        .sl            = Req.sl
+        .sl            = dev->sl
     };
 
     if (dev->trans == IBV_QPT_UD) {
@@ -2208,10 +3793,34 @@ ib_prep(DEVICE *dev)
         dev->ah = ibv_create_ah(dev->pd, &ah_attr);
         if (!dev->ah)
             error(SYS, "failed to create address handle");
+    } else {
+        int i;
+
+        for (i = 0; i < dev->num_qps; ++i) {
+            if (dev->qps) {
+                rtr_attr.dest_qp_num = dev->qps[i].rqpn;
+                rtr_attr.rq_psn      = dev->qps[i].rpsn;
+                rts_attr.sq_psn      = dev->qps[i].psn;
+            }
+            ib_prep_qp(dev, rd_qp(dev, i), &rtr_attr, &rts_attr);
+        }
+    }
+}
+
+
+/*
+ * Move a connected queue pair to the RTR and then the RTS state.
+ */
+static void
+ib_prep_qp(DEVICE *dev, struct ibv_qp *qp,
+                        struct ibv_qp_attr *rtr_attr, struct ibv_qp_attr *rts_attr)
+{
+    int flags;
+
 #ifdef HAS_XRC
-    } else if (dev->trans == IBV_QPT_RC || dev->trans == IBV_QPT_XRC) {
+    if (dev->trans == IBV_QPT_RC || dev->trans == IBV_QPT_XRC) {
 #else
-    } else if (dev->trans == IBV_QPT_RC) {
+    if (dev->trans == IBV_QPT_RC) {
 #endif
         /* Modify queue pair to RTR */
         flags = IBV_QP_STATE              |
@@ -2221,7 +3830,7 @@ ib_prep(DEVICE *dev)
                 IBV_QP_RQ_PSN             |
                 IBV_QP_MAX_DEST_RD_ATOMIC |
                 IBV_QP_MIN_RNR_TIMER;
-        if (ibv_modify_qp(dev->qp, &rtr_attr, flags) != 0)
+        if (ibv_modify_qp(qp, rtr_attr, flags) != 0)
             error(SYS, "failed to modify QP to RTR");
 
         /* Modify queue pair to RTS */
@@ -2233,7 +3842,7 @@ ib_prep(DEVICE *dev)
                 IBV_QP_MAX_QP_RD_ATOMIC;
         if (dev->trans == IBV_QPT_RC && dev->rnode.alt_lid)
             flags |= IBV_QP_ALT_PATH | IBV_QP_PATH_MIG_STATE;
-        if (ibv_modify_qp(dev->qp, &rts_attr, flags) != 0)
+        if (ibv_modify_qp(qp, rts_attr, flags) != 0)
             error(SYS, "failed to modify QP to RTS");
     } else if (dev->trans == IBV_QPT_UC) {
         /* Modify queue pair to RTR */
@@ -2242,7 +3851,7 @@ ib_prep(DEVICE *dev)
                 IBV_QP_PATH_MTU |
                 IBV_QP_DEST_QPN |
                 IBV_QP_RQ_PSN;
-        if (ibv_modify_qp(dev->qp, &rtr_attr, flags) != 0)
+        if (ibv_modify_qp(qp, rtr_attr, flags) != 0)
             error(SYS, "failed to modify QP to RTR");
 
         /* Modify queue pair to RTS */
@@ -2250,7 +3859,7 @@ ib_prep(DEVICE *dev)
                 IBV_QP_SQ_PSN;
         if (dev->rnode.alt_lid)
             flags |= IBV_QP_ALT_PATH | IBV_QP_PATH_MIG_STATE;
-        if (ibv_modify_qp(dev->qp, &rts_attr, flags) != 0)
+        if (ibv_modify_qp(qp, rts_attr, flags) != 0)
             error(SYS, "failed to modify QP to RTS");
     }
 }
@@ -2262,6 +3871,14 @@ ib_prep(DEVICE *dev)
 static void
 ib_close1(DEVICE *dev)
 {
+    if (dev->qps) {
+        int i;
+
+        for (i = 1; i < dev->num_qps; ++i)
+            if (dev->qps[i].qp)
+                ibv_destroy_qp(dev->qps[i].qp);
+        free(dev->qps);
+    }
     if (dev->qp)
         ibv_destroy_qp(dev->qp);
     if (dev->srq)
@@ -2274,14 +3891,15 @@ ib_close1(DEVICE *dev)
 
 
 /*
- * Close an InfiniBand device, part 2.
+ * Close an InfiniBand device, part 2.  The device itself stays open for the
+ * next test.
  */
 static void
 ib_close2(DEVICE *dev)
 {
-    if (dev->ib.context)
+    if (dev->ib.context && dev->ib.context != KeptContext)
         ibv_close_device(dev->ib.context);
-    if (dev->ib.devlist)
+    if (dev->ib.devlist && dev->ib.devlist != KeptDevList)
         free(dev->ib.devlist);
 }
 
@@ -2300,22 +3918,28 @@ ib_migrate(DEVICE *dev)
         return;
 
     {
+        int i;
         struct ibv_qp_attr attr ={
             .path_mig_state  = IBV_MIG_MIGRATED,
         };
 
-        if (ibv_modify_qp(dev->qp, &attr, IBV_QP_PATH_MIG_STATE) != SUCCESS0)
-            error(SYS, "failed to modify QP to Migrated state");
+        for (i = 0; i < dev->num_qps; ++i) {
+            struct ibv_qp *qp = rd_qp(dev, i);
+
+            if (ibv_modify_qp(qp, &attr, IBV_QP_PATH_MIG_STATE) != SUCCESS0)
+                error(SYS, "failed to modify QP to Migrated state");
+        }
     }
 }
 
 
 /*
- * Post an atomic.
+ * Post an atomic on queue pair wrid % num_qps.  It is aimed at roffset in the
+ * remote buffer and the value it returns is placed at offset in ours.
  */
 static void
 ib_post_atomic(DEVICE *dev, ATOMIC atomic, int wrid,
-                            int offset, uint64_t compare_add, uint64_t swap)
+                int offset, int roffset, uint64_t compare_add, uint64_t swap)
 {
     struct ibv_sge sge ={
         .addr   = (uintptr_t)dev->buffer + offset,
@@ -2329,7 +3953,7 @@ ib_post_atomic(DEVICE *dev, ATOMIC atomic, int wrid,
         .send_flags = IBV_SEND_SIGNALED,
         .wr = {
             .atomic = {
-                .remote_addr = dev->rnode.vaddr,
+                .remote_addr = dev->rnode.vaddr + roffset,
                 .rkey        = dev->rnode.rkey,
             }
         }
@@ -2346,7 +3970,8 @@ ib_post_atomic(DEVICE *dev, ATOMIC atomic, int wrid,
     }
 
     errno = 0;
-    if (ibv_post_send(dev->qp, &wr, &badwr) != SUCCESS0) {
+    if (ibv_post_send(rd_qp(dev, wrid % dev->num_qps), &wr, &badwr)
+                                                                != SUCCESS0) {
         if (Finished && errno == EINTR)
             return;
         if (atomic == COMPARE_SWAP)
@@ -2373,12 +3998,50 @@ rd_post_send_std(DEVICE *dev, int n)
 }
 
 
+/*
+ * Post a send carrying imm as immediate data.  Return the number posted,
+ * which is 0 if no queue pair has room.
+ */
+static int
+rd_post_send_imm(DEVICE *dev, uint32_t imm)
+{
+    int n;
+    struct ibv_sge sge ={
+        .addr   = (uintptr_t) dev->buffer,
+        .length = dev->msg_size,
+        .lkey   = dev->mr->lkey
+    };
+    struct ibv_send_wr wr ={
+        .wr_id      = WRID_SEND,
+        .sg_list    = &sge,
+        .num_sge    = 1,
+        .opcode     = IBV_WR_SEND_WITH_IMM,
+        .send_flags = IBV_SEND_SIGNALED,
+        .imm_data   = htonl(imm)
+    };
+
+    if (dev->trans == IBV_QPT_UD) {
+        wr.wr.ud.ah          = dev->ah;
+        wr.wr.ud.remote_qpn  = dev->rnode.qpn;
+        wr.wr.ud.remote_qkey = dev->qkey;
+    }
+    if (dev->msg_size <= dev->max_inline)
+        wr.send_flags |= IBV_SEND_INLINE;
+
+    n = rd_post_wrs(dev, &wr, 0, 1);
+    LStat.s.no_bytes += (uint64_t)n * dev->msg_size;
+    LStat.s.no_msgs += n;
+    return n;
+}
+
+
 /*
  * Post one or more sends.
  */
 static void
 rd_post_send(DEVICE *dev, int off, int len, int inc, int rep, int stat)
 {
+    int n;
     struct ibv_sge sge ={
         .addr   = (uintptr_t) &dev->buffer[off],
         .length = len,
@@ -2391,7 +4054,6 @@ rd_post_send(DEVICE *dev, int off, int len, int inc, int rep, int stat)
         .opcode     = IBV_WR_SEND,
         .send_flags = IBV_SEND_SIGNALED,
     };
-    struct ibv_send_wr *badwr;
 
     if (dev->trans == IBV_QPT_UD) {
         wr.wr.ud.ah          = dev->ah;
@@ -2406,25 +4068,96 @@ rd_post_send(DEVICE *dev, int off, int len, int inc, int rep, int stat)
     if (dev->msg_size <= dev->max_inline)
         wr.send_flags |= IBV_SEND_INLINE;
 
+    n = rd_post_wrs(dev, &wr, inc, rep);
+    if (stat) {
+        LStat.s.no_bytes += (uint64_t)n * dev->msg_size;
+        LStat.s.no_msgs += n;
+    }
+}
+
+
+/*
+ * Post n send work requests modelled on tmpl, advancing the address and
+ * length of each successive one by inc.  Up to post_list requests are
+ * chained into a single call to ibv_post_send and, if sig_every is set, only
+ * every sig_every-th request is signaled.  If there are several queue pairs,
+ * each call goes to the next one that has room.  Return the number posted.
+ */
+static int
+rd_post_wrs(DEVICE *dev, struct ibv_send_wr *tmpl, int inc, int n)
+{
+    struct ibv_sge sge = *tmpl->sg_list;
+    struct ibv_sge sges[MAX_POST_LIST];
+    struct ibv_send_wr wrs[MAX_POST_LIST];
+    struct ibv_send_wr *badwr;
+    int list = dev->post_list ? dev->post_list : 1;
+    int posted = 0;
+
     errno = 0;
-    while (!Finished && rep-- > 0) {
-        if (ibv_post_send(dev->qp, &wr, &badwr) != SUCCESS0) {
-            if (Finished && errno == EINTR)
-                return;
-            error(SYS, "failed to post send");
+    while (!Finished && posted < n) {
+        int i;
+        int m = n - posted;
+        uint64_t qpid = 0;
+        struct ibv_qp *qp = dev->qp;
+        int *unsignaled = &dev->unsignaled;
+
+        if (m > list)
+            m = list;
+        if (dev->qps) {
+            QP *q = 0;
+
+            for (i = 0; i < dev->num_qps; ++i) {
+                qpid = dev->qp_next;
+                q = &dev->qps[qpid];
+                if (++dev->qp_next >= dev->num_qps)
+                    dev->qp_next = 0;
+                if (q->send_room > 0)
+                    break;
+            }
+            if (i == dev->num_qps)
+                break;
+            if (m > q->send_room)
+                m = q->send_room;
+            q->send_room -= m;
+            qp = q->qp;
+            unsignaled = &q->unsignaled;
+        }
+        for (i = 0; i < m; ++i) {
+            struct ibv_send_wr *wr = &wrs[i];
+
+            sges[i] = sge;
+            *wr = *tmpl;
+            wr->sg_list = &sges[i];
+            wr->next = i < m-1 ? &wrs[i+1] : NULL;
+            if (dev->sig_every > 1) {
+                int last = dev->sig_flush && posted + i == n-1;
+
+                wr->send_flags &= ~IBV_SEND_SIGNALED;
+                if (++*unsignaled >= dev->sig_every || last) {
+                    wr->send_flags |= IBV_SEND_SIGNALED;
+                    wr->wr_id |= (uint64_t)*unsignaled << WRID_SHIFT;
+                    *unsignaled = 0;
+                }
+            }
+            wr->wr_id |= qpid << WRID_QP_SHIFT;
+            sge.addr += inc;
+            sge.length += inc;
         }
-        sge.addr += inc;
-        sge.length += inc;
-        if (stat) {
-            LStat.s.no_bytes += dev->msg_size;
-            LStat.s.no_msgs++;
+        if (ibv_post_send(qp, wrs, &badwr) != SUCCESS0) {
+            if (Finished && errno == EINTR)
+                return posted;
+            error(SYS, "failed to post %s", opcode_name(tmpl->opcode));
         }
+        posted += m;
     }
+    dev->sig_flush = 0;
+    return posted;
 }
 
 
 /*
- * Post n receives.
+ * Post n receives.  If there are several queue pairs, each gets receives
+ * while it has room for them.
  */
 static void
 rd_post_recv_std(DEVICE *dev, int n)
@@ -2434,27 +4167,57 @@ rd_post_recv_std(DEVICE *dev, int n)
         .length = dev->buf_size,
         .lkey   = dev->mr->lkey
     };
-    struct ibv_recv_wr wr ={
-        .wr_id      = WRID_RECV,
-        .sg_list    = &sge,
-        .num_sge    = 1,
-    };
+    struct ibv_recv_wr wrs[MAX_POST_LIST];
     struct ibv_recv_wr *badwr;
+    int list = dev->post_list ? dev->post_list : 1;
+    int i;
+
+    for (i = 0; i < list; ++i) {
+        wrs[i].wr_id   = WRID_RECV;
+        wrs[i].sg_list = &sge;
+        wrs[i].num_sge = 1;
+        wrs[i].next    = i < list-1 ? &wrs[i+1] : NULL;
+    }
 
     errno = 0;
-    while (!Finished && n-- > 0) {
+    while (!Finished && n > 0) {
         int stat;
+        int m = n < list ? n : list;
+        uint64_t qpid = 0;
+        struct ibv_qp *qp = dev->qp;
+
+        if (dev->qps && !dev->srq) {
+            QP *q = 0;
 
+            for (i = 0; i < dev->num_qps; ++i) {
+                qpid = i;
+                q = &dev->qps[qpid];
+                if (q->recv_room > 0)
+                    break;
+            }
+            if (i == dev->num_qps)
+                return;
+            if (m > q->recv_room)
+                m = q->recv_room;
+            q->recv_room -= m;
+            qp = q->qp;
+            for (i = 0; i < m; ++i)
+                wrs[i].wr_id = WRID_RECV | qpid << WRID_QP_SHIFT;
+        }
+
+        wrs[m-1].next = NULL;
         if (dev->srq)
-            stat = ibv_post_srq_recv(dev->srq, &wr, &badwr);
+            stat = ibv_post_srq_recv(dev->srq, wrs, &badwr);
         else
-            stat = ibv_post_recv(dev->qp, &wr, &badwr);
+            stat = ibv_post_recv(qp, wrs, &badwr);
+        wrs[m-1].next = m < list ? &wrs[m] : NULL;
 
         if (stat != SUCCESS0) {
             if (Finished && errno == EINTR)
                 return;
             error(SYS, "failed to post receive");
         }
+        n -= m;
     }
 }
 
@@ -2483,42 +4246,97 @@ rd_post_rdma_std(DEVICE *dev, ibv_op opcode, int n)
             }
         }
     };
-    struct ibv_send_wr *badwr;
 
     if (opcode != IBV_WR_RDMA_READ && dev->msg_size <= dev->max_inline)
         wr.send_flags |= IBV_SEND_INLINE;
-    errno = 0;
-    while (!Finished && n--) {
-        if (ibv_post_send(dev->qp, &wr, &badwr) != SUCCESS0) {
-            if (Finished && errno == EINTR)
-                return;
-            error(SYS, "failed to post %s", opcode_name(wr.opcode));
-        }
-        if (opcode != IBV_WR_RDMA_READ) {
-            LStat.s.no_bytes += dev->msg_size;
-            LStat.s.no_msgs++;
-        }
+    n = rd_post_wrs(dev, &wr, 0, n);
+    if (opcode != IBV_WR_RDMA_READ) {
+        LStat.s.no_bytes += (uint64_t)n * dev->msg_size;
+        LStat.s.no_msgs += n;
     }
 }
 
 
 /*
- * Poll the completion queue.
+ * Poll the completion queue and return to each queue pair the room used by
+ * the work requests that completed.
  */
 static int
 rd_poll(DEVICE *dev, struct ibv_wc *wc, int nwc)
+{
+    int n = rd_poll_cq(dev, wc, nwc);
+
+    rd_credit(dev, wc, n);
+    return n;
+}
+
+
+/*
+ * Return the room used by n completed work requests to their queue pairs.
+ */
+static void
+rd_credit(DEVICE *dev, struct ibv_wc *wc, int n)
+{
+    int i;
+
+    if (!dev->qps)
+        return;
+    for (i = 0; i < n; ++i) {
+        uint64_t id = wc[i].wr_id;
+        QP *q = &dev->qps[WRID_QP(id)];
+
+        if (WRID_TYPE(id) == WRID_RECV)
+            q->recv_room++;
+        else
+            q->send_room += WRID_COUNT(id);
+    }
+}
+
+
+/*
+ * Poll the completion queue.  If we are not polling but cq_spin is set, we
+ * first spin on the completion queue for up to cq_spin microseconds and only
+ * arm it and wait for an event if nothing shows up in that time.
+ */
+static int
+rd_poll_cq(DEVICE *dev, struct ibv_wc *wc, int nwc)
 {
     int n;
 
+    if (!Req.poll_mode && Req.cq_spin && !Finished) {
+        uint64_t end = get_nsecs() + Req.cq_spin * 1000ULL;
+
+        do {
+            n = ibv_poll_cq(dev->cq, nwc, wc);
+            if (n < 0)
+                return maybe(0, "CQ poll failed");
+            if (n > 0)
+                return n;
+        } while (!Finished && get_nsecs() < end);
+
+        if (!dev->armed) {
+            if (ibv_req_notify_cq(dev->cq, 0) != SUCCESS0)
+                return maybe(0, "failed to request CQ notification");
+            dev->armed = 1;
+            n = ibv_poll_cq(dev->cq, nwc, wc);
+            if (n != 0)
+                return n > 0 ? n : maybe(0, "CQ poll failed");
+        }
+    }
+
     if (!Req.poll_mode && !Finished) {
         void *ectx;
         struct ibv_cq *ecq;
 
-        if (ibv_get_cq_event(dev->channel, &ecq, &ectx) != SUCCESS0)
-            return maybe(0, "failed to get CQ event");
+        while (ibv_get_cq_event(dev->channel, &ecq, &ectx) != SUCCESS0) {
+            if (errno != EINTR || Finished)
+                return maybe(0, "failed to get CQ event");
+        }
         if (ecq != dev->cq)
             error(0, "CQ event for unknown CQ");
-        if (ibv_req_notify_cq(dev->cq, 0) != SUCCESS0)
+        if (Req.cq_spin)
+            dev->armed = 0;
+        else if (ibv_req_notify_cq(dev->cq, 0) != SUCCESS0)
             return maybe(0, "failed to request CQ notification");
 	ibv_ack_cq_events(dev->cq, 1);
     }
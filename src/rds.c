@@ -124,16 +124,35 @@ run_client_rds_bw(void)
 {
     char *buf;
     int sockfd;
+    MMSG mmsg ={0};
 
     par_use(L_ACCESS_RECV);
     par_use(R_ACCESS_RECV);
+    par_use(L_BATCH_SIZE);
+    par_use(R_BATCH_SIZE);
     set_parameters(8*1024);
     client_send_request();
     sockfd = init();
-    buf = qmalloc(Req.msg_size);
+    buf = mem_alloc(Req.msg_size);
+    if (Req.batch_size > 1)
+        mmsg_send_init(&mmsg, Req.batch_size, Req.msg_size, (SA *)&RAddr, RLen);
     sync_test();
     while (!Finished) {
-        int n = sendto(sockfd, buf, Req.msg_size, 0, (SA *)&RAddr, RLen);
+        int n;
+
+        if (mmsg.n) {
+            n = mmsg_send(&mmsg, sockfd);
+            if (Finished)
+                break;
+            if (n < 0) {
+                LStat.s.no_errs++;
+                continue;
+            }
+            LStat.s.no_bytes += (uint64_t)n * Req.msg_size;
+            LStat.s.no_msgs += n;
+            continue;
+        }
+        n = sendto(sockfd, buf, Req.msg_size, 0, (SA *)&RAddr, RLen);
 
         if (Finished)
             break;
@@ -146,7 +165,9 @@ run_client_rds_bw(void)
     }
     stop_test_timer();
     exchange_results();
-    free(buf);
+    if (mmsg.n)
+        mmsg_free(&mmsg);
+    mem_free(buf);
     close(sockfd);
     show_results(BANDWIDTH);
 }
@@ -160,12 +181,39 @@ run_server_rds_bw(void)
 {
     char *buf;
     int sockfd;
+    MMSG mmsg ={0};
 
     sockfd = init();
+    buf = mem_alloc(Req.msg_size);
+    if (Req.batch_size > 1)
+        mmsg_recv_init(&mmsg, Req.batch_size, Req.msg_size, 0);
     sync_test();
-    buf = qmalloc(Req.msg_size);
     while (!Finished) {
-        int n = read(sockfd, buf, Req.msg_size);
+        int n;
+
+        if (mmsg.n) {
+            int i;
+
+            n = mmsg_recv(&mmsg, sockfd);
+            if (Finished)
+                break;
+            if (n < 0) {
+                LStat.r.no_errs++;
+                continue;
+            }
+            for (i = 0; i < n; ++i) {
+                if (mmsg.hdr[i].msg_len != Req.msg_size) {
+                    LStat.r.no_errs++;
+                    continue;
+                }
+                LStat.r.no_bytes += Req.msg_size;
+                LStat.r.no_msgs++;
+                if (Req.access_recv)
+                    touch_data(mmsg.iov[i].iov_base, Req.msg_size);
+            }
+            continue;
+        }
+        n = read(sockfd, buf, Req.msg_size);
         if (Finished)
             break;
         if (n != Req.msg_size) {
@@ -179,7 +227,9 @@ run_server_rds_bw(void)
     }
     stop_test_timer();
     exchange_results();
-    free(buf);
+    if (mmsg.n)
+        mmsg_free(&mmsg);
+    mem_free(buf);
     close(sockfd);
 }
 
@@ -196,9 +246,10 @@ run_client_rds_lat(void)
     set_parameters(1);
     client_send_request();
     sockfd = init();
-    buf = qmalloc(Req.msg_size);
+    buf = mem_alloc(Req.msg_size);
     sync_test();
     while (!Finished) {
+        uint64_t t = get_nsecs();
         int n = sendto(sockfd, buf, Req.msg_size, 0, (SA *)&RAddr, RLen);
 
         if (Finished)
@@ -219,10 +270,11 @@ run_client_rds_lat(void)
         }
         LStat.r.no_bytes += n;
         LStat.r.no_msgs++;
+        hist_add(&LatHist, (get_nsecs() - t) / 2);
     }
     stop_test_timer();
     exchange_results();
-    free(buf);
+    mem_free(buf);
     close(sockfd);
     show_results(LATENCY);
 }
@@ -238,8 +290,8 @@ run_server_rds_lat(void)
     int sockfd;
 
     sockfd = init();
+    buf = mem_alloc(Req.msg_size);
     sync_test();
-    buf = qmalloc(Req.msg_size);
     while (!Finished) {
         SS raddr;
         socklen_t rlen = sizeof(raddr);
@@ -266,7 +318,7 @@ run_server_rds_lat(void)
     }
     stop_test_timer();
     exchange_results();
-    free(buf);
+    mem_free(buf);
     close(sockfd);
 }
 
@@ -279,6 +331,10 @@ set_parameters(long msgSize)
 {
     setp_u32(0, L_MSG_SIZE, msgSize);
     setp_u32(0, R_MSG_SIZE, msgSize);
+    par_use(L_MEM_HUGE);
+    par_use(R_MEM_HUGE);
+    par_use(L_MEM_NODE);
+    par_use(R_MEM_NODE);
     par_use(L_PORT);
     par_use(R_PORT);
     par_use(L_SOCK_BUF_SIZE);
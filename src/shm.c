@@ -0,0 +1,398 @@
+/*
+ * qperf - shared memory ring tests.
+ * Measure socket and RDMA performance.
+ *
+ * Copyright (c) 2002-2009 Johann George.  All rights reserved.
+ * Copyright (c) 2006-2009 QLogic Corporation.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "qperf.h"
+
+
+/*
+ * Parameters.
+ */
+#define RING_BYTES      (1024*1024)     /* Target data bytes in a ring */
+#define MAX_SLOTS       1024            /* Maximum slots in a ring */
+#define SPIN_TRIES      1000            /* Polls before yielding the CPU */
+
+
+/*
+ * One direction of traffic.  The producer only writes head and the consumer
+ * only writes tail; each lives on its own cache line so that they do not
+ * bounce between the two processes.
+ */
+typedef struct SHMRING {
+    uint64_t    head;                   /* Messages produced */
+    char        pad1[CACHE_LINE - sizeof(uint64_t)];
+    uint64_t    tail;                   /* Messages consumed */
+    char        pad2[CACHE_LINE - sizeof(uint64_t)];
+} SHMRING;
+
+
+/*
+ * Layout of the start of the shared segment.  The data for each ring
+ * follows it.
+ */
+typedef struct SHMSEG {
+    uint32_t    slots;                  /* Slots in each ring */
+    uint32_t    size;                   /* Bytes in each slot */
+    char        pad[CACHE_LINE - 2*sizeof(uint32_t)];
+    SHMRING     ring[2];                /* Client to server, then back */
+} SHMSEG;
+
+
+/*
+ * Our view of the segment.
+ */
+typedef struct SHM {
+    SHMSEG     *seg;                    /* Mapped segment */
+    size_t      len;                    /* Length of mapping */
+    uint32_t    slots;                  /* Slots in each ring */
+    uint32_t    size;                   /* Bytes in each slot */
+    char       *data[2];                /* Data area of each ring */
+    char        name[STRSIZE];          /* Name of the segment */
+} SHM;
+
+
+/*
+ * Function prototypes.
+ */
+static void     shm_client_init(SHM *shm);
+static void     shm_close(SHM *shm);
+static void     shm_layout(SHM *shm);
+static void     shm_map(SHM *shm, int fd, size_t len);
+static void     shm_parameters(long msgSize);
+static int      shm_recv(SHM *shm, int i, char *buf);
+static int      shm_send(SHM *shm, int i, char *buf);
+static void     shm_server_init(SHM *shm);
+static int      shm_wait(int *spins);
+
+
+/*
+ * Measure shared memory bandwidth (client side).
+ */
+void
+run_client_shm_bw(void)
+{
+    SHM shm;
+    char *buf;
+
+    shm_parameters(64*1024);
+    shm_client_init(&shm);
+    buf = mem_alloc(shm.size);
+    sync_test();
+    while (!Finished) {
+        if (!shm_send(&shm, 0, buf))
+            break;
+        LStat.s.no_bytes += shm.size;
+        LStat.s.no_msgs++;
+    }
+    stop_test_timer();
+    exchange_results();
+    mem_free(buf);
+    shm_close(&shm);
+    show_results(BANDWIDTH);
+}
+
+
+/*
+ * Measure shared memory bandwidth (server side).
+ */
+void
+run_server_shm_bw(void)
+{
+    SHM shm;
+    char *buf;
+
+    shm_server_init(&shm);
+    buf = mem_alloc(shm.size);
+    sync_test();
+    shm_unlink(shm.name);
+    while (!Finished) {
+        if (!shm_recv(&shm, 0, buf))
+            break;
+        LStat.r.no_bytes += shm.size;
+        LStat.r.no_msgs++;
+    }
+    stop_test_timer();
+    exchange_results();
+    mem_free(buf);
+    shm_close(&shm);
+}
+
+
+/*
+ * Measure shared memory latency (client side).
+ */
+void
+run_client_shm_lat(void)
+{
+    SHM shm;
+    char *buf;
+
+    shm_parameters(1);
+    shm_client_init(&shm);
+    buf = mem_alloc(shm.size);
+    sync_test();
+    while (!Finished) {
+        uint64_t t = get_nsecs();
+
+        if (!shm_send(&shm, 0, buf))
+            break;
+        LStat.s.no_bytes += shm.size;
+        LStat.s.no_msgs++;
+        if (!shm_recv(&shm, 1, buf))
+            break;
+        LStat.r.no_bytes += shm.size;
+        LStat.r.no_msgs++;
+        hist_add(&LatHist, (get_nsecs() - t) / 2);
+    }
+    stop_test_timer();
+    exchange_results();
+    mem_free(buf);
+    shm_close(&shm);
+    show_results(LATENCY);
+}
+
+
+/*
+ * Measure shared memory latency (server side).
+ */
+void
+run_server_shm_lat(void)
+{
+    SHM shm;
+    char *buf;
+
+    shm_server_init(&shm);
+    buf = mem_alloc(shm.size);
+    sync_test();
+    shm_unlink(shm.name);
+    while (!Finished) {
+        if (!shm_recv(&shm, 0, buf))
+            break;
+        LStat.r.no_bytes += shm.size;
+        LStat.r.no_msgs++;
+        if (!shm_send(&shm, 1, buf))
+            break;
+        LStat.s.no_bytes += shm.size;
+        LStat.s.no_msgs++;
+    }
+    stop_test_timer();
+    exchange_results();
+    mem_free(buf);
+    shm_close(&shm);
+}
+
+
+/*
+ * Set default parameters and note the ones we use.
+ */
+static void
+shm_parameters(long msgSize)
+{
+    setp_u32(0, L_MSG_SIZE, msgSize);
+    setp_u32(0, R_MSG_SIZE, msgSize);
+    par_use(L_MEM_HUGE);
+    par_use(R_MEM_HUGE);
+    par_use(L_MEM_NODE);
+    par_use(R_MEM_NODE);
+    opt_check();
+}
+
+
+/*
+ * Create the shared segment and tell the client its name.  The server picks
+ * the ring geometry so both sides agree on it; the slot count is a power of
+ * two so that an index can be masked rather than divided.
+ */
+static void
+shm_server_init(SHM *shm)
+{
+    int fd;
+    size_t len;
+    uint32_t slots;
+    static int count;
+
+    if (Req.msg_size == 0)
+        error(0, "message size must be positive");
+    slots = 2;
+    while (slots < MAX_SLOTS &&
+           (uint64_t)slots * 2 * Req.msg_size <= RING_BYTES)
+        slots *= 2;
+    len = sizeof(SHMSEG) + 2 * (size_t)slots * Req.msg_size;
+
+    snprintf(shm->name, sizeof(shm->name), "/qperf.%d.%d", getpid(), count++);
+    fd = shm_open(shm->name, O_CREAT|O_EXCL|O_RDWR, 0600);
+    if (fd < 0)
+        error(SYS, "shm_open %s failed", shm->name);
+    if (ftruncate(fd, len) < 0) {
+        shm_unlink(shm->name);
+        error(SYS, "ftruncate of %s failed", shm->name);
+    }
+    shm_map(shm, fd, len);
+    shm->seg->slots = slots;
+    shm->seg->size = Req.msg_size;
+    shm_layout(shm);
+    send_mesg(shm->name, sizeof(shm->name), "shm name");
+}
+
+
+/*
+ * Find the segment the server created and map it.  This only works if we are
+ * on the same host as the server.
+ */
+static void
+shm_client_init(SHM *shm)
+{
+    int fd;
+    struct stat st;
+
+    client_send_request();
+    recv_mesg(shm->name, sizeof(shm->name), "shm name");
+    shm->name[sizeof(shm->name) - 1] = '\0';
+    fd = shm_open(shm->name, O_RDWR, 0);
+    if (fd < 0)
+        error(SYS, "shm_open %s failed: client and server must be on the "
+                   "same host", shm->name);
+    if (fstat(fd, &st) < 0)
+        error(SYS, "fstat of %s failed", shm->name);
+    if ((size_t)st.st_size < sizeof(SHMSEG))
+        error(0, "shared segment %s is too small", shm->name);
+    shm_map(shm, fd, st.st_size);
+    shm_layout(shm);
+    if (sizeof(SHMSEG) + 2 * (size_t)shm->slots * shm->size > shm->len)
+        error(0, "shared segment %s is too small", shm->name);
+}
+
+
+/*
+ * Map the segment and close the descriptor.
+ */
+static void
+shm_map(SHM *shm, int fd, size_t len)
+{
+    void *p = mmap(0, len, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+
+    close(fd);
+    if (p == MAP_FAILED)
+        error(SYS, "mmap of %s failed", shm->name);
+    shm->seg = p;
+    shm->len = len;
+}
+
+
+/*
+ * Pick up the ring geometry from the segment header.
+ */
+static void
+shm_layout(SHM *shm)
+{
+    shm->slots = shm->seg->slots;
+    shm->size = shm->seg->size;
+    shm->data[0] = (char *)(shm->seg + 1);
+    shm->data[1] = shm->data[0] + (size_t)shm->slots * shm->size;
+}
+
+
+/*
+ * Unmap the segment.
+ */
+static void
+shm_close(SHM *shm)
+{
+    munmap(shm->seg, shm->len);
+}
+
+
+/*
+ * Copy a message into the next slot of a ring, waiting for one to free up.
+ * Return 0 if the test finished while we were waiting.
+ */
+static int
+shm_send(SHM *shm, int i, char *buf)
+{
+    SHMRING *r = &shm->seg->ring[i];
+    uint64_t head = r->head;
+    int spins = 0;
+
+    while (head - __atomic_load_n(&r->tail, __ATOMIC_ACQUIRE) >= shm->slots)
+        if (!shm_wait(&spins))
+            return 0;
+    memcpy(shm->data[i] + (head & (shm->slots-1)) * shm->size, buf, shm->size);
+    __atomic_store_n(&r->head, head + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+
+/*
+ * Copy the next message out of a ring, waiting for one to arrive.  Return 0
+ * if the test finished while we were waiting.
+ */
+static int
+shm_recv(SHM *shm, int i, char *buf)
+{
+    SHMRING *r = &shm->seg->ring[i];
+    uint64_t tail = r->tail;
+    int spins = 0;
+
+    while (__atomic_load_n(&r->head, __ATOMIC_ACQUIRE) == tail)
+        if (!shm_wait(&spins))
+            return 0;
+    memcpy(buf, shm->data[i] + (tail & (shm->slots-1)) * shm->size, shm->size);
+    __atomic_store_n(&r->tail, tail + 1, __ATOMIC_RELEASE);
+    return 1;
+}
+
+
+/*
+ * Called each time a poll of a ring comes up empty.  We spin for a while and
+ * then start yielding so that the other side can run if we share a CPU.
+ * Return 0 if the test has finished.
+ */
+static int
+shm_wait(int *spins)
+{
+    if (Finished)
+        return 0;
+    if (++*spins > SPIN_TRIES)
+        sched_yield();
+    return 1;
+}
@@ -34,10 +34,24 @@
  */
 #define _GNU_SOURCE
 #include <errno.h>
+#include <fcntl.h>
+#include <ifaddrs.h>
 #include <netdb.h>
+#include <poll.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/sendfile.h>
+#include <sys/un.h>
+#include <netinet/udp.h>
+#include <linux/errqueue.h>
+#include <linux/tcp.h>
 #include "qperf.h"
 
 
@@ -45,6 +59,33 @@
  * Parameters.
  */
 #define AF_INET_SDP 27                  /* Family for SDP */
+#define ZC_MAX_PEND 256                 /* Maximum pending zero copy sends */
+#define GSO_MAX_SEGS 64                 /* Maximum segments per GSO send */
+#define GSO_MAX_SIZE 65000              /* Maximum bytes per GSO send */
+#define GRO_MAX_SIZE 65536              /* Largest possible GRO receive */
+
+
+/*
+ * For older headers.
+ */
+#ifndef SO_ZEROCOPY
+#define SO_ZEROCOPY 60
+#endif
+#ifndef MSG_ZEROCOPY
+#define MSG_ZEROCOPY 0x4000000
+#endif
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+#ifndef UDP_GRO
+#define UDP_GRO 104
+#endif
+#ifndef SO_BUSY_POLL
+#define SO_BUSY_POLL 46
+#endif
+#ifndef SO_PREFER_BUSY_POLL
+#define SO_PREFER_BUSY_POLL 69
+#endif
 
 
 /*
@@ -55,32 +96,133 @@ typedef enum {
     K_SDP,
     K_TCP,
     K_UDP,
+    K_UNIX_DGRAM,
+    K_UNIX_STREAM,
 } KIND;
 
-char *Kinds[] ={ "SCTP", "SDP", "TCP", "UDP", };
+char *Kinds[] ={ "SCTP", "SDP", "TCP", "UDP", "Unix datagram", "Unix stream", };
+
+#define is_dgram(k)     ((k) == K_UDP || (k) == K_UNIX_DGRAM)
+#define is_unix(k)      ((k) == K_UNIX_DGRAM || (k) == K_UNIX_STREAM)
+
+
+/*
+ * Ways of sending on a stream socket.
+ */
+typedef enum {
+    ZC_NONE,                            /* Regular write */
+    ZC_MSG_ZEROCOPY,                    /* send with MSG_ZEROCOPY */
+    ZC_SENDFILE,                        /* sendfile from a memfd */
+    ZC_SPLICE,                          /* splice from a memfd via a pipe */
+} ZCMODE;
+
+
+/*
+ * Zero copy send state.
+ */
+typedef struct ZCOPY {
+    ZCMODE      mode;                   /* Mode */
+    int         fd;                     /* Socket */
+    int         memfd;                  /* File holding the data */
+    int         pipe[2];                /* Pipe used by splice */
+    int         pipe_size;              /* Capacity of the pipe */
+    uint64_t    sent;                   /* MSG_ZEROCOPY sends issued */
+    uint64_t    done;                   /* MSG_ZEROCOPY sends completed */
+} ZCOPY;
+
+
+/*
+ * Datagram send and receive state.  Datagrams are either handled one per
+ * system call, in batches using sendmmsg and recvmmsg, or, with UDP GSO and
+ * GRO, as large buffers that the kernel splits into or coalesces from
+ * individual datagrams.
+ */
+typedef struct DGRAM {
+    int         fd;                     /* Socket */
+    int         segs;                   /* Datagrams per GSO send */
+    int         gro;                    /* Receiving with GRO */
+    char       *buf;                    /* Buffer for single datagrams */
+    MMSG        mmsg;                   /* Batch state */
+} DGRAM;
+
+
+/*
+ * Worker thread state.  Each worker has its own socket and keeps its own
+ * statistics which are combined once all workers are done.
+ */
+typedef struct WORKER {
+    pthread_t   thread;                 /* Thread */
+    void      (*func)(struct WORKER *); /* Function to run */
+    int         fd;                     /* Socket */
+    int         cpu;                    /* CPU to run on or -1 */
+    USTAT       s;                      /* Send statistics */
+    USTAT       r;                      /* Receive statistics */
+    KIND        kind;                   /* Kind of socket */
+    ZCOPY       zc;                     /* Zero copy send state */
+} WORKER;
+
+typedef void (WORKFUNC)(WORKER *w);
 
 
 /*
  * Function prototypes.
  */
-static void     client_init(int *fd, KIND kind);
+static void     client_connect(int *fd, KIND kind);
+static void     client_init(int *fds, int n, KIND kind);
 static void     datagram_client_bw(KIND kind);
 static void     datagram_client_lat(KIND kind);
+static WORKFUNC datagram_recv_worker;
+static WORKFUNC datagram_send_worker;
 static void     datagram_server_bw(KIND kind);
-static void     datagram_server_init(int *fd, KIND kind);
+static void     datagram_server_init(int *fds, int n, KIND kind);
 static void     datagram_server_lat(KIND kind);
+static void     dg_close(DGRAM *dg);
+static void     dg_init(DGRAM *dg, int fd, int sender);
+static void     dg_recv(DGRAM *dg, USTAT *r);
+static void     dg_send(DGRAM *dg, USTAT *s);
 static void     get_socket_port(int fd, uint32_t *port);
+static void     freeaddrinfo_kind(AI *ailist, KIND kind);
 static AI      *getaddrinfo_kind(int serverflag, KIND kind, int port);
+static AI      *getaddrinfo_unix(int serverflag, KIND kind, int port);
+static int      gro_segs(struct msghdr *msg, int len);
 static void     ip_parameters(long msgSize);
+static int      ip_threads(void);
+static int      ip_uring(void);
 static char    *kind_name(KIND kind);
+static void     load_client_lat(int fd, int stream);
 static int      recv_full(int fd, void *ptr, int len);
+static void     run_uring_bw(int fd, KIND kind, int sender);
+static void     run_uring_lat(int fd, KIND kind);
+static void     run_workers(int *fds, int n, KIND kind, WORKFUNC *func,
+                            WORKFUNC *probe);
 static int      send_full(int fd, void *ptr, int len);
 static void     set_socket_buffer_size(int fd);
+static void     set_socket_busy_poll(int fd);
+static void     set_socket_nic(int fd);
+static void     set_socket_tcp(int fd, KIND kind);
 static void     stream_client_bw(KIND kind);
+static void     stream_client_bw_lat(KIND kind);
+static void     stream_client_conn_rate(KIND kind);
 static void     stream_client_lat(KIND kind);
+static WORKFUNC stream_echo_worker;
+static WORKFUNC stream_probe_worker;
+static WORKFUNC stream_recv_worker;
+static WORKFUNC stream_send_worker;
 static void     stream_server_bw(KIND kind);
-static void     stream_server_init(int *fd, KIND kind);
+static void     stream_server_bw_lat(KIND kind);
+static void     stream_server_conn_rate(KIND kind);
+static void     stream_server_init(int *fds, int n, KIND kind);
 static void     stream_server_lat(KIND kind);
+static int      stream_listen(KIND kind, int backlog, uint32_t *port);
+static void     tcp_end(int *fds, int n, KIND kind);
+static void     tcp_parameters(void);
+static void     tcp_watch(int *fds, int n, KIND kind);
+static void    *worker_main(void *arg);
+static void     zc_close(ZCOPY *zc);
+static void     zc_drain(ZCOPY *zc, int n);
+static void     zc_init(ZCOPY *zc, int fd, KIND kind, char *buf);
+static void     zc_reap(ZCOPY *zc, int wait);
+static int      zc_send_full(ZCOPY *zc, void *ptr, int len);
 
 
 /*
@@ -91,6 +233,12 @@ run_client_sctp_bw(void)
 {
     par_use(L_ACCESS_RECV);
     par_use(R_ACCESS_RECV);
+    par_use(L_CPU_LIST);
+    par_use(R_CPU_LIST);
+    par_use(L_THREADS);
+    par_use(R_THREADS);
+    par_use(L_URING_DEPTH);
+    par_use(R_URING_DEPTH);
     ip_parameters(32*1024);
     stream_client_bw(K_SCTP);
 }
@@ -135,6 +283,12 @@ run_client_sdp_bw(void)
 {
     par_use(L_ACCESS_RECV);
     par_use(R_ACCESS_RECV);
+    par_use(L_CPU_LIST);
+    par_use(R_CPU_LIST);
+    par_use(L_THREADS);
+    par_use(R_THREADS);
+    par_use(L_URING_DEPTH);
+    par_use(R_URING_DEPTH);
     ip_parameters(64*1024);
     stream_client_bw(K_SDP);
 }
@@ -179,6 +333,15 @@ run_client_tcp_bw(void)
 {
     par_use(L_ACCESS_RECV);
     par_use(R_ACCESS_RECV);
+    par_use(L_CPU_LIST);
+    par_use(R_CPU_LIST);
+    par_use(L_THREADS);
+    par_use(R_THREADS);
+    par_use(L_URING_DEPTH);
+    par_use(R_URING_DEPTH);
+    par_use(L_ZCOPY);
+    par_use(R_ZCOPY);
+    tcp_parameters();
     ip_parameters(64*1024);
     stream_client_bw(K_TCP);
 }
@@ -194,13 +357,77 @@ run_server_tcp_bw(void)
 }
 
 
+/*
+ * Measure TCP latency while a bandwidth test runs alongside (client side).
+ */
+void
+run_client_tcp_bw_lat(void)
+{
+    par_use(L_ACCESS_RECV);
+    par_use(R_ACCESS_RECV);
+    par_use(L_CPU_LIST);
+    par_use(R_CPU_LIST);
+    par_use(L_PROBE_SIZE);
+    par_use(R_PROBE_SIZE);
+    par_use(L_THREADS);
+    par_use(R_THREADS);
+    par_use(L_URING_DEPTH);
+    par_use(R_URING_DEPTH);
+    par_use(L_ZCOPY);
+    par_use(R_ZCOPY);
+    setp_u32(0, L_PROBE_SIZE, 1);
+    setp_u32(0, R_PROBE_SIZE, 1);
+    tcp_parameters();
+    ip_parameters(64*1024);
+    stream_client_bw_lat(K_TCP);
+}
+
+
+/*
+ * Measure TCP latency while a bandwidth test runs alongside (server side).
+ */
+void
+run_server_tcp_bw_lat(void)
+{
+    stream_server_bw_lat(K_TCP);
+}
+
+
+/*
+ * Measure the TCP connection rate (client side).
+ */
+void
+run_client_tcp_conn_rate(void)
+{
+    par_use(L_CONN_DEPTH);
+    par_use(R_CONN_DEPTH);
+    ip_parameters(1);
+    stream_client_conn_rate(K_TCP);
+}
+
+
+/*
+ * Measure the TCP connection rate (server side).
+ */
+void
+run_server_tcp_conn_rate(void)
+{
+    stream_server_conn_rate(K_TCP);
+}
+
+
 /*
  * Measure TCP latency (client side).
  */
 void
 run_client_tcp_lat(void)
 {
-    ip_parameters(1);
+    par_use(L_OFFERED_LOAD);
+    par_use(R_OFFERED_LOAD);
+    par_use(L_POISSON);
+    par_use(R_POISSON);
+    tcp_parameters();
+    ip_parameters(Req.offered_load[0] ? sizeof(uint64_t) : 1);
     stream_client_lat(K_TCP);
 }
 
@@ -223,6 +450,16 @@ run_client_udp_bw(void)
 {
     par_use(L_ACCESS_RECV);
     par_use(R_ACCESS_RECV);
+    par_use(L_BATCH_SIZE);
+    par_use(R_BATCH_SIZE);
+    par_use(L_CPU_LIST);
+    par_use(R_CPU_LIST);
+    par_use(L_THREADS);
+    par_use(R_THREADS);
+    par_use(L_UDP_GSO);
+    par_use(R_UDP_GSO);
+    par_use(L_URING_DEPTH);
+    par_use(R_URING_DEPTH);
     ip_parameters(32*1024);
     datagram_client_bw(K_UDP);
 }
@@ -244,7 +481,11 @@ run_server_udp_bw(void)
 void
 run_client_udp_lat(void)
 {
-    ip_parameters(1);
+    par_use(L_OFFERED_LOAD);
+    par_use(R_OFFERED_LOAD);
+    par_use(L_POISSON);
+    par_use(R_POISSON);
+    ip_parameters(Req.offered_load[0] ? sizeof(uint64_t) : 1);
     datagram_client_lat(K_UDP);
 }
 
@@ -259,6 +500,116 @@ run_server_udp_lat(void)
 }
 
 
+/*
+ * Measure Unix datagram bandwidth (client side).
+ */
+void
+run_client_unix_dgram_bw(void)
+{
+    par_use(L_ACCESS_RECV);
+    par_use(R_ACCESS_RECV);
+    par_use(L_BATCH_SIZE);
+    par_use(R_BATCH_SIZE);
+    par_use(L_CPU_LIST);
+    par_use(R_CPU_LIST);
+    par_use(L_THREADS);
+    par_use(R_THREADS);
+    par_use(L_URING_DEPTH);
+    par_use(R_URING_DEPTH);
+    ip_parameters(32*1024);
+    datagram_client_bw(K_UNIX_DGRAM);
+}
+
+
+/*
+ * Measure Unix datagram bandwidth (server side).
+ */
+void
+run_server_unix_dgram_bw(void)
+{
+    datagram_server_bw(K_UNIX_DGRAM);
+}
+
+
+/*
+ * Measure Unix datagram latency (client side).
+ */
+void
+run_client_unix_dgram_lat(void)
+{
+    par_use(L_OFFERED_LOAD);
+    par_use(R_OFFERED_LOAD);
+    par_use(L_POISSON);
+    par_use(R_POISSON);
+    ip_parameters(Req.offered_load[0] ? sizeof(uint64_t) : 1);
+    datagram_client_lat(K_UNIX_DGRAM);
+}
+
+
+/*
+ * Measure Unix datagram latency (server side).
+ */
+void
+run_server_unix_dgram_lat(void)
+{
+    datagram_server_lat(K_UNIX_DGRAM);
+}
+
+
+/*
+ * Measure Unix stream bandwidth (client side).
+ */
+void
+run_client_unix_stream_bw(void)
+{
+    par_use(L_ACCESS_RECV);
+    par_use(R_ACCESS_RECV);
+    par_use(L_CPU_LIST);
+    par_use(R_CPU_LIST);
+    par_use(L_THREADS);
+    par_use(R_THREADS);
+    par_use(L_URING_DEPTH);
+    par_use(R_URING_DEPTH);
+    ip_parameters(64*1024);
+    stream_client_bw(K_UNIX_STREAM);
+}
+
+
+/*
+ * Measure Unix stream bandwidth (server side).
+ */
+void
+run_server_unix_stream_bw(void)
+{
+    stream_server_bw(K_UNIX_STREAM);
+}
+
+
+/*
+ * Measure Unix stream latency (client side).
+ */
+void
+run_client_unix_stream_lat(void)
+{
+    par_use(L_OFFERED_LOAD);
+    par_use(R_OFFERED_LOAD);
+    par_use(L_POISSON);
+    par_use(R_POISSON);
+    ip_parameters(Req.offered_load[0] ? sizeof(uint64_t) : 1);
+    stream_client_lat(K_UNIX_STREAM);
+}
+
+
+/*
+ * Measure Unix stream latency (server side).
+ */
+void
+run_server_unix_stream_lat(void)
+{
+    stream_server_lat(K_UNIX_STREAM);
+}
+
+
 /*
  * Measure stream bandwidth (client side).
  */
@@ -267,12 +618,28 @@ stream_client_bw(KIND kind)
 {
     char *buf;
     int sockFD;
+    ZCOPY zc;
+
+    if (ip_threads() > 1) {
+        int fds[MAX_THREADS];
 
-    client_init(&sockFD, kind);
-    buf = qmalloc(Req.msg_size);
+        client_init(fds, Req.threads, kind);
+        run_workers(fds, Req.threads, kind, stream_send_worker, 0);
+        show_results(BANDWIDTH);
+        return;
+    }
+    client_init(&sockFD, 1, kind);
+    if (ip_uring()) {
+        run_uring_bw(sockFD, kind, 1);
+        show_results(BANDWIDTH);
+        return;
+    }
+    buf = mem_alloc(Req.msg_size);
+    zc_init(&zc, sockFD, kind, buf);
+    tcp_watch(&sockFD, 1, kind);
     sync_test();
     while (!Finished) {
-        int n = send_full(sockFD, buf, Req.msg_size);
+        int n = zc_send_full(&zc, buf, Req.msg_size);
 
         if (Finished)
             break;
@@ -283,14 +650,47 @@ stream_client_bw(KIND kind)
         LStat.s.no_bytes += n;
         LStat.s.no_msgs++;
     }
+    tcp_end(&sockFD, 1, kind);
     stop_test_timer();
+    zc_close(&zc);
     exchange_results();
-    free(buf);
+    mem_free(buf);
     close(sockFD);
     show_results(BANDWIDTH);
 }
 
 
+/*
+ * Measure stream latency with a ping-pong probe on one connection while
+ * worker threads stream data as fast as they can on others (client side).
+ * Only the streaming connections count towards the bandwidth.
+ */
+static void
+stream_client_bw_lat(KIND kind)
+{
+    int fds[MAX_THREADS+1];
+    int n = ip_threads() > 1 ? Req.threads : 1;
+
+    client_init(fds, n+1, kind);
+    run_workers(fds, n, kind, stream_send_worker, stream_probe_worker);
+    show_results(BANDWIDTH_LAT);
+}
+
+
+/*
+ * Measure stream latency while a bandwidth test runs alongside (server side).
+ */
+static void
+stream_server_bw_lat(KIND kind)
+{
+    int fds[MAX_THREADS+1];
+    int n = ip_threads() > 1 ? Req.threads : 1;
+
+    stream_server_init(fds, n+1, kind);
+    run_workers(fds, n, kind, stream_recv_worker, stream_echo_worker);
+}
+
+
 /*
  * Measure stream bandwidth (server side).
  */
@@ -300,9 +700,21 @@ stream_server_bw(KIND kind)
     int sockFD = -1;
     char *buf = 0;
 
-    stream_server_init(&sockFD, kind);
+    if (ip_threads() > 1) {
+        int fds[MAX_THREADS];
+
+        stream_server_init(fds, Req.threads, kind);
+        run_workers(fds, Req.threads, kind, stream_recv_worker, 0);
+        return;
+    }
+    stream_server_init(&sockFD, 1, kind);
+    if (ip_uring()) {
+        run_uring_bw(sockFD, kind, 0);
+        return;
+    }
+    buf = mem_alloc(Req.msg_size);
+    tcp_watch(&sockFD, 1, kind);
     sync_test();
-    buf = qmalloc(Req.msg_size);
     while (!Finished) {
         int n = recv_full(sockFD, buf, Req.msg_size);
 
@@ -317,9 +729,10 @@ stream_server_bw(KIND kind)
         if (Req.access_recv)
             touch_data(buf, Req.msg_size);
     }
+    tcp_end(&sockFD, 1, kind);
     stop_test_timer();
     exchange_results();
-    free(buf);
+    mem_free(buf);
     if (sockFD >= 0)
         close(sockFD);
 }
@@ -334,10 +747,22 @@ stream_client_lat(KIND kind)
     char *buf;
     int sockFD;
 
-    client_init(&sockFD, kind);
-    buf = qmalloc(Req.msg_size);
+    client_init(&sockFD, 1, kind);
+    if (Req.offered_load[0]) {
+        load_client_lat(sockFD, 1);
+        show_results(LATENCY);
+        return;
+    }
+    if (ip_uring()) {
+        run_uring_lat(sockFD, kind);
+        show_results(LATENCY);
+        return;
+    }
+    buf = mem_alloc(Req.msg_size);
+    tcp_watch(&sockFD, 1, kind);
     sync_test();
     while (!Finished) {
+        uint64_t t = get_nsecs();
         int n = send_full(sockFD, buf, Req.msg_size);
 
         if (Finished)
@@ -358,10 +783,12 @@ stream_client_lat(KIND kind)
         }
         LStat.r.no_bytes += n;
         LStat.r.no_msgs++;
+        hist_add(&LatHist, (get_nsecs() - t) / 2);
     }
+    tcp_end(&sockFD, 1, kind);
     stop_test_timer();
     exchange_results();
-    free(buf);
+    mem_free(buf);
     close(sockFD);
     show_results(LATENCY);
 }
@@ -376,9 +803,14 @@ stream_server_lat(KIND kind)
     int sockFD = -1;
     char *buf = 0;
 
-    stream_server_init(&sockFD, kind);
+    stream_server_init(&sockFD, 1, kind);
+    if (ip_uring()) {
+        run_uring_lat(sockFD, kind);
+        return;
+    }
+    buf = mem_alloc(Req.msg_size);
+    tcp_watch(&sockFD, 1, kind);
     sync_test();
-    buf = qmalloc(Req.msg_size);
     while (!Finished) {
         int n = recv_full(sockFD, buf, Req.msg_size);
 
@@ -401,40 +833,162 @@ stream_server_lat(KIND kind)
         LStat.s.no_bytes += n;
         LStat.s.no_msgs++;
     }
+    tcp_end(&sockFD, 1, kind);
     stop_test_timer();
     exchange_results();
-    free(buf);
+    mem_free(buf);
     close(sockFD);
 }
 
 
 /*
- * Measure datagram bandwidth (client side).
+ * Measure the rate at which stream connections can be set up (client side).
+ * Up to --conn_depth non-blocking connects are kept in progress at once.  The
+ * latency of each is from the creation of its socket until it is found to be
+ * connected.  A connection is aborted with a reset as soon as it is up so
+ * that its port is not held in TIME_WAIT, which would soon run us out of
+ * ports.
  */
 static void
-datagram_client_bw(KIND kind)
+stream_client_conn_rate(KIND kind)
 {
-    char *buf;
-    int sockFD;
+    int i;
+    int fd;
+    SS addr;
+    socklen_t addrlen = sizeof(addr);
+    int n = Req.conn_depth ? Req.conn_depth : 1;
+    struct pollfd *pfds = qmalloc(n * sizeof(*pfds));
+    uint64_t *start = qmalloc(n * sizeof(*start));
+    uint64_t *begun = qmalloc(n * sizeof(*begun));
+    struct linger linger ={ .l_onoff = 1, .l_linger = 0 };
+
+    client_init(&fd, 1, kind);
+    if (getpeername(fd, (SA *)&addr, &addrlen) < 0)
+        error(SYS, "getpeername failed");
+    close(fd);
+    for (i = 0; i < n; ++i)
+        pfds[i].fd = -1;
 
-    client_init(&sockFD, kind);
-    buf = qmalloc(Req.msg_size);
     sync_test();
     while (!Finished) {
-        int n = write(sockFD, buf, Req.msg_size);
+        for (i = 0; i < n; ++i) {
+            if (pfds[i].fd >= 0)
+                continue;
+            start[i] = get_nsecs();
+            fd = socket(addr.ss_family, SOCK_STREAM|SOCK_NONBLOCK, 0);
+            if (fd < 0)
+                error(SYS, "socket failed");
+            begun[i] = get_nsecs();
+            if (connect(fd, (SA *)&addr, addrlen) < 0 && errno != EINPROGRESS) {
+                LStat.r.no_errs++;
+                close(fd);
+                continue;
+            }
+            pfds[i].fd = fd;
+            pfds[i].events = POLLOUT;
+        }
+        if (poll(pfds, n, 100) <= 0)
+            continue;
+        for (i = 0; i < n; ++i) {
+            int err = 0;
+            socklen_t errlen = sizeof(err);
+            uint64_t t;
+
+            if (pfds[i].fd < 0 || !pfds[i].revents)
+                continue;
+            t = get_nsecs();
+            getsockopt(pfds[i].fd, SOL_SOCKET, SO_ERROR, &err, &errlen);
+            if (err)
+                LStat.r.no_errs++;
+            else if (!Finished) {
+                LStat.r.no_msgs++;
+                LStat.create_nsecs += begun[i] - start[i];
+                LStat.connect_nsecs += t - begun[i];
+                hist_add(&LatHist, t - start[i]);
+            }
+            setsockopt(pfds[i].fd, SOL_SOCKET, SO_LINGER,
+                       &linger, sizeof(linger));
+            close(pfds[i].fd);
+            pfds[i].fd = -1;
+        }
+    }
+    stop_test_timer();
+    for (i = 0; i < n; ++i)
+        if (pfds[i].fd >= 0)
+            close(pfds[i].fd);
+    exchange_results();
+    free(begun);
+    free(start);
+    free(pfds);
+    show_results(CONN_RATE);
+}
 
-        if (Finished)
-            break;
-        if (n < 0) {
-            LStat.s.no_errs++;
+
+/*
+ * Measure the rate at which stream connections can be set up (server side).
+ * The first connection only tells the client which address reaches us.
+ */
+static void
+stream_server_conn_rate(KIND kind)
+{
+    int fd;
+    uint32_t port;
+    int listenFD = stream_listen(kind, SOMAXCONN, &port);
+
+    encode_uint32(&port, port);
+    send_mesg(&port, sizeof(port), "port");
+    fd = accept(listenFD, 0, 0);
+    if (fd < 0)
+        error(SYS, "accept failed");
+    close(fd);
+
+    sync_test();
+    while (!Finished) {
+        fd = accept(listenFD, 0, 0);
+        if (fd < 0) {
+            if (errno != EINTR)
+                LStat.r.no_errs++;
             continue;
         }
-        LStat.s.no_bytes += n;
-        LStat.s.no_msgs++;
+        LStat.r.no_msgs++;
+        close(fd);
+    }
+    stop_test_timer();
+    exchange_results();
+    close(listenFD);
+}
+
+
+/*
+ * Measure datagram bandwidth (client side).
+ */
+static void
+datagram_client_bw(KIND kind)
+{
+    DGRAM dg;
+    int sockFD;
+
+    if (ip_threads() > 1) {
+        int fds[MAX_THREADS];
+
+        client_init(fds, Req.threads, kind);
+        run_workers(fds, Req.threads, kind, datagram_send_worker, 0);
+        show_results(BANDWIDTH_SR);
+        return;
+    }
+    client_init(&sockFD, 1, kind);
+    if (ip_uring()) {
+        run_uring_bw(sockFD, kind, 1);
+        show_results(BANDWIDTH_SR);
+        return;
     }
+    dg_init(&dg, sockFD, 1);
+    sync_test();
+    while (!Finished)
+        dg_send(&dg, &LStat.s);
     stop_test_timer();
     exchange_results();
-    free(buf);
+    dg_close(&dg);
     close(sockFD);
     show_results(BANDWIDTH_SR);
 }
@@ -446,29 +1000,28 @@ datagram_client_bw(KIND kind)
 static void
 datagram_server_bw(KIND kind)
 {
+    DGRAM dg;
     int sockFD;
-    char *buf = 0;
 
-    datagram_server_init(&sockFD, kind);
-    sync_test();
-    buf = qmalloc(Req.msg_size);
-    while (!Finished) {
-        int n = recv(sockFD, buf, Req.msg_size, 0);
+    if (ip_threads() > 1) {
+        int fds[MAX_THREADS];
 
-        if (Finished)
-            break;
-        if (n < 0) {
-            LStat.r.no_errs++;
-            continue;
-        }
-        LStat.r.no_bytes += n;
-        LStat.r.no_msgs++;
-        if (Req.access_recv)
-            touch_data(buf, Req.msg_size);
+        datagram_server_init(fds, Req.threads, kind);
+        run_workers(fds, Req.threads, kind, datagram_recv_worker, 0);
+        return;
+    }
+    datagram_server_init(&sockFD, 1, kind);
+    if (ip_uring()) {
+        run_uring_bw(sockFD, kind, 0);
+        return;
     }
+    dg_init(&dg, sockFD, 0);
+    sync_test();
+    while (!Finished)
+        dg_recv(&dg, &LStat.r);
     stop_test_timer();
     exchange_results();
-    free(buf);
+    dg_close(&dg);
     close(sockFD);
 }
 
@@ -482,10 +1035,21 @@ datagram_client_lat(KIND kind)
     char *buf;
     int sockFD;
 
-    client_init(&sockFD, kind);
-    buf = qmalloc(Req.msg_size);
+    client_init(&sockFD, 1, kind);
+    if (Req.offered_load[0]) {
+        load_client_lat(sockFD, 0);
+        show_results(LATENCY);
+        return;
+    }
+    if (ip_uring()) {
+        run_uring_lat(sockFD, kind);
+        show_results(LATENCY);
+        return;
+    }
+    buf = mem_alloc(Req.msg_size);
     sync_test();
     while (!Finished) {
+        uint64_t t = get_nsecs();
         int n = write(sockFD, buf, Req.msg_size);
 
         if (Finished)
@@ -506,10 +1070,11 @@ datagram_client_lat(KIND kind)
         }
         LStat.r.no_bytes += n;
         LStat.r.no_msgs++;
+        hist_add(&LatHist, (get_nsecs() - t) / 2);
     }
     stop_test_timer();
     exchange_results();
-    free(buf);
+    mem_free(buf);
     close(sockFD);
     show_results(LATENCY);
 }
@@ -524,9 +1089,13 @@ datagram_server_lat(KIND kind)
     int sockfd;
     char *buf = 0;
 
-    datagram_server_init(&sockfd, kind);
+    datagram_server_init(&sockfd, 1, kind);
+    if (ip_uring()) {
+        run_uring_lat(sockfd, kind);
+        return;
+    }
+    buf = mem_alloc(Req.msg_size);
     sync_test();
-    buf = qmalloc(Req.msg_size);
     while (!Finished) {
         SS clientAddr;
         socklen_t clientLen = sizeof(clientAddr);
@@ -554,11 +1123,91 @@ datagram_server_lat(KIND kind)
     }
     stop_test_timer();
     exchange_results();
-    free(buf);
+    mem_free(buf);
     close(sockfd);
 }
 
 
+/*
+ * Measure latency under an offered load (client side).  Messages are sent on
+ * the schedule set by --offered_load without waiting for replies and each
+ * carries the time it was due in its first 8 bytes; the server echoes it back
+ * unchanged.  Both directions are non-blocking so a stalled reply never holds
+ * back later sends.  For a stream, partial sends and receives are resumed
+ * where they left off.
+ */
+static void
+load_client_lat(int fd, int stream)
+{
+    int n;
+    uint64_t t;
+    int size = Req.msg_size;
+    int soff = 0;
+    int roff = 0;
+    int sending = 0;
+    char *sbuf = mem_alloc(size);
+    char *rbuf = mem_alloc(size);
+
+    if (size < (int)sizeof(t))
+        error(0, "--msg_size must be at least %d with --offered_load",
+                 (int)sizeof(t));
+    if (ip_uring())
+        error(0, "--offered_load cannot be used with --io_engine %s",
+                 Req.io_engine);
+    sync_test();
+    pace_init();
+    while (!Finished) {
+        if (!sending) {
+            t = pace_take();
+            if (t) {
+                memcpy(sbuf, &t, sizeof(t));
+                soff = 0;
+                sending = 1;
+            }
+        }
+        if (sending) {
+            n = send(fd, sbuf+soff, size-soff, MSG_DONTWAIT);
+            if (n > 0) {
+                LStat.s.no_bytes += n;
+                soff += n;
+                if (!stream || soff == size) {
+                    LStat.s.no_msgs++;
+                    sending = 0;
+                }
+            } else if (errno != EAGAIN && errno != EINTR) {
+                LStat.s.no_errs++;
+                if (!stream)
+                    sending = 0;
+            }
+        }
+
+        n = recv(fd, rbuf+roff, size-roff, MSG_DONTWAIT);
+        if (n > 0) {
+            LStat.r.no_bytes += n;
+            roff += n;
+            if (!stream && roff < (int)sizeof(t)) {
+                LStat.r.no_errs++;
+                roff = 0;
+            } else if (!stream || roff == size) {
+                memcpy(&t, rbuf, sizeof(t));
+                hist_add(&LatHist, (get_nsecs() - t) / 2);
+                LStat.r.no_msgs++;
+                roff = 0;
+            }
+        } else if (n == 0 && stream) {
+            break;
+        } else if (n < 0 && errno != EAGAIN && errno != EINTR) {
+            LStat.r.no_errs++;
+        }
+    }
+    stop_test_timer();
+    exchange_results();
+    mem_free(rbuf);
+    mem_free(sbuf);
+    close(fd);
+}
+
+
 /*
  * Set default IP parameters and ensure that any that are set are being used.
  */
@@ -571,35 +1220,404 @@ ip_parameters(long msgSize)
     par_use(R_PORT);
     par_use(L_SOCK_BUF_SIZE);
     par_use(R_SOCK_BUF_SIZE);
+    par_use(L_SOCK_BUSY_POLL);
+    par_use(R_SOCK_BUSY_POLL);
+    par_use(L_IO_ENGINE);
+    par_use(R_IO_ENGINE);
+    par_use(L_MEM_HUGE);
+    par_use(R_MEM_HUGE);
+    par_use(L_MEM_NODE);
+    par_use(R_MEM_NODE);
     opt_check();
 }
 
 
 /*
- * Socket client initialization.
+ * Note the parameters that control TCP connections.
  */
 static void
-client_init(int *fd, KIND kind)
+tcp_parameters(void)
 {
-    uint32_t rport;
-    AI *ai, *ailist;
+    par_use(L_TCP_CC);
+    par_use(R_TCP_CC);
+    par_use(L_TCP_CORK);
+    par_use(R_TCP_CORK);
+    par_use(L_TCP_NODELAY);
+    par_use(R_TCP_NODELAY);
+}
 
-    client_send_request();
-    recv_mesg(&rport, sizeof(rport), "port");
-    rport = decode_uint32(&rport);
-    ailist = getaddrinfo_kind(0, kind, rport);
-    for (ai = ailist; ai; ai = ai->ai_next) {
-        if (!ai->ai_family)
-            continue;
-        *fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+
+/*
+ * Return the number of worker threads that were requested.
+ */
+static int
+ip_threads(void)
+{
+    if (Req.threads > MAX_THREADS)
+        error(0, "too many threads: %d; maximum is %d",
+                 Req.threads, MAX_THREADS);
+    return Req.threads;
+}
+
+
+/*
+ * Return true if the io_uring engine was requested.  It does its own sending
+ * and receiving so it cannot be combined with zero copy or batching.
+ */
+static int
+ip_uring(void)
+{
+    if (!Req.io_engine[0] || streq(Req.io_engine, "sync"))
+        return 0;
+    if (Req.zcopy[0] && !streq(Req.zcopy, "none"))
+        error(0, "--zcopy cannot be used with --io_engine %s", Req.io_engine);
+    if (Req.batch_size > 1 || Req.udp_gso)
+        error(0, "--batch_size and --udp_gso cannot be used with "
+                 "--io_engine %s", Req.io_engine);
+    return 1;
+}
+
+
+/*
+ * Run a bandwidth test on a single socket using the io_uring engine.
+ */
+static void
+run_uring_bw(int fd, KIND kind, int sender)
+{
+    URING *ring = uring_open(fd, 0, !is_dgram(kind));
+
+    tcp_watch(&fd, 1, kind);
+    sync_test();
+    if (sender)
+        uring_send_bw(ring, &LStat.s);
+    else
+        uring_recv_bw(ring, &LStat.r);
+    tcp_end(&fd, 1, kind);
+    stop_test_timer();
+    uring_close(ring);
+    exchange_results();
+    close(fd);
+}
+
+
+/*
+ * Run a latency test on a single socket using the io_uring engine.
+ */
+static void
+run_uring_lat(int fd, KIND kind)
+{
+    URING *ring = uring_open(fd, 1, !is_dgram(kind));
+
+    tcp_watch(&fd, 1, kind);
+    sync_test();
+    if (is_client())
+        uring_client_lat(ring);
+    else
+        uring_server_lat(ring);
+    tcp_end(&fd, 1, kind);
+    stop_test_timer();
+    uring_close(ring);
+    exchange_results();
+    close(fd);
+}
+
+
+/*
+ * Run a test using one worker thread for each of the n sockets.  All signals
+ * are blocked in the workers so that the main thread is the one that notices
+ * when time is up; it then shuts down the sockets to knock the workers out of
+ * any system call they might be blocked in.  Statistics from each worker are
+ * combined and also saved individually.  If probe is set, one more worker
+ * runs it on socket n; its traffic is left out of the statistics.
+ */
+static void
+run_workers(int *fds, int n, KIND kind, WORKFUNC *func, WORKFUNC *probe)
+{
+    int i;
+    sigset_t set;
+    sigset_t old;
+    WORKER workers[MAX_THREADS+1];
+    int t = probe ? n+1 : n;
+
+    memset(workers, 0, sizeof(workers));
+    for (i = 0; i < t; ++i) {
+        workers[i].func = i < n ? func : probe;
+        workers[i].kind = kind;
+        workers[i].fd = fds[i];
+        workers[i].cpu = thread_cpu(i);
+    }
+
+    for (i = 0; i < n; ++i)
+        interval_watch(&workers[i].s, &workers[i].r);
+    tcp_watch(fds, n, kind);
+    sync_test();
+    sigfillset(&set);
+    pthread_sigmask(SIG_BLOCK, &set, &old);
+    for (i = 0; i < t; ++i)
+        if (pthread_create(&workers[i].thread, 0, worker_main, &workers[i]))
+            error(SYS, "failed to create thread");
+    pthread_sigmask(SIG_SETMASK, &old, 0);
+
+    while (!Finished)
+        pause();
+    tcp_end(fds, n, kind);
+    for (i = 0; i < t; ++i)
+        shutdown(fds[i], SHUT_RDWR);
+    for (i = 0; i < t; ++i)
+        pthread_join(workers[i].thread, 0);
+    stop_test_timer();
+
+    LStat.no_threads = n;
+    for (i = 0; i < n; ++i) {
+        WORKER *w = &workers[i];
+
+        LStat.ts[i] = w->s;
+        LStat.tr[i] = w->r;
+        LStat.s.no_bytes += w->s.no_bytes;
+        LStat.s.no_msgs  += w->s.no_msgs;
+        LStat.s.no_errs  += w->s.no_errs;
+        LStat.r.no_bytes += w->r.no_bytes;
+        LStat.r.no_msgs  += w->r.no_msgs;
+        LStat.r.no_errs  += w->r.no_errs;
+    }
+    exchange_results();
+    for (i = 0; i < t; ++i)
+        close(fds[i]);
+}
+
+
+/*
+ * Main routine of a worker thread.  A worker may finish on its own if its
+ * peer closes the connection so we send ourselves a SIGALRM to ensure that
+ * the main thread wakes up.
+ */
+static void *
+worker_main(void *arg)
+{
+    WORKER *w = arg;
+
+    if (w->cpu >= 0) {
+        cpu_set_t set;
+
+        CPU_ZERO(&set);
+        CPU_SET(w->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+            error(0, "cannot set thread affinity (cpu %d)", w->cpu);
+    }
+    (w->func)(w);
+    kill(getpid(), SIGALRM);
+    return 0;
+}
+
+
+/*
+ * Worker that sends on a stream socket.
+ */
+static void
+stream_send_worker(WORKER *w)
+{
+    char *buf;
+
+    if (ip_uring()) {
+        URING *ring = uring_open(w->fd, 0, 1);
+
+        uring_send_bw(ring, &w->s);
+        uring_close(ring);
+        return;
+    }
+    buf = mem_alloc(Req.msg_size);
+    zc_init(&w->zc, w->fd, w->kind, buf);
+    while (!Finished) {
+        int n = zc_send_full(&w->zc, buf, Req.msg_size);
+
+        if (Finished)
+            break;
+        if (n < 0) {
+            w->s.no_errs++;
+            continue;
+        }
+        w->s.no_bytes += n;
+        w->s.no_msgs++;
+    }
+    zc_close(&w->zc);
+    mem_free(buf);
+}
+
+
+/*
+ * Worker that measures latency on a stream socket by sending probe_size
+ * messages back and forth.
+ */
+static void
+stream_probe_worker(WORKER *w)
+{
+    char *buf = mem_alloc(Req.probe_size);
+
+    while (!Finished) {
+        uint64_t t = get_nsecs();
+
+        if (send_full(w->fd, buf, Req.probe_size) < 0) {
+            w->s.no_errs++;
+            continue;
+        }
+        if (recv_full(w->fd, buf, Req.probe_size) < 0) {
+            w->r.no_errs++;
+            continue;
+        }
+        if (Finished)
+            break;
+        hist_add(&LatHist, (get_nsecs() - t) / 2);
+    }
+    mem_free(buf);
+}
+
+
+/*
+ * Worker that echoes the messages of a stream_probe_worker.
+ */
+static void
+stream_echo_worker(WORKER *w)
+{
+    char *buf = mem_alloc(Req.probe_size);
+
+    while (!Finished) {
+        if (recv_full(w->fd, buf, Req.probe_size) < 0) {
+            w->r.no_errs++;
+            continue;
+        }
+        if (send_full(w->fd, buf, Req.probe_size) < 0)
+            w->s.no_errs++;
+    }
+    mem_free(buf);
+}
+
+
+/*
+ * Worker that receives on a stream socket.
+ */
+static void
+stream_recv_worker(WORKER *w)
+{
+    char *buf;
+
+    if (ip_uring()) {
+        URING *ring = uring_open(w->fd, 0, 1);
+
+        uring_recv_bw(ring, &w->r);
+        uring_close(ring);
+        return;
+    }
+    buf = mem_alloc(Req.msg_size);
+    while (!Finished) {
+        int n = recv_full(w->fd, buf, Req.msg_size);
+
+        if (Finished)
+            break;
+        if (n < 0) {
+            w->r.no_errs++;
+            continue;
+        }
+        w->r.no_bytes += n;
+        w->r.no_msgs++;
+        if (Req.access_recv)
+            touch_data(buf, Req.msg_size);
+    }
+    mem_free(buf);
+}
+
+
+/*
+ * Worker that sends on a datagram socket.
+ */
+static void
+datagram_send_worker(WORKER *w)
+{
+    DGRAM dg;
+
+    if (ip_uring()) {
+        URING *ring = uring_open(w->fd, 0, 0);
+
+        uring_send_bw(ring, &w->s);
+        uring_close(ring);
+        return;
+    }
+    dg_init(&dg, w->fd, 1);
+    while (!Finished)
+        dg_send(&dg, &w->s);
+    dg_close(&dg);
+}
+
+
+/*
+ * Worker that receives on a datagram socket.
+ */
+static void
+datagram_recv_worker(WORKER *w)
+{
+    DGRAM dg;
+
+    if (ip_uring()) {
+        URING *ring = uring_open(w->fd, 0, 0);
+
+        uring_recv_bw(ring, &w->r);
+        uring_close(ring);
+        return;
+    }
+    dg_init(&dg, w->fd, 0);
+    while (!Finished)
+        dg_recv(&dg, &w->r);
+    dg_close(&dg);
+}
+
+
+/*
+ * Socket client initialization.  We make n connections to the server.
+ */
+static void
+client_init(int *fds, int n, KIND kind)
+{
+    int i;
+
+    client_send_request();
+    for (i = 0; i < n; ++i)
+        client_connect(&fds[i], kind);
+}
+
+
+/*
+ * Make a single connection to the server using the port it sends us.
+ */
+static void
+client_connect(int *fd, KIND kind)
+{
+    uint32_t rport;
+    AI *ai, *ailist;
+
+    recv_mesg(&rport, sizeof(rport), "port");
+    rport = decode_uint32(&rport);
+    ailist = getaddrinfo_kind(0, kind, rport);
+    for (ai = ailist; ai; ai = ai->ai_next) {
+        if (!ai->ai_family)
+            continue;
+        *fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
 	setsockopt_one(*fd, SO_REUSEADDR);
+        set_socket_tcp(*fd, kind);
+        /* Unix datagram sockets need a name for the server to reply to */
+        if (kind == K_UNIX_DGRAM) {
+            sa_family_t family = AF_UNIX;
+
+            if (bind(*fd, (SA *)&family, sizeof(family)) < 0)
+                error(SYS, "bind failed");
+        }
         if (connect(*fd, ai->ai_addr, ai->ai_addrlen) == SUCCESS0)
             break;
         close(*fd);
     }
-    freeaddrinfo(ailist);
+    freeaddrinfo_kind(ailist, kind);
     if (!ai)
         error(0, "could not make %s connection to server", kind_name(kind));
+    set_socket_busy_poll(*fd);
+    set_socket_nic(*fd);
     if (Debug) {
         uint32_t lport;
         get_socket_port(*fd, &lport);
@@ -609,12 +1627,38 @@ client_init(int *fd, KIND kind)
 
 
 /*
- * Socket server initialization.
+ * Socket server initialization.  We accept n connections from the client,
+ * sending it the port before each one.
  */
 static void
-stream_server_init(int *fd, KIND kind)
+stream_server_init(int *fds, int n, KIND kind)
 {
+    int i;
     uint32_t port;
+    int listenFD = stream_listen(kind, 1, &port);
+
+    encode_uint32(&port, port);
+    for (i = 0; i < n; ++i) {
+        send_mesg(&port, sizeof(port), "port");
+        fds[i] = accept(listenFD, 0, 0);
+        if (fds[i] < 0)
+            error(SYS, "accept failed");
+        debug("accepted %s connection", kind_name(kind));
+        set_socket_buffer_size(fds[i]);
+        set_socket_busy_poll(fds[i]);
+        set_socket_nic(fds[i]);
+        set_socket_tcp(fds[i], kind);
+    }
+    close(listenFD);
+}
+
+
+/*
+ * Create a socket to listen for stream connections and note its port.
+ */
+static int
+stream_listen(KIND kind, int backlog, uint32_t *port)
+{
     AI *ai;
     int listenFD = -1;
 
@@ -631,57 +1675,56 @@ stream_server_init(int *fd, KIND kind)
         close(listenFD);
         listenFD = -1;
     }
-    freeaddrinfo(ailist);
+    freeaddrinfo_kind(ailist, kind);
     if (!ai)
         error(0, "unable to make %s socket", kind_name(kind));
-    if (listen(listenFD, 1) < 0)
+    if (listen(listenFD, backlog) < 0)
         error(SYS, "listen failed");
 
-    get_socket_port(listenFD, &port);
-    encode_uint32(&port, port);
-    send_mesg(&port, sizeof(port), "port");
-    *fd = accept(listenFD, 0, 0);
-    if (*fd < 0)
-        error(SYS, "accept failed");
-    debug("accepted %s connection", kind_name(kind));
-    set_socket_buffer_size(*fd);
-    close(listenFD);
-    debug("receiving to %s port %d", kind_name(kind), port);
+    get_socket_port(listenFD, port);
+    debug("receiving to %s port %d", kind_name(kind), *port);
+    return listenFD;
 }
 
 
 /*
- * Datagram server initialization.
+ * Datagram server initialization.  We create n sockets and send the client
+ * the port of each.  If a port was requested, only the first socket uses it.
  */
 static void
-datagram_server_init(int *fd, KIND kind)
+datagram_server_init(int *fds, int n, KIND kind)
 {
-    uint32_t port;
-    AI *ai;
-    int sockfd = -1;
-
-    AI *ailist = getaddrinfo_kind(1, kind, Req.port);
-    for (ai = ailist; ai; ai = ai->ai_next) {
-        if (!ai->ai_family)
-            continue;
-        sockfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
-        if (sockfd < 0)
-            continue;
-        setsockopt_one(sockfd, SO_REUSEADDR);
-        if (bind(sockfd, ai->ai_addr, ai->ai_addrlen) == SUCCESS0)
-            break;
-        close(sockfd);
-        sockfd = -1;
+    int i;
+
+    for (i = 0; i < n; ++i) {
+        uint32_t port;
+        AI *ai;
+        int sockfd = -1;
+
+        AI *ailist = getaddrinfo_kind(1, kind, i ? 0 : Req.port);
+        for (ai = ailist; ai; ai = ai->ai_next) {
+            if (!ai->ai_family)
+                continue;
+            sockfd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+            if (sockfd < 0)
+                continue;
+            setsockopt_one(sockfd, SO_REUSEADDR);
+            if (bind(sockfd, ai->ai_addr, ai->ai_addrlen) == SUCCESS0)
+                break;
+            close(sockfd);
+            sockfd = -1;
+        }
+        freeaddrinfo_kind(ailist, kind);
+        if (!ai)
+            error(0, "unable to make %s socket", kind_name(kind));
+
+        set_socket_buffer_size(sockfd);
+        set_socket_busy_poll(sockfd);
+        get_socket_port(sockfd, &port);
+        encode_uint32(&port, port);
+        send_mesg(&port, sizeof(port), "port");
+        fds[i] = sockfd;
     }
-    freeaddrinfo(ailist);
-    if (!ai)
-        error(0, "unable to make %s socket", kind_name(kind));
-
-    set_socket_buffer_size(sockfd);
-    get_socket_port(sockfd, &port);
-    encode_uint32(&port, port);
-    send_mesg(&port, sizeof(port), "port");
-    *fd = sockfd;
 }
 
 
@@ -699,6 +1742,8 @@ getaddrinfo_kind(int serverflag, KIND kind, int port)
         .ai_socktype = SOCK_STREAM
     };
 
+    if (is_unix(kind))
+        return getaddrinfo_unix(serverflag, kind, port);
     if (serverflag){
         hints.ai_flags |= AI_PASSIVE;
         hints.ai_family = AF_INET6;
@@ -724,6 +1769,49 @@ getaddrinfo_kind(int serverflag, KIND kind, int port)
 }
 
 
+/*
+ * Return an address for a Unix domain socket.  These are named in the
+ * abstract namespace by their port written as five hex digits, which is the
+ * form that the kernel uses when it picks the name itself.  A server that is
+ * given a port of 0 leaves the choice to the kernel.  The address follows
+ * the addrinfo in a single allocation.
+ */
+static AI *
+getaddrinfo_unix(int serverflag, KIND kind, int port)
+{
+    struct {
+        AI                 ai;
+        struct sockaddr_un sun;
+    } *p = qmalloc(sizeof(*p));
+
+    memset(p, 0, sizeof(*p));
+    p->sun.sun_family = AF_UNIX;
+    p->ai.ai_family = AF_UNIX;
+    p->ai.ai_socktype = (kind == K_UNIX_DGRAM) ? SOCK_DGRAM : SOCK_STREAM;
+    p->ai.ai_addr = (SA *)&p->sun;
+    if (serverflag && !port)
+        p->ai.ai_addrlen = sizeof(sa_family_t);
+    else {
+        snprintf(p->sun.sun_path+1, sizeof(p->sun.sun_path)-1, "%05x", port);
+        p->ai.ai_addrlen = offsetof(struct sockaddr_un, sun_path) + 6;
+    }
+    return &p->ai;
+}
+
+
+/*
+ * Free a list returned by getaddrinfo_kind.
+ */
+static void
+freeaddrinfo_kind(AI *ailist, KIND kind)
+{
+    if (is_unix(kind))
+        free(ailist);
+    else
+        freeaddrinfo(ailist);
+}
+
+
 /*
  * Set both the send and receive socket buffer sizes.
  */
@@ -741,6 +1829,226 @@ set_socket_buffer_size(int fd)
 }
 
 
+/*
+ * Have blocking receives on the socket busy poll the device queue for up to
+ * sock_busy_poll microseconds before sleeping.  We also ask the kernel to
+ * prefer busy polling over interrupts but older kernels do not support that.
+ */
+static void
+set_socket_busy_poll(int fd)
+{
+    int usecs = Req.sock_busy_poll;
+    int one = 1;
+
+    if (!usecs)
+        return;
+    if (setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usecs, sizeof(usecs)) < 0)
+        error(SYS, "Failed to set busy poll time on socket");
+    if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one)) < 0)
+        debug("SO_PREFER_BUSY_POLL not supported");
+}
+
+
+/*
+ * Set the congestion control algorithm and the TCP_NODELAY and TCP_CORK
+ * options on a TCP connection if they were asked for.
+ */
+static void
+set_socket_tcp(int fd, KIND kind)
+{
+    int one = 1;
+
+    if (kind != K_TCP)
+        return;
+    if (Req.tcp_cc[0] && setsockopt(fd, IPPROTO_TCP, TCP_CONGESTION,
+                                    Req.tcp_cc, strlen(Req.tcp_cc)) < 0)
+        error(SYS, "failed to set TCP congestion control to %s; see "
+                   "net.ipv4.tcp_allowed_congestion_control", Req.tcp_cc);
+    if (Req.tcp_nodelay &&
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) < 0)
+        error(SYS, "failed to set TCP_NODELAY");
+    if (Req.tcp_cork &&
+        setsockopt(fd, IPPROTO_TCP, TCP_CORK, &one, sizeof(one)) < 0)
+        error(SYS, "failed to set TCP_CORK");
+}
+
+
+/*
+ * Have the interval reporter show the state of the connections of a TCP
+ * test.
+ */
+static void
+tcp_watch(int *fds, int n, KIND kind)
+{
+    int i;
+
+    if (kind != K_TCP)
+        return;
+    for (i = 0; i < n; ++i)
+        interval_tcp(fds[i]);
+}
+
+
+/*
+ * Note the state of the connections of a TCP test as it ends.
+ */
+static void
+tcp_end(int *fds, int n, KIND kind)
+{
+    if (kind != K_TCP)
+        return;
+    tcp_sample(fds, n, &LStat.tcp);
+}
+
+
+/*
+ * Sample TCP_INFO on n connections.  Older kernels return less than the
+ * full structure; fields they do not know about are left as 0.
+ */
+void
+tcp_sample(int *fds, int n, TCPI *tcpi)
+{
+    int i;
+
+    memset(tcpi, 0, sizeof(*tcpi));
+    for (i = 0; i < n; ++i) {
+        struct tcp_info info;
+        socklen_t len = sizeof(info);
+
+        memset(&info, 0, sizeof(info));
+        if (getsockopt(fds[i], IPPROTO_TCP, TCP_INFO, &info, &len) < 0)
+            continue;
+        if (!tcpi->conns) {
+            len = sizeof(tcpi->cc) - 1;
+            if (getsockopt(fds[i], IPPROTO_TCP, TCP_CONGESTION,
+                           tcpi->cc, &len) < 0)
+                tcpi->cc[0] = '\0';
+        }
+        tcpi->conns++;
+        tcpi->rtt            += info.tcpi_rtt;
+        tcpi->rttvar         += info.tcpi_rttvar;
+        tcpi->cwnd           += info.tcpi_snd_cwnd;
+        tcpi->retrans        += info.tcpi_total_retrans;
+        tcpi->delivery_rate  += info.tcpi_delivery_rate;
+        tcpi->busy           += info.tcpi_busy_time;
+        tcpi->rwnd_limited   += info.tcpi_rwnd_limited;
+        tcpi->sndbuf_limited += info.tcpi_sndbuf_limited;
+    }
+    if (tcpi->conns > 1) {
+        tcpi->rtt            /= tcpi->conns;
+        tcpi->rttvar         /= tcpi->conns;
+        tcpi->cwnd           /= tcpi->conns;
+        tcpi->busy           /= tcpi->conns;
+        tcpi->rwnd_limited   /= tcpi->conns;
+        tcpi->sndbuf_limited /= tcpi->conns;
+    }
+}
+
+
+/*
+ * If test buffers are to be placed on the node of the NIC or network counters
+ * were requested, find the interface that has the local address of the socket
+ * and note the node of its device and where its counters are.  Sockets bound
+ * to a wildcard address or to an interface with no device, such as loopback,
+ * leave the node unknown.
+ */
+static void
+set_socket_nic(int fd)
+{
+    char *name;
+
+    if (!streq(Req.mem_node, "nic") && !Req.net_counters)
+        return;
+    name = socket_nic(fd);
+    if (name) {
+        set_nic(name);
+        free(name);
+    } else
+        debug("no interface for socket address; numa node of nic unknown");
+}
+
+
+/*
+ * Note the node of the device of an interface and where its counters are, if
+ * they were asked for.
+ */
+void
+set_nic(char *name)
+{
+    char *dir = qasprintf("/sys/class/net/%s", name);
+    char *dev = qasprintf("%s/device", dir);
+
+    if (streq(Req.mem_node, "nic"))
+        mem_nic(dev);
+    if (Req.net_counters)
+        net_dir(dir);
+    free(dev);
+    free(dir);
+}
+
+
+/*
+ * Return the local address of a socket, converting a v4-mapped IPv6 address
+ * back to plain IPv4.
+ */
+void
+socket_addr(int fd, SS *sa)
+{
+    socklen_t salen = sizeof(*sa);
+
+    if (getsockname(fd, (SA *)sa, &salen) < 0)
+        error(SYS, "getsockname failed");
+    if (sa->ss_family == AF_INET6 &&
+        IN6_IS_ADDR_V4MAPPED(&((struct sockaddr_in6 *)sa)->sin6_addr)) {
+        struct in_addr a;
+
+        memcpy(&a, &((struct sockaddr_in6 *)sa)->sin6_addr.s6_addr[12],
+               sizeof(a));
+        memset(sa, 0, sizeof(*sa));
+        sa->ss_family = AF_INET;
+        ((struct sockaddr_in *)sa)->sin_addr = a;
+    }
+}
+
+
+/*
+ * Return the name of the interface that has the local address of a socket or
+ * 0 if there is none.  The caller frees the name.
+ */
+char *
+socket_nic(int fd)
+{
+    SS sa;
+    struct ifaddrs *ifa;
+    struct ifaddrs *ifalist;
+    char *name = 0;
+
+    socket_addr(fd, &sa);
+    if (getifaddrs(&ifalist) < 0)
+        error(SYS, "getifaddrs failed");
+    for (ifa = ifalist; ifa; ifa = ifa->ifa_next) {
+        SA *a = ifa->ifa_addr;
+
+        if (!a || a->sa_family != sa.ss_family)
+            continue;
+        if (a->sa_family == AF_INET &&
+            !memcmp(&((struct sockaddr_in *)a)->sin_addr,
+                    &((struct sockaddr_in *)&sa)->sin_addr,
+                    sizeof(struct in_addr)))
+            break;
+        if (a->sa_family == AF_INET6 &&
+            !memcmp(&((struct sockaddr_in6 *)a)->sin6_addr,
+                    &((struct sockaddr_in6 *)&sa)->sin6_addr,
+                    sizeof(struct in6_addr)))
+            break;
+    }
+    if (ifa)
+        name = qasprintf("%s", ifa->ifa_name);
+    freeifaddrs(ifalist);
+    return name;
+}
+
+
 /*
  * Given an open socket, return the port associated with it.  There must be a
  * more efficient way to do this that is portable.
@@ -754,6 +2062,13 @@ get_socket_port(int fd, uint32_t *port)
 
     if (getsockname(fd, (SA *)&sa, &salen) < 0)
         error(SYS, "getsockname failed");
+    if (sa.ss_family == AF_UNIX) {
+        char *name = ((struct sockaddr_un *)&sa)->sun_path;
+
+        *port = (salen > sizeof(sa_family_t) && !name[0]) ?
+                                                strtoul(name+1, 0, 16) : 0;
+        return;
+    }
     if (getnameinfo((SA *)&sa, salen, 0, 0, p, sizeof(p), NI_NUMERICSERV) < 0)
         error(SYS, "getnameinfo failed");
     *port = atoi(p);
@@ -764,7 +2079,8 @@ get_socket_port(int fd, uint32_t *port)
 
 /*
  * Send a complete message to a socket.  A zero byte write indicates an end of
- * file which suggests that we are finished.
+ * file which suggests that we are finished.  A write interrupted before then,
+ * such as by the end of a warm up, is tried again.
  */
 static int
 send_full(int fd, void *ptr, int len)
@@ -774,6 +2090,8 @@ send_full(int fd, void *ptr, int len)
     while (!Finished && n) {
         int i = write(fd, ptr, n);
 
+        if (i < 0 && errno == EINTR)
+            continue;
         if (i < 0)
             return i;
         ptr += i;
@@ -787,7 +2105,8 @@ send_full(int fd, void *ptr, int len)
 
 /*
  * Receive a complete message from a socket.  A zero byte read indicates an end
- * of file which suggests that we are finished.
+ * of file which suggests that we are finished.  A read interrupted before then
+ * is tried again so that what was already read is not lost.
  */
 static int
 recv_full(int fd, void *ptr, int len)
@@ -797,6 +2116,8 @@ recv_full(int fd, void *ptr, int len)
     while (!Finished && n) {
         int i = read(fd, ptr, n);
 
+        if (i < 0 && errno == EINTR)
+            continue;
         if (i < 0)
             return i;
         ptr += i;
@@ -808,6 +2129,368 @@ recv_full(int fd, void *ptr, int len)
 }
 
 
+/*
+ * Set up for sending on a stream socket using the zero copy mode the user
+ * asked for.  This is only supported for TCP.  For sendfile and splice, the
+ * message is kept in a memfd; note that these send the same data every time.
+ */
+static void
+zc_init(ZCOPY *zc, int fd, KIND kind, char *buf)
+{
+    char *mode = Req.zcopy;
+
+    memset(zc, 0, sizeof(*zc));
+    zc->fd = fd;
+    zc->memfd = -1;
+    zc->pipe[0] = -1;
+    zc->pipe[1] = -1;
+    if (kind != K_TCP || !*mode || streq(mode, "none"))
+        zc->mode = ZC_NONE;
+    else if (streq(mode, "msg_zerocopy"))
+        zc->mode = ZC_MSG_ZEROCOPY;
+    else if (streq(mode, "sendfile"))
+        zc->mode = ZC_SENDFILE;
+    else if (streq(mode, "splice"))
+        zc->mode = ZC_SPLICE;
+    else
+        error(0, "%s: bad zero copy mode", mode);
+
+    if (zc->mode == ZC_MSG_ZEROCOPY)
+        setsockopt_one(fd, SO_ZEROCOPY);
+    if (zc->mode == ZC_SENDFILE || zc->mode == ZC_SPLICE) {
+        zc->memfd = memfd_create("qperf", 0);
+        if (zc->memfd < 0)
+            error(SYS, "memfd_create failed");
+        if (write(zc->memfd, buf, Req.msg_size) != Req.msg_size)
+            error(SYS, "failed to write memfd");
+    }
+    if (zc->mode == ZC_SPLICE) {
+        if (pipe(zc->pipe) < 0)
+            error(SYS, "failed to create pipe");
+        fcntl(zc->pipe[1], F_SETPIPE_SZ, Req.msg_size);
+        zc->pipe_size = fcntl(zc->pipe[1], F_GETPIPE_SZ);
+        if (zc->pipe_size <= 0)
+            error(SYS, "failed to get pipe size");
+    }
+}
+
+
+/*
+ * Finish up zero copy sends, collecting any completions that are left.
+ */
+static void
+zc_close(ZCOPY *zc)
+{
+    if (zc->mode == ZC_MSG_ZEROCOPY)
+        zc_reap(zc, 0);
+    if (zc->memfd >= 0)
+        close(zc->memfd);
+    if (zc->pipe[0] >= 0)
+        close(zc->pipe[0]);
+    if (zc->pipe[1] >= 0)
+        close(zc->pipe[1]);
+}
+
+
+/*
+ * Discard the n bytes left in the splice pipe when sending them failed so
+ * that they are not sent as part of the next message.  errno is kept.
+ */
+static void
+zc_drain(ZCOPY *zc, int n)
+{
+    int save = errno;
+    char buf[4096];
+
+    while (n > 0) {
+        int i = read(zc->pipe[0], buf, n < (int)sizeof(buf) ? n : sizeof(buf));
+
+        if (i < 0 && errno == EINTR)
+            continue;
+        if (i <= 0)
+            break;
+        n -= i;
+    }
+    errno = save;
+}
+
+
+/*
+ * Send a complete message using the zero copy mode.  This otherwise behaves
+ * like send_full.
+ */
+static int
+zc_send_full(ZCOPY *zc, void *ptr, int len)
+{
+    int n = len;
+    loff_t off = 0;
+
+    if (zc->mode == ZC_NONE)
+        return send_full(zc->fd, ptr, len);
+    while (!Finished && n) {
+        int i;
+
+        if (zc->mode == ZC_MSG_ZEROCOPY) {
+            if (zc->sent - zc->done >= ZC_MAX_PEND)
+                zc_reap(zc, 1);
+            i = send(zc->fd, ptr + len - n, n, MSG_ZEROCOPY);
+            if (i < 0 && errno == ENOBUFS) {
+                zc_reap(zc, 1);
+                continue;
+            }
+            if (i > 0)
+                zc->sent++;
+        } else if (zc->mode == ZC_SENDFILE) {
+            i = sendfile(zc->fd, zc->memfd, &off, n);
+        } else {
+            int m = n < zc->pipe_size ? n : zc->pipe_size;
+
+            i = splice(zc->memfd, &off, zc->pipe[1], 0, m, SPLICE_F_MOVE);
+            if (i > 0) {
+                int j = i;
+
+                while (j > 0) {
+                    int k = splice(zc->pipe[0], 0, zc->fd, 0, j,
+                                   SPLICE_F_MOVE | SPLICE_F_MORE);
+                    if (k > 0) {
+                        j -= k;
+                        continue;
+                    }
+                    if (k < 0 && errno == EINTR && !Finished)
+                        continue;
+                    if (k == 0)
+                        set_finished();
+                    else if (!Finished) {
+                        zc_drain(zc, j);
+                        return -1;
+                    }
+                    break;
+                }
+                zc_drain(zc, j);
+                i -= j;
+            }
+        }
+        if (i < 0 && errno == EINTR)
+            continue;
+        if (i < 0)
+            return i;
+        n -= i;
+        if (i == 0)
+            set_finished();
+    }
+    if (zc->mode == ZC_MSG_ZEROCOPY)
+        zc_reap(zc, 0);
+    return len-n;
+}
+
+
+/*
+ * Collect MSG_ZEROCOPY completions from the socket error queue.  If wait is
+ * set, we block until at least one is available.  The kernel notes if it had
+ * to copy the data after all, such as when sending over loopback.  They are
+ * counted in LStat as they arrive so that the ones from a warm up period are
+ * left out of the results.
+ */
+static void
+zc_reap(ZCOPY *zc, int wait)
+{
+    if (wait) {
+        struct pollfd pollfd ={
+            .fd = zc->fd,
+        };
+
+        poll(&pollfd, 1, Req.timeout * 1000);
+    }
+    for (;;) {
+        struct msghdr msg ={0};
+        struct cmsghdr *cmsg;
+        char control[CMSG_SPACE(sizeof(struct sock_extended_err)) + 64];
+
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(zc->fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0)
+            break;
+        for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            struct sock_extended_err *err;
+            uint32_t n;
+
+            if (!((cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+              || (cmsg->cmsg_level == SOL_IPV6 &&
+                  cmsg->cmsg_type == IPV6_RECVERR)))
+                continue;
+            err = (struct sock_extended_err *)CMSG_DATA(cmsg);
+            if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            n = err->ee_data - err->ee_info + 1;
+            zc->done += n;
+            __sync_fetch_and_add(&LStat.zc_done, n);
+            if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED)
+                __sync_fetch_and_add(&LStat.zc_copied, n);
+        }
+    }
+}
+
+
+/*
+ * Set up for sending or receiving datagrams according to the batch size and
+ * whether UDP segmentation offload was requested.  With GSO, the sender puts
+ * batch_size datagrams (or as many as will fit) into each send and the kernel
+ * splits them up; the receiver enables GRO and receives batch_size coalesced
+ * buffers per system call.
+ */
+static void
+dg_init(DGRAM *dg, int fd, int sender)
+{
+    int batch = Req.batch_size;
+    int size = Req.msg_size;
+
+    memset(dg, 0, sizeof(*dg));
+    dg->fd = fd;
+    if (sender) {
+        if (Req.udp_gso) {
+            dg->segs = batch > 1 ? batch : GSO_MAX_SEGS;
+            if (dg->segs > GSO_MAX_SEGS)
+                dg->segs = GSO_MAX_SEGS;
+            if (dg->segs * size > GSO_MAX_SIZE)
+                dg->segs = size < GSO_MAX_SIZE ? GSO_MAX_SIZE / size : 1;
+            if (setsockopt(fd, SOL_UDP, UDP_SEGMENT, &size, sizeof(size)) < 0)
+                error(SYS, "failed to enable UDP GSO");
+            dg->buf = mem_alloc(dg->segs * size);
+        } else if (batch > 1)
+            mmsg_send_init(&dg->mmsg, batch, size, 0, 0);
+        else
+            dg->buf = mem_alloc(size);
+    } else {
+        if (Req.udp_gso) {
+            int one = 1;
+
+            if (setsockopt(fd, SOL_UDP, UDP_GRO, &one, sizeof(one)) < 0)
+                error(SYS, "failed to enable UDP GRO");
+            dg->gro = 1;
+            mmsg_recv_init(&dg->mmsg, batch > 1 ? batch : 1,
+                           GRO_MAX_SIZE, CMSG_SPACE(sizeof(int)));
+        } else if (batch > 1)
+            mmsg_recv_init(&dg->mmsg, batch, size, 0);
+        else
+            dg->buf = mem_alloc(size);
+    }
+}
+
+
+/*
+ * Free datagram state.
+ */
+static void
+dg_close(DGRAM *dg)
+{
+    if (dg->mmsg.n)
+        mmsg_free(&dg->mmsg);
+    mem_free(dg->buf);
+}
+
+
+/*
+ * Send one datagram, one batch of them or one GSO buffer and update the
+ * statistics.
+ */
+static void
+dg_send(DGRAM *dg, USTAT *s)
+{
+    int n;
+
+    if (dg->mmsg.n) {
+        n = mmsg_send(&dg->mmsg, dg->fd);
+        if (Finished)
+            return;
+        if (n < 0) {
+            s->no_errs++;
+            return;
+        }
+        s->no_bytes += (uint64_t)n * Req.msg_size;
+        s->no_msgs  += n;
+        return;
+    }
+
+    n = write(dg->fd, dg->buf, dg->segs ? dg->segs * Req.msg_size
+                                        : Req.msg_size);
+    if (Finished)
+        return;
+    if (n < 0) {
+        s->no_errs++;
+        return;
+    }
+    s->no_bytes += n;
+    s->no_msgs  += dg->segs ? dg->segs : 1;
+}
+
+
+/*
+ * Receive one datagram or one batch of them and update the statistics.  With
+ * GRO, each message received may hold several datagrams.
+ */
+static void
+dg_recv(DGRAM *dg, USTAT *r)
+{
+    int i;
+    int n;
+
+    if (!dg->mmsg.n) {
+        n = recv(dg->fd, dg->buf, Req.msg_size, 0);
+        if (Finished)
+            return;
+        if (n < 0) {
+            r->no_errs++;
+            return;
+        }
+        r->no_bytes += n;
+        r->no_msgs++;
+        if (Req.access_recv)
+            touch_data(dg->buf, Req.msg_size);
+        return;
+    }
+
+    n = mmsg_recv(&dg->mmsg, dg->fd);
+    if (Finished)
+        return;
+    if (n < 0) {
+        r->no_errs++;
+        return;
+    }
+    for (i = 0; i < n; ++i) {
+        struct msghdr *msg = &dg->mmsg.hdr[i].msg_hdr;
+        int len = dg->mmsg.hdr[i].msg_len;
+
+        r->no_bytes += len;
+        r->no_msgs  += dg->gro ? gro_segs(msg, len) : 1;
+        if (Req.access_recv)
+            touch_data(msg->msg_iov->iov_base, len);
+    }
+}
+
+
+/*
+ * Return the number of datagrams that GRO coalesced into a message of len
+ * bytes.  The kernel passes the size of the original datagrams in a control
+ * message.
+ */
+static int
+gro_segs(struct msghdr *msg, int len)
+{
+    struct cmsghdr *cmsg;
+
+    for (cmsg = CMSG_FIRSTHDR(msg); cmsg; cmsg = CMSG_NXTHDR(msg, cmsg)) {
+        int size;
+
+        if (cmsg->cmsg_level != SOL_UDP || cmsg->cmsg_type != UDP_GRO)
+            continue;
+        memcpy(&size, CMSG_DATA(cmsg), sizeof(size));
+        if (size > 0)
+            return (len + size - 1) / size;
+    }
+    return 1;
+}
+
+
 /*
  * Return the name of a transport kind.
  */
@@ -42,7 +42,15 @@
 #include <stdarg.h>
 #include <stdlib.h>
 #include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
 #include <sys/time.h>
+#if defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+#endif
 #include "qperf.h"
 
 
@@ -50,6 +58,47 @@
  * Configurable parameters.
  */
 #define ERROR_TIMEOUT   3               /* Error timeout in seconds */
+#define MAX_MAPS        (4*MAX_THREADS) /* Maximum mapped test buffers */
+#define MAX_NODES       1024            /* Maximum NUMA nodes */
+
+
+/*
+ * The CRC32C polynomial, bit reversed.
+ */
+#define CRC32C_POLY     0x82f63b78
+
+
+/*
+ * Received data is read a vector at a time.  On x86 a version of data_read
+ * is built for each vector extension and the best one the processor has is
+ * picked when qperf starts.  Elsewhere the compiler uses what the target
+ * always has, such as NEON.
+ */
+typedef uint64_t VEC __attribute__((vector_size(64)));
+
+#if defined(__x86_64__) && defined(__GNUC__) && __GNUC__ >= 6
+#define SIMD_CLONES __attribute__((target_clones("avx512f", "avx2", "default")))
+#else
+#define SIMD_CLONES
+#endif
+
+#if defined(__x86_64__)
+#define CRC32C_HW       __builtin_cpu_supports("sse4.2")
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+#define CRC32C_HW       1
+#endif
+
+
+/*
+ * For older headers.
+ */
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+#define MPOL_BIND       2
+#define MPOL_F_NODE     (1<<0)
+#define MPOL_F_ADDR     (1<<1)
+#define MPOL_MF_MOVE    (1<<1)
 
 
 /*
@@ -58,12 +107,32 @@
 typedef void (SIGFUNC)(int signo, siginfo_t *siginfo, void *ucontext);
 
 
+/*
+ * A test buffer that was mapped from huge pages.
+ */
+typedef struct MAP {
+    void   *addr;                       /* Address */
+    long    size;                       /* Size */
+} MAP;
+
+
 /*
  * Function prototypes.
  */
 static void     buf_app(char **pp, char *end, char *str);
 static void     buf_end(char **pp, char *end);
+static uint32_t crc32c(void *p, int n);
+#ifdef CRC32C_HW
+static uint32_t crc32c_hw(uint32_t crc, uint8_t *p, int n);
+#endif
+static void     crc32c_init(void);
+static void     data_copy(void *p, int n);
+static void     data_read(void *p, int n);
+static void     data_verify(void *p, int n);
 static double   get_seconds(void);
+static int      hist_index(uint64_t value);
+static void     mem_bind(void *p, long n);
+static void     mem_note(void *p, long page);
 static void     remote_failure_error(void);
 static char    *remote_name(void);
 static int      send_recv_mesg(int sr, char *item, int fd, char *buf, int len);
@@ -78,6 +147,14 @@ static void     timeout_end(void);
  */
 static uint8_t *DecodePtr;
 static uint8_t *EncodePtr;
+static int      MapN;
+static MAP      MapTable[MAX_MAPS];
+static int      NicNode = -1;
+static uint32_t Crc32cTable[256];
+static pthread_once_t Crc32cOnce = PTHREAD_ONCE_INIT;
+static volatile uint64_t DataSink;
+
+static pthread_mutex_t MapLock = PTHREAD_MUTEX_INITIALIZER;
 
 
 /*
@@ -186,6 +263,172 @@ qmalloc(long n)
 }
 
 
+/*
+ * Allocate a test buffer that is page aligned and made up of whole pages.  If
+ * a huge page size was requested, the buffer is mapped from huge pages,
+ * falling back to normal pages if none are available.  If a NUMA node was
+ * requested, the buffer is bound to it.  In either case, it is touched so that
+ * its placement is settled before the test starts and the placement that
+ * resulted is noted in LStat.
+ */
+void *
+mem_alloc(long n)
+{
+    void *p = 0;
+    long page = sysconf(_SC_PAGESIZE);
+    long huge = Req.mem_huge;
+
+    n = (n + page - 1) & ~(page - 1);
+    if (!huge && !Req.mem_node[0]) {
+        errno = posix_memalign(&p, page, n);
+        if (errno)
+            error(SYS, "failed to allocate test buffer");
+        if (Req.access_recv == ACCESS_VERIFY)
+            data_fill(p, n);
+        return p;
+    }
+    if (huge) {
+        int shift = huge == 1024*1024*1024 ? 30 : 21;
+        long size = (n + huge - 1) & ~(huge - 1);
+
+        p = mmap(0, size, PROT_READ|PROT_WRITE,
+                 MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB|(shift<<MAP_HUGE_SHIFT),
+                 -1, 0);
+        if (p == MAP_FAILED) {
+            p = 0;
+            error(SYS|RET, "cannot map %ld bytes of %ld byte huge pages; "
+                           "using %ld byte pages", size, huge, page);
+        } else {
+            pthread_mutex_lock(&MapLock);
+            if (MapN >= MAX_MAPS)
+                error(BUG, "too many mapped test buffers");
+            MapTable[MapN].addr = p;
+            MapTable[MapN].size = size;
+            ++MapN;
+            pthread_mutex_unlock(&MapLock);
+            page = huge;
+        }
+    }
+    if (!p) {
+        errno = posix_memalign(&p, page, n);
+        if (errno)
+            error(SYS, "failed to allocate test buffer");
+    }
+    mem_bind(p, n);
+    memset(p, 0, n);
+    if (Req.access_recv == ACCESS_VERIFY)
+        data_fill(p, n);
+    mem_note(p, page);
+    return p;
+}
+
+
+/*
+ * Free a test buffer allocated by mem_alloc.
+ */
+void
+mem_free(void *p)
+{
+    int i;
+
+    if (!p)
+        return;
+    pthread_mutex_lock(&MapLock);
+    for (i = 0; i < MapN; ++i)
+        if (MapTable[i].addr == p)
+            break;
+    if (i < MapN) {
+        munmap(p, MapTable[i].size);
+        MapTable[i] = MapTable[--MapN];
+        p = 0;
+    }
+    pthread_mutex_unlock(&MapLock);
+    free(p);
+}
+
+
+/*
+ * Map the memory that is shared by all the clients of a server.  The server
+ * maps it before it forks any children so they all see the same pages.  The
+ * atomic tests use it so that several clients contend for the same words.
+ */
+void
+mem_share(void)
+{
+    SharedMem = mmap(0, MAX_SPREAD * CACHE_LINE, PROT_READ|PROT_WRITE,
+                     MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    if (SharedMem == MAP_FAILED)
+        error(SYS, "failed to map shared memory");
+}
+
+
+/*
+ * Note the NUMA node of the network device used by the test.  dev is its
+ * sysfs device directory.  A mem_node of nic binds buffers to this node.
+ */
+void
+mem_nic(char *dev)
+{
+    FILE *fp;
+    char *path = qasprintf("%s/numa_node", dev);
+
+    NicNode = -1;
+    fp = fopen(path, "r");
+    if (fp) {
+        if (fscanf(fp, "%d", &NicNode) != 1)
+            NicNode = -1;
+        fclose(fp);
+    }
+    debug("numa node of %s is %d", dev, NicNode);
+    free(path);
+}
+
+
+/*
+ * Bind a test buffer to the requested NUMA node.  If the node is that of the
+ * NIC and it is not known, the buffer is left to be placed on first touch.
+ */
+static void
+mem_bind(void *p, long n)
+{
+    int node;
+    unsigned long mask[MAX_NODES/(8*sizeof(unsigned long))];
+
+    if (!Req.mem_node[0])
+        return;
+    if (streq(Req.mem_node, "nic")) {
+        if (NicNode < 0) {
+            debug("numa node of nic unknown; buffer not bound");
+            return;
+        }
+        node = NicNode;
+    } else
+        node = atoi(Req.mem_node);
+    if (node >= MAX_NODES)
+        error(0, "memory node %d too large; maximum is %d", node, MAX_NODES-1);
+    memset(mask, 0, sizeof(mask));
+    mask[node / (8*sizeof(unsigned long))] |=
+                                    1UL << (node % (8*sizeof(unsigned long)));
+    if (syscall(SYS_mbind, p, n, MPOL_BIND, mask, MAX_NODES+1, MPOL_MF_MOVE))
+        error(SYS, "failed to bind test buffer to memory node %d", node);
+}
+
+
+/*
+ * Note the NUMA node and page size a test buffer ended up with.
+ */
+static void
+mem_note(void *p, long page)
+{
+    int node = -1;
+
+    if (syscall(SYS_get_mempolicy, &node, 0, 0, p, MPOL_F_NODE|MPOL_F_ADDR))
+        node = -1;
+    LStat.mem_node = node;
+    LStat.mem_page = page;
+}
+
+
 /*
  * Attempt to print out a string allocating the necessary storage and exit with
  * an error on failure.
@@ -207,27 +450,332 @@ qasprintf(char *fmt, ...)
 
 
 /*
- * Touch data.
+ * Access n bytes of data that were just received at p in the way that
+ * --access_recv asked for.
  */
 void
 touch_data(void *p, int n)
 {
-    volatile uint64_t *p64 = p;
+    switch (Req.access_recv) {
+    case ACCESS_NONE:
+        break;
+    case ACCESS_COPY:
+        data_copy(p, n);
+        break;
+    case ACCESS_VERIFY:
+        data_verify(p, n);
+        break;
+    default:
+        data_read(p, n);
+        break;
+    }
+}
 
-    while (n >= sizeof(*p64)) {
-        (void) *p64++;
-        n -= sizeof(*p64);
+
+/*
+ * Read data as fast as the processor can, using the widest vector loads it
+ * has.  The loads are folded together into a sink so that they cannot be
+ * optimized away.
+ */
+SIMD_CLONES
+static void
+data_read(void *p, int n)
+{
+    uint8_t *q = p;
+    VEC acc ={0};
+    uint64_t sum = 0;
+
+    while (n >= 4 * (int)sizeof(VEC)) {
+        VEC v0, v1, v2, v3;
+
+        memcpy(&v0, q + 0 * sizeof(VEC), sizeof(VEC));
+        memcpy(&v1, q + 1 * sizeof(VEC), sizeof(VEC));
+        memcpy(&v2, q + 2 * sizeof(VEC), sizeof(VEC));
+        memcpy(&v3, q + 3 * sizeof(VEC), sizeof(VEC));
+        acc ^= (v0 ^ v1) ^ (v2 ^ v3);
+        q += 4 * sizeof(VEC);
+        n -= 4 * sizeof(VEC);
     }
-    if (n) {
-        volatile uint8_t *p8 = (uint8_t *)p64;
-        while (n >= sizeof(*p8)) {
-            (void) *p8++;
-            n -= sizeof(*p8);
-        }
+    while (n >= (int)sizeof(VEC)) {
+        VEC v;
+
+        memcpy(&v, q, sizeof(VEC));
+        acc ^= v;
+        q += sizeof(VEC);
+        n -= sizeof(VEC);
+    }
+    while (n-- > 0)
+        sum ^= *q++;
+    for (n = 0; n < (int)(sizeof(VEC) / sizeof(uint64_t)); ++n)
+        sum ^= acc[n];
+    DataSink = sum;
+}
+
+
+/*
+ * Copy data out to a buffer of the thread's own, as an application that
+ * does not process data in place would.
+ */
+static void
+data_copy(void *p, int n)
+{
+    static __thread char *buf;
+    static __thread int size;
+
+    if (n > size) {
+        free(buf);
+        buf = qmalloc(n);
+        size = n;
+    }
+    memcpy(buf, p, n);
+}
+
+
+/*
+ * Check that data is the pattern written by data_fill.  The pattern starts
+ * again every msg_size bytes so the data may hold several messages, as with
+ * UDP GRO.  The CRC32C of each message, and of any shorter one at the end, is
+ * compared to that of the pattern and each that does not match counts as a
+ * data error.  Each thread keeps the pattern of one message and its CRC.
+ */
+static void
+data_verify(void *p, int n)
+{
+    static __thread char *pat;
+    static __thread int size;
+    static __thread uint32_t crc;
+    int m = Req.msg_size ? Req.msg_size : n;
+    uint8_t *q = p;
+    uint64_t errs = 0;
+
+    if (n <= 0)
+        return;
+    if (m != size) {
+        free(pat);
+        pat = qmalloc(m);
+        data_fill(pat, m);
+        crc = crc32c(pat, m);
+        size = m;
+    }
+    for (; n >= m; q += m, n -= m)
+        if (crc32c(q, m) != crc)
+            ++errs;
+    if (n > 0 && crc32c(q, n) != crc32c(pat, n))
+        ++errs;
+    if (errs)
+        __sync_fetch_and_add(&LStat.data_errs, errs);
+}
+
+
+/*
+ * Fill a buffer of n bytes that is made up of messages of --msg_size bytes
+ * with the pattern that received data is checked against when --access_recv
+ * is verify.  The pattern varies with the offset into each message so that
+ * data that is misplaced, as well as data that is damaged, is caught.
+ */
+void
+data_fill(void *p, long n)
+{
+    long i;
+    uint8_t *q = p;
+    long size = Req.msg_size ? Req.msg_size : n;
+
+    for (i = 0; i < n; ++i) {
+        long j = i % size;
+
+        q[i] = (j ^ (j >> 8) ^ (j >> 16)) * 167 + 61;
     }
 }
 
 
+/*
+ * Compute the CRC32C (Castagnoli) of n bytes of data.  Processor support is
+ * used if there is any; otherwise a table is used.
+ */
+static uint32_t
+crc32c(void *p, int n)
+{
+    uint8_t *q = p;
+    uint32_t crc = ~0U;
+
+#ifdef CRC32C_HW
+    if (CRC32C_HW)
+        return ~crc32c_hw(crc, q, n);
+#endif
+    pthread_once(&Crc32cOnce, crc32c_init);
+    while (n-- > 0)
+        crc = Crc32cTable[(crc ^ *q++) & 0xff] ^ (crc >> 8);
+    return ~crc;
+}
+
+
+/*
+ * Build the table used to compute CRC32C without processor support.
+ */
+static void
+crc32c_init(void)
+{
+    int i;
+    int j;
+
+    for (i = 0; i < 256; ++i) {
+        uint32_t c = i;
+
+        for (j = 0; j < 8; ++j)
+            c = (c >> 1) ^ (c & 1 ? CRC32C_POLY : 0);
+        Crc32cTable[i] = c;
+    }
+}
+
+
+#if defined(__x86_64__)
+/*
+ * Compute CRC32C with the SSE4.2 crc32 instruction.
+ */
+__attribute__((target("sse4.2")))
+static uint32_t
+crc32c_hw(uint32_t crc, uint8_t *p, int n)
+{
+    uint64_t c = crc;
+
+    while (n >= 8) {
+        uint64_t v;
+
+        memcpy(&v, p, sizeof(v));
+        c = __builtin_ia32_crc32di(c, v);
+        p += 8;
+        n -= 8;
+    }
+    crc = c;
+    while (n-- > 0)
+        crc = __builtin_ia32_crc32qi(crc, *p++);
+    return crc;
+}
+#elif defined(__aarch64__) && defined(__ARM_FEATURE_CRC32)
+/*
+ * Compute CRC32C with the ARMv8 CRC32 instructions.
+ */
+static uint32_t
+crc32c_hw(uint32_t crc, uint8_t *p, int n)
+{
+    while (n >= 8) {
+        uint64_t v;
+
+        memcpy(&v, p, sizeof(v));
+        crc = __crc32cd(crc, v);
+        p += 8;
+        n -= 8;
+    }
+    while (n-- > 0)
+        crc = __crc32cb(crc, *p++);
+    return crc;
+}
+#endif
+
+
+/*
+ * Return the current value of a monotonic clock in nanoseconds.  This is
+ * used to time individual operations as well as whole tests.  The raw clock
+ * is not slewed by NTP so intervals measure the same from start to end.
+ */
+uint64_t
+get_nsecs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+
+/*
+ * Add a value to a histogram.
+ */
+void
+hist_add(HIST *hist, uint64_t value)
+{
+    if (hist->count++ == 0 || value < hist->min)
+        hist->min = value;
+    if (value > hist->max)
+        hist->max = value;
+    hist->sum += value;
+    hist->bins[hist_index(value)]++;
+}
+
+
+/*
+ * Add the samples of one histogram to another.
+ */
+void
+hist_merge(HIST *hist, HIST *add)
+{
+    int i;
+
+    if (!add->count)
+        return;
+    if (!hist->count || add->min < hist->min)
+        hist->min = add->min;
+    if (add->max > hist->max)
+        hist->max = add->max;
+    hist->count += add->count;
+    hist->sum   += add->sum;
+    for (i = 0; i < HIST_BINS; ++i)
+        hist->bins[i] += add->bins[i];
+}
+
+
+/*
+ * Return the value below which pct percent of the samples in a histogram
+ * fall.  We return the middle of the bucket, clamped to the extremes that
+ * were actually seen.
+ */
+uint64_t
+hist_pct(HIST *hist, double pct)
+{
+    int i;
+    uint64_t n;
+    uint64_t sum = 0;
+
+    if (!hist->count)
+        return 0;
+    n = hist->count * pct / 100;
+    if (n >= hist->count)
+        n = hist->count - 1;
+    for (i = 0; i < HIST_BINS; ++i) {
+        sum += hist->bins[i];
+        if (sum > n)
+            break;
+    }
+    if (i < HIST_SUB)
+        n = i;
+    else {
+        int shift = i/HIST_SUB - 1;
+        uint64_t low = (uint64_t)(HIST_SUB + i%HIST_SUB) << shift;
+        n = low + ((1ULL << shift) >> 1);
+    }
+    if (n < hist->min)
+        n = hist->min;
+    if (n > hist->max)
+        n = hist->max;
+    return n;
+}
+
+
+/*
+ * Return the histogram bucket a value belongs in.
+ */
+static int
+hist_index(uint64_t value)
+{
+    int shift;
+
+    if (value < HIST_SUB)
+        return value;
+    shift = 63 - __builtin_clzll(value) - HIST_SUB_BITS;
+    return (shift+1)*HIST_SUB + (value >> shift) - HIST_SUB;
+}
+
+
 /*
  * Synchronize the client and server.
  */
@@ -339,8 +887,11 @@ send_recv_mesg(int sr, char *item, int fd, char *buf, int len)
         FD_ZERO(&rfdset);
         FD_ZERO(&wfdset);
         FD_SET(fd, fdset);
-        if (select(fd+1, &rfdset, &wfdset, 0, &timeval) < 0)
+        if (select(fd+1, &rfdset, &wfdset, 0, &timeval) < 0) {
+            if (errno == EINTR)
+                continue;
             error(SYS, "failed to %s %s: select failed", action, item);
+        }
         if (!FD_ISSET(fd, fdset))
             continue;
         n = func(fd, buf, len);
@@ -410,6 +961,112 @@ setsockopt_one(int fd, int optname)
 }
 
 
+/*
+ * Set up to send n messages of the given size with each call to mmsg_send.
+ * All the messages are sent from the same buffer.  If addr is set, it is used
+ * as the destination of each message.
+ */
+void
+mmsg_send_init(MMSG *mmsg, int n, int size, SA *addr, socklen_t len)
+{
+    int i;
+
+    if (n > MAX_BATCH)
+        error(0, "batch size %d too large; maximum is %d", n, MAX_BATCH);
+    memset(mmsg, 0, sizeof(*mmsg));
+    mmsg->n   = n;
+    mmsg->buf = mem_alloc(size);
+    mmsg->iov = qmalloc(n * sizeof(*mmsg->iov));
+    mmsg->hdr = qmalloc(n * sizeof(*mmsg->hdr));
+    memset(mmsg->hdr, 0, n * sizeof(*mmsg->hdr));
+    for (i = 0; i < n; ++i) {
+        struct msghdr *h = &mmsg->hdr[i].msg_hdr;
+
+        mmsg->iov[i].iov_base = mmsg->buf;
+        mmsg->iov[i].iov_len  = size;
+        h->msg_iov     = &mmsg->iov[i];
+        h->msg_iovlen  = 1;
+        h->msg_name    = addr;
+        h->msg_namelen = len;
+    }
+}
+
+
+/*
+ * Set up to receive up to n messages of up to the given size with each call
+ * to mmsg_recv.  Each message has its own buffer and, if ctl_size is
+ * non-zero, a control buffer of that size.
+ */
+void
+mmsg_recv_init(MMSG *mmsg, int n, int size, int ctl_size)
+{
+    int i;
+
+    if (n > MAX_BATCH)
+        error(0, "batch size %d too large; maximum is %d", n, MAX_BATCH);
+    memset(mmsg, 0, sizeof(*mmsg));
+    mmsg->n        = n;
+    mmsg->ctl_size = ctl_size;
+    mmsg->buf      = mem_alloc((long)n * size);
+    mmsg->iov      = qmalloc(n * sizeof(*mmsg->iov));
+    mmsg->hdr      = qmalloc(n * sizeof(*mmsg->hdr));
+    if (ctl_size)
+        mmsg->ctl = qmalloc(n * ctl_size);
+    memset(mmsg->hdr, 0, n * sizeof(*mmsg->hdr));
+    for (i = 0; i < n; ++i) {
+        struct msghdr *h = &mmsg->hdr[i].msg_hdr;
+
+        mmsg->iov[i].iov_base = mmsg->buf + (long)i * size;
+        mmsg->iov[i].iov_len  = size;
+        h->msg_iov    = &mmsg->iov[i];
+        h->msg_iovlen = 1;
+        if (ctl_size)
+            h->msg_control = mmsg->ctl + i * ctl_size;
+    }
+}
+
+
+/*
+ * Send a batch of messages.  Return the number of messages sent or -1 on
+ * error.
+ */
+int
+mmsg_send(MMSG *mmsg, int fd)
+{
+    return sendmmsg(fd, mmsg->hdr, mmsg->n, 0);
+}
+
+
+/*
+ * Receive a batch of messages, blocking only until the first one arrives.
+ * Return the number of messages received or -1 on error.  The length of each
+ * message is left in msg_len of its header.
+ */
+int
+mmsg_recv(MMSG *mmsg, int fd)
+{
+    int i;
+
+    for (i = 0; i < mmsg->n; ++i)
+        mmsg->hdr[i].msg_hdr.msg_controllen = mmsg->ctl_size;
+    return recvmmsg(fd, mmsg->hdr, mmsg->n, MSG_WAITFORONE, 0);
+}
+
+
+/*
+ * Free the resources used by a batch.
+ */
+void
+mmsg_free(MMSG *mmsg)
+{
+    mem_free(mmsg->buf);
+    free(mmsg->ctl);
+    free(mmsg->iov);
+    free(mmsg->hdr);
+    memset(mmsg, 0, sizeof(*mmsg));
+}
+
+
 /*
  * This is called when a SIGURG signal is received indicating that TCP
  * out-of-band data has arrived.  This is used by the remote end to indicate
@@ -551,7 +1208,7 @@ error(int actions, char *fmt, ...)
         buf_app(&p, q, strerror(errno));
     }
     buf_end(&p, q);
-    fwrite(buffer, 1, p+1-buffer, stdout);
+    fwrite(buffer, 1, p+1-buffer, OutFormat ? stderr : stdout);
     if ((actions & RET) != 0)
         return 0;
 
@@ -0,0 +1,614 @@
+/*
+ * qperf - io_uring socket I/O engine.
+ * Measure socket and RDMA performance.
+ *
+ * Copyright (c) 2002-2009 Johann George.  All rights reserved.
+ * Copyright (c) 2006-2009 QLogic Corporation.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <limits.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include "qperf.h"
+#ifdef HAVE_LINUX_IO_URING_H
+#include <linux/io_uring.h>
+#endif
+
+
+#ifdef HAVE_LINUX_IO_URING_H
+/*
+ * Parameters.
+ */
+#define DEF_DEPTH       8               /* Default operations in flight */
+#define MAX_DEPTH       4096            /* Maximum operations in flight */
+#define SQPOLL_IDLE     1000            /* SQ thread idle time in ms */
+#define CANCEL_TRIES    100             /* Attempts to collect cancellations */
+
+
+/*
+ * For older headers.
+ */
+#ifndef IORING_ASYNC_CANCEL_ANY
+#define IORING_ASYNC_CANCEL_ANY (1U << 2)
+#endif
+
+
+/*
+ * User data for operations.  Bandwidth tests use the buffer index.
+ */
+#define UD_WRITE        ((uint64_t)-1)  /* Latency write */
+#define UD_READ         ((uint64_t)-2)  /* Latency read */
+#define UD_CANCEL       ((uint64_t)-3)  /* Cancellation */
+#define NO_WRITE        INT_MIN         /* No reply outstanding */
+
+
+/*
+ * An io_uring instance for one socket.  The socket is registered as fixed
+ * file 0 and the message buffers as fixed buffer 0.  We talk to the kernel
+ * directly rather than depend on liburing.
+ */
+struct URING {
+    int                  fd;            /* Ring */
+    int                  sqpoll;        /* Kernel thread polls the SQ */
+    int                  stream;        /* Socket is a stream */
+    int                  depth;         /* Operations in flight */
+    int                  size;          /* Message size */
+    char                *buf;           /* Message buffers */
+    unsigned             tail;          /* Local SQ tail */
+    unsigned             pending;       /* SQEs not yet submitted */
+    unsigned             inflight;      /* Operations not yet completed */
+    unsigned            *sq_head;       /* SQ head */
+    unsigned            *sq_tail;       /* SQ tail */
+    unsigned            *sq_mask;       /* SQ mask */
+    unsigned            *sq_flags;      /* SQ flags */
+    unsigned            *sq_array;      /* SQ index array */
+    unsigned            *cq_head;       /* CQ head */
+    unsigned            *cq_tail;       /* CQ tail */
+    unsigned            *cq_mask;       /* CQ mask */
+    struct io_uring_sqe *sqes;          /* Submission entries */
+    struct io_uring_cqe *cqes;          /* Completion entries */
+    char                *sq_map;        /* SQ ring mapping */
+    char                *cq_map;        /* CQ ring mapping */
+    size_t               sq_len;        /* Length of SQ ring mapping */
+    size_t               cq_len;        /* Length of CQ ring mapping */
+    size_t               sqes_len;      /* Length of SQE mapping */
+};
+
+
+/*
+ * Function prototypes.
+ */
+static void     ring_cancel(URING *u);
+static int      ring_cqe(URING *u, int *res, uint64_t *data);
+static int      ring_enter(URING *u, unsigned n);
+static int      ring_full(URING *u, int op, char *buf, int len, int done);
+static void    *ring_map(int fd, size_t len, off_t off);
+static void     ring_prep(URING *u, int op, void *addr, int len, int flags,
+                          uint64_t data);
+static unsigned ring_ready(URING *u);
+
+
+/*
+ * Set up an io_uring instance for a socket.  For bandwidth tests, depth is 0
+ * and --uring_depth operations are kept in flight, each with its own buffer.
+ * Latency tests pass 1 and keep one write and one read in flight.
+ */
+URING *
+uring_open(int fd, int depth, int stream)
+{
+    struct iovec iov;
+    struct io_uring_params p;
+    URING *u = qmalloc(sizeof(*u));
+
+    if (!depth)
+        depth = Req.uring_depth ? Req.uring_depth : DEF_DEPTH;
+    if (depth > MAX_DEPTH)
+        error(0, "io_uring depth %d too large; maximum is %d",
+                 depth, MAX_DEPTH);
+    if (stream && Req.access_recv == ACCESS_VERIFY)
+        error(0, "received data cannot be verified using io_uring on a "
+                 "stream; reads do not keep to message boundaries");
+    memset(u, 0, sizeof(*u));
+    memset(&p, 0, sizeof(p));
+    u->depth  = depth;
+    u->stream = stream;
+    u->size   = Req.msg_size;
+    if (streq(Req.io_engine, "io_uring_sqpoll")) {
+        p.flags |= IORING_SETUP_SQPOLL;
+        p.sq_thread_idle = SQPOLL_IDLE;
+        u->sqpoll = 1;
+    }
+
+    u->fd = syscall(__NR_io_uring_setup, 2 * depth, &p);
+    if (u->fd < 0)
+        error(SYS, "io_uring_setup failed");
+    u->sq_len   = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_len   = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    u->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sq_map   = ring_map(u->fd, u->sq_len, IORING_OFF_SQ_RING);
+    u->cq_map   = ring_map(u->fd, u->cq_len, IORING_OFF_CQ_RING);
+    u->sqes     = ring_map(u->fd, u->sqes_len, IORING_OFF_SQES);
+    u->sq_head  = (unsigned *)(u->sq_map + p.sq_off.head);
+    u->sq_tail  = (unsigned *)(u->sq_map + p.sq_off.tail);
+    u->sq_mask  = (unsigned *)(u->sq_map + p.sq_off.ring_mask);
+    u->sq_flags = (unsigned *)(u->sq_map + p.sq_off.flags);
+    u->sq_array = (unsigned *)(u->sq_map + p.sq_off.array);
+    u->cq_head  = (unsigned *)(u->cq_map + p.cq_off.head);
+    u->cq_tail  = (unsigned *)(u->cq_map + p.cq_off.tail);
+    u->cq_mask  = (unsigned *)(u->cq_map + p.cq_off.ring_mask);
+    u->cqes     = (struct io_uring_cqe *)(u->cq_map + p.cq_off.cqes);
+    u->tail     = *u->sq_tail;
+
+    if (syscall(__NR_io_uring_register, u->fd,
+                IORING_REGISTER_FILES, &fd, 1) < 0)
+        error(SYS, "failed to register socket with io_uring");
+    u->buf = mem_alloc((long)depth * u->size);
+    iov.iov_base = u->buf;
+    iov.iov_len  = (long)depth * u->size;
+    if (syscall(__NR_io_uring_register, u->fd,
+                IORING_REGISTER_BUFFERS, &iov, 1) < 0)
+        error(SYS, "failed to register buffers with io_uring");
+    return u;
+}
+
+
+/*
+ * Tear down an io_uring instance.  Any operations still in flight are
+ * cancelled first so the kernel is done with the buffers before we free them.
+ */
+void
+uring_close(URING *u)
+{
+    ring_cancel(u);
+    munmap(u->sqes, u->sqes_len);
+    munmap(u->cq_map, u->cq_len);
+    munmap(u->sq_map, u->sq_len);
+    close(u->fd);
+    mem_free(u->buf);
+    free(u);
+}
+
+
+/*
+ * Send until the test is finished, keeping depth writes in flight.  Since
+ * the data is never looked at, all writes use the same buffer.
+ */
+void
+uring_send_bw(URING *u, USTAT *s)
+{
+    int i;
+
+    for (i = 0; i < u->depth; ++i)
+        ring_prep(u, IORING_OP_WRITE_FIXED, u->buf, u->size, 0, 0);
+    while (!Finished) {
+        int res;
+
+        if (ring_enter(u, 1) < 0) {
+            if (!Finished)
+                s->no_errs++;
+            continue;
+        }
+        while (!Finished && ring_cqe(u, &res, 0)) {
+            if (res < 0)
+                s->no_errs++;
+            else {
+                s->no_bytes += res;
+                if (res == u->size)
+                    s->no_msgs++;
+            }
+            ring_prep(u, IORING_OP_WRITE_FIXED, u->buf, u->size, 0, 0);
+        }
+    }
+}
+
+
+/*
+ * Receive until the test is finished, keeping depth reads in flight.  On a
+ * stream, messages are counted as each msg_size bytes arrive.
+ */
+void
+uring_recv_bw(URING *u, USTAT *r)
+{
+    int i;
+    long part = 0;
+
+    for (i = 0; i < u->depth; ++i)
+        ring_prep(u, IORING_OP_READ_FIXED, u->buf + (long)i * u->size,
+                  u->size, 0, i);
+    while (!Finished) {
+        int res;
+        uint64_t data;
+
+        if (ring_enter(u, 1) < 0) {
+            if (!Finished)
+                r->no_errs++;
+            continue;
+        }
+        while (!Finished && ring_cqe(u, &res, &data)) {
+            char *buf = u->buf + (long)data * u->size;
+
+            if (res < 0)
+                r->no_errs++;
+            else if (res == 0 && u->stream) {
+                set_finished();
+                break;
+            } else {
+                r->no_bytes += res;
+                if (u->stream) {
+                    part += res;
+                    r->no_msgs += part / u->size;
+                    part %= u->size;
+                } else
+                    r->no_msgs++;
+                if (Req.access_recv)
+                    touch_data(buf, res);
+            }
+            ring_prep(u, IORING_OP_READ_FIXED, buf, u->size, 0, data);
+        }
+    }
+}
+
+
+/*
+ * Latency test (client side).  Each round trip is a write linked to a read
+ * so that it costs a single system call.  If a stream write or read comes up
+ * short, the rest of it is done on its own.
+ */
+void
+uring_client_lat(URING *u)
+{
+    while (!Finished) {
+        int res;
+        uint64_t data;
+        int w = 0;
+        int r = 0;
+        int n = 0;
+        uint64_t t = get_nsecs();
+
+        ring_prep(u, IORING_OP_WRITE_FIXED, u->buf, u->size, IOSQE_IO_LINK,
+                  UD_WRITE);
+        ring_prep(u, IORING_OP_READ_FIXED, u->buf, u->size, 0, UD_READ);
+        while (n < 2 && !Finished) {
+            if (ring_enter(u, 2 - n) < 0)
+                continue;
+            while (ring_cqe(u, &res, &data)) {
+                if (data == UD_WRITE)
+                    w = res;
+                else
+                    r = res;
+                n++;
+            }
+        }
+        if (Finished)
+            break;
+        if (w > 0 && w < u->size)
+            w = ring_full(u, IORING_OP_WRITE_FIXED, u->buf, u->size, w);
+        if (w < 0) {
+            LStat.s.no_errs++;
+            continue;
+        }
+        LStat.s.no_bytes += w;
+        LStat.s.no_msgs++;
+
+        if (r == -ECANCELED)
+            r = 0;
+        if (r >= 0 && r < u->size)
+            r = ring_full(u, IORING_OP_READ_FIXED, u->buf, u->size, r);
+        if (Finished)
+            break;
+        if (r < 0) {
+            LStat.r.no_errs++;
+            continue;
+        }
+        LStat.r.no_bytes += r;
+        LStat.r.no_msgs++;
+        hist_add(&LatHist, (get_nsecs() - t) / 2);
+    }
+}
+
+
+/*
+ * Latency test (server side).  Once a message arrives, the reply is linked
+ * to the read of the next message.  On a datagram socket, we need the
+ * address of the client so we use recvmsg and sendmsg instead.
+ */
+void
+uring_server_lat(URING *u)
+{
+    SS addr;
+    struct iovec iov;
+    struct msghdr rmsg;
+    struct msghdr smsg;
+    int rop = u->stream ? IORING_OP_READ_FIXED  : IORING_OP_RECVMSG;
+    int sop = u->stream ? IORING_OP_WRITE_FIXED : IORING_OP_SENDMSG;
+    void *raddr = u->stream ? (void *)u->buf : &rmsg;
+    void *saddr = u->stream ? (void *)u->buf : &smsg;
+    int len = u->stream ? u->size : 1;
+    int w = NO_WRITE;
+
+    iov.iov_base = u->buf;
+    iov.iov_len  = u->size;
+    memset(&rmsg, 0, sizeof(rmsg));
+    rmsg.msg_name    = &addr;
+    rmsg.msg_namelen = sizeof(addr);
+    rmsg.msg_iov     = &iov;
+    rmsg.msg_iovlen  = 1;
+    smsg = rmsg;
+
+    ring_prep(u, rop, raddr, len, 0, UD_READ);
+    while (!Finished) {
+        int res;
+        uint64_t data;
+        int r = 0;
+        int got = 0;
+
+        if (ring_enter(u, 1) < 0)
+            continue;
+        while (ring_cqe(u, &res, &data)) {
+            if (data == UD_WRITE) {
+                w = res;
+                continue;
+            }
+            r = res;
+            got = 1;
+            break;
+        }
+        if (Finished)
+            break;
+        if (!got)
+            continue;
+
+        if (w != NO_WRITE) {
+            if (w >= 0 && w < u->size && u->stream)
+                w = ring_full(u, IORING_OP_WRITE_FIXED, u->buf, u->size, w);
+            if (w < 0)
+                LStat.s.no_errs++;
+            else {
+                LStat.s.no_bytes += w;
+                LStat.s.no_msgs++;
+            }
+            w = NO_WRITE;
+        }
+
+        if (r == -ECANCELED) {
+            ring_prep(u, rop, raddr, len, 0, UD_READ);
+            continue;
+        }
+        if (r > 0 && r < u->size && u->stream)
+            r = ring_full(u, IORING_OP_READ_FIXED, u->buf, u->size, r);
+        if (r == 0 && u->stream)
+            set_finished();
+        if (Finished)
+            break;
+        if (r < 0) {
+            LStat.r.no_errs++;
+            ring_prep(u, rop, raddr, len, 0, UD_READ);
+            continue;
+        }
+        LStat.r.no_bytes += r;
+        LStat.r.no_msgs++;
+
+        smsg.msg_namelen = rmsg.msg_namelen;
+        rmsg.msg_namelen = sizeof(addr);
+        ring_prep(u, sop, saddr, len, IOSQE_IO_LINK, UD_WRITE);
+        ring_prep(u, rop, raddr, len, 0, UD_READ);
+    }
+}
+
+
+/*
+ * Finish a stream read or write of which done bytes have already been
+ * transferred.  Return the total transferred or -1 on error.  End of file
+ * causes the test to finish.
+ */
+static int
+ring_full(URING *u, int op, char *buf, int len, int done)
+{
+    while (!Finished && done < len) {
+        int res = 0;
+
+        ring_prep(u, op, buf + done, len - done, 0, UD_READ);
+        if (ring_enter(u, 1) < 0)
+            return -1;
+        if (!ring_cqe(u, &res, 0))
+            return -1;
+        if (res < 0)
+            return -1;
+        if (res == 0) {
+            set_finished();
+            break;
+        }
+        done += res;
+    }
+    return done;
+}
+
+
+/*
+ * Cancel any operations still in flight and wait for them to complete.  We
+ * give up after a while since the timer keeps interrupting us.
+ */
+static void
+ring_cancel(URING *u)
+{
+    int i;
+    struct io_uring_sqe *sqe;
+
+    if (!u->inflight)
+        return;
+    ring_prep(u, IORING_OP_ASYNC_CANCEL, 0, 0, 0, UD_CANCEL);
+    sqe = &u->sqes[(u->tail - 1) & *u->sq_mask];
+    sqe->fd = -1;
+    sqe->flags = 0;
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_ANY;
+    for (i = 0; u->inflight && i < CANCEL_TRIES; ++i) {
+        ring_enter(u, 1);
+        while (ring_cqe(u, 0, 0))
+            ;
+    }
+}
+
+
+/*
+ * Map part of an io_uring instance.
+ */
+static void *
+ring_map(int fd, size_t len, off_t off)
+{
+    void *p = mmap(0, len, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                   fd, off);
+
+    if (p == MAP_FAILED)
+        error(SYS, "failed to map io_uring");
+    return p;
+}
+
+
+/*
+ * Queue an operation on the socket.  Reads and writes use the registered
+ * buffer; addr must lie within it.
+ */
+static void
+ring_prep(URING *u, int op, void *addr, int len, int flags, uint64_t data)
+{
+    unsigned i;
+    struct io_uring_sqe *sqe;
+
+    if (u->tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >=
+                                                        2 * (unsigned)u->depth)
+        error(BUG, "io_uring submission queue full");
+    i = u->tail & *u->sq_mask;
+    sqe = &u->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode    = op;
+    sqe->flags     = IOSQE_FIXED_FILE | flags;
+    sqe->fd        = 0;
+    sqe->addr      = (unsigned long)addr;
+    sqe->len       = len;
+    sqe->user_data = data;
+    u->sq_array[i] = i;
+    u->tail++;
+    u->pending++;
+    u->inflight++;
+}
+
+
+/*
+ * Submit any queued operations and wait until at least n completions are
+ * available.  With SQPOLL, the kernel picks up submissions on its own and we
+ * spin waiting for completions so that no system calls are made at all.
+ * Otherwise, we submit whatever the kernel has not yet taken, which includes
+ * any that a call that was interrupted left behind.  Return -1 if interrupted.
+ */
+static int
+ring_enter(URING *u, unsigned n)
+{
+    unsigned submit = u->pending;
+
+    __atomic_store_n(u->sq_tail, u->tail, __ATOMIC_RELEASE);
+    u->pending = 0;
+    if (u->sqpoll) {
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+        if (submit && (*u->sq_flags & IORING_SQ_NEED_WAKEUP))
+            syscall(__NR_io_uring_enter, u->fd, 0, 0,
+                    IORING_ENTER_SQ_WAKEUP, 0, 0);
+        while (ring_ready(u) < n)
+            if (Finished)
+                return -1;
+        return 0;
+    }
+    submit = u->tail - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (ring_ready(u) >= n && !submit)
+        return 0;
+    if (syscall(__NR_io_uring_enter, u->fd, submit, n,
+                n ? IORING_ENTER_GETEVENTS : 0, 0, 0) < 0)
+        return -1;
+    return 0;
+}
+
+
+/*
+ * Return the number of completions waiting to be collected.
+ */
+static unsigned
+ring_ready(URING *u)
+{
+    return __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE) - *u->cq_head;
+}
+
+
+/*
+ * Collect a completion if there is one.  Return 1 if so and 0 otherwise.
+ */
+static int
+ring_cqe(URING *u, int *res, uint64_t *data)
+{
+    unsigned head = *u->cq_head;
+    struct io_uring_cqe *cqe;
+
+    if (head == __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+        return 0;
+    cqe = &u->cqes[head & *u->cq_mask];
+    if (res)
+        *res = cqe->res;
+    if (data)
+        *data = cqe->user_data;
+    __atomic_store_n(u->cq_head, head + 1, __ATOMIC_RELEASE);
+    u->inflight--;
+    return 1;
+}
+
+
+#else /* HAVE_LINUX_IO_URING_H */
+
+
+/*
+ * Without io_uring, requesting the engine is an error.
+ */
+URING *
+uring_open(int fd, int depth, int stream)
+{
+    error(0, "io_uring is not supported on this system");
+    return 0;
+}
+
+void uring_close(URING *u)                  {}
+void uring_send_bw(URING *u, USTAT *s)      {}
+void uring_recv_bw(URING *u, USTAT *r)      {}
+void uring_client_lat(URING *u)             {}
+void uring_server_lat(URING *u)             {}
+#endif /* HAVE_LINUX_IO_URING_H */
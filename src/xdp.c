@@ -0,0 +1,820 @@
+/*
+ * qperf - AF_XDP tests.
+ * Measure socket and RDMA performance.
+ *
+ * Copyright (c) 2002-2009 Johann George.  All rights reserved.
+ * Copyright (c) 2006-2009 QLogic Corporation.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+#define _GNU_SOURCE
+#include <errno.h>
+#include <poll.h>
+#include <sched.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <net/if.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include "qperf.h"
+#ifdef HAVE_LINUX_IF_XDP_H
+#include <linux/bpf.h>
+#include <linux/if_ether.h>
+#include <linux/if_xdp.h>
+#endif
+
+
+#ifdef HAVE_LINUX_IF_XDP_H
+/*
+ * Parameters.
+ */
+#define FRAME_SIZE      4096            /* Bytes in each UMEM frame */
+#define DEF_RING_SIZE   2048            /* Default entries in each ring */
+#define DEF_BATCH       64              /* Default frames per batch */
+#define MAX_BATCH       1024            /* Maximum frames per batch */
+#define SPIN_TRIES      1000            /* Polls before sleeping */
+#define POLL_MS         100             /* Longest we sleep in poll */
+#define BIND_TRIES      100             /* Attempts to bind a busy queue */
+#define ETH_TYPE        ETH_P_802_EX1   /* Ethernet type of our frames */
+
+
+/*
+ * Older C libraries may not know about AF_XDP.
+ */
+#ifndef AF_XDP
+#define AF_XDP          44
+#endif
+#ifndef SOL_XDP
+#define SOL_XDP         283
+#endif
+
+
+/*
+ * Build a BPF instruction.
+ */
+#define INSN(code, dst, src, off, imm) { (code), (dst), (src), (off), (imm) }
+
+
+/*
+ * A ring shared with the kernel.  We are either its producer or its consumer
+ * and only ever write our own index.
+ */
+typedef struct XRING {
+    uint32_t   *producer;               /* Producer index */
+    uint32_t   *consumer;               /* Consumer index */
+    uint32_t   *flags;                  /* Ring flags */
+    void       *desc;                   /* Descriptors */
+    void       *map;                    /* Start of mapping */
+    size_t      len;                    /* Length of mapping */
+    uint32_t    size;                   /* Number of entries */
+} XRING;
+
+
+/*
+ * An AF_XDP socket with its UMEM and rings.
+ */
+typedef struct XSK {
+    int         fd;                     /* AF_XDP socket */
+    int         map_fd;                 /* XSKMAP, or -1 */
+    int         prog_fd;                /* XDP program, or -1 */
+    int         link_fd;                /* Program attached to interface */
+    int         zcopy;                  /* Bound in zero copy mode */
+    uint32_t    size;                   /* Length of frames we send */
+    int         batch;                  /* Frames per batch */
+    char       *umem;                   /* Frame buffers */
+    size_t      umem_len;               /* Bytes of frame buffers */
+    uint64_t   *free;                   /* Stack of free frames */
+    uint32_t    nfree;                  /* Frames on free stack */
+    XRING       fill;                   /* Frames given to kernel for rx */
+    XRING       comp;                   /* Frames kernel has sent */
+    XRING       rx;                     /* Frames received */
+    XRING       tx;                     /* Frames to send */
+    uint8_t     hdr[ETH_HLEN];          /* Header of frames we send */
+} XSK;
+
+
+/*
+ * Function prototypes.
+ */
+static int      xdp_bind(int fd, struct sockaddr_xdp *sxdp);
+static void     xdp_close(XSK *x);
+static void     xdp_kick_rx(XSK *x);
+static void     xdp_kick_tx(XSK *x);
+static void     xdp_map(XSK *x, XRING *r, int opt, uint64_t pgoff,
+                        struct xdp_ring_offset *off, size_t esize);
+static void     xdp_open(XSK *x, int recv);
+static void     xdp_parameters(long msgSize);
+static void     xdp_prog(XSK *x, int ifindex);
+static int      xdp_recv(XSK *x, struct xdp_desc *d, int n);
+static void     xdp_reap(XSK *x);
+static int      xdp_send(XSK *x, int n);
+static void     xdp_stats(XSK *x);
+static int      xdp_wait(XSK *x, int *spins, int events);
+static int      xdp_xmit(XSK *x, struct xdp_desc *d, int n);
+static int      xr_avail(XRING *r);
+static int      xr_room(XRING *r);
+static long     sys_bpf(int cmd, union bpf_attr *attr);
+
+
+/*
+ * Measure AF_XDP bandwidth (client side).
+ */
+void
+run_client_xdp_bw(void)
+{
+    XSK x;
+
+    par_use(L_ACCESS_RECV);
+    par_use(R_ACCESS_RECV);
+    par_use(L_BATCH_SIZE);
+    par_use(R_BATCH_SIZE);
+    xdp_parameters(64);
+    client_send_request();
+    xdp_open(&x, 0);
+    recv_mesg(x.hdr, ETH_ALEN, "xdp mac");
+    sync_test();
+    while (!Finished) {
+        int spins = 0;
+        int n;
+
+        while ((n = xdp_send(&x, x.batch)) == 0)
+            if (!xdp_wait(&x, &spins, 0))
+                break;
+        LStat.s.no_bytes += (uint64_t)n * Req.msg_size;
+        LStat.s.no_msgs += n;
+    }
+    stop_test_timer();
+    xdp_stats(&x);
+    exchange_results();
+    xdp_close(&x);
+    show_results(BANDWIDTH);
+}
+
+
+/*
+ * Measure AF_XDP bandwidth (server side).
+ */
+void
+run_server_xdp_bw(void)
+{
+    XSK x;
+    struct xdp_desc d[MAX_BATCH];
+
+    xdp_open(&x, 1);
+    send_mesg(x.hdr + ETH_ALEN, ETH_ALEN, "xdp mac");
+    sync_test();
+    while (!Finished) {
+        int i;
+        int spins = 0;
+        int n;
+
+        while ((n = xdp_recv(&x, d, x.batch)) == 0)
+            if (!xdp_wait(&x, &spins, POLLIN))
+                break;
+        for (i = 0; i < n; ++i) {
+            if (Req.access_recv)
+                touch_data(x.umem + d[i].addr + ETH_HLEN, Req.msg_size);
+            x.free[x.nfree++] = d[i].addr;
+        }
+        LStat.r.no_bytes += (uint64_t)n * Req.msg_size;
+        LStat.r.no_msgs += n;
+    }
+    stop_test_timer();
+    xdp_stats(&x);
+    exchange_results();
+    xdp_close(&x);
+}
+
+
+/*
+ * Measure AF_XDP latency (client side).
+ */
+void
+run_client_xdp_lat(void)
+{
+    XSK x;
+    struct xdp_desc d;
+
+    xdp_parameters(1);
+    client_send_request();
+    xdp_open(&x, 1);
+    recv_mesg(x.hdr, ETH_ALEN, "xdp mac");
+    sync_test();
+    while (!Finished) {
+        int spins = 0;
+        uint64_t t = get_nsecs();
+
+        while (!xdp_send(&x, 1))
+            if (!xdp_wait(&x, &spins, 0))
+                break;
+        if (Finished)
+            break;
+        LStat.s.no_bytes += Req.msg_size;
+        LStat.s.no_msgs++;
+
+        spins = 0;
+        while (!xdp_recv(&x, &d, 1))
+            if (!xdp_wait(&x, &spins, POLLIN))
+                break;
+        if (Finished)
+            break;
+        x.free[x.nfree++] = d.addr;
+        LStat.r.no_bytes += Req.msg_size;
+        LStat.r.no_msgs++;
+        hist_add(&LatHist, (get_nsecs() - t) / 2);
+    }
+    stop_test_timer();
+    xdp_stats(&x);
+    exchange_results();
+    xdp_close(&x);
+    show_results(LATENCY);
+}
+
+
+/*
+ * Measure AF_XDP latency (server side).  Frames are sent back from the buffer
+ * they arrived in with the addresses swapped.
+ */
+void
+run_server_xdp_lat(void)
+{
+    XSK x;
+    struct xdp_desc d[MAX_BATCH];
+
+    xdp_open(&x, 1);
+    send_mesg(x.hdr + ETH_ALEN, ETH_ALEN, "xdp mac");
+    sync_test();
+    while (!Finished) {
+        int i;
+        int spins = 0;
+        int n;
+
+        while ((n = xdp_recv(&x, d, x.batch)) == 0)
+            if (!xdp_wait(&x, &spins, POLLIN))
+                break;
+        LStat.r.no_bytes += (uint64_t)n * Req.msg_size;
+        LStat.r.no_msgs += n;
+        for (i = 0; i < n; ++i) {
+            char *p = x.umem + d[i].addr;
+
+            memcpy(p, p + ETH_ALEN, ETH_ALEN);
+            memcpy(p + ETH_ALEN, x.hdr + ETH_ALEN, ETH_ALEN);
+        }
+        n = xdp_xmit(&x, d, n);
+        LStat.s.no_bytes += (uint64_t)n * Req.msg_size;
+        LStat.s.no_msgs += n;
+    }
+    stop_test_timer();
+    xdp_stats(&x);
+    exchange_results();
+    xdp_close(&x);
+}
+
+
+/*
+ * Set default parameters and note the ones we use.
+ */
+static void
+xdp_parameters(long msgSize)
+{
+    setp_u32(0, L_MSG_SIZE, msgSize);
+    setp_u32(0, R_MSG_SIZE, msgSize);
+    par_use(L_MEM_HUGE);
+    par_use(R_MEM_HUGE);
+    par_use(L_MEM_NODE);
+    par_use(R_MEM_NODE);
+    par_use(L_XDP_MODE);
+    par_use(R_XDP_MODE);
+    par_use(L_XDP_QUEUE);
+    par_use(R_XDP_QUEUE);
+    par_use(L_XDP_RING_SIZE);
+    par_use(R_XDP_RING_SIZE);
+    opt_check();
+}
+
+
+/*
+ * Open an AF_XDP socket on the interface that carries the control connection
+ * and, if we are to receive, attach an XDP program that steers our frames to
+ * it.  The frame header is filled in except for the destination address which
+ * the caller gets from the other side.
+ */
+static void
+xdp_open(XSK *x, int recv)
+{
+    int i;
+    int ifindex;
+    int nframes;
+    char *name;
+    char *mode;
+    struct ifreq ifr;
+    struct xdp_umem_reg reg;
+    struct xdp_mmap_offsets off;
+    struct sockaddr_xdp sxdp;
+    uint32_t ringSize = Req.xdp_ring_size ? Req.xdp_ring_size : DEF_RING_SIZE;
+    socklen_t optlen;
+
+    memset(x, 0, sizeof(*x));
+    x->fd = x->map_fd = x->prog_fd = x->link_fd = -1;
+    if (ringSize & (ringSize - 1))
+        error(0, "XDP ring size must be a power of two: %d", ringSize);
+    x->batch = Req.batch_size ? Req.batch_size : DEF_BATCH;
+    if (x->batch > MAX_BATCH || x->batch > ringSize)
+        error(0, "XDP batch size may be at most %d and the ring size",
+                 MAX_BATCH);
+
+    name = socket_nic(RemoteFD);
+    if (!name)
+        error(0, "cannot find the interface of the control connection");
+    set_nic(name);
+    ifindex = if_nametoindex(name);
+    if (!ifindex)
+        error(SYS, "cannot find interface %s", name);
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, name, sizeof(ifr.ifr_name) - 1);
+    if (ioctl(RemoteFD, SIOCGIFMTU, &ifr) < 0)
+        error(SYS, "cannot get MTU of %s", name);
+    if (Req.msg_size > ifr.ifr_mtu || Req.msg_size + ETH_HLEN > FRAME_SIZE)
+        error(0, "message size %d is larger than the MTU of %s",
+                 Req.msg_size, name);
+    if (ioctl(RemoteFD, SIOCGIFHWADDR, &ifr) < 0)
+        error(SYS, "cannot get address of %s", name);
+    memcpy(x->hdr + ETH_ALEN, ifr.ifr_hwaddr.sa_data, ETH_ALEN);
+    *(uint16_t *)(x->hdr + 2*ETH_ALEN) = htons(ETH_TYPE);
+    x->size = ETH_HLEN + Req.msg_size;
+    if (x->size < ETH_ZLEN)
+        x->size = ETH_ZLEN;
+
+    nframes = 2 * ringSize;
+    x->umem_len = (size_t)nframes * FRAME_SIZE;
+    x->umem = mem_alloc(x->umem_len);
+    x->free = qmalloc(nframes * sizeof(*x->free));
+    for (i = 0; i < nframes; ++i) {
+        x->free[x->nfree++] = (uint64_t)(nframes - 1 - i) * FRAME_SIZE;
+        if (Req.access_recv == ACCESS_VERIFY)
+            data_fill(x->umem + (long)i * FRAME_SIZE + ETH_HLEN, Req.msg_size);
+    }
+
+    x->fd = socket(AF_XDP, SOCK_RAW, 0);
+    if (x->fd < 0)
+        error(SYS, "failed to create AF_XDP socket");
+    memset(&reg, 0, sizeof(reg));
+    reg.addr = (uintptr_t)x->umem;
+    reg.len = x->umem_len;
+    reg.chunk_size = FRAME_SIZE;
+    if (setsockopt(x->fd, SOL_XDP, XDP_UMEM_REG, &reg, sizeof(reg)) < 0)
+        error(SYS, "failed to register XDP UMEM");
+    optlen = sizeof(off);
+    x->fill.size = x->comp.size = x->rx.size = x->tx.size = ringSize;
+    if (setsockopt(x->fd, SOL_XDP, XDP_UMEM_FILL_RING,
+                   &ringSize, sizeof(ringSize)) < 0 ||
+        setsockopt(x->fd, SOL_XDP, XDP_UMEM_COMPLETION_RING,
+                   &ringSize, sizeof(ringSize)) < 0 ||
+        setsockopt(x->fd, SOL_XDP, XDP_RX_RING,
+                   &ringSize, sizeof(ringSize)) < 0 ||
+        setsockopt(x->fd, SOL_XDP, XDP_TX_RING,
+                   &ringSize, sizeof(ringSize)) < 0)
+        error(SYS, "failed to size XDP rings");
+    if (getsockopt(x->fd, SOL_XDP, XDP_MMAP_OFFSETS, &off, &optlen) < 0)
+        error(SYS, "failed to get XDP ring offsets");
+    xdp_map(x, &x->fill, XDP_UMEM_FILL_RING, XDP_UMEM_PGOFF_FILL_RING,
+            &off.fr, sizeof(uint64_t));
+    xdp_map(x, &x->comp, XDP_UMEM_COMPLETION_RING,
+            XDP_UMEM_PGOFF_COMPLETION_RING, &off.cr, sizeof(uint64_t));
+    xdp_map(x, &x->rx, XDP_RX_RING, XDP_PGOFF_RX_RING,
+            &off.rx, sizeof(struct xdp_desc));
+    xdp_map(x, &x->tx, XDP_TX_RING, XDP_PGOFF_TX_RING,
+            &off.tx, sizeof(struct xdp_desc));
+
+    mode = Req.xdp_mode[0] ? Req.xdp_mode : "auto";
+    memset(&sxdp, 0, sizeof(sxdp));
+    sxdp.sxdp_family = AF_XDP;
+    sxdp.sxdp_ifindex = ifindex;
+    sxdp.sxdp_queue_id = Req.xdp_queue;
+    sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP |
+                      (streq(mode, "copy") ? XDP_COPY : XDP_ZEROCOPY);
+    if (xdp_bind(x->fd, &sxdp) < 0) {
+        if (!streq(mode, "auto"))
+            error(SYS, "failed to bind AF_XDP socket to %s queue %d in %s mode",
+                       name, Req.xdp_queue, mode);
+        debug("zero copy bind to %s failed; using copy mode", name);
+        sxdp.sxdp_flags = XDP_USE_NEED_WAKEUP | XDP_COPY;
+        if (xdp_bind(x->fd, &sxdp) < 0)
+            error(SYS, "failed to bind AF_XDP socket to %s queue %d",
+                       name, Req.xdp_queue);
+    }
+    x->zcopy = !(sxdp.sxdp_flags & XDP_COPY);
+    LStat.xdp_zcopy = x->zcopy ? 2 : 1;
+
+    if (recv) {
+        xdp_prog(x, ifindex);
+        xdp_kick_rx(x);
+    }
+    free(name);
+}
+
+
+/*
+ * Bind the socket to a queue.  The kernel releases the queue of a socket that
+ * was just closed, such as the one from the previous test, in the background
+ * so if it is still busy, we try again for a while.
+ */
+static int
+xdp_bind(int fd, struct sockaddr_xdp *sxdp)
+{
+    int i;
+
+    for (i = 0; i < BIND_TRIES; ++i) {
+        if (bind(fd, (SA *)sxdp, sizeof(*sxdp)) == 0)
+            return 0;
+        if (errno != EBUSY)
+            break;
+        usleep(10*1000);
+    }
+    return -1;
+}
+
+
+/*
+ * Map one of the rings.
+ */
+static void
+xdp_map(XSK *x, XRING *r, int opt, uint64_t pgoff,
+        struct xdp_ring_offset *off, size_t esize)
+{
+    char *p;
+
+    r->len = off->desc + r->size * esize;
+    p = mmap(0, r->len, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_POPULATE,
+             x->fd, pgoff);
+    if (p == MAP_FAILED)
+        error(SYS, "failed to map XDP ring");
+    r->map = p;
+    r->producer = (uint32_t *)(p + off->producer);
+    r->consumer = (uint32_t *)(p + off->consumer);
+    r->flags = (uint32_t *)(p + off->flags);
+    r->desc = p + off->desc;
+}
+
+
+/*
+ * Load an XDP program that redirects frames of our Ethernet type arriving on
+ * our queue to the socket and passes everything else, such as the control
+ * connection, up the stack as usual.  It is attached with a BPF link so that
+ * it goes away when we do.
+ */
+static void
+xdp_prog(XSK *x, int ifindex)
+{
+    int key = Req.xdp_queue;
+    int fd;
+    union bpf_attr attr;
+    static char license[] = "Dual BSD/GPL";
+
+    memset(&attr, 0, sizeof(attr));
+    attr.map_type = BPF_MAP_TYPE_XSKMAP;
+    attr.key_size = sizeof(int);
+    attr.value_size = sizeof(int);
+    attr.max_entries = key + 1;
+    x->map_fd = sys_bpf(BPF_MAP_CREATE, &attr);
+    if (x->map_fd < 0)
+        error(SYS, "failed to create XSKMAP");
+    memset(&attr, 0, sizeof(attr));
+    attr.map_fd = x->map_fd;
+    attr.key = (uintptr_t)&key;
+    attr.value = (uintptr_t)&x->fd;
+    if (sys_bpf(BPF_MAP_UPDATE_ELEM, &attr) < 0)
+        error(SYS, "failed to add AF_XDP socket to XSKMAP");
+
+    {
+        struct bpf_insn prog[] ={
+            /* r2 = data, r3 = data_end */
+            INSN(BPF_LDX|BPF_MEM|BPF_W, 2, 1, 0, 0),
+            INSN(BPF_LDX|BPF_MEM|BPF_W, 3, 1, 4, 0),
+            /* if (data + ETH_HLEN > data_end) goto pass */
+            INSN(BPF_ALU64|BPF_MOV|BPF_X, 4, 2, 0, 0),
+            INSN(BPF_ALU64|BPF_ADD|BPF_K, 4, 0, 0, ETH_HLEN),
+            INSN(BPF_JMP|BPF_JGT|BPF_X, 4, 3, 8, 0),
+            /* if (ethertype != ETH_TYPE) goto pass */
+            INSN(BPF_LDX|BPF_MEM|BPF_H, 4, 2, 2*ETH_ALEN, 0),
+            INSN(BPF_JMP|BPF_JNE|BPF_K, 4, 0, 6, htons(ETH_TYPE)),
+            /* return bpf_redirect_map(map, rx_queue_index, XDP_PASS) */
+            INSN(BPF_LDX|BPF_MEM|BPF_W, 2, 1, 16, 0),
+            INSN(BPF_LD|BPF_DW|BPF_IMM, 1, BPF_PSEUDO_MAP_FD, 0, x->map_fd),
+            INSN(0, 0, 0, 0, 0),
+            INSN(BPF_ALU64|BPF_MOV|BPF_K, 3, 0, 0, XDP_PASS),
+            INSN(BPF_JMP|BPF_CALL, 0, 0, 0, BPF_FUNC_redirect_map),
+            INSN(BPF_JMP|BPF_EXIT, 0, 0, 0, 0),
+            /* pass: return XDP_PASS */
+            INSN(BPF_ALU64|BPF_MOV|BPF_K, 0, 0, 0, XDP_PASS),
+            INSN(BPF_JMP|BPF_EXIT, 0, 0, 0, 0),
+        };
+
+        memset(&attr, 0, sizeof(attr));
+        attr.prog_type = BPF_PROG_TYPE_XDP;
+        attr.insns = (uintptr_t)prog;
+        attr.insn_cnt = cardof(prog);
+        attr.license = (uintptr_t)license;
+        x->prog_fd = sys_bpf(BPF_PROG_LOAD, &attr);
+        if (x->prog_fd < 0)
+            error(SYS, "failed to load XDP program");
+    }
+
+    memset(&attr, 0, sizeof(attr));
+    attr.link_create.prog_fd = x->prog_fd;
+    attr.link_create.target_ifindex = ifindex;
+    attr.link_create.attach_type = BPF_XDP;
+    fd = sys_bpf(BPF_LINK_CREATE, &attr);
+    if (fd < 0)
+        error(SYS, "failed to attach XDP program; is another one attached?");
+    x->link_fd = fd;
+}
+
+
+/*
+ * Fold the kernel's drop counts into our error counts.
+ */
+static void
+xdp_stats(XSK *x)
+{
+    struct xdp_statistics s;
+    socklen_t optlen = sizeof(s);
+
+    memset(&s, 0, sizeof(s));
+    if (getsockopt(x->fd, SOL_XDP, XDP_STATISTICS, &s, &optlen) < 0)
+        return;
+    debug("xdp rx_dropped=%llu rx_invalid=%llu rx_ring_full=%llu "
+          "rx_fill_empty=%llu tx_invalid=%llu",
+          (unsigned long long)s.rx_dropped,
+          (unsigned long long)s.rx_invalid_descs,
+          (unsigned long long)s.rx_ring_full,
+          (unsigned long long)s.rx_fill_ring_empty_descs,
+          (unsigned long long)s.tx_invalid_descs);
+    LStat.r.no_errs += s.rx_dropped + s.rx_invalid_descs + s.rx_ring_full;
+    LStat.s.no_errs += s.tx_invalid_descs;
+}
+
+
+/*
+ * Detach the program and free everything.
+ */
+static void
+xdp_close(XSK *x)
+{
+    if (x->link_fd >= 0)
+        close(x->link_fd);
+    if (x->prog_fd >= 0)
+        close(x->prog_fd);
+    if (x->map_fd >= 0)
+        close(x->map_fd);
+    munmap(x->fill.map, x->fill.len);
+    munmap(x->comp.map, x->comp.len);
+    munmap(x->rx.map, x->rx.len);
+    munmap(x->tx.map, x->tx.len);
+    close(x->fd);
+    mem_free(x->umem);
+    free(x->free);
+}
+
+
+/*
+ * Send up to n frames from the free stack.  Return the number sent.
+ */
+static int
+xdp_send(XSK *x, int n)
+{
+    int i;
+    struct xdp_desc d[MAX_BATCH];
+
+    if (x->nfree < n)
+        xdp_reap(x);
+    if (n > x->nfree)
+        n = x->nfree;
+    for (i = 0; i < n; ++i) {
+        d[i].addr = x->free[--x->nfree];
+        d[i].len = x->size;
+        d[i].options = 0;
+        memcpy(x->umem + d[i].addr, x->hdr, ETH_HLEN);
+    }
+    return xdp_xmit(x, d, n);
+}
+
+
+/*
+ * Put n frames on the transmit ring, waiting for room if need be.  Return the
+ * number queued; it is only short if the test finished.
+ */
+static int
+xdp_xmit(XSK *x, struct xdp_desc *d, int n)
+{
+    int i;
+    int spins = 0;
+    uint32_t prod;
+    struct xdp_desc *ring = x->tx.desc;
+
+    while (xr_room(&x->tx) < n) {
+        xdp_reap(x);
+        xdp_kick_tx(x);
+        if (!xdp_wait(x, &spins, 0)) {
+            for (i = 0; i < n; ++i)
+                x->free[x->nfree++] = d[i].addr;
+            return 0;
+        }
+    }
+    prod = *x->tx.producer;
+    for (i = 0; i < n; ++i)
+        ring[(prod + i) & (x->tx.size - 1)] = d[i];
+    __atomic_store_n(x->tx.producer, prod + n, __ATOMIC_RELEASE);
+    xdp_kick_tx(x);
+    return n;
+}
+
+
+/*
+ * Take up to n frames off the receive ring, after first giving the kernel
+ * whatever free frames it has room for.  Return the number received; the
+ * caller owns their buffers.
+ */
+static int
+xdp_recv(XSK *x, struct xdp_desc *d, int n)
+{
+    int i;
+    int room;
+    uint32_t cons;
+    struct xdp_desc *ring = x->rx.desc;
+
+    xdp_reap(x);
+    room = xr_room(&x->fill);
+    if (room > x->nfree)
+        room = x->nfree;
+    if (room) {
+        uint32_t prod = *x->fill.producer;
+        uint64_t *fill = x->fill.desc;
+
+        for (i = 0; i < room; ++i)
+            fill[(prod + i) & (x->fill.size - 1)] = x->free[--x->nfree];
+        __atomic_store_n(x->fill.producer, prod + room, __ATOMIC_RELEASE);
+    }
+
+    i = xr_avail(&x->rx);
+    if (n > i)
+        n = i;
+    cons = *x->rx.consumer;
+    for (i = 0; i < n; ++i)
+        d[i] = ring[(cons + i) & (x->rx.size - 1)];
+    if (n)
+        __atomic_store_n(x->rx.consumer, cons + n, __ATOMIC_RELEASE);
+    else
+        xdp_kick_rx(x);
+    return n;
+}
+
+
+/*
+ * Return frames the kernel has finished sending to the free stack.
+ */
+static void
+xdp_reap(XSK *x)
+{
+    int i;
+    int n = xr_avail(&x->comp);
+    uint32_t cons = *x->comp.consumer;
+    uint64_t *comp = x->comp.desc;
+
+    for (i = 0; i < n; ++i)
+        x->free[x->nfree++] = comp[(cons + i) & (x->comp.size - 1)];
+    if (n)
+        __atomic_store_n(x->comp.consumer, cons + n, __ATOMIC_RELEASE);
+}
+
+
+/*
+ * Tell the kernel there is something to send.  In copy mode the frames are
+ * sent from this call; in zero copy mode it is only needed if the driver has
+ * gone idle.
+ */
+static void
+xdp_kick_tx(XSK *x)
+{
+    if (x->zcopy && !(*x->tx.flags & XDP_RING_NEED_WAKEUP))
+        return;
+    if (sendto(x->fd, 0, 0, MSG_DONTWAIT, 0, 0) < 0) {
+        if (errno != EAGAIN && errno != EBUSY && errno != ENOBUFS &&
+            errno != EINTR && errno != ENETDOWN)
+            error(SYS, "AF_XDP send failed");
+    }
+}
+
+
+/*
+ * If the driver has gone idle for want of fill ring entries, wake it.
+ */
+static void
+xdp_kick_rx(XSK *x)
+{
+    if (*x->fill.flags & XDP_RING_NEED_WAKEUP)
+        (void) recvfrom(x->fd, 0, 0, MSG_DONTWAIT, 0, 0);
+}
+
+
+/*
+ * Called each time we come up empty.  We spin for a while and then, if we are
+ * waiting to receive, sleep in poll, or otherwise yield the processor.
+ * Return 0 if the test has finished.
+ */
+static int
+xdp_wait(XSK *x, int *spins, int events)
+{
+    if (Finished)
+        return 0;
+    if (++*spins <= SPIN_TRIES)
+        return 1;
+    if (events) {
+        struct pollfd pfd ={ .fd = x->fd, .events = events };
+
+        (void) poll(&pfd, 1, POLL_MS);
+    } else
+        sched_yield();
+    return !Finished;
+}
+
+
+/*
+ * Return the number of entries the producer may add to a ring.
+ */
+static int
+xr_room(XRING *r)
+{
+    return r->size - (*r->producer -
+                      __atomic_load_n(r->consumer, __ATOMIC_ACQUIRE));
+}
+
+
+/*
+ * Return the number of entries waiting for the consumer of a ring.
+ */
+static int
+xr_avail(XRING *r)
+{
+    return __atomic_load_n(r->producer, __ATOMIC_ACQUIRE) - *r->consumer;
+}
+
+
+/*
+ * Make a bpf system call.
+ */
+static long
+sys_bpf(int cmd, union bpf_attr *attr)
+{
+    return syscall(__NR_bpf, cmd, attr, sizeof(*attr));
+}
+
+
+#else /* HAVE_LINUX_IF_XDP_H */
+
+
+/*
+ * Without AF_XDP, the tests are an error.
+ */
+static void
+xdp_unsupported(void)
+{
+    error(0, "AF_XDP is not supported on this system");
+}
+
+void run_client_xdp_bw(void)                { xdp_unsupported(); }
+void run_server_xdp_bw(void)                { xdp_unsupported(); }
+void run_client_xdp_lat(void)               { xdp_unsupported(); }
+void run_server_xdp_lat(void)               { xdp_unsupported(); }
+#endif /* HAVE_LINUX_IF_XDP_H */